@@ -40,13 +40,14 @@ VkAccelerationStructureBuildSizesInfoKHR VulkanBackend::Raytracing::Acceleration
 void VulkanBackend::Raytracing::AccelerationStructure::createAccelerationStructure(
   std::unique_ptr<Device>& device,
   AllocatedBuffer& resultBuffer,
-  const VkDeviceSize resultOffset)
+  const VkDeviceSize resultOffset,
+  const VkDeviceSize size)
 {
   VkAccelerationStructureCreateInfoKHR createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
   createInfo.pNext = nullptr;
   createInfo.type = _buildGeometryInfo.type;
-  createInfo.size = _buildSizesInfo.accelerationStructureSize;
+  createInfo.size = size;
   createInfo.buffer = resultBuffer.buffer;
   createInfo.offset = resultOffset;
 
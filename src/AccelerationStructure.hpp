@@ -25,7 +25,8 @@ namespace VulkanBackend::Raytracing
     void createAccelerationStructure(
       std::unique_ptr<Device>& device,
       AllocatedBuffer& resultBuffer,
-      const VkDeviceSize resultOffset);
+      const VkDeviceSize resultOffset,
+      const VkDeviceSize size);
     VkBuildAccelerationStructureFlagsKHR _flags;
 
    private:
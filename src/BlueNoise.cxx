@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "BlueNoise.hpp"
+
+namespace
+{
+  // Gaussian energy of the set pixels, on a torus so that the mask tiles
+  class EnergyField
+  {
+   public:
+    EnergyField(uint32_t size) : _size(size), _kernel(size * size), _energy(size * size, 0.f), _isSet(size * size, false)
+    {
+      constexpr float sigma = 1.5f;
+      for (uint32_t y = 0; y < size; y++)
+      {
+        for (uint32_t x = 0; x < size; x++)
+        {
+          const float dx = static_cast<float>(std::min(x, size - x));
+          const float dy = static_cast<float>(std::min(y, size - y));
+          _kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+        }
+      }
+    }
+
+    void set(uint32_t pixel, bool isSet)
+    {
+      _isSet[pixel] = isSet;
+
+      const float sign = isSet ? 1.f : -1.f;
+      const uint32_t px = pixel % _size;
+      const uint32_t py = pixel / _size;
+      for (uint32_t y = 0; y < _size; y++)
+      {
+        const uint32_t ky = (y + _size - py) % _size;
+        for (uint32_t x = 0; x < _size; x++)
+        {
+          _energy[y * _size + x] += sign * _kernel[ky * _size + (x + _size - px) % _size];
+        }
+      }
+    }
+
+    bool isSet(uint32_t pixel) const
+    {
+      return _isSet[pixel];
+    }
+
+    // set pixel with the most energy
+    uint32_t tightestCluster() const
+    {
+      uint32_t best = 0;
+      float bestEnergy = -1.f;
+      for (uint32_t pixel = 0; pixel < _energy.size(); pixel++)
+      {
+        if (_isSet[pixel] && _energy[pixel] > bestEnergy)
+        {
+          best = pixel;
+          bestEnergy = _energy[pixel];
+        }
+      }
+      return best;
+    }
+
+    // unset pixel with the least energy
+    uint32_t largestVoid() const
+    {
+      uint32_t best = 0;
+      float bestEnergy = INFINITY;
+      for (uint32_t pixel = 0; pixel < _energy.size(); pixel++)
+      {
+        if (!_isSet[pixel] && _energy[pixel] < bestEnergy)
+        {
+          best = pixel;
+          bestEnergy = _energy[pixel];
+        }
+      }
+      return best;
+    }
+
+   private:
+    uint32_t _size;
+    std::vector<float> _kernel;  // energy a pixel gives at each offset
+    std::vector<float> _energy;
+    std::vector<bool> _isSet;
+  };
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+std::vector<float> vkutil::generateBlueNoise(uint32_t size, uint32_t seed)
+{
+  const uint32_t pixelCount = size * size;
+
+  // a tenth of the pixels at random
+  EnergyField field(size);
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<uint32_t> distribution(0, pixelCount - 1);
+  uint32_t initialCount = 0;
+  while (initialCount < pixelCount / 10)
+  {
+    const uint32_t pixel = distribution(generator);
+    if (!field.isSet(pixel))
+    {
+      field.set(pixel, true);
+      initialCount++;
+    }
+  }
+
+  // spread them evenly: the tightest cluster moves to the largest void until it would move back where it was
+  for (uint32_t iteration = 0; iteration < pixelCount; iteration++)
+  {
+    const uint32_t cluster = field.tightestCluster();
+    field.set(cluster, false);
+    const uint32_t largestVoid = field.largestVoid();
+    field.set(largestVoid, true);
+    if (largestVoid == cluster)
+    {
+      break;
+    }
+  }
+
+  // the initial pixels are ranked from the last one, the tightest cluster is the most redundant of them
+  std::vector<uint32_t> ranks(pixelCount);
+  EnergyField initialField = field;
+  for (uint32_t rank = initialCount; rank-- > 0;)
+  {
+    const uint32_t cluster = initialField.tightestCluster();
+    initialField.set(cluster, false);
+    ranks[cluster] = rank;
+  }
+
+  // then every other pixel, in the largest void left by the ones ranked before
+  for (uint32_t rank = initialCount; rank < pixelCount; rank++)
+  {
+    const uint32_t largestVoid = field.largestVoid();
+    field.set(largestVoid, true);
+    ranks[largestVoid] = rank;
+  }
+
+  std::vector<float> mask(pixelCount);
+  for (uint32_t pixel = 0; pixel < pixelCount; pixel++)
+  {
+    mask[pixel] = (ranks[pixel] + 0.5f) / pixelCount;
+  }
+  return mask;
+}
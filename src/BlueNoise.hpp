@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace vkutil
+{
+  // Tileable blue noise mask of size x size ranks in [0, 1), following the void and cluster method of Ulichney.
+  // A rank is given to every pixel in turn, always in the largest void left by the pixels ranked before it.
+  std::vector<float> generateBlueNoise(uint32_t size, uint32_t seed = 1);
+}  // namespace vkutil
@@ -14,8 +14,9 @@ VulkanBackend::Raytracing::BottomLevelAccelerationStructure::BottomLevelAccelera
 
   _offsetInfo = offsetInfo;
   _buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-  _buildGeometryInfo.flags =
-    _flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_DATA_ACCESS_KHR;  // For Ray Tracing Position Fetch extension
+  // Data access for the Ray Tracing Position Fetch extension, compaction to copy the built structure in its compacted size
+  _buildGeometryInfo.flags = _flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_DATA_ACCESS_KHR |
+                             VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
   _buildGeometryInfo.geometryCount = static_cast<uint32_t>(_geometry.size());
   _buildGeometryInfo.pGeometries = _geometry.data();
   _buildGeometryInfo.ppGeometries = nullptr;
@@ -43,26 +44,111 @@ void VulkanBackend::Raytracing::BottomLevelAccelerationStructure::Generate(
   AllocatedBuffer& resultBuffer,
   const VkDeviceSize resultOffset)
 {
-  // Create the acceleration structure.
-  createAccelerationStructure(device, resultBuffer, resultOffset);
-
-  // Build the actual bottom-level acceleration structure
-  const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = _offsetInfo.data();
   VkBufferDeviceAddressInfo info = {};
   info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
   info.pNext = nullptr;
   info.buffer = scratchBuffer.buffer;
   VkDeviceAddress scratchBufferAdress = vkGetBufferDeviceAddress(device->getHandle(), &info);
-  _buildGeometryInfo.scratchData.deviceAddress = scratchBufferAdress + scratchOffset;
+
+  prepareBuild(device, scratchBufferAdress + scratchOffset, resultBuffer, resultOffset);
+  BuildBatch(device, commandBuffer, {this, 1}, VK_NULL_HANDLE, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Raytracing::BottomLevelAccelerationStructure::prepareBuild(
+  std::unique_ptr<Device>& device,
+  VkDeviceAddress scratchAddress,
+  AllocatedBuffer& resultBuffer,
+  const VkDeviceSize resultOffset)
+{
+  // Create the acceleration structure.
+  createAccelerationStructure(device, resultBuffer, resultOffset, _buildSizesInfo.accelerationStructureSize);
+
+  // the structure may have moved since its construction, along with its geometry
+  _buildGeometryInfo.pGeometries = _geometry.data();
+  _buildGeometryInfo.scratchData.deviceAddress = scratchAddress;
   _buildGeometryInfo.dstAccelerationStructure = _handle;
+}
 
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Raytracing::BottomLevelAccelerationStructure::BuildBatch(
+  std::unique_ptr<Device>& device,
+  VkCommandBuffer commandBuffer,
+  std::span<BottomLevelAccelerationStructure> structures,
+  VkQueryPool compactedSizeQueryPool,
+  uint32_t firstQuery)
+{
+  if (structures.empty())
+  {
+    return;
+  }
+
+  if (compactedSizeQueryPool != VK_NULL_HANDLE)
+  {
+    vkCmdResetQueryPool(commandBuffer, compactedSizeQueryPool, firstQuery, static_cast<uint32_t>(structures.size()));
+  }
+
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildOffsetInfos;
+  buildGeometryInfos.reserve(structures.size());
+  buildOffsetInfos.reserve(structures.size());
+  for (BottomLevelAccelerationStructure& structure : structures)
+  {
+    buildGeometryInfos.push_back(structure._buildGeometryInfo);
+    buildOffsetInfos.push_back(structure._offsetInfo.data());
+  }
+
+  // Build the actual bottom-level acceleration structures
   auto cmdBuildAccelerationStructuresKHR = vkloader::loadFunction<PFN_vkCmdBuildAccelerationStructuresKHR>(
     device->getHandle(), "vkCmdBuildAccelerationStructuresKHR");
-  cmdBuildAccelerationStructuresKHR(commandBuffer, 1, &_buildGeometryInfo, &pBuildOffsetInfo);
+  cmdBuildAccelerationStructuresKHR(
+    commandBuffer, static_cast<uint32_t>(buildGeometryInfos.size()), buildGeometryInfos.data(), buildOffsetInfos.data());
 
   // Barrier to ensure proper synchronization after building
-  accelerationStructureBarrier(
+  structures.front().accelerationStructureBarrier(
     commandBuffer,
     VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
     VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+
+  if (compactedSizeQueryPool != VK_NULL_HANDLE)
+  {
+    std::vector<VkAccelerationStructureKHR> handles;
+    handles.reserve(structures.size());
+    for (const BottomLevelAccelerationStructure& structure : structures)
+    {
+      handles.push_back(structure._handle);
+    }
+    auto cmdWriteAccelerationStructuresPropertiesKHR =
+      vkloader::loadFunction<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(
+        device->getHandle(), "vkCmdWriteAccelerationStructuresPropertiesKHR");
+    cmdWriteAccelerationStructuresPropertiesKHR(
+      commandBuffer,
+      static_cast<uint32_t>(handles.size()),
+      handles.data(),
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+      compactedSizeQueryPool,
+      firstQuery);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+VkAccelerationStructureKHR VulkanBackend::Raytracing::BottomLevelAccelerationStructure::compact(
+  std::unique_ptr<Device>& device,
+  VkCommandBuffer commandBuffer,
+  AllocatedBuffer& resultBuffer,
+  const VkDeviceSize resultOffset,
+  const VkDeviceSize compactedSize)
+{
+  const VkAccelerationStructureKHR builtHandle = _handle;
+  createAccelerationStructure(device, resultBuffer, resultOffset, compactedSize);
+
+  VkCopyAccelerationStructureInfoKHR copyInfo{VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR};
+  copyInfo.src = builtHandle;
+  copyInfo.dst = _handle;
+  copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+  auto cmdCopyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkCmdCopyAccelerationStructureKHR>(
+    device->getHandle(), "vkCmdCopyAccelerationStructureKHR");
+  cmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+  return builtHandle;
 }
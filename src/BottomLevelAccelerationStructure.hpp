@@ -19,6 +19,30 @@ namespace VulkanBackend::Raytracing
       const VkDeviceSize scratchOffset,
       AllocatedBuffer& resultBuffer,
       const VkDeviceSize resultOffset);
+    // Creates the structure in its result region and points its build at its scratch region, records nothing.
+    void prepareBuild(
+      std::unique_ptr<Device>& device,
+      VkDeviceAddress scratchAddress,
+      AllocatedBuffer& resultBuffer,
+      const VkDeviceSize resultOffset);
+    // Builds every prepared structure in a single command followed by a single barrier, so that the driver can build
+    // them in parallel. Their scratch regions must not overlap. The compacted size of the structure i is written in the
+    // query firstQuery + i of the pool, when there is one.
+    static void BuildBatch(
+      std::unique_ptr<Device>& device,
+      VkCommandBuffer commandBuffer,
+      std::span<BottomLevelAccelerationStructure> structures,
+      VkQueryPool compactedSizeQueryPool,
+      uint32_t firstQuery);
+    // Creates a structure of `compactedSize` in the result region and records the compacting copy of the built one.
+    // Returns the built structure, to destroy once the copy has executed.
+    VkAccelerationStructureKHR compact(
+      std::unique_ptr<Device>& device,
+      VkCommandBuffer commandBuffer,
+      AllocatedBuffer& resultBuffer,
+      const VkDeviceSize resultOffset,
+      const VkDeviceSize compactedSize);
+
    private:
     std::vector<VkAccelerationStructureGeometryKHR> _geometry;
     // Build range information corresponding to each geometry.
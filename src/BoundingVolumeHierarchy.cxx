@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <glm/common.hpp>
+#include <numeric>
+#include <thread>
+#include "BoundingVolumeHierarchy.hpp"
+
+namespace
+{
+  // bins of the centroids along each axis, the split planes lie between them
+  constexpr uint32_t BIN_COUNT = 16;
+  // a node of more primitives is always split, even when the heuristic finds it cheaper to keep it a leaf
+  constexpr uint32_t MAX_LEAF_SIZE = 8;
+  // of visiting an inner node, relative to the intersection of a primitive
+  constexpr float TRAVERSAL_COST = 1.f;
+  // nodes of fewer primitives are not worth a task of the parallel build
+  constexpr uint32_t MIN_TASK_SIZE = 1024;
+
+  struct BuildInput
+  {
+    std::span<const vkutil::BvhBounds> primitives;
+    std::vector<glm::vec3> centroids;
+  };
+
+  //--------------------------------------------------------------------------------------------------
+  // Bounds the node and splits it when the surface area heuristic finds it worth it: its two children are appended to
+  // `nodes` and the node becomes an inner one. Returns whether it was split.
+  bool splitNode(const BuildInput& input, std::vector<uint32_t>& order, std::vector<GPUBvhNode>& nodes, uint32_t index)
+  {
+    GPUBvhNode& node = nodes[index];
+    const auto first = order.begin() + node.first;
+    const auto last = first + node.count;
+
+    vkutil::BvhBounds bounds;
+    vkutil::BvhBounds centroidBounds;
+    for (auto primitive = first; primitive != last; primitive++)
+    {
+      bounds.grow(input.primitives[*primitive]);
+      centroidBounds.grow(input.centroids[*primitive]);
+    }
+    node.boundsMin = bounds.min;
+    node.boundsMax = bounds.max;
+    if (node.count == 1)
+    {
+      return false;
+    }
+
+    // Cost of every plane between two bins of every axis, as the areas of the two sides weighted by their primitives
+    int bestAxis = -1;
+    uint32_t bestBin = 0;
+    float bestCost = INFINITY;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+      if (extent <= 0.f)
+      {
+        continue;
+      }
+      const float scale = BIN_COUNT / extent;
+
+      std::array<vkutil::BvhBounds, BIN_COUNT> binBounds;
+      std::array<uint32_t, BIN_COUNT> binCounts{};
+      for (auto primitive = first; primitive != last; primitive++)
+      {
+        const uint32_t bin = std::min(
+          BIN_COUNT - 1, static_cast<uint32_t>((input.centroids[*primitive][axis] - centroidBounds.min[axis]) * scale));
+        binBounds[bin].grow(input.primitives[*primitive]);
+        binCounts[bin]++;
+      }
+
+      // the left sides from the first bin, then the right sides from the last one
+      std::array<float, BIN_COUNT - 1> leftCosts;
+      std::array<uint32_t, BIN_COUNT - 1> leftCounts;
+      vkutil::BvhBounds left;
+      uint32_t leftCount = 0;
+      for (uint32_t plane = 0; plane < BIN_COUNT - 1; plane++)
+      {
+        left.grow(binBounds[plane]);
+        leftCount += binCounts[plane];
+        leftCounts[plane] = leftCount;
+        leftCosts[plane] = leftCount * left.halfArea();
+      }
+      vkutil::BvhBounds right;
+      uint32_t rightCount = 0;
+      for (uint32_t plane = BIN_COUNT - 1; plane > 0; plane--)
+      {
+        right.grow(binBounds[plane]);
+        rightCount += binCounts[plane];
+        const float cost = leftCosts[plane - 1] + rightCount * right.halfArea();
+        if (leftCounts[plane - 1] > 0 && rightCount > 0 && cost < bestCost)
+        {
+          bestAxis = axis;
+          bestBin = plane;
+          bestCost = cost;
+        }
+      }
+    }
+
+    const float leafCost = node.count * bounds.halfArea();
+    const float splitCost = TRAVERSAL_COST * bounds.halfArea() + bestCost;
+    if (node.count <= MAX_LEAF_SIZE && (bestAxis < 0 || splitCost >= leafCost))
+    {
+      return false;
+    }
+
+    // the primitives of the bins before the plane go left, those sharing the same centroid are split in half
+    auto middle = first + node.count / 2;
+    if (bestAxis >= 0)
+    {
+      const float scale = BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+      middle = std::partition(
+        first,
+        last,
+        [&](uint32_t primitive)
+        {
+          const uint32_t bin = std::min(
+            BIN_COUNT - 1,
+            static_cast<uint32_t>((input.centroids[primitive][bestAxis] - centroidBounds.min[bestAxis]) * scale));
+          return bin < bestBin;
+        });
+    }
+
+    const uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+    const uint32_t leftCount = static_cast<uint32_t>(middle - first);
+    const uint32_t nodeFirst = node.first;
+    const uint32_t nodeCount = node.count;
+    node.first = leftChild;
+    node.count = 0;
+    // the push may reallocate the nodes, `node` is not used past this point
+    nodes.push_back(GPUBvhNode{glm::vec3(0.f), nodeFirst, glm::vec3(0.f), leftCount});
+    nodes.push_back(GPUBvhNode{glm::vec3(0.f), nodeFirst + leftCount, glm::vec3(0.f), nodeCount - leftCount});
+    return true;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Splits the node at `index` and its descendants until they are all leaves
+  void buildSubtree(const BuildInput& input, std::vector<uint32_t>& order, std::vector<GPUBvhNode>& nodes, uint32_t index)
+  {
+    std::vector<uint32_t> pendingNodes{index};
+    while (!pendingNodes.empty())
+    {
+      const uint32_t node = pendingNodes.back();
+      pendingNodes.pop_back();
+      if (splitNode(input, order, nodes, node))
+      {
+        pendingNodes.push_back(nodes[node].first);
+        pendingNodes.push_back(nodes[node].first + 1);
+      }
+    }
+  }
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::BvhBounds::grow(const glm::vec3& point)
+{
+  min = glm::min(min, point);
+  max = glm::max(max, point);
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::BvhBounds::grow(const BvhBounds& bounds)
+{
+  min = glm::min(min, bounds.min);
+  max = glm::max(max, bounds.max);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool vkutil::BvhBounds::isEmpty() const
+{
+  return min.x > max.x;
+}
+
+//--------------------------------------------------------------------------------------------------
+float vkutil::BvhBounds::halfArea() const
+{
+  if (this->isEmpty())
+  {
+    return 0.f;
+  }
+  const glm::vec3 extent = max - min;
+  return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+//--------------------------------------------------------------------------------------------------
+std::vector<GPUBvhNode> vkutil::buildBvh(
+  std::span<const BvhBounds> primitives,
+  std::vector<uint32_t>& order,
+  uint32_t threadCount)
+{
+  const uint32_t primitiveCount = static_cast<uint32_t>(primitives.size());
+  order.resize(primitiveCount);
+  std::iota(order.begin(), order.end(), 0);
+  if (primitiveCount == 0)
+  {
+    const BvhBounds empty;
+    return {GPUBvhNode{empty.min, 0, empty.max, 0}};
+  }
+
+  BuildInput input{primitives, std::vector<glm::vec3>(primitiveCount)};
+  for (uint32_t i = 0; i < primitiveCount; i++)
+  {
+    input.centroids[i] = (primitives[i].min + primitives[i].max) * 0.5f;
+  }
+
+  // a binary tree of n leaves has 2n - 1 nodes
+  std::vector<GPUBvhNode> nodes;
+  nodes.reserve(2 * primitiveCount - 1);
+  nodes.push_back(GPUBvhNode{glm::vec3(0.f), 0, glm::vec3(0.f), primitiveCount});
+  if (threadCount <= 1 || primitiveCount < 2 * MIN_TASK_SIZE)
+  {
+    buildSubtree(input, order, nodes, 0);
+    return nodes;
+  }
+
+  // The top of the tree is split breadth first until there are enough subtrees for the threads to balance their work,
+  // the subtrees own disjoint ranges of `order` and are built in parallel into nodes of their own
+  std::deque<uint32_t> pendingNodes{0};
+  std::vector<uint32_t> subtrees;
+  while (!pendingNodes.empty() && pendingNodes.size() + subtrees.size() < 4 * threadCount)
+  {
+    const uint32_t node = pendingNodes.front();
+    pendingNodes.pop_front();
+    if (nodes[node].count < MIN_TASK_SIZE)
+    {
+      subtrees.push_back(node);
+    }
+    else if (splitNode(input, order, nodes, node))
+    {
+      pendingNodes.push_back(nodes[node].first);
+      pendingNodes.push_back(nodes[node].first + 1);
+    }
+  }
+  subtrees.insert(subtrees.end(), pendingNodes.begin(), pendingNodes.end());
+
+  std::vector<std::vector<GPUBvhNode>> subtreeNodes(subtrees.size());
+  std::atomic<uint32_t> nextSubtree{0};
+  auto buildSubtrees = [&]()
+  {
+    for (uint32_t i = nextSubtree++; i < subtrees.size(); i = nextSubtree++)
+    {
+      subtreeNodes[i] = {nodes[subtrees[i]]};
+      buildSubtree(input, order, subtreeNodes[i], 0);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < std::min<size_t>(threadCount, subtrees.size()); i++)
+  {
+    workers.emplace_back(buildSubtrees);
+  }
+  buildSubtrees();
+  for (std::thread& worker : workers)
+  {
+    worker.join();
+  }
+
+  // the root of a subtree replaces its node, the others are appended with their children moved by the same offset
+  for (size_t i = 0; i < subtrees.size(); i++)
+  {
+    const std::vector<GPUBvhNode>& subtree = subtreeNodes[i];
+    const uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+    for (size_t node = 0; node < subtree.size(); node++)
+    {
+      GPUBvhNode moved = subtree[node];
+      if (moved.count == 0)
+      {
+        moved.first += offset;
+      }
+      if (node == 0)
+      {
+        nodes[subtrees[i]] = moved;
+      }
+      else
+      {
+        nodes.push_back(moved);
+      }
+    }
+  }
+  return nodes;
+}
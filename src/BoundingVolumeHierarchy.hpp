@@ -0,0 +1,28 @@
+#pragma once
+#include <cmath>
+#include <span>
+#include <vector>
+#include "VkTypes.hpp"
+
+namespace vkutil
+{
+  struct BvhBounds
+  {
+    glm::vec3 min{INFINITY};
+    glm::vec3 max{-INFINITY};
+
+    void grow(const glm::vec3& point);
+    void grow(const BvhBounds& bounds);
+    bool isEmpty() const;
+    float halfArea() const;
+  };
+
+  // Bounding volume hierarchy of primitives given by their bounds, split with the binned surface area heuristic of
+  // Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies". Returns the nodes, the root first, and in
+  // `order` the primitives in the order of the leaves. Without primitives the root is a leaf with empty bounds.
+  // With several threads the subtrees below the first splits are built in parallel.
+  std::vector<GPUBvhNode> buildBvh(
+    std::span<const BvhBounds> primitives,
+    std::vector<uint32_t>& order,
+    uint32_t threadCount = 1);
+}  // namespace vkutil
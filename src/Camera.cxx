@@ -17,6 +17,19 @@ glm::mat4 Camera::getViewMatrix()
   return glm::inverse(cameraTranslation * cameraRotation);
 }
 
+//--------------------------------------------------------------------------------------------------
+glm::mat4 Camera::getProjectionMatrix(float aspect)
+{
+  float fov = 70.f;
+  float near = 0.1f;
+  float far = 1000.0f;
+  glm::mat4 projection = glm::perspective(fov, aspect, near, far);
+  // invert the Y direction on projection matrix so that we are more similar
+  // to opengl and gltf axis
+  projection[1][1] *= -1;
+  return projection;
+}
+
 //--------------------------------------------------------------------------------------------------
 glm::mat4 Camera::getRotationMatrix()
 {
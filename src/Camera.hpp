@@ -15,6 +15,8 @@ class Camera
 
   glm::mat4 getViewMatrix();
   glm::mat4 getRotationMatrix();
+  // with the Y axis flipped for Vulkan
+  glm::mat4 getProjectionMatrix(float aspect);
 
   void processSDLEvent(SDL_Event& e);
 
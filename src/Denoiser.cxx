@@ -0,0 +1,212 @@
+#include <cmath>
+#include "DebugUtils.hpp"
+#include "Denoiser.hpp"
+#include "VkEngine.hpp"
+#include "VkImages.hpp"
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::Denoiser::Denoiser(
+  VkEngine* engine,
+  VkExtent2D extent,
+  std::unique_ptr<Image>& output,
+  GeometryBuffer& geometryBuffer)
+  : _engine(engine), _extent(extent)
+{
+  this->initImages({extent.width, extent.height, 1});
+  this->initPipelines(output, geometryBuffer);
+}
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::Denoiser::~Denoiser()
+{
+  VkDevice device = _engine->_device->getHandle();
+  for (size_t i = 0; i < 2; i++)
+  {
+    _engine->destroyImage(_colorHistory[i]->_handle);
+    _engine->destroyImage(_momentHistory[i]->_handle);
+    _engine->destroyImage(_pingPongImages[i]->_handle);
+  }
+
+  _descriptorAllocator.destroyPools(device);
+  vkDestroyDescriptorSetLayout(device, _descriptorLayout->_handle, nullptr);
+  vkDestroyPipelineLayout(device, _pipelineLayout->_handle, nullptr);
+  vkDestroyPipeline(device, _reprojectPipeline->_handle, nullptr);
+  vkDestroyPipeline(device, _variancePipeline->_handle, nullptr);
+  vkDestroyPipeline(device, _atrousPipeline->_handle, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Denoiser::denoise(VkCommandBuffer cmd, uint32_t frame)
+{
+  DenoiserPushConstants constants{};
+  constants.size = glm::ivec2(_extent.width, _extent.height);
+  constants.frameParity = frame & 1;
+  constants.isHistoryValid = _isHistoryValid ? 1 : 0;
+
+  vkCmdBindDescriptorSets(
+    cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout->_handle, 0, 1, &_descriptorSet->_handle, 0, nullptr);
+
+  // the noisy frame and its G-buffer come from the ray tracing pass
+  VkMemoryBarrier tracedBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  tracedBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  tracedBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(
+    cmd,
+    _engine->raytracingStages(),
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    0,
+    1,
+    &tracedBarrier,
+    0,
+    nullptr,
+    0,
+    nullptr);
+
+  this->dispatch(cmd, _reprojectPipeline, constants);
+  this->dispatch(cmd, _variancePipeline, constants);
+
+  // the variance pass leaves its result in the second ping pong image
+  uint32_t source = 1;
+  for (uint32_t iteration = 0; iteration < DENOISER_ITERATIONS; iteration++)
+  {
+    constants.stepSize = 1u << iteration;
+    constants.source = source;
+    constants.flags = 0;
+    if (iteration == 0)
+    {
+      constants.flags |= DENOISER_WRITE_HISTORY;
+    }
+    if (iteration == DENOISER_ITERATIONS - 1)
+    {
+      constants.flags |= DENOISER_FINAL;
+    }
+    this->dispatch(cmd, _atrousPipeline, constants);
+    source = 1 - source;
+  }
+
+  _isHistoryValid = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Denoiser::reset()
+{
+  _isHistoryValid = false;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Denoiser::dispatch(
+  VkCommandBuffer cmd,
+  std::unique_ptr<ComputePipeline>& pipeline,
+  const DenoiserPushConstants& constants)
+{
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->_handle);
+  vkCmdPushConstants(
+    cmd, _pipelineLayout->_handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DenoiserPushConstants), &constants);
+  vkCmdDispatch(cmd, std::ceil(_extent.width / 16.0), std::ceil(_extent.height / 16.0), 1);
+
+  // every pass reads the neighbours of the pixels written by the previous one
+  VkMemoryBarrier passBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  passBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  passBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(
+    cmd,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    _engine->raytracingStages(),
+    0,
+    1,
+    &passBarrier,
+    0,
+    nullptr,
+    0,
+    nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Denoiser::initImages(VkExtent3D extent)
+{
+  VkDevice device = _engine->_device->getHandle();
+  const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  auto createImage = [&](VkFormat format, const char* name)
+  {
+    auto image = std::make_unique<Image>(_engine->_device, extent, format, usage, _engine->_allocator, false);
+    DebugUtils::SetObjectName(image->_handle.image, name, device);
+    return image;
+  };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    _colorHistory[i] = createImage(VK_FORMAT_R32G32B32A32_SFLOAT, "Denoiser color history");
+    _momentHistory[i] = createImage(VK_FORMAT_R32G32B32A32_SFLOAT, "Denoiser moment history");
+    _pingPongImages[i] = createImage(VK_FORMAT_R32G32B32A32_SFLOAT, "Denoiser ping pong");
+  }
+
+  // the images stay in the general layout, their content only matters once written by a frame
+  _engine->immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      for (size_t i = 0; i < 2; i++)
+      {
+        for (auto* images : {&_colorHistory, &_momentHistory, &_pingPongImages})
+        {
+          vkutil::transitionImage(cmd, (*images)[i]->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        }
+      }
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Denoiser::initPipelines(std::unique_ptr<Image>& output, GeometryBuffer& geometryBuffer)
+{
+  std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 13}};
+  _descriptorAllocator.init(_engine->_device->getHandle(), 1, sizes);
+
+  std::vector<DescriptorBinding> bindings = {
+    // Noisy frame in, denoised frame out
+    {0, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    // G-buffer
+    {1, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    {2, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    {3, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    // Histories of the previous and current frames
+    {4, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    {5, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    // Intermediate results of the filter
+    {6, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    // Motion vectors of the G-buffer
+    {7, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT}};
+  _descriptorLayout = std::make_unique<DescriptorSetLayout>(_engine->_device, bindings);
+  _descriptorSet = std::make_unique<DescriptorSet>(_engine->_device, _descriptorLayout, _descriptorAllocator);
+
+  std::vector<VkImageView> colorHistoryViews{_colorHistory[0]->_handle.imageView, _colorHistory[1]->_handle.imageView};
+  std::vector<VkImageView> momentHistoryViews{
+    _momentHistory[0]->_handle.imageView, _momentHistory[1]->_handle.imageView};
+  std::vector<VkImageView> pingPongViews{_pingPongImages[0]->_handle.imageView, _pingPongImages[1]->_handle.imageView};
+  _descriptorSet->writeImage(_engine->_device, output, 0);
+  geometryBuffer.write(*_descriptorSet, 1, 2, 3, 7);
+  _descriptorSet->writeImageViews(_engine->_device, colorHistoryViews, 4);
+  _descriptorSet->writeImageViews(_engine->_device, momentHistoryViews, 5);
+  _descriptorSet->writeImageViews(_engine->_device, pingPongViews, 6);
+  _descriptorSet->updateSet(_engine->_device);
+
+  VkPushConstantRange pushConstant{};
+  pushConstant.offset = 0;
+  pushConstant.size = sizeof(DenoiserPushConstants);
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  std::vector<VkPushConstantRange> pushConstants;
+  pushConstants.push_back(pushConstant);
+
+  std::vector<VkDescriptorSetLayout> descriptors = {_descriptorLayout->_handle};
+  _pipelineLayout = std::make_unique<PipelineLayout>(_engine->_device, descriptors, pushConstants);
+
+  _reprojectPipeline = std::make_unique<ComputePipeline>(
+    _engine->_device, _pipelineLayout, "../shaders/svgf_reproject.comp.spv", "svgf reproject");
+  _variancePipeline = std::make_unique<ComputePipeline>(
+    _engine->_device, _pipelineLayout, "../shaders/svgf_variance.comp.spv", "svgf variance");
+  _atrousPipeline = std::make_unique<ComputePipeline>(
+    _engine->_device, _pipelineLayout, "../shaders/svgf_atrous.comp.spv", "svgf atrous");
+
+  VkDevice device = _engine->_device->getHandle();
+  vkDestroyShaderModule(device, _reprojectPipeline->_shader, nullptr);
+  vkDestroyShaderModule(device, _variancePipeline->_shader, nullptr);
+  vkDestroyShaderModule(device, _atrousPipeline->_shader, nullptr);
+}
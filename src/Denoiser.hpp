@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include "ComputePipeline.hpp"
+#include "DescriptorSet.hpp"
+#include "DescriptorSetLayout.hpp"
+#include "GeometryBuffer.hpp"
+#include "Image.hpp"
+#include "PipelineLayout.hpp"
+#include "VkDescriptors.hpp"
+#include "VkTypes.hpp"
+
+//forward declaration
+class VkEngine;
+
+namespace VulkanBackend
+{
+  // A-trous iterations, the distance between the taps doubles at each of them
+  constexpr uint32_t DENOISER_ITERATIONS = 5;
+
+  // Spatiotemporal variance guided filter (SVGF, Schied et al. 2017) of the ray traced image.
+  // The raygen shader writes the G-buffer of its primary hits next to a frame of a few samples. The illumination, the
+  // color demodulated by the albedo, accumulates over the frames while the history found by the motion vectors lies on
+  // the same surface, its variance comes from the moments of the luminance, then an edge-aware a-trous wavelet filter
+  // stopped by the variance, the normals and the depth removes the remaining noise before the albedo is put back.
+  class Denoiser
+  {
+   public:
+    // `output` holds the noisy frame and gets the denoised one
+    Denoiser(VkEngine* engine, VkExtent2D extent, std::unique_ptr<Image>& output, GeometryBuffer& geometryBuffer);
+    ~Denoiser();
+    Denoiser(const Denoiser&) = delete;
+    Denoiser& operator=(const Denoiser&) = delete;
+
+    // records the passes after the ray tracing pass, `frame` selects the parity of the G-buffer it wrote
+    void denoise(VkCommandBuffer cmd, uint32_t frame);
+    // the next frame does not reuse the history, for a cut or a change of the scene
+    void reset();
+
+   private:
+    void initImages(VkExtent3D extent);
+    void initPipelines(std::unique_ptr<Image>& output, GeometryBuffer& geometryBuffer);
+    void dispatch(VkCommandBuffer cmd, std::unique_ptr<ComputePipeline>& pipeline, const DenoiserPushConstants& constants);
+
+    VkEngine* _engine;
+    VkExtent2D _extent;
+
+    std::array<std::unique_ptr<Image>, 2> _colorHistory;   // filtered illumination and its variance
+    std::array<std::unique_ptr<Image>, 2> _momentHistory;  // luminance moments and history length
+    std::array<std::unique_ptr<Image>, 2> _pingPongImages;
+
+    DescriptorAllocatorGrowable _descriptorAllocator;
+    std::unique_ptr<DescriptorSetLayout> _descriptorLayout;
+    std::unique_ptr<DescriptorSet> _descriptorSet;
+    std::unique_ptr<PipelineLayout> _pipelineLayout;
+    std::unique_ptr<ComputePipeline> _reprojectPipeline;
+    std::unique_ptr<ComputePipeline> _variancePipeline;
+    std::unique_ptr<ComputePipeline> _atrousPipeline;
+
+    bool _isHistoryValid{false};
+  };
+}  // namespace VulkanBackend
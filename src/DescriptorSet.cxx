@@ -32,6 +32,32 @@ void VulkanBackend::DescriptorSet::writeImage(
   _writes.push_back(write);
 }
 
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::DescriptorSet::writeImageViews(
+  std::unique_ptr<Device>& device,
+  std::vector<VkImageView>& imageViews,
+  uint32_t binding)
+{
+  // The infos of an array must be contiguous, which the deque of single image infos does not guarantee
+  std::vector<VkDescriptorImageInfo>& infos = _imageArrayInfos.emplace_back();
+  for (VkImageView imageView : imageViews)
+  {
+    infos.emplace_back(
+      VkDescriptorImageInfo{.sampler = VK_NULL_HANDLE, .imageView = imageView, .imageLayout = VK_IMAGE_LAYOUT_GENERAL});
+  }
+
+  VkWriteDescriptorSet write = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+
+  write.dstBinding = binding;
+  write.dstSet = VK_NULL_HANDLE;  //left empty for now until we need to write it
+  write.descriptorCount = infos.size();
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  write.pImageInfo = infos.data();
+  write.dstSet = _handle;
+
+  _writes.push_back(write);
+}
+
 //--------------------------------------------------------------------------------------------------
 void VulkanBackend::DescriptorSet::writeBuffers(
   std::unique_ptr<Device>& device,
@@ -91,7 +117,8 @@ void VulkanBackend::DescriptorSet::writeAccelerationStructure(
   write.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
   write.dstArrayElement = 0;
   write.dstSet = _handle;
-  write.pNext = &descInfo;
+  // kept alive until the set is updated
+  write.pNext = &_TLASInfos.emplace_back(descInfo);
 
   _writes.push_back(write);
 }
@@ -112,6 +139,8 @@ void VulkanBackend::DescriptorSet::updateSet(std::unique_ptr<Device>& device)
 void VulkanBackend::DescriptorSet::clear()
 {
   _imageInfos.clear();
+  _imageArrayInfos.clear();
   _writes.clear();
   _bufferInfos.clear();
+  _TLASInfos.clear();
 }
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include "DebugUtils.hpp"
+#include "GeometryArena.hpp"
+#include "VkEngine.hpp"
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::GeometryArena::GeometryArena(
+  VkEngine* engine,
+  uint32_t elementSize,
+  uint32_t capacity,
+  VkBufferUsageFlags usage,
+  const char* name)
+  : _elementSize(elementSize), _capacity(capacity), _engine(engine), _name(name)
+{
+  // the transfers move the ranges between buffers when defragmenting
+  _usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  _allocator = std::make_unique<vkutil::OffsetAllocator>(capacity);
+  _buffer = this->createArenaBuffer(capacity);
+  this->updateAddress();
+}
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::GeometryArena::~GeometryArena()
+{
+  _engine->destroyBuffer(_buffer);
+}
+
+//--------------------------------------------------------------------------------------------------
+uint32_t VulkanBackend::GeometryArena::allocate(uint32_t count)
+{
+  vkutil::OffsetAllocation allocation = _allocator->allocate(count);
+
+  // out of space or too fragmented: compact everything in a buffer with room for the new range
+  if (allocation.offset == vkutil::OffsetAllocation::NO_SPACE)
+  {
+    const uint32_t used = _capacity - _allocator->report().totalFree;
+    this->defragment(std::max(_capacity * 2, used + count));
+    allocation = _allocator->allocate(count);
+  }
+
+  if (!_freeRanges.empty())
+  {
+    const uint32_t range = _freeRanges.back();
+    _freeRanges.pop_back();
+    _ranges[range] = allocation;
+    return range;
+  }
+
+  _ranges.push_back(allocation);
+  return static_cast<uint32_t>(_ranges.size() - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::GeometryArena::free(uint32_t range)
+{
+  _allocator->free(_ranges[range]);
+  _ranges[range] = {};
+  _freeRanges.push_back(range);
+}
+
+//--------------------------------------------------------------------------------------------------
+uint32_t VulkanBackend::GeometryArena::offset(uint32_t range) const
+{
+  return _ranges[range].offset;
+}
+
+//--------------------------------------------------------------------------------------------------
+VkDeviceAddress VulkanBackend::GeometryArena::address(uint32_t range) const
+{
+  return _address + static_cast<VkDeviceAddress>(_ranges[range].offset) * _elementSize;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::GeometryArena::defragment(uint32_t capacity)
+{
+  // live ranges in their current order, so that they keep it once packed
+  std::vector<uint32_t> liveRanges;
+  for (uint32_t range = 0; range < _ranges.size(); range++)
+  {
+    if (_ranges[range].offset != vkutil::OffsetAllocation::NO_SPACE)
+    {
+      liveRanges.push_back(range);
+    }
+  }
+  std::sort(
+    liveRanges.begin(), liveRanges.end(), [&](uint32_t a, uint32_t b) { return _ranges[a].offset < _ranges[b].offset; });
+
+  auto allocator = std::make_unique<vkutil::OffsetAllocator>(capacity);
+  AllocatedBuffer buffer = this->createArenaBuffer(capacity);
+
+  // a fresh allocator hands out the ranges one after the other from the start
+  std::vector<VkBufferCopy> copyRegions;
+  for (uint32_t range : liveRanges)
+  {
+    const uint32_t count = _allocator->allocationSize(_ranges[range]);
+    const vkutil::OffsetAllocation allocation = allocator->allocate(count);
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = static_cast<VkDeviceSize>(_ranges[range].offset) * _elementSize;
+    copyRegion.dstOffset = static_cast<VkDeviceSize>(allocation.offset) * _elementSize;
+    copyRegion.size = static_cast<VkDeviceSize>(count) * _elementSize;
+    if (copyRegion.size > 0)
+    {
+      copyRegions.push_back(copyRegion);
+    }
+
+    _ranges[range] = allocation;
+  }
+
+  if (!copyRegions.empty())
+  {
+    _engine->immediateSubmit(
+      [&](VkCommandBuffer cmd)
+      { vkCmdCopyBuffer(cmd, _buffer.buffer, buffer.buffer, copyRegions.size(), copyRegions.data()); });
+  }
+
+  // the frame in flight may still read the old buffer
+  AllocatedBuffer oldBuffer = _buffer;
+  _engine->getCurrentFrame()->_deletionQueue.push([=, this]() { _engine->destroyBuffer(oldBuffer); });
+
+  _allocator = std::move(allocator);
+  _buffer = buffer;
+  _capacity = capacity;
+  this->updateAddress();
+}
+
+//--------------------------------------------------------------------------------------------------
+vkutil::OffsetAllocatorReport VulkanBackend::GeometryArena::report() const
+{
+  return _allocator->report();
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::GeometryArena::updateAddress()
+{
+  VkBufferDeviceAddressInfo addressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _buffer.buffer};
+  _address = vkGetBufferDeviceAddress(_engine->_device->getHandle(), &addressInfo);
+}
+
+//--------------------------------------------------------------------------------------------------
+AllocatedBuffer VulkanBackend::GeometryArena::createArenaBuffer(uint32_t capacity)
+{
+  AllocatedBuffer buffer = _engine->createBuffer(
+    static_cast<size_t>(capacity) * _elementSize, _usage, MemoryIntent::Static);
+  DebugUtils::SetObjectName(buffer.buffer, _name.c_str(), _engine->_device->getHandle());
+  return buffer;
+}
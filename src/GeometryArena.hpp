@@ -0,0 +1,49 @@
+#pragma once
+#include "OffsetAllocator.hpp"
+#include "VkTypes.hpp"
+
+//forward declaration
+class VkEngine;
+
+namespace VulkanBackend
+{
+  // Device local buffer shared by the geometry of every mesh, sub-allocated in elements of a fixed size.
+  // Meshes keep a range handle rather than an offset: compacting the arena, or growing it once it is full, moves the
+  // ranges and only updates the table behind the handles.
+  class GeometryArena
+  {
+   public:
+    GeometryArena(VkEngine* engine, uint32_t elementSize, uint32_t capacity, VkBufferUsageFlags usage, const char* name);
+    ~GeometryArena();
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // returns the handle of a range of `count` elements
+    uint32_t allocate(uint32_t count);
+    void free(uint32_t range);
+
+    // first element of the range
+    uint32_t offset(uint32_t range) const;
+    VkDeviceAddress address(uint32_t range) const;
+
+    // moves every range to the front of a new buffer of `capacity` elements
+    void defragment(uint32_t capacity);
+    vkutil::OffsetAllocatorReport report() const;
+
+    AllocatedBuffer _buffer;
+    VkDeviceAddress _address;
+    uint32_t _elementSize;
+    uint32_t _capacity;
+
+   private:
+    AllocatedBuffer createArenaBuffer(uint32_t capacity);
+    void updateAddress();
+
+    VkEngine* _engine;
+    VkBufferUsageFlags _usage;
+    std::string _name;
+    std::unique_ptr<vkutil::OffsetAllocator> _allocator;
+    std::vector<vkutil::OffsetAllocation> _ranges;  // indexed by range handle
+    std::vector<uint32_t> _freeRanges;
+  };
+}  // namespace VulkanBackend
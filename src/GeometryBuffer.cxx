@@ -0,0 +1,83 @@
+#include "DebugUtils.hpp"
+#include "GeometryBuffer.hpp"
+#include "VkEngine.hpp"
+#include "VkImages.hpp"
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::GeometryBuffer::GeometryBuffer(VkEngine* engine, VkExtent2D extent) : _engine(engine)
+{
+  VkDevice device = _engine->_device->getHandle();
+  const VkExtent3D imageExtent{extent.width, extent.height, 1};
+  const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  auto createImage = [&](VkFormat format, const char* name)
+  {
+    auto image = std::make_unique<Image>(_engine->_device, imageExtent, format, usage, _engine->_allocator, false);
+    DebugUtils::SetObjectName(image->_handle.image, name, device);
+    return image;
+  };
+
+  const std::vector<VkFormat> formats = attachmentFormats();
+  for (size_t i = 0; i < 2; i++)
+  {
+    _positionImages[i] = createImage(formats[0], "G-buffer position");
+    _normalImages[i] = createImage(formats[1], "G-buffer normal");
+  }
+  _albedoImage = createImage(formats[2], "G-buffer albedo");
+  _motionImage = createImage(VK_FORMAT_R32G32_SFLOAT, "G-buffer motion");
+
+  // the images stay in the general layout, their content only matters once written by a frame
+  _engine->immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      for (size_t i = 0; i < 2; i++)
+      {
+        vkutil::transitionImage(
+          cmd, _positionImages[i]->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        vkutil::transitionImage(cmd, _normalImages[i]->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+      }
+      vkutil::transitionImage(cmd, _albedoImage->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+      vkutil::transitionImage(cmd, _motionImage->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::GeometryBuffer::~GeometryBuffer()
+{
+  for (size_t i = 0; i < 2; i++)
+  {
+    _engine->destroyImage(_positionImages[i]->_handle);
+    _engine->destroyImage(_normalImages[i]->_handle);
+  }
+  _engine->destroyImage(_albedoImage->_handle);
+  _engine->destroyImage(_motionImage->_handle);
+}
+
+//--------------------------------------------------------------------------------------------------
+std::vector<VkFormat> VulkanBackend::GeometryBuffer::attachmentFormats()
+{
+  return {VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT};
+}
+
+//--------------------------------------------------------------------------------------------------
+std::vector<VkImageView> VulkanBackend::GeometryBuffer::attachmentViews(uint32_t parity) const
+{
+  return {
+    _positionImages[parity]->_handle.imageView, _normalImages[parity]->_handle.imageView, _albedoImage->_handle.imageView};
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::GeometryBuffer::write(
+  DescriptorSet& set,
+  uint32_t positionBinding,
+  uint32_t normalBinding,
+  uint32_t albedoBinding,
+  uint32_t motionBinding)
+{
+  std::vector<VkImageView> positionViews{
+    _positionImages[0]->_handle.imageView, _positionImages[1]->_handle.imageView};
+  std::vector<VkImageView> normalViews{_normalImages[0]->_handle.imageView, _normalImages[1]->_handle.imageView};
+  set.writeImageViews(_engine->_device, positionViews, positionBinding);
+  set.writeImageViews(_engine->_device, normalViews, normalBinding);
+  set.writeImage(_engine->_device, _albedoImage, albedoBinding);
+  set.writeImage(_engine->_device, _motionImage, motionBinding);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include "DescriptorSet.hpp"
+#include "Image.hpp"
+#include "VkTypes.hpp"
+
+//forward declaration
+class VkEngine;
+
+namespace VulkanBackend
+{
+  // Primary hits of the ray traced frames, written by the raygen shader, or rasterized by the hybrid renderer, and read
+  // by the passes reusing the previous frames. The positions and normals are kept for both parities of the frames, so
+  // that the surface the pixel saw in the previous frame can be compared with the current one.
+  class GeometryBuffer
+  {
+   public:
+    GeometryBuffer(VkEngine* engine, VkExtent2D extent);
+    ~GeometryBuffer();
+    GeometryBuffer(const GeometryBuffer&) = delete;
+    GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+    // the position and normal bindings are arrays of the two parities
+    void write(
+      DescriptorSet& set,
+      uint32_t positionBinding,
+      uint32_t normalBinding,
+      uint32_t albedoBinding,
+      uint32_t motionBinding);
+
+    // formats of the position, normal and albedo images, the color attachments of the rasterized G-buffer
+    static std::vector<VkFormat> attachmentFormats();
+    // views of the rasterized images of a frame, in the order of attachmentFormats
+    std::vector<VkImageView> attachmentViews(uint32_t parity) const;
+
+    std::array<std::unique_ptr<Image>, 2> _positionImages;  // world position, hit distance in w (-1 for a miss)
+    std::array<std::unique_ptr<Image>, 2> _normalImages;    // roughness in w
+    std::unique_ptr<Image> _albedoImage;                    // metallic in alpha
+    std::unique_ptr<Image> _motionImage;  // offset in pixels to where the surface was in the previous frame
+
+   private:
+    VkEngine* _engine;
+  };
+}  // namespace VulkanBackend
@@ -7,17 +7,23 @@ VulkanBackend::Image::Image(
   VkFormat format,
   VkImageUsageFlags usage,
   VmaAllocator allocator,
-  bool mipmapped)
+  bool mipmapped,
+  uint32_t mipLevels)
 {
   //hardcoding the draw format to 32 bit float
   _handle.imageFormat = format;
   _handle.imageExtent = imageExtent;
 
   VkImageCreateInfo imgInfo = vkinit::imageCreateInfo(_handle.imageFormat, usage, imageExtent);
-  if (mipmapped)
+  if (mipLevels > 0)
   {
-    imgInfo.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(imageExtent.width, imageExtent.height)))) + 1;
+    imgInfo.mipLevels = mipLevels;
   }
+  else if (mipmapped)
+  {
+    imgInfo.mipLevels = mipLevelCount(imageExtent);
+  }
+  _handle.mipLevels = imgInfo.mipLevels;
 
   // always allocate images on dedicated GPU memory  VmaAllocationCreateInfo imgAllocInfo = {};
   VmaAllocationCreateInfo imgAllocInfo = {};
@@ -37,3 +43,9 @@ VulkanBackend::Image::Image(
 
   VK_CHECK(vkCreateImageView(device->getHandle(), &viewInfo, nullptr, &_handle.imageView));
 }
+
+//--------------------------------------------------------------------------------------------------
+uint32_t VulkanBackend::Image::mipLevelCount(VkExtent3D imageExtent)
+{
+  return static_cast<uint32_t>(std::floor(std::log2(std::max(imageExtent.width, imageExtent.height)))) + 1;
+}
@@ -13,9 +13,13 @@ namespace VulkanBackend
       VkFormat imageFormat,
       VkImageUsageFlags usage,
       VmaAllocator allocator,
-      bool mipmapped);
+      bool mipmapped,
+      uint32_t mipLevels = 0);  // overrides the full mip chain of a mipmapped image when not zero
     ~Image() = default;
 
+    // Number of levels of a full mip chain down to 1x1
+    static uint32_t mipLevelCount(VkExtent3D imageExtent);
+
     AllocatedImage _handle{};
   };
 }  // namespace VulkanBackend
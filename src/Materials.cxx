@@ -8,7 +8,8 @@ void GLTFMetallicRoughness::buildPipelines(
   VkDevice device,
   VkDescriptorSetLayout gpuSceneDataDescriptorLayout,
   AllocatedImage drawImage,
-  AllocatedImage depthImage)
+  AllocatedImage depthImage,
+  const std::vector<VkFormat>& geometryBufferFormats)
 {
   VkShaderModule meshFragShader;
   if (!vkutil::loadShaderModule("../shaders/blinn_phong.frag.spv", device, &meshFragShader))
@@ -16,6 +17,12 @@ void GLTFMetallicRoughness::buildPipelines(
     fmt::println("Error when building the triangle fragment shader module");
   }
 
+  VkShaderModule gbufferFragShader;
+  if (!vkutil::loadShaderModule("../shaders/gbuffer.frag.spv", device, &gbufferFragShader))
+  {
+    fmt::println("Error when building the G-buffer fragment shader module");
+  }
+
   VkShaderModule meshVertexShader;
   if (!vkutil::loadShaderModule("../shaders/mesh.vert.spv", device, &meshVertexShader))
   {
@@ -50,6 +57,7 @@ void GLTFMetallicRoughness::buildPipelines(
 
   _opaquePipeline.layout = newLayout;
   _transparentPipeline.layout = newLayout;
+  _gbufferPipeline.layout = newLayout;
 
   // build the stage-create-info for both vertex and fragment stages. This lets
   // the pipeline know the shader modules per stage
@@ -79,7 +87,16 @@ void GLTFMetallicRoughness::buildPipelines(
 
   _transparentPipeline.pipeline = pipelineBuilder.buildPipeline(device);
 
+  // the G-buffer variant, opaque, writes the surface attributes instead of the shaded color
+  pipelineBuilder.setShaders(meshVertexShader, gbufferFragShader);
+  pipelineBuilder.disableBlending();
+  pipelineBuilder.enableDepthtest(true, VK_COMPARE_OP_LESS);
+  pipelineBuilder.setColorAttachmentFormats(geometryBufferFormats);
+
+  _gbufferPipeline.pipeline = pipelineBuilder.buildPipeline(device);
+
   vkDestroyShaderModule(device, meshFragShader, nullptr);
+  vkDestroyShaderModule(device, gbufferFragShader, nullptr);
   vkDestroyShaderModule(device, meshVertexShader, nullptr);
 }
 
@@ -92,6 +109,7 @@ void GLTFMetallicRoughness::clearResources(VkDevice device)
 
     vkDestroyPipeline(device, _transparentPipeline.pipeline, nullptr);
     vkDestroyPipeline(device, _opaquePipeline.pipeline, nullptr);
+    vkDestroyPipeline(device, _gbufferPipeline.pipeline, nullptr);
   }
 }
 
@@ -113,9 +131,6 @@ MaterialInstance GLTFMetallicRoughness::writeMaterial(
     matData.pipeline = &_opaquePipeline;
   }
 
-  matData.materialSet = descriptorAllocator.allocate(device, _materialLayout);
-
-
   writer.clear();
   writer.writeBuffer(
     0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
@@ -132,7 +147,11 @@ MaterialInstance GLTFMetallicRoughness::writeMaterial(
     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
     VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-  writer.updateSet(device, matData.materialSet);
+  for (VkDescriptorSet& materialSet : matData.materialSets)
+  {
+    materialSet = descriptorAllocator.allocate(device, _materialLayout);
+    writer.updateSet(device, materialSet);
+  }
 
   return matData;
 }
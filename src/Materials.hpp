@@ -7,6 +7,7 @@ class GLTFMetallicRoughness
  public:
   MaterialPipeline _opaquePipeline;
   MaterialPipeline _transparentPipeline;
+  MaterialPipeline _gbufferPipeline;  // opaque surfaces to the G-buffer of the hybrid renderer, same layout
 
   VkDescriptorSetLayout _materialLayout;
 
@@ -34,7 +35,8 @@ class GLTFMetallicRoughness
     VkDevice device,
     VkDescriptorSetLayout gpuSceneDataDescriptorLayout,
     AllocatedImage drawImage,
-    AllocatedImage depthImage);
+    AllocatedImage depthImage,
+    const std::vector<VkFormat>& geometryBufferFormats);
   void clearResources(VkDevice device);
 
   MaterialInstance writeMaterial(
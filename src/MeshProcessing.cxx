@@ -0,0 +1,152 @@
+#include <meshoptimizer.h>
+#include "MeshProcessing.hpp"
+
+//--------------------------------------------------------------------------------------------------
+Bounds vkutil::computeSurfaceBounds(std::span<const uint32_t> indices, std::span<const Vertex> vertices)
+{
+  Bounds bounds{};
+  if (indices.empty())
+  {
+    return bounds;
+  }
+
+  glm::vec3 minpos = vertices[indices[0]].position;
+  glm::vec3 maxpos = vertices[indices[0]].position;
+  for (uint32_t index : indices)
+  {
+    minpos = glm::min(minpos, vertices[index].position);
+    maxpos = glm::max(maxpos, vertices[index].position);
+  }
+
+  bounds.origin = (maxpos + minpos) / 2.f;
+  bounds.extents = (maxpos - minpos) / 2.f;
+  bounds.sphereRadius = glm::length(bounds.extents);
+  return bounds;
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::generateSurfaceLods(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, GeoSurface& surface)
+{
+  surface.lods.clear();
+  surface.lods.push_back({surface.startIndex, surface.count, 0.f});
+
+  // Every level halves the triangle count of the previous one.
+  constexpr float reductionRatio = 0.5f;
+  // Stop as soon as the simplifier cannot remove enough triangles anymore (flat or locked geometry).
+  constexpr float minimalReduction = 0.85f;
+  // Relative error allowed to reach the target count, the selection is driven by the reported error anyway.
+  constexpr float maxRelativeError = 0.2f;
+
+  // The simplifier error is relative to the mesh extents, scale it back to object space.
+  const float errorScale = meshopt_simplifyScale(&vertices[0].position.x, vertices.size(), sizeof(Vertex));
+
+  // Copy the source range, the index vector is appended to while we iterate.
+  std::vector<uint32_t> source(indices.begin() + surface.startIndex, indices.begin() + surface.startIndex + surface.count);
+  std::vector<uint32_t> simplified(source.size());
+
+  for (uint32_t lod = 1; lod < MAX_SURFACE_LODS; lod++)
+  {
+    size_t targetCount = static_cast<size_t>(source.size() * reductionRatio) / 3 * 3;
+    if (targetCount < 3)
+    {
+      break;
+    }
+
+    float resultError = 0.f;
+    // Lock the border so the surfaces sharing this index buffer do not open cracks between them.
+    size_t count = meshopt_simplify(
+      simplified.data(),
+      source.data(),
+      source.size(),
+      &vertices[0].position.x,
+      vertices.size(),
+      sizeof(Vertex),
+      targetCount,
+      maxRelativeError,
+      meshopt_SimplifyLockBorder,
+      &resultError);
+
+    if (count == 0 || count > source.size() * minimalReduction)
+    {
+      break;
+    }
+
+    // Each level is simplified from the previous one, so the errors add up along the chain.
+    SurfaceLod newLod;
+    newLod.startIndex = static_cast<uint32_t>(indices.size());
+    newLod.count = static_cast<uint32_t>(count);
+    newLod.error = surface.lods.back().error + resultError * errorScale;
+
+    indices.insert(indices.end(), simplified.begin(), simplified.begin() + count);
+    surface.lods.push_back(newLod);
+
+    source.assign(simplified.begin(), simplified.begin() + count);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::generateMeshlets(
+  const std::vector<uint32_t>& indices,
+  const std::vector<Vertex>& vertices,
+  SurfaceLod& lod,
+  std::vector<GPUMeshlet>& meshlets,
+  std::vector<uint32_t>& meshletIndices)
+{
+  lod.meshletOffset = static_cast<uint32_t>(meshlets.size());
+  lod.meshletCount = 0;
+  if (lod.count == 0)
+  {
+    return;
+  }
+
+  // Favors meshlets with coherent normals so that the cone test rejects more of them.
+  constexpr float coneWeight = 0.25f;
+
+  const size_t maxMeshlets = meshopt_buildMeshletsBound(lod.count, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+  std::vector<meshopt_Meshlet> localMeshlets(maxMeshlets);
+  std::vector<uint32_t> meshletVertices(maxMeshlets * MESHLET_MAX_VERTICES);
+  std::vector<uint8_t> meshletTriangles(maxMeshlets * MESHLET_MAX_TRIANGLES * 3);
+
+  const size_t meshletCount = meshopt_buildMeshlets(
+    localMeshlets.data(),
+    meshletVertices.data(),
+    meshletTriangles.data(),
+    indices.data() + lod.startIndex,
+    lod.count,
+    &vertices[0].position.x,
+    vertices.size(),
+    sizeof(Vertex),
+    MESHLET_MAX_VERTICES,
+    MESHLET_MAX_TRIANGLES,
+    coneWeight);
+
+  for (size_t i = 0; i < meshletCount; i++)
+  {
+    const meshopt_Meshlet& meshlet = localMeshlets[i];
+    const meshopt_Bounds bounds = meshopt_computeMeshletBounds(
+      &meshletVertices[meshlet.vertex_offset],
+      &meshletTriangles[meshlet.triangle_offset],
+      meshlet.triangle_count,
+      &vertices[0].position.x,
+      vertices.size(),
+      sizeof(Vertex));
+
+    GPUMeshlet gpuMeshlet{};
+    gpuMeshlet.center = glm::vec3(bounds.center[0], bounds.center[1], bounds.center[2]);
+    gpuMeshlet.radius = bounds.radius;
+    gpuMeshlet.coneApex = glm::vec3(bounds.cone_apex[0], bounds.cone_apex[1], bounds.cone_apex[2]);
+    gpuMeshlet.coneAxis = glm::vec3(bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2]);
+    gpuMeshlet.coneCutoff = bounds.cone_cutoff;
+    gpuMeshlet.indexOffset = static_cast<uint32_t>(meshletIndices.size());
+    gpuMeshlet.indexCount = meshlet.triangle_count * 3;
+
+    // The micro indices reference the meshlet vertex list, resolve them to mesh vertex indices.
+    for (uint32_t j = 0; j < gpuMeshlet.indexCount; j++)
+    {
+      meshletIndices.push_back(meshletVertices[meshlet.vertex_offset + meshletTriangles[meshlet.triangle_offset + j]]);
+    }
+    meshlets.push_back(gpuMeshlet);
+  }
+
+  lod.meshletCount = static_cast<uint32_t>(meshletCount);
+}
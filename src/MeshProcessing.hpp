@@ -0,0 +1,29 @@
+#pragma once
+#include "VkLoader.hpp"
+#include "VkTypes.hpp"
+
+namespace vkutil
+{
+  // Maximum number of levels of detail generated per surface, including the full detail one.
+  constexpr uint32_t MAX_SURFACE_LODS = 5;
+
+  // Computes the bounding box and sphere of the vertices referenced by a surface.
+  Bounds computeSurfaceBounds(std::span<const uint32_t> indices, std::span<const Vertex> vertices);
+
+  // Simplifies the surface index range and appends the resulting LOD index ranges at the end of `indices`.
+  // The full detail range is stored as lods[0], coarser levels follow with their object space error.
+  void generateSurfaceLods(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, GeoSurface& surface);
+
+  // Limits of a meshlet, 124 triangles keeps the triangle count a multiple of 4 as meshoptimizer requires.
+  constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+  constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+  // Splits the index range of a LOD into meshlets and appends them with their bounding sphere and normal cone.
+  // The meshlet triangles are expanded to plain vertex indices so they can be drawn without mesh shaders.
+  void generateMeshlets(
+    const std::vector<uint32_t>& indices,
+    const std::vector<Vertex>& vertices,
+    SurfaceLod& lod,
+    std::vector<GPUMeshlet>& meshlets,
+    std::vector<uint32_t>& meshletIndices);
+}  // namespace vkutil
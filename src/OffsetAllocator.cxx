@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include "OffsetAllocator.hpp"
+
+namespace
+{
+  constexpr uint32_t MANTISSA_BITS = 3;
+  constexpr uint32_t MANTISSA_VALUE = 1 << MANTISSA_BITS;
+  constexpr uint32_t MANTISSA_MASK = MANTISSA_VALUE - 1;
+
+  // Bin of the smallest free range able to hold `size`, a request never lands in a bin holding smaller ranges
+  uint32_t binRoundUp(uint32_t size)
+  {
+    if (size < MANTISSA_VALUE)
+    {
+      return size;
+    }
+
+    const uint32_t highestBit = 31 - std::countl_zero(size);
+    const uint32_t mantissaStart = highestBit - MANTISSA_BITS;
+    const uint32_t exponent = mantissaStart + 1;
+    uint32_t mantissa = (size >> mantissaStart) & MANTISSA_MASK;
+
+    if (size & ((1u << mantissaStart) - 1))
+    {
+      mantissa++;
+    }
+
+    // a mantissa overflow carries into the exponent
+    return (exponent << MANTISSA_BITS) + mantissa;
+  }
+
+  // Bin a free range of `size` is stored in
+  uint32_t binRoundDown(uint32_t size)
+  {
+    if (size < MANTISSA_VALUE)
+    {
+      return size;
+    }
+
+    const uint32_t highestBit = 31 - std::countl_zero(size);
+    const uint32_t mantissaStart = highestBit - MANTISSA_BITS;
+    const uint32_t exponent = mantissaStart + 1;
+    const uint32_t mantissa = (size >> mantissaStart) & MANTISSA_MASK;
+
+    return (exponent << MANTISSA_BITS) | mantissa;
+  }
+
+  uint32_t lowestSetBitAfter(uint32_t mask, uint32_t startBit)
+  {
+    if (startBit >= 32)
+    {
+      return vkutil::OffsetAllocation::NO_SPACE;
+    }
+
+    const uint32_t maskAfter = mask & ~((1u << startBit) - 1);
+    return maskAfter == 0 ? vkutil::OffsetAllocation::NO_SPACE : std::countr_zero(maskAfter);
+  }
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+vkutil::OffsetAllocator::OffsetAllocator(uint32_t size, uint32_t maxAllocations)
+  : _size(size), _nodes(maxAllocations), _freeNodes(maxAllocations), _freeNodeCount(maxAllocations)
+{
+  _binIndices.fill(UNUSED);
+
+  // popped from the back, so that the first nodes are used first
+  for (uint32_t i = 0; i < maxAllocations; i++)
+  {
+    _freeNodes[i] = maxAllocations - i - 1;
+  }
+
+  this->insertNodeIntoBin(size, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+vkutil::OffsetAllocation vkutil::OffsetAllocator::allocate(uint32_t size)
+{
+  // a split may need a second node
+  if (_freeNodeCount < 2)
+  {
+    return {};
+  }
+
+  const uint32_t minBin = binRoundUp(size);
+  const uint32_t minTopBin = minBin >> MANTISSA_BITS;
+  const uint32_t minLeafBin = minBin & MANTISSA_MASK;
+
+  uint32_t topBin = minTopBin;
+  uint32_t leafBin = OffsetAllocation::NO_SPACE;
+
+  // first a large enough bin in the same top bin, then the smallest bin of the next non empty top bin
+  if (_usedBinsTop & (1u << topBin))
+  {
+    leafBin = lowestSetBitAfter(_usedBins[topBin], minLeafBin);
+  }
+
+  if (leafBin == OffsetAllocation::NO_SPACE)
+  {
+    topBin = lowestSetBitAfter(_usedBinsTop, minTopBin + 1);
+    if (topBin == OffsetAllocation::NO_SPACE)
+    {
+      return {};
+    }
+    leafBin = std::countr_zero(static_cast<uint32_t>(_usedBins[topBin]));
+  }
+
+  const uint32_t bin = (topBin << MANTISSA_BITS) | leafBin;
+
+  // pop the head of the bin
+  const uint32_t nodeIndex = _binIndices[bin];
+  Node& node = _nodes[nodeIndex];
+  const uint32_t nodeTotalSize = node.dataSize;
+  node.dataSize = size;
+  node.isUsed = true;
+  _binIndices[bin] = node.binListNext;
+  if (node.binListNext != UNUSED)
+  {
+    _nodes[node.binListNext].binListPrev = UNUSED;
+  }
+  node.binListNext = UNUSED;
+  _freeStorage -= nodeTotalSize;
+  _allocationCount++;
+
+  if (_binIndices[bin] == UNUSED)
+  {
+    _usedBins[topBin] &= ~(1u << leafBin);
+    if (_usedBins[topBin] == 0)
+    {
+      _usedBinsTop &= ~(1u << topBin);
+    }
+  }
+
+  // the rest of the range goes back to the bins, right after the allocation
+  const uint32_t remainder = nodeTotalSize - size;
+  if (remainder > 0)
+  {
+    const uint32_t newNodeIndex = this->insertNodeIntoBin(remainder, node.dataOffset + size);
+
+    if (node.neighborNext != UNUSED)
+    {
+      _nodes[node.neighborNext].neighborPrev = newNodeIndex;
+    }
+    _nodes[newNodeIndex].neighborPrev = nodeIndex;
+    _nodes[newNodeIndex].neighborNext = node.neighborNext;
+    node.neighborNext = newNodeIndex;
+  }
+
+  return {node.dataOffset, nodeIndex};
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::OffsetAllocator::free(OffsetAllocation allocation)
+{
+  if (allocation.metadata == OffsetAllocation::NO_SPACE)
+  {
+    return;
+  }
+
+  const uint32_t nodeIndex = allocation.metadata;
+  Node& node = _nodes[nodeIndex];
+  assert(node.isUsed);
+
+  uint32_t offset = node.dataOffset;
+  uint32_t size = node.dataSize;
+
+  // merge with the free neighbours
+  if (node.neighborPrev != UNUSED && !_nodes[node.neighborPrev].isUsed)
+  {
+    const Node& prevNode = _nodes[node.neighborPrev];
+    offset = prevNode.dataOffset;
+    size += prevNode.dataSize;
+
+    const uint32_t prevIndex = node.neighborPrev;
+    node.neighborPrev = prevNode.neighborPrev;
+    this->removeNodeFromBin(prevIndex);
+  }
+
+  if (node.neighborNext != UNUSED && !_nodes[node.neighborNext].isUsed)
+  {
+    const Node& nextNode = _nodes[node.neighborNext];
+    size += nextNode.dataSize;
+
+    const uint32_t nextIndex = node.neighborNext;
+    node.neighborNext = nextNode.neighborNext;
+    this->removeNodeFromBin(nextIndex);
+  }
+
+  const uint32_t neighborPrev = node.neighborPrev;
+  const uint32_t neighborNext = node.neighborNext;
+
+  node.isUsed = false;
+  _freeNodes[_freeNodeCount++] = nodeIndex;
+  _allocationCount--;
+
+  const uint32_t combinedIndex = this->insertNodeIntoBin(size, offset);
+  if (neighborNext != UNUSED)
+  {
+    _nodes[combinedIndex].neighborNext = neighborNext;
+    _nodes[neighborNext].neighborPrev = combinedIndex;
+  }
+  if (neighborPrev != UNUSED)
+  {
+    _nodes[combinedIndex].neighborPrev = neighborPrev;
+    _nodes[neighborPrev].neighborNext = combinedIndex;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+uint32_t vkutil::OffsetAllocator::allocationSize(OffsetAllocation allocation) const
+{
+  if (allocation.metadata == OffsetAllocation::NO_SPACE)
+  {
+    return 0;
+  }
+  return _nodes[allocation.metadata].dataSize;
+}
+
+//--------------------------------------------------------------------------------------------------
+vkutil::OffsetAllocatorReport vkutil::OffsetAllocator::report() const
+{
+  OffsetAllocatorReport report{_freeStorage, 0, _allocationCount};
+
+  // the largest range sits in the highest non empty bin, which still mixes sizes
+  if (_usedBinsTop != 0)
+  {
+    const uint32_t topBin = 31 - std::countl_zero(_usedBinsTop);
+    const uint32_t leafBin = 31 - std::countl_zero(static_cast<uint32_t>(_usedBins[topBin]));
+    for (uint32_t nodeIndex = _binIndices[(topBin << MANTISSA_BITS) | leafBin]; nodeIndex != UNUSED;
+         nodeIndex = _nodes[nodeIndex].binListNext)
+    {
+      report.largestFree = std::max(report.largestFree, _nodes[nodeIndex].dataSize);
+    }
+  }
+  return report;
+}
+
+//--------------------------------------------------------------------------------------------------
+uint32_t vkutil::OffsetAllocator::insertNodeIntoBin(uint32_t size, uint32_t dataOffset)
+{
+  const uint32_t bin = binRoundDown(size);
+  const uint32_t topBin = bin >> MANTISSA_BITS;
+  const uint32_t leafBin = bin & MANTISSA_MASK;
+
+  if (_binIndices[bin] == UNUSED)
+  {
+    _usedBins[topBin] |= 1u << leafBin;
+    _usedBinsTop |= 1u << topBin;
+  }
+
+  const uint32_t headIndex = _binIndices[bin];
+  const uint32_t nodeIndex = _freeNodes[--_freeNodeCount];
+  _nodes[nodeIndex] = {dataOffset, size, UNUSED, headIndex};
+  if (headIndex != UNUSED)
+  {
+    _nodes[headIndex].binListPrev = nodeIndex;
+  }
+  _binIndices[bin] = nodeIndex;
+
+  _freeStorage += size;
+  return nodeIndex;
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::OffsetAllocator::removeNodeFromBin(uint32_t nodeIndex)
+{
+  const Node& node = _nodes[nodeIndex];
+
+  if (node.binListPrev != UNUSED)
+  {
+    // in the middle of the list, the bin stays non empty
+    _nodes[node.binListPrev].binListNext = node.binListNext;
+    if (node.binListNext != UNUSED)
+    {
+      _nodes[node.binListNext].binListPrev = node.binListPrev;
+    }
+  }
+  else
+  {
+    const uint32_t bin = binRoundDown(node.dataSize);
+    const uint32_t topBin = bin >> MANTISSA_BITS;
+    const uint32_t leafBin = bin & MANTISSA_MASK;
+
+    _binIndices[bin] = node.binListNext;
+    if (node.binListNext != UNUSED)
+    {
+      _nodes[node.binListNext].binListPrev = UNUSED;
+    }
+
+    if (_binIndices[bin] == UNUSED)
+    {
+      _usedBins[topBin] &= ~(1u << leafBin);
+      if (_usedBins[topBin] == 0)
+      {
+        _usedBinsTop &= ~(1u << topBin);
+      }
+    }
+  }
+
+  _freeNodes[_freeNodeCount++] = nodeIndex;
+  _freeStorage -= node.dataSize;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace vkutil
+{
+  // Range handed out by OffsetAllocator, in the units the allocator was created with.
+  struct OffsetAllocation
+  {
+    static constexpr uint32_t NO_SPACE = 0xffffffff;
+
+    uint32_t offset = NO_SPACE;
+    uint32_t metadata = NO_SPACE;  // node of the allocator, needed to free the range
+  };
+
+  struct OffsetAllocatorReport
+  {
+    uint32_t totalFree;
+    uint32_t largestFree;
+    uint32_t allocationCount;
+  };
+
+  // Two level segregated fit (TLSF) allocator of ranges in [0, size), allocations and frees are O(1).
+  // Free ranges are sorted in 256 bins following a small float of their size (5 bits of exponent, 3 of mantissa),
+  // two levels of bitmasks find the first non empty bin large enough. Freed ranges are merged with their neighbours.
+  // Only offsets are managed, the memory itself belongs to the caller.
+  class OffsetAllocator
+  {
+   public:
+    OffsetAllocator(uint32_t size, uint32_t maxAllocations = 128 * 1024);
+
+    OffsetAllocation allocate(uint32_t size);
+    void free(OffsetAllocation allocation);
+
+    uint32_t allocationSize(OffsetAllocation allocation) const;
+    OffsetAllocatorReport report() const;
+    uint32_t size() const
+    {
+      return _size;
+    }
+
+   private:
+    static constexpr uint32_t TOP_BIN_COUNT = 32;
+    static constexpr uint32_t BINS_PER_LEAF = 8;
+    static constexpr uint32_t LEAF_BIN_COUNT = TOP_BIN_COUNT * BINS_PER_LEAF;
+    static constexpr uint32_t UNUSED = 0xffffffff;
+
+    struct Node
+    {
+      uint32_t dataOffset = 0;
+      uint32_t dataSize = 0;
+      uint32_t binListPrev = UNUSED;
+      uint32_t binListNext = UNUSED;
+      uint32_t neighborPrev = UNUSED;
+      uint32_t neighborNext = UNUSED;
+      bool isUsed = false;
+    };
+
+    uint32_t insertNodeIntoBin(uint32_t size, uint32_t dataOffset);
+    void removeNodeFromBin(uint32_t nodeIndex);
+
+    uint32_t _size;
+    uint32_t _freeStorage = 0;
+    uint32_t _allocationCount = 0;
+
+    uint32_t _usedBinsTop = 0;
+    std::array<uint8_t, TOP_BIN_COUNT> _usedBins{};
+    std::array<uint32_t, LEAF_BIN_COUNT> _binIndices;
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _freeNodes;  // stack of the unused node slots
+    uint32_t _freeNodeCount;
+  };
+}  // namespace vkutil
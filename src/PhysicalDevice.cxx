@@ -3,6 +3,14 @@
 //--------------------------------------------------------------------------------------------------
 VulkanBackend::PhysicalDevice::PhysicalDevice(std::unique_ptr<Instance>& instance, VkSurfaceKHR& surface)
 {
+  //vulkan 1.0 features
+  // The single pass mipmap downsampler selects the destination mip in an image array, the ray tracing and the denoiser
+  // the image of the frame parity
+  _features.shaderStorageImageArrayDynamicIndexing = true;
+  // A single indirect draw covers every surface of a material, each one reading its transform via firstInstance
+  _features.multiDrawIndirect = true;
+  _features.drawIndirectFirstInstance = true;
+
   //vulkan 1.3 features
   _features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
   _features13.dynamicRendering = true;
@@ -38,22 +46,60 @@ VulkanBackend::PhysicalDevice::PhysicalDevice(std::unique_ptr<Instance>& instanc
   //use vkbootstrap to select a gpu.
   //We want a gpu that can write to the SDL surface and supports vulkan 1.3 with the correct features
   vkb::Instance vkbInstanceHandle = instance->getHandle();
-  vkb::PhysicalDeviceSelector selector{vkbInstanceHandle};
-  _vkbHandle = selector.set_minimum_version(1, 3)
-                 .set_required_features_13(_features13)
-                 .set_required_features_12(_features12)
-                 .add_required_extension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)
-                 .add_required_extension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME)
-                 .add_required_extension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME)
-                 .add_required_extension(VK_KHR_SPIRV_1_4_EXTENSION_NAME)
-                 .add_required_extension(VK_NV_RAY_TRACING_VALIDATION_EXTENSION_NAME)
-                 .add_required_extension(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)
-                 .add_required_extension(VK_KHR_RAY_TRACING_POSITION_FETCH_EXTENSION_NAME)
-                 .add_required_extension_features(accelerationStructureFeatures)
-                 .add_required_extension_features(rayTracingFeatures)
-                 .add_required_extension_features(swapChainMaintenanceFeatures)
-                 .add_required_extension_features(RTPositionFetchFeatures)
-                 .set_surface(surface)
-                 .select()
-                 .value();
+  auto requireRasterization = [&](vkb::PhysicalDeviceSelector& selector) -> vkb::PhysicalDeviceSelector&
+  {
+    return selector.set_minimum_version(1, 3)
+      .set_required_features(_features)
+      .set_required_features_13(_features13)
+      .set_required_features_12(_features12)
+      .add_required_extension(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)
+      .add_required_extension_features(swapChainMaintenanceFeatures)
+      .set_surface(surface);
+  };
+
+  // A device with the ray tracing pipeline first, any other one traces the rays through the BVH built by the engine
+  vkb::PhysicalDeviceSelector raytracingSelector{vkbInstanceHandle};
+  auto raytracingDevice = requireRasterization(raytracingSelector)
+                            .add_required_extension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)
+                            .add_required_extension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME)
+                            .add_required_extension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME)
+                            .add_required_extension(VK_KHR_SPIRV_1_4_EXTENSION_NAME)
+                            .add_required_extension_features(accelerationStructureFeatures)
+                            .add_required_extension_features(rayTracingFeatures)
+                            .select();
+  if (raytracingDevice)
+  {
+    _vkbHandle = raytracingDevice.value();
+    _raytracingTier = RaytracingTier::Pipeline;
+  }
+  else
+  {
+    fmt::println("No ray tracing device ({}), the rays are traced in software", raytracingDevice.error().message());
+    vkb::PhysicalDeviceSelector softwareSelector{vkbInstanceHandle};
+    _vkbHandle = requireRasterization(softwareSelector).select().value();
+    _raytracingTier = RaytracingTier::Software;
+  }
+
+  _isMemoryBudgetEnabled = _vkbHandle.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+  // Cooked textures are uploaded as BC4, BC5 and BC7 blocks, the devices without them get rgba8 images
+  VkPhysicalDeviceFeatures compressionFeatures{};
+  compressionFeatures.textureCompressionBC = true;
+  _isTextureCompressionBCEnabled = _vkbHandle.enable_features_if_present(compressionFeatures);
+
+  if (_raytracingTier == RaytracingTier::Pipeline)
+  {
+    // Nice to have: the shaders do not fetch the positions and the validation only helps debugging
+    _vkbHandle.enable_extension_if_present(VK_NV_RAY_TRACING_VALIDATION_EXTENSION_NAME);
+    if (_vkbHandle.enable_extension_if_present(VK_KHR_RAY_TRACING_POSITION_FETCH_EXTENSION_NAME))
+    {
+      _vkbHandle.enable_extension_features_if_present(RTPositionFetchFeatures);
+    }
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{};
+    rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    rayQueryFeatures.rayQuery = true;
+    _isRayQueryEnabled = _vkbHandle.enable_extension_if_present(VK_KHR_RAY_QUERY_EXTENSION_NAME) &&
+                         _vkbHandle.enable_extension_features_if_present(rayQueryFeatures);
+  }
 }
@@ -4,6 +4,13 @@
 
 namespace VulkanBackend
 {
+  // How the device can trace rays
+  enum class RaytracingTier : uint8_t
+  {
+    Pipeline,  // VK_KHR_ray_tracing_pipeline and the acceleration structures, ray queries when present
+    Software   // neither, a compute shader traverses the BVH built by the engine
+  };
+
   class PhysicalDevice
   {
    public:
@@ -14,8 +21,18 @@ namespace VulkanBackend
       return _vkbHandle;
     }
     ~PhysicalDevice() = default;
+
+    // VK_EXT_memory_budget, lets the allocator report the real budget of the heaps
+    bool _isMemoryBudgetEnabled = false;
+    // textureCompressionBC, the textures are cooked to BC blocks, or uploaded as rgba8 without it
+    bool _isTextureCompressionBCEnabled = false;
+    // VK_KHR_ray_query, lets the compute shaders trace rays inline instead of going through the ray tracing pipeline
+    bool _isRayQueryEnabled = false;
+    RaytracingTier _raytracingTier = RaytracingTier::Pipeline;
+
    private:
     vkb::PhysicalDevice _vkbHandle;
+    VkPhysicalDeviceFeatures _features{};
     VkPhysicalDeviceVulkan13Features _features13{};
     VkPhysicalDeviceVulkan12Features _features12{};
   };
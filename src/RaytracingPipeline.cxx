@@ -32,11 +32,9 @@ VulkanBackend::Raytracing::RaytracingPipeline::RaytracingPipeline(
   pipelineInfo.pStages = _shaderStages.data();
   pipelineInfo.groupCount = static_cast<uint32_t>(_shaderGroups.size());
   pipelineInfo.pGroups = _shaderGroups.data();
-  // The ray tracing process can shoot rays from the camera, and a shadow ray can be shot from the
-  // hit points of the camera rays, hence a recursion level of 2. This number should be kept as low
-  // as possible for performance reasons. Even recursive ray tracing should be flattened into a loop
-  // in the ray generation to avoid deep recursion.
-  pipelineInfo.maxPipelineRayRecursionDepth = 2;
+  // The paths are traced by a loop in the ray generation shader, the hit shaders only return the surface they hit and
+  // never trace rays themselves, hence a recursion level of 1 whatever the number of bounces.
+  pipelineInfo.maxPipelineRayRecursionDepth = 1;
   pipelineInfo.layout = layout->_handle;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
   pipelineInfo.basePipelineIndex = 0;
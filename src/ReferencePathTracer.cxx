@@ -0,0 +1,841 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <thread>
+#include "BoundingVolumeHierarchy.hpp"
+#include "ReferencePathTracer.hpp"
+#include "shaders/sampler_shared.h"
+
+namespace
+{
+  // side of the square tiles the threads take from the queues, in pixels
+  constexpr uint32_t TILE_SIZE = 16;
+  // camera rays traversing the BVH together, those of a 2x2 quad of pixels
+  constexpr uint32_t PACKET_WIDTH = 4;
+  // pending far children of a traversal
+  constexpr uint32_t STACK_SIZE = 128;
+
+  // as in shaders/pathtracer.glsl and brdf.glsl
+  constexpr float PI = 3.14159265359f;
+  const glm::vec3 SKY_RADIANCE(0.f, 0.1f, 0.3f);
+  constexpr float LIGHT_INTENSITY = 20.f * PI;
+  constexpr float CAMERA_T_MIN = 0.1f;
+  constexpr float T_MAX = 1000.f;
+  constexpr uint32_t NO_HIT = ~0u;
+
+  // BVH of a mesh, over its triangles
+  struct MeshBvh
+  {
+    std::vector<GPUBvhNode> nodes;
+    std::vector<uint32_t> triangles;  // in the order of the leaves
+  };
+
+  struct SceneInstance
+  {
+    glm::mat4 worldToObject;
+    uint32_t mesh;
+  };
+
+  // BVH of the instances leading to the BVH of their meshes, as the TLAS and the BLAS
+  struct SceneBvh
+  {
+    const vkutil::ReferenceScene* scene;
+    std::vector<MeshBvh> meshes;
+    std::vector<GPUBvhNode> nodes;
+    std::vector<SceneInstance> instances;  // in the order of the leaves
+  };
+
+  // Rays of a packet in structure of arrays, the loops over the lanes are vectorized by the compiler. The hit fields
+  // keep the closest hit so far.
+  template<size_t Width> struct RayPacket
+  {
+    std::array<float, Width> originX, originY, originZ;
+    std::array<float, Width> directionX, directionY, directionZ;
+    std::array<float, Width> tMin;
+    std::array<float, Width> t;  // tMax until something is hit, the distance of the closest hit then
+    std::array<float, Width> u, v;
+    std::array<uint32_t, Width> instance;  // NO_HIT until something is hit
+    std::array<uint32_t, Width> triangle;
+    std::array<uint32_t, Width> isActive;  // 0 for the lanes without a ray, or already occluded
+  };
+
+  // Surface of the closest hit, as the hit payload of the shaders
+  struct Surface
+  {
+    glm::vec3 normal;  // facing the ray
+    float hitT;        // -1 when the ray missed
+    glm::vec3 albedo;
+    float metallic;
+    float roughness;
+  };
+
+  struct BrdfSurface
+  {
+    glm::vec3 normal;
+    glm::vec3 albedo;
+    float metallic;
+    float alpha;
+  };
+
+  // SAMPLER_RANDOM of shaders/sampler.glsl
+  struct Sampler
+  {
+    uint32_t pixelSeed;
+    uint32_t sampleIndex;
+    uint32_t dimension;
+  };
+
+  //--------------------------------------------------------------------------------------------------
+  uint32_t samplerHash(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  uint32_t tea(uint32_t val0, uint32_t val1)
+  {
+    uint32_t v0 = val0;
+    uint32_t v1 = val1;
+    uint32_t s0 = 0;
+    for (uint32_t n = 0; n < 16; n++)
+    {
+      s0 += 0x9e3779b9;
+      v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+      v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+    }
+    return v0;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float rnd(uint32_t& previous)
+  {
+    previous = 1664525u * previous + 1013904223u;
+    return static_cast<float>(previous & 0x00FFFFFF) / static_cast<float>(0x01000000);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  Sampler samplerInit(uint32_t x, uint32_t y, uint32_t sampleIndex)
+  {
+    return Sampler{samplerHash(x ^ samplerHash(y)), sampleIndex, SAMPLER_DIMENSION_CAMERA};
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  void samplerStartBounce(Sampler& sampler, uint32_t bounce, uint32_t offset)
+  {
+    sampler.dimension = SAMPLER_DIMENSION_FIRST_BOUNCE + bounce * SAMPLER_DIMENSIONS_PER_BOUNCE + offset;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  glm::vec2 samplerNext2D(Sampler& sampler)
+  {
+    uint32_t seed = tea(sampler.pixelSeed ^ samplerHash(sampler.dimension), sampler.sampleIndex);
+    sampler.dimension += 2;
+    const float x = rnd(seed);
+    const float y = rnd(seed);
+    return glm::vec2(x, y);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float luminance(const glm::vec3& color)
+  {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  BrdfSurface brdfSurface(const Surface& surface)
+  {
+    const float perceptualRoughness = glm::clamp(surface.roughness, 0.05f, 1.f);
+    return BrdfSurface{
+      surface.normal, surface.albedo, glm::clamp(surface.metallic, 0.f, 1.f), perceptualRoughness * perceptualRoughness};
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  glm::vec3 fresnelSchlick(const glm::vec3& f0, float cosTheta)
+  {
+    return f0 + (1.f - f0) * std::pow(1.f - cosTheta, 5.f);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float distributionGGX(float NdotH, float alpha)
+  {
+    const float a2 = alpha * alpha;
+    const float d = NdotH * NdotH * (a2 - 1.f) + 1.f;
+    return a2 / (PI * d * d);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float visibilitySmithGGX(float NdotL, float NdotV, float alpha)
+  {
+    const float a2 = alpha * alpha;
+    const float lambdaV = NdotL * std::sqrt(NdotV * NdotV * (1.f - a2) + a2);
+    const float lambdaL = NdotV * std::sqrt(NdotL * NdotL * (1.f - a2) + a2);
+    return 0.5f / std::max(lambdaV + lambdaL, 1e-7f);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float specularProbability(const BrdfSurface& surface, float NdotV)
+  {
+    const glm::vec3 f0 = glm::mix(glm::vec3(0.04f), surface.albedo, surface.metallic);
+    const float specular = luminance(fresnelSchlick(f0, NdotV));
+    const float diffuse = luminance(surface.albedo) * (1.f - surface.metallic);
+    return glm::clamp(specular / std::max(specular + diffuse, 1e-4f), 0.1f, 0.9f);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  glm::vec3 brdfEvaluate(const BrdfSurface& surface, const glm::vec3& view, const glm::vec3& light)
+  {
+    const float NdotL = glm::dot(surface.normal, light);
+    const float NdotV = glm::dot(surface.normal, view);
+    if (NdotL <= 0.f || NdotV <= 0.f)
+    {
+      return glm::vec3(0.f);
+    }
+    const glm::vec3 halfVector = glm::normalize(view + light);
+    const float NdotH = std::max(glm::dot(surface.normal, halfVector), 0.f);
+    const float VdotH = std::max(glm::dot(view, halfVector), 0.f);
+
+    const glm::vec3 f0 = glm::mix(glm::vec3(0.04f), surface.albedo, surface.metallic);
+    const glm::vec3 fresnel = fresnelSchlick(f0, VdotH);
+    const glm::vec3 specular =
+      fresnel * distributionGGX(NdotH, surface.alpha) * visibilitySmithGGX(NdotL, NdotV, surface.alpha);
+    const glm::vec3 diffuse = (1.f - fresnel) * (1.f - surface.metallic) * surface.albedo / PI;
+    return diffuse + specular;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  float brdfPdf(const BrdfSurface& surface, const glm::vec3& view, const glm::vec3& light)
+  {
+    const float NdotL = glm::dot(surface.normal, light);
+    const float NdotV = glm::dot(surface.normal, view);
+    if (NdotL <= 0.f || NdotV <= 0.f)
+    {
+      return 0.f;
+    }
+    const glm::vec3 halfVector = glm::normalize(view + light);
+    const float NdotH = std::max(glm::dot(surface.normal, halfVector), 0.f);
+    const float VdotH = std::max(glm::dot(view, halfVector), 1e-4f);
+
+    const float specularPdf = distributionGGX(NdotH, surface.alpha) * NdotH / (4.f * VdotH);
+    const float diffusePdf = NdotL / PI;
+    return glm::mix(diffusePdf, specularPdf, specularProbability(surface, NdotV));
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  bool brdfSample(
+    const BrdfSurface& surface,
+    const glm::vec3& view,
+    const glm::vec2& u,
+    float lobe,
+    glm::vec3& light,
+    glm::vec3& weight)
+  {
+    // Duff et al. "Building an Orthonormal Basis, Revisited"
+    const glm::vec3& n = surface.normal;
+    const float s = n.z >= 0.f ? 1.f : -1.f;
+    const float a = -1.f / (s + n.z);
+    const float b = n.x * n.y * a;
+    const glm::vec3 tangent(1.f + s * n.x * n.x * a, s * b, -s * n.x);
+    const glm::vec3 bitangent(b, s + n.y * n.y * a, -n.y);
+
+    if (lobe < specularProbability(surface, glm::dot(n, view)))
+    {
+      const float a2 = surface.alpha * surface.alpha;
+      const float phi = 2.f * PI * u.x;
+      const float cosTheta = std::sqrt((1.f - u.y) / (1.f + (a2 - 1.f) * u.y));
+      const float sinTheta = std::sqrt(std::max(1.f - cosTheta * cosTheta, 0.f));
+      const glm::vec3 halfVector =
+        glm::normalize(tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + n * cosTheta);
+      light = glm::reflect(-view, halfVector);
+    }
+    else
+    {
+      const float radius = std::sqrt(u.x);
+      const float phi = 2.f * PI * u.y;
+      light = glm::normalize(
+        tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + n * std::sqrt(std::max(1.f - u.x, 0.f)));
+    }
+
+    const float pdf = brdfPdf(surface, view, light);
+    if (pdf <= 0.f)
+    {
+      weight = glm::vec3(0.f);
+      return false;
+    }
+    weight = brdfEvaluate(surface, view, light) * glm::dot(n, light) / pdf;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Distance at which each lane enters the box, false when none of them does before its closest hit
+  template<size_t Width>
+  bool enterBounds(
+    const RayPacket<Width>& rays,
+    const std::array<glm::vec3, Width>& inverseDirections,
+    const GPUBvhNode& node,
+    float& nearest)
+  {
+    nearest = INFINITY;
+    bool isEntered = false;
+    for (uint32_t lane = 0; lane < Width; lane++)
+    {
+      const glm::vec3 origin(rays.originX[lane], rays.originY[lane], rays.originZ[lane]);
+      const glm::vec3 t0 = (node.boundsMin - origin) * inverseDirections[lane];
+      const glm::vec3 t1 = (node.boundsMax - origin) * inverseDirections[lane];
+      const glm::vec3 tNear = glm::min(t0, t1);
+      const glm::vec3 tFar = glm::max(t0, t1);
+      const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, rays.tMin[lane]));
+      const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, rays.t[lane]));
+      if (rays.isActive[lane] != 0 && enter <= exit)
+      {
+        isEntered = true;
+        nearest = std::min(nearest, enter);
+      }
+    }
+    return isEntered;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Near first traversal of a BVH, `leaf` intersects the primitives of a leaf and returns whether the traversal stops
+  template<size_t Width, typename Leaf>
+  void traverse(const std::vector<GPUBvhNode>& nodes, const RayPacket<Width>& rays, Leaf&& leaf)
+  {
+    std::array<glm::vec3, Width> inverseDirections;
+    for (uint32_t lane = 0; lane < Width; lane++)
+    {
+      const glm::vec3 direction(rays.directionX[lane], rays.directionY[lane], rays.directionZ[lane]);
+      // a zero component would make the slabs parallel to the ray NaN
+      inverseDirections[lane] =
+        1.f / glm::mix(glm::vec3(1e-20f), direction, glm::greaterThan(glm::abs(direction), glm::vec3(1e-20f)));
+    }
+
+    float rootDistance;
+    if (nodes[0].boundsMin.x > nodes[0].boundsMax.x || !enterBounds(rays, inverseDirections, nodes[0], rootDistance))
+    {
+      return;
+    }
+
+    std::array<uint32_t, STACK_SIZE> stack;
+    uint32_t stackSize = 0;
+    uint32_t index = 0;
+    while (true)
+    {
+      const GPUBvhNode& node = nodes[index];
+      if (node.count > 0)
+      {
+        if (leaf(node) || stackSize == 0)
+        {
+          return;
+        }
+        index = stack[--stackSize];
+        continue;
+      }
+
+      float nearDistance;
+      float farDistance;
+      uint32_t nearIndex = node.first;
+      uint32_t farIndex = node.first + 1;
+      bool isNearEntered = enterBounds(rays, inverseDirections, nodes[nearIndex], nearDistance);
+      bool isFarEntered = enterBounds(rays, inverseDirections, nodes[farIndex], farDistance);
+      if (isFarEntered && (!isNearEntered || farDistance < nearDistance))
+      {
+        std::swap(nearIndex, farIndex);
+        std::swap(isNearEntered, isFarEntered);
+      }
+
+      if (!isNearEntered)
+      {
+        if (stackSize == 0)
+        {
+          return;
+        }
+        index = stack[--stackSize];
+        continue;
+      }
+      if (isFarEntered)
+      {
+        assert(stackSize < STACK_SIZE);
+        stack[stackSize++] = farIndex;
+      }
+      index = nearIndex;
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Triangles of a mesh closer than the hits so far, the rays are in object space. The occlusion rays stop at the first
+  // triangle hit and leave the packet, returns true once none is left.
+  template<size_t Width>
+  bool traceMesh(
+    const vkutil::ReferenceMesh& mesh,
+    const MeshBvh& bvh,
+    uint32_t instance,
+    RayPacket<Width>& rays,
+    bool isOcclusion)
+  {
+    bool isOccluded = false;
+    traverse(
+      bvh.nodes,
+      rays,
+      [&](const GPUBvhNode& node)
+      {
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+          // Moller-Trumbore, both faces
+          const uint32_t triangle = bvh.triangles[i];
+          const glm::vec3& v0 = mesh.positions[mesh.indices[triangle * 3]];
+          const glm::vec3 edge1 = mesh.positions[mesh.indices[triangle * 3 + 1]] - v0;
+          const glm::vec3 edge2 = mesh.positions[mesh.indices[triangle * 3 + 2]] - v0;
+          for (uint32_t lane = 0; lane < Width; lane++)
+          {
+            const glm::vec3 direction(rays.directionX[lane], rays.directionY[lane], rays.directionZ[lane]);
+            const glm::vec3 p = glm::cross(direction, edge2);
+            const float determinant = glm::dot(edge1, p);
+            const float inverseDeterminant = 1.f / determinant;
+            const glm::vec3 s = glm::vec3(rays.originX[lane], rays.originY[lane], rays.originZ[lane]) - v0;
+            const float u = glm::dot(s, p) * inverseDeterminant;
+            const glm::vec3 q = glm::cross(s, edge1);
+            const float v = glm::dot(direction, q) * inverseDeterminant;
+            const float t = glm::dot(edge2, q) * inverseDeterminant;
+            if (rays.isActive[lane] != 0 && determinant != 0.f && u >= 0.f && v >= 0.f && u + v <= 1.f &&
+                t >= rays.tMin[lane] && t < rays.t[lane])
+            {
+              rays.t[lane] = t;
+              rays.u[lane] = u;
+              rays.v[lane] = v;
+              rays.instance[lane] = instance;
+              rays.triangle[lane] = triangle;
+              if (isOcclusion)
+              {
+                rays.isActive[lane] = 0;
+              }
+            }
+          }
+        }
+        isOccluded = isOcclusion && std::none_of(
+                                      rays.isActive.begin(), rays.isActive.end(), [](uint32_t active) { return active; });
+        return isOccluded;
+      });
+    return isOccluded;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Closest hits of the rays of the packet, or only whether something is hit for the occlusion rays
+  template<size_t Width> void traceScene(const SceneBvh& bvh, RayPacket<Width>& rays, bool isOcclusion)
+  {
+    traverse(
+      bvh.nodes,
+      rays,
+      [&](const GPUBvhNode& node)
+      {
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+          // the rays in the space of the mesh keep the distances of the world rays
+          const SceneInstance& instance = bvh.instances[i];
+          RayPacket<Width> objectRays = rays;
+          for (uint32_t lane = 0; lane < Width; lane++)
+          {
+            const glm::vec4 origin =
+              instance.worldToObject * glm::vec4(rays.originX[lane], rays.originY[lane], rays.originZ[lane], 1.f);
+            const glm::vec4 direction = instance.worldToObject *
+                                        glm::vec4(rays.directionX[lane], rays.directionY[lane], rays.directionZ[lane], 0.f);
+            objectRays.originX[lane] = origin.x;
+            objectRays.originY[lane] = origin.y;
+            objectRays.originZ[lane] = origin.z;
+            objectRays.directionX[lane] = direction.x;
+            objectRays.directionY[lane] = direction.y;
+            objectRays.directionZ[lane] = direction.z;
+          }
+
+          const bool isOccluded =
+            traceMesh(bvh.scene->meshes[instance.mesh], bvh.meshes[instance.mesh], i, objectRays, isOcclusion);
+          rays.t = objectRays.t;
+          rays.u = objectRays.u;
+          rays.v = objectRays.v;
+          rays.instance = objectRays.instance;
+          rays.triangle = objectRays.triangle;
+          rays.isActive = objectRays.isActive;
+          if (isOccluded)
+          {
+            return true;
+          }
+        }
+        return false;
+      });
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  template<size_t Width>
+  void setRay(
+    RayPacket<Width>& rays,
+    uint32_t lane,
+    const glm::vec3& origin,
+    float tMin,
+    const glm::vec3& direction,
+    float tMax)
+  {
+    rays.originX[lane] = origin.x;
+    rays.originY[lane] = origin.y;
+    rays.originZ[lane] = origin.z;
+    rays.directionX[lane] = direction.x;
+    rays.directionY[lane] = direction.y;
+    rays.directionZ[lane] = direction.z;
+    rays.tMin[lane] = tMin;
+    rays.t[lane] = tMax;
+    rays.instance[lane] = NO_HIT;
+    rays.isActive[lane] = 1;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Surface hit by a lane, as triangleSurface of shaders/scene.glsl
+  template<size_t Width>
+  Surface hitSurface(const SceneBvh& bvh, const RayPacket<Width>& rays, uint32_t lane, const glm::vec3& direction)
+  {
+    if (rays.instance[lane] == NO_HIT)
+    {
+      return Surface{glm::vec3(0.f), -1.f, glm::vec3(1.f), 0.f, 1.f};
+    }
+
+    const SceneInstance& instance = bvh.instances[rays.instance[lane]];
+    const vkutil::ReferenceMesh& mesh = bvh.scene->meshes[instance.mesh];
+    const uint32_t triangle = rays.triangle[lane];
+    const glm::vec3 barycentrics(1.f - rays.u[lane] - rays.v[lane], rays.u[lane], rays.v[lane]);
+    const glm::vec3 normal = mesh.normals[mesh.indices[triangle * 3]] * barycentrics.x +
+                             mesh.normals[mesh.indices[triangle * 3 + 1]] * barycentrics.y +
+                             mesh.normals[mesh.indices[triangle * 3 + 2]] * barycentrics.z;
+
+    // the normal goes to world space by the transpose of the inverse, two-sided: it faces the ray
+    glm::vec3 worldNormal = glm::normalize(glm::vec3(glm::vec4(normal, 0.f) * instance.worldToObject));
+    if (glm::dot(worldNormal, direction) > 0.f)
+    {
+      worldNormal = -worldNormal;
+    }
+
+    const GPURaytracingMaterial& material = bvh.scene->materials[mesh.materials[triangle]];
+    return Surface{
+      worldNormal,
+      rays.t[lane],
+      glm::vec3(material.colorFactors),
+      material.metalRoughFactors.x,
+      material.metalRoughFactors.y};
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Radiance of the path from the surface hit by the ray from origin along direction, as shadePath of
+  // shaders/pathtracer.glsl
+  glm::vec3 shadePath(
+    const SceneBvh& bvh,
+    const vkutil::ReferenceSettings& settings,
+    Sampler& sampler,
+    Surface surface,
+    glm::vec3 origin,
+    glm::vec3 direction,
+    uint64_t& rayCount)
+  {
+    const GPUSceneData& sceneData = bvh.scene->sceneData;
+    glm::vec3 radiance(0.f);
+    glm::vec3 throughput(1.f);
+    for (uint32_t bounce = 0;; bounce++)
+    {
+      if (surface.hitT < 0.f)
+      {
+        radiance += throughput * SKY_RADIANCE;
+        break;
+      }
+
+      const glm::vec3 position = origin + direction * surface.hitT;
+      const glm::vec3 view = -direction;
+      const BrdfSurface brdf = brdfSurface(surface);
+      const glm::vec3 rayOrigin = position + surface.normal * 1e-3f * std::max(1.f, glm::length(position));
+
+      // next event estimation of the point light
+      const glm::vec3 toLight = glm::vec3(sceneData.lightPosition) - position;
+      const float lightDistance = glm::length(toLight);
+      const glm::vec3 lightDirection = toLight / std::max(lightDistance, 1e-4f);
+      const float NdotL = glm::dot(surface.normal, lightDirection);
+      if (NdotL > 0.f && lightDistance > 1e-4f)
+      {
+        RayPacket<1> shadowRay;
+        setRay(shadowRay, 0, rayOrigin, 0.f, lightDirection, lightDistance);
+        traceScene(bvh, shadowRay, true);
+        rayCount++;
+        if (shadowRay.instance[0] == NO_HIT)
+        {
+          const glm::vec3 intensity = LIGHT_INTENSITY * sceneData.lightPower * glm::vec3(sceneData.lightColor);
+          radiance += throughput * brdfEvaluate(brdf, view, lightDirection) * NdotL * intensity /
+                      (lightDistance * lightDistance);
+        }
+      }
+
+      if (bounce + 1 >= settings.maxBounces)
+      {
+        break;
+      }
+
+      samplerStartBounce(sampler, bounce, SAMPLER_DIMENSION_BSDF);
+      const glm::vec2 u = samplerNext2D(sampler);
+      const glm::vec2 choices = samplerNext2D(sampler);
+      glm::vec3 weight;
+      if (!brdfSample(brdf, view, u, choices.x, direction, weight))
+      {
+        break;
+      }
+      throughput *= weight;
+
+      if (bounce >= settings.rouletteDepth)
+      {
+        const float survival = glm::clamp(std::max(throughput.r, std::max(throughput.g, throughput.b)), 0.05f, 0.95f);
+        if (choices.y >= survival)
+        {
+          break;
+        }
+        throughput /= survival;
+      }
+
+      origin = rayOrigin;
+      RayPacket<1> bounceRay;
+      setRay(bounceRay, 0, origin, 0.f, direction, T_MAX);
+      traceScene(bvh, bounceRay, false);
+      rayCount++;
+      surface = hitSurface(bvh, bounceRay, 0, direction);
+    }
+    return radiance;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  SceneBvh buildSceneBvh(const vkutil::ReferenceScene& scene, uint32_t threadCount)
+  {
+    SceneBvh bvh{&scene};
+    std::vector<vkutil::BvhBounds> meshBounds(scene.meshes.size());
+    for (size_t i = 0; i < scene.meshes.size(); i++)
+    {
+      const vkutil::ReferenceMesh& mesh = scene.meshes[i];
+      std::vector<vkutil::BvhBounds> triangles(mesh.indices.size() / 3);
+      for (size_t triangle = 0; triangle < triangles.size(); triangle++)
+      {
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+          triangles[triangle].grow(mesh.positions[mesh.indices[triangle * 3 + corner]]);
+        }
+        meshBounds[i].grow(triangles[triangle]);
+      }
+      MeshBvh& meshBvh = bvh.meshes.emplace_back();
+      meshBvh.nodes = vkutil::buildBvh(triangles, meshBvh.triangles, threadCount);
+    }
+
+    std::vector<SceneInstance> instances;
+    std::vector<vkutil::BvhBounds> instanceBounds;
+    for (const vkutil::ReferenceInstance& instance : scene.instances)
+    {
+      const vkutil::BvhBounds& bounds = meshBounds[instance.mesh];
+      if (bounds.isEmpty())
+      {
+        continue;
+      }
+      vkutil::BvhBounds worldBounds;
+      for (int corner = 0; corner < 8; corner++)
+      {
+        const glm::vec3 point(
+          (corner & 1) ? bounds.max.x : bounds.min.x,
+          (corner & 2) ? bounds.max.y : bounds.min.y,
+          (corner & 4) ? bounds.max.z : bounds.min.z);
+        worldBounds.grow(glm::vec3(instance.transform * glm::vec4(point, 1.f)));
+      }
+      instances.push_back({glm::inverse(instance.transform), instance.mesh});
+      instanceBounds.push_back(worldBounds);
+    }
+
+    std::vector<uint32_t> order;
+    bvh.nodes = vkutil::buildBvh(instanceBounds, order, threadCount);
+    for (uint32_t instance : order)
+    {
+      bvh.instances.push_back(instances[instance]);
+    }
+    return bvh;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Samples of the pixels of a tile, the camera rays of each quad of pixels are traced as a packet
+  void renderTile(
+    const SceneBvh& bvh,
+    const vkutil::ReferenceSettings& settings,
+    uint32_t tile,
+    std::vector<glm::vec4>& pixels,
+    uint64_t& rayCount)
+  {
+    const GPUSceneData& sceneData = bvh.scene->sceneData;
+    const glm::vec3 cameraOrigin = glm::vec3(sceneData.invView * glm::vec4(0.f, 0.f, 0.f, 1.f));
+    const glm::vec2 size(settings.width, settings.height);
+    const uint32_t tilesPerRow = (settings.width + TILE_SIZE - 1) / TILE_SIZE;
+    const uint32_t tileX = (tile % tilesPerRow) * TILE_SIZE;
+    const uint32_t tileY = (tile / tilesPerRow) * TILE_SIZE;
+
+    for (uint32_t quadY = tileY; quadY < std::min(tileY + TILE_SIZE, settings.height); quadY += 2)
+    {
+      for (uint32_t quadX = tileX; quadX < std::min(tileX + TILE_SIZE, settings.width); quadX += 2)
+      {
+        std::array<glm::vec3, PACKET_WIDTH> colors{};
+        for (uint32_t sampleIndex = 0; sampleIndex < settings.samplesPerPixel; sampleIndex++)
+        {
+          RayPacket<PACKET_WIDTH> cameraRays;
+          std::array<Sampler, PACKET_WIDTH> samplers;
+          std::array<glm::vec3, PACKET_WIDTH> directions;
+          for (uint32_t lane = 0; lane < PACKET_WIDTH; lane++)
+          {
+            const uint32_t x = quadX + (lane & 1);
+            const uint32_t y = quadY + (lane >> 1);
+            samplers[lane] = samplerInit(x, y, sampleIndex);
+
+            // cameraRayDirection of shaders/pathtracer.glsl, through a jittered position in the pixel
+            const glm::vec2 pixelPosition = glm::vec2(x, y) + samplerNext2D(samplers[lane]);
+            const glm::vec2 d = pixelPosition / size * 2.f - 1.f;
+            const glm::vec4 target = sceneData.invProj * glm::vec4(d.x, d.y, 1.f, 1.f);
+            directions[lane] = glm::vec3(sceneData.invView * glm::vec4(glm::normalize(glm::vec3(target)), 0.f));
+            setRay(cameraRays, lane, cameraOrigin, CAMERA_T_MIN, directions[lane], T_MAX);
+            cameraRays.isActive[lane] = x < settings.width && y < settings.height;
+          }
+          traceScene(bvh, cameraRays, false);
+
+          for (uint32_t lane = 0; lane < PACKET_WIDTH; lane++)
+          {
+            if (cameraRays.isActive[lane] == 0)
+            {
+              continue;
+            }
+            rayCount++;
+            const Surface surface = hitSurface(bvh, cameraRays, lane, directions[lane]);
+            colors[lane] +=
+              shadePath(bvh, settings, samplers[lane], surface, cameraOrigin, directions[lane], rayCount);
+          }
+        }
+
+        for (uint32_t lane = 0; lane < PACKET_WIDTH; lane++)
+        {
+          const uint32_t x = quadX + (lane & 1);
+          const uint32_t y = quadY + (lane >> 1);
+          if (x < settings.width && y < settings.height)
+          {
+            pixels[size_t(y) * settings.width + x] =
+              glm::vec4(colors[lane] / static_cast<float>(settings.samplesPerPixel), 1.f);
+          }
+        }
+      }
+    }
+  }
+
+  // Tiles of a thread, shared with the others once they are done with theirs
+  struct TileQueue
+  {
+    std::mutex mutex;
+    std::deque<uint32_t> tiles;
+  };
+
+  //--------------------------------------------------------------------------------------------------
+  // The next tile of the thread from the front of its queue, or stolen from the back of another one: the tiles stolen
+  // are the farthest from those their thread renders next
+  std::optional<uint32_t> nextTile(std::vector<TileQueue>& queues, uint32_t thread)
+  {
+    for (uint32_t i = 0; i < queues.size(); i++)
+    {
+      TileQueue& queue = queues[(thread + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tiles.empty())
+      {
+        continue;
+      }
+      uint32_t tile;
+      if (i == 0)
+      {
+        tile = queue.tiles.front();
+        queue.tiles.pop_front();
+      }
+      else
+      {
+        tile = queue.tiles.back();
+        queue.tiles.pop_back();
+      }
+      return tile;
+    }
+    return std::nullopt;
+  }
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+vkutil::ReferenceImage vkutil::renderReference(const ReferenceScene& scene, const ReferenceSettings& settings)
+{
+  const uint32_t threadCount =
+    settings.threadCount > 0 ? settings.threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+  ReferenceImage image{settings.width, settings.height};
+  image.pixels.resize(size_t(settings.width) * settings.height);
+
+  const auto buildStart = std::chrono::high_resolution_clock::now();
+  const SceneBvh bvh = buildSceneBvh(scene, threadCount);
+  const auto renderStart = std::chrono::high_resolution_clock::now();
+
+  // every thread starts with a band of contiguous tiles
+  const uint32_t tileCount =
+    ((settings.width + TILE_SIZE - 1) / TILE_SIZE) * ((settings.height + TILE_SIZE - 1) / TILE_SIZE);
+  std::vector<TileQueue> queues(threadCount);
+  for (uint32_t tile = 0; tile < tileCount; tile++)
+  {
+    queues[uint64_t(tile) * threadCount / tileCount].tiles.push_back(tile);
+  }
+
+  std::atomic<uint64_t> rayCount{0};
+  auto render = [&](uint32_t thread)
+  {
+    uint64_t threadRayCount = 0;
+    while (const std::optional<uint32_t> tile = nextTile(queues, thread))
+    {
+      renderTile(bvh, settings, *tile, image.pixels, threadRayCount);
+    }
+    rayCount += threadRayCount;
+  };
+  std::vector<std::thread> workers;
+  for (uint32_t thread = 1; thread < threadCount; thread++)
+  {
+    workers.emplace_back(render, thread);
+  }
+  render(0);
+  for (std::thread& worker : workers)
+  {
+    worker.join();
+  }
+
+  const auto renderEnd = std::chrono::high_resolution_clock::now();
+  image.rayCount = rayCount;
+  image.buildTime = std::chrono::duration<float, std::milli>(renderStart - buildStart).count();
+  image.renderTime = std::chrono::duration<float, std::milli>(renderEnd - renderStart).count();
+  return image;
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::saveReferenceImage(const std::filesystem::path& path, const ReferenceImage& image)
+{
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open())
+  {
+    fmt::println("Could not write the reference image {}", path.string());
+    return;
+  }
+
+  // a negative scale for little endian floats, the rows go from the bottom
+  const std::string header = fmt::format("PF\n{} {}\n-1.0\n", image.width, image.height);
+  file.write(header.data(), header.size());
+  for (uint32_t row = image.height; row-- > 0;)
+  {
+    for (uint32_t x = 0; x < image.width; x++)
+    {
+      const glm::vec4& pixel = image.pixels[size_t(row) * image.width + x];
+      file.write(reinterpret_cast<const char*>(&pixel), 3 * sizeof(float));
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <filesystem>
+#include "VkTypes.hpp"
+
+namespace vkutil
+{
+  // Full detail triangles of a mesh, in object space
+  struct ReferenceMesh
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> materials;  // of each triangle, in ReferenceScene::materials
+  };
+
+  struct ReferenceInstance
+  {
+    glm::mat4 transform;  // object to world
+    uint32_t mesh;
+  };
+
+  // What the ray traced frames see: the visible instances, the camera and the point light of the scene data
+  struct ReferenceScene
+  {
+    std::vector<ReferenceMesh> meshes;
+    std::vector<ReferenceInstance> instances;
+    std::vector<GPURaytracingMaterial> materials;
+    GPUSceneData sceneData;
+  };
+
+  struct ReferenceSettings
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint32_t maxBounces;
+    uint32_t rouletteDepth;
+    uint32_t threadCount;  // 0 for every hardware thread
+  };
+
+  struct ReferenceImage
+  {
+    uint32_t width;
+    uint32_t height;
+    std::vector<glm::vec4> pixels;  // mean radiance of the samples, rows from the top
+    uint64_t rayCount;              // camera, shadow and bounce rays
+    float buildTime;                // of the BVH, in ms
+    float renderTime;               // in ms
+  };
+
+  // Path traces the scene on the CPU with the model of the ray traced frames (shaders/pathtracer.glsl and brdf.glsl) and
+  // their SAMPLER_RANDOM sequence, as a ground truth of the GPU backends and a baseline of their rays per second. The
+  // tiles of the image are shared by the threads, which steal the tiles of the others once done with theirs, and the
+  // camera rays of each 2x2 quad of pixels traverse the BVH together.
+  ReferenceImage renderReference(const ReferenceScene& scene, const ReferenceSettings& settings);
+
+  // Portable float map, the radiance is kept as is
+  void saveReferenceImage(const std::filesystem::path& path, const ReferenceImage& image);
+}  // namespace vkutil
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include "DebugUtils.hpp"
+#include "ScratchPool.hpp"
+#include "VkEngine.hpp"
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::Raytracing::ScratchPool::ScratchPool(VkEngine* engine, VkDeviceSize budget, VkDeviceSize alignment)
+  : _budget(budget), _engine(engine), _alignment(alignment)
+{
+}
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::Raytracing::ScratchPool::~ScratchPool()
+{
+  this->release();
+}
+
+//--------------------------------------------------------------------------------------------------
+std::vector<size_t> VulkanBackend::Raytracing::ScratchPool::partition(std::span<const VkDeviceSize> scratchSizes)
+{
+  std::vector<size_t> batchEnds;
+  VkDeviceSize batchSize = 0;
+  for (size_t i = 0; i < scratchSizes.size(); i++)
+  {
+    if (batchSize > 0 && batchSize + scratchSizes[i] > _budget)
+    {
+      batchEnds.push_back(i);
+      batchSize = 0;
+    }
+    batchSize += scratchSizes[i];
+    _requestedSize += scratchSizes[i];
+  }
+
+  if (!scratchSizes.empty())
+  {
+    batchEnds.push_back(scratchSizes.size());
+  }
+  return batchEnds;
+}
+
+//--------------------------------------------------------------------------------------------------
+VkDeviceAddress VulkanBackend::Raytracing::ScratchPool::acquire(VkDeviceSize size)
+{
+  if (size > _size)
+  {
+    // the frame in flight may still build with the old buffer
+    if (_buffer.buffer != VK_NULL_HANDLE)
+    {
+      AllocatedBuffer oldBuffer = _buffer;
+      _engine->getCurrentFrame()->_deletionQueue.push([=, this]() { _engine->destroyBuffer(oldBuffer); });
+    }
+
+    // the base address of the buffer is not guaranteed to meet the scratch alignment
+    _buffer = _engine->createBuffer(
+      size + _alignment,
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      MemoryIntent::GpuOnly);
+    DebugUtils::SetObjectName(_buffer.buffer, "Acceleration structure scratch buffer", _engine->_device->getHandle());
+    _size = size;
+    _peakSize = std::max(_peakSize, size);
+
+    VkBufferDeviceAddressInfo addressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _buffer.buffer};
+    const VkDeviceAddress address = vkGetBufferDeviceAddress(_engine->_device->getHandle(), &addressInfo);
+    _address = (address + _alignment - 1) & ~(_alignment - 1);
+  }
+  return _address;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Raytracing::ScratchPool::release()
+{
+  if (_buffer.buffer != VK_NULL_HANDLE)
+  {
+    _engine->destroyBuffer(_buffer);
+  }
+  _buffer = {};
+  _size = 0;
+  _address = 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "VkTypes.hpp"
+
+//forward declaration
+class VkEngine;
+
+namespace VulkanBackend::Raytracing
+{
+  // Scratch memory of the acceleration structure builds. The builds are split in batches whose scratch fits in a budget
+  // and every batch reuses the same buffer, which is then as large as the largest batch rather than all the builds.
+  class ScratchPool
+  {
+   public:
+    ScratchPool(VkEngine* engine, VkDeviceSize budget, VkDeviceSize alignment);
+    ~ScratchPool();
+    ScratchPool(const ScratchPool&) = delete;
+    ScratchPool& operator=(const ScratchPool&) = delete;
+
+    // splits the builds in consecutive batches of at most the budget, a build larger than the budget is a batch on its
+    // own. Returns the end of every batch.
+    std::vector<size_t> partition(std::span<const VkDeviceSize> scratchSizes);
+    // aligned address of a scratch region of at least `size` bytes, the buffer grows when needed
+    VkDeviceAddress acquire(VkDeviceSize size);
+    // frees the buffer once the builds using it have executed
+    void release();
+
+    VkDeviceSize _budget;
+    VkDeviceSize _peakSize{0};       // largest buffer allocated
+    VkDeviceSize _requestedSize{0};  // scratch of every build partitioned, what a single region per build would need
+
+   private:
+    VkEngine* _engine;
+    VkDeviceSize _alignment;
+    AllocatedBuffer _buffer{};
+    VkDeviceSize _size{0};
+    VkDeviceAddress _address{0};
+  };
+}  // namespace VulkanBackend::Raytracing
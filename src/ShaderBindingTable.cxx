@@ -1,4 +1,5 @@
 #include "ShaderBindingTable.hpp"
+#include <cassert>
 #include "VkLoader.hpp"
 
 //--------------------------------------------------------------------------------------------------
@@ -9,7 +10,8 @@ VulkanBackend::Raytracing::ShaderBindingTable::ShaderBindingTable(
   const std::unique_ptr<RaytracingPipeline>& rayTracingPipeline,
   const std::vector<Entry>& rayGenPrograms,
   const std::vector<Entry>& missPrograms,
-  const std::vector<Entry>& hitGroups)
+  const std::vector<Entry>& hitGroups,
+  uint32_t sliceCount)
 {
   _raygenEntrySize = getEntrySize(rayGenPrograms, properties);
   _missEntrySize = getEntrySize(missPrograms, properties);
@@ -23,8 +25,10 @@ VulkanBackend::Raytracing::ShaderBindingTable::ShaderBindingTable(
   _missSize = missPrograms.size() * _missEntrySize;
   _hitGroupSize = hitGroups.size() * _hitGroupEntrySize;
 
-  // Compute the size of the table.
-  const size_t shaderBindingTableSize = _raygenSize + _missSize + _hitGroupSize;
+  // Compute the size of the table. The entry sizes are multiples of the base alignment, so are the slices.
+  _sliceSize = _raygenSize + _missSize + _hitGroupSize;
+  _sliceCount = sliceCount;
+  const size_t shaderBindingTableSize = _sliceSize * _sliceCount;
 
   // Allocate buffer & memory.
   VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
@@ -49,10 +53,10 @@ VulkanBackend::Raytracing::ShaderBindingTable::ShaderBindingTable(
   _missShaderAddress = _raygenShaderAddress + _missOffset;
   _closesHitShaderAddress = _raygenShaderAddress + _hitGroupOffset;
 
-  // Generate the table.
+  // Generate the table. The handles are those of the groups of the pipeline, several entries may share a group.
   const uint32_t handleSize = properties->_pipelineProperties.shaderGroupHandleSize;
-  const size_t groupCount = rayGenPrograms.size() + missPrograms.size() + hitGroups.size();
-  std::vector<uint8_t> shaderHandleStorage(groupCount * handleSize);
+  const size_t groupCount = rayTracingPipeline->_shaderGroups.size();
+  _shaderHandleStorage.resize(groupCount * handleSize);
 
   auto getRayTracingShaderGroupHandlesKHR = vkloader::loadFunction<PFN_vkGetRayTracingShaderGroupHandlesKHR>(
     device->getHandle(), "vkGetRayTracingShaderGroupHandlesKHR");
@@ -62,22 +66,49 @@ VulkanBackend::Raytracing::ShaderBindingTable::ShaderBindingTable(
     rayTracingPipeline->_handle,
     0,
     static_cast<uint32_t>(groupCount),
-    shaderHandleStorage.size(),
-    shaderHandleStorage.data()));
+    _shaderHandleStorage.size(),
+    _shaderHandleStorage.data()));
 
   // Copy the shader identifiers followed by their resource pointers or root constants:
-  // first the ray generation, then the miss shaders, and finally the set of hit groups.
+  // first the ray generation, then the miss shaders, and finally the set of hit groups, in every slice.
   void* pData;
   VK_CHECK(vmaMapMemory(allocator, _handle.allocation, &pData));
 
-  uint8_t* shaderTableData = static_cast<uint8_t*>(pData);
+  for (uint32_t slice = 0; slice < _sliceCount; slice++)
+  {
+    uint8_t* shaderTableData = static_cast<uint8_t*>(pData) + slice * _sliceSize;
+
+    shaderTableData +=
+      copyShaderData(shaderTableData, properties, rayGenPrograms, _raygenEntrySize, _shaderHandleStorage.data());
+    shaderTableData +=
+      copyShaderData(shaderTableData, properties, missPrograms, _missEntrySize, _shaderHandleStorage.data());
+    copyShaderData(shaderTableData, properties, hitGroups, _hitGroupEntrySize, _shaderHandleStorage.data());
+  }
+
+  vmaUnmapMemory(allocator, _handle.allocation);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Raytracing::ShaderBindingTable::updateHitGroups(
+  const VmaAllocator& allocator,
+  const std::unique_ptr<RaytracingProperties>& properties,
+  uint32_t slice,
+  size_t first,
+  const std::vector<Entry>& hitGroups)
+{
+  assert(slice < _sliceCount);
+  assert((first + hitGroups.size()) * _hitGroupEntrySize <= _hitGroupSize);
+  assert(getEntrySize(hitGroups, properties) <= _hitGroupEntrySize);
+
+  void* pData;
+  VK_CHECK(vmaMapMemory(allocator, _handle.allocation, &pData));
 
-  shaderTableData +=
-    copyShaderData(shaderTableData, properties, rayGenPrograms, _raygenEntrySize, shaderHandleStorage.data());
-  shaderTableData += copyShaderData(shaderTableData, properties, missPrograms, _missEntrySize, shaderHandleStorage.data());
-  copyShaderData(shaderTableData, properties, hitGroups, _hitGroupEntrySize, shaderHandleStorage.data());
+  const size_t offset = slice * _sliceSize + _hitGroupOffset + first * _hitGroupEntrySize;
+  copyShaderData(
+    static_cast<uint8_t*>(pData) + offset, properties, hitGroups, _hitGroupEntrySize, _shaderHandleStorage.data());
 
   vmaUnmapMemory(allocator, _handle.allocation);
+  VK_CHECK(vmaFlushAllocation(allocator, _handle.allocation, offset, hitGroups.size() * _hitGroupEntrySize));
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -24,8 +24,19 @@ namespace VulkanBackend
         const std::unique_ptr<RaytracingPipeline>& rayTracingPipeline,
         const std::vector<Entry>& rayGenPrograms,
         const std::vector<Entry>& missPrograms,
+        const std::vector<Entry>& hitGroups,
+        uint32_t sliceCount = 1);
+
+      // Rewrites the hit records of `slice` from `first` in place, they must be within the table and their inline data
+      // no larger than the one it was created with
+      void updateHitGroups(
+        const VmaAllocator& allocator,
+        const std::unique_ptr<RaytracingProperties>& properties,
+        uint32_t slice,
+        size_t first,
         const std::vector<Entry>& hitGroups);
 
+      // The table is repeated in `sliceCount` slices of `_sliceSize` bytes, the addresses are those of the first one
       AllocatedBuffer _handle;
       VkDeviceAddress _raygenShaderAddress;
       VkDeviceAddress _missShaderAddress;
@@ -45,6 +56,9 @@ namespace VulkanBackend
       size_t _missEntrySize;
       size_t _hitGroupEntrySize;
 
+      size_t _sliceSize;
+      uint32_t _sliceCount;
+
      private:
       size_t getEntrySize(
         const std::vector<ShaderBindingTable::Entry>& entries,
@@ -56,6 +70,8 @@ namespace VulkanBackend
         const std::vector<ShaderBindingTable::Entry>& entries,
         const size_t entrySize,
         const uint8_t* const shaderHandleStorage);
+
+      std::vector<uint8_t> _shaderHandleStorage;  // of every group of the pipeline, for the updates
     };
   }  // namespace Raytracing
 }  // namespace VulkanBackend
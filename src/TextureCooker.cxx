@@ -0,0 +1,634 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <thread>
+#include "TextureCooker.hpp"
+#include "stb_image.h"
+
+namespace
+{
+  // Bumped whenever an encoder changes so that the stale cache entries are cooked again.
+  constexpr uint32_t COOKER_VERSION = 1;
+  constexpr std::array<char, 4> COOKED_MAGIC = {'V', 'C', 'T', 'X'};
+
+  constexpr std::array<uint8_t, 12> KTX2_IDENTIFIER = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+  // Largest side of the KTX2 textures, the maxImageDimension2D every device supports
+  constexpr uint32_t KTX2_MAX_EXTENT = 16384;
+
+  // BC7 interpolation weights of 4 bit indices
+  constexpr std::array<int, 16> BC7_WEIGHTS = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  struct CookedTextureHeader
+  {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+  };
+
+  // 4x4 texels of a block, rgba
+  using Block = std::array<glm::u8vec4, 16>;
+
+  // Writes little endian bit fields the way the BC7 blocks are laid out.
+  struct BitWriter
+  {
+    uint8_t* output;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t bitCount)
+    {
+      for (uint32_t i = 0; i < bitCount; i++, position++)
+      {
+        if ((value >> i) & 1)
+        {
+          output[position >> 3] |= 1 << (position & 7);
+        }
+      }
+    }
+  };
+
+  //--------------------------------------------------------------------------------------------------
+  // Splits [0, count) in contiguous ranges processed on the hardware threads.
+  void parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& task)
+  {
+    const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 1u, std::max(count, 1u));
+    if (threadCount == 1)
+    {
+      task(0, count);
+      return;
+    }
+
+    const uint32_t rangeSize = (count + threadCount - 1) / threadCount;
+    std::vector<std::thread> workers;
+    for (uint32_t begin = 0; begin < count; begin += rangeSize)
+    {
+      workers.emplace_back(task, begin, std::min(begin + rangeSize, count));
+    }
+    for (std::thread& worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  Block fetchBlock(const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY)
+  {
+    Block block;
+    for (uint32_t y = 0; y < 4; y++)
+    {
+      for (uint32_t x = 0; x < 4; x++)
+      {
+        // the texels past the edge of the image repeat the last row or column
+        const uint32_t pixelX = std::min(blockX * 4 + x, width - 1);
+        const uint32_t pixelY = std::min(blockY * 4 + y, height - 1);
+        const uint8_t* texel = &rgba[(size_t(pixelY) * width + pixelX) * 4];
+        block[y * 4 + x] = glm::u8vec4(texel[0], texel[1], texel[2], texel[3]);
+      }
+    }
+    return block;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Box filters a rgba8 image into the next mip, odd sizes clamp to the last row or column.
+  std::vector<uint8_t> downsample(const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height)
+  {
+    const uint32_t mipWidth = std::max(width / 2, 1u);
+    const uint32_t mipHeight = std::max(height / 2, 1u);
+    std::vector<uint8_t> mip(size_t(mipWidth) * mipHeight * 4);
+
+    for (uint32_t y = 0; y < mipHeight; y++)
+    {
+      for (uint32_t x = 0; x < mipWidth; x++)
+      {
+        const uint32_t x0 = std::min(x * 2, width - 1);
+        const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+        const uint32_t y0 = std::min(y * 2, height - 1);
+        const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+        for (uint32_t c = 0; c < 4; c++)
+        {
+          const uint32_t sum = rgba[(size_t(y0) * width + x0) * 4 + c] + rgba[(size_t(y0) * width + x1) * 4 + c] +
+                               rgba[(size_t(y1) * width + x0) * 4 + c] + rgba[(size_t(y1) * width + x1) * 4 + c];
+          mip[(size_t(y) * mipWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+        }
+      }
+    }
+    return mip;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // BC4 : two 8 bit endpoints and 3 bit indices. The endpoints are the min and max of the block with max first,
+  // which selects the mode with 6 interpolated values.
+  void encodeBC4(const Block& block, uint32_t channel, uint8_t* output)
+  {
+    uint8_t minValue = 255;
+    uint8_t maxValue = 0;
+    for (const glm::u8vec4& texel : block)
+    {
+      minValue = std::min(minValue, texel[channel]);
+      maxValue = std::max(maxValue, texel[channel]);
+    }
+
+    output[0] = maxValue;
+    output[1] = minValue;
+
+    uint64_t indices = 0;
+    if (maxValue > minValue)
+    {
+      const float range = static_cast<float>(maxValue - minValue);
+      for (uint32_t i = 0; i < 16; i++)
+      {
+        // palette order : max, min, then the interpolated values going from max to min
+        const int position = static_cast<int>(std::round((maxValue - block[i][channel]) / range * 7.f));
+        const uint64_t index = position == 0 ? 0 : position == 7 ? 1 : position + 1;
+        indices |= index << (3 * i);
+      }
+    }
+
+    for (uint32_t i = 0; i < 6; i++)
+    {
+      output[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // BC7 mode 6 : a single subset with rgba 7 bit endpoints, one p bit per endpoint and 4 bit indices.
+  // The endpoints are fitted along the principal axis of the block colors.
+  void encodeBC7(const Block& block, uint8_t* output)
+  {
+    glm::vec4 mean(0.f);
+    for (const glm::u8vec4& texel : block)
+    {
+      mean += glm::vec4(texel);
+    }
+    mean /= 16.f;
+
+    glm::mat4 covariance(0.f);
+    for (const glm::u8vec4& texel : block)
+    {
+      const glm::vec4 delta = glm::vec4(texel) - mean;
+      covariance += glm::outerProduct(delta, delta);
+    }
+
+    // power iteration converges quickly towards the dominant eigenvector
+    glm::vec4 axis(1.f);
+    for (int i = 0; i < 8; i++)
+    {
+      axis = covariance * axis;
+      const float length = glm::length(axis);
+      if (length < 1e-6f)
+      {
+        axis = glm::vec4(0.f);
+        break;
+      }
+      axis /= length;
+    }
+
+    float minProjection = 0.f;
+    float maxProjection = 0.f;
+    for (const glm::u8vec4& texel : block)
+    {
+      const float projection = glm::dot(glm::vec4(texel) - mean, axis);
+      minProjection = std::min(minProjection, projection);
+      maxProjection = std::max(maxProjection, projection);
+    }
+
+    const std::array<glm::vec4, 2> endpoints = {
+      glm::clamp(mean + axis * minProjection, 0.f, 255.f), glm::clamp(mean + axis * maxProjection, 0.f, 255.f)};
+
+    // quantize each endpoint to 7 bits, keeping the p bit that reconstructs it best
+    std::array<glm::ivec4, 2> quantized;
+    std::array<uint32_t, 2> pBits;
+    std::array<glm::ivec4, 2> reconstructed;
+    for (uint32_t e = 0; e < 2; e++)
+    {
+      float bestError = std::numeric_limits<float>::max();
+      for (uint32_t p = 0; p < 2; p++)
+      {
+        const glm::ivec4 q = glm::clamp(glm::ivec4(glm::round((endpoints[e] - float(p)) / 2.f)), 0, 127);
+        const glm::ivec4 value = (q << 1) | int(p);
+        const glm::vec4 delta = glm::vec4(value) - endpoints[e];
+        const float error = glm::dot(delta, delta);
+        if (error < bestError)
+        {
+          bestError = error;
+          quantized[e] = q;
+          pBits[e] = p;
+          reconstructed[e] = value;
+        }
+      }
+    }
+
+    std::array<glm::ivec4, 16> palette;
+    for (uint32_t i = 0; i < 16; i++)
+    {
+      palette[i] = ((64 - BC7_WEIGHTS[i]) * reconstructed[0] + BC7_WEIGHTS[i] * reconstructed[1] + 32) >> 6;
+    }
+
+    std::array<uint32_t, 16> indices;
+    for (uint32_t t = 0; t < 16; t++)
+    {
+      int bestError = std::numeric_limits<int>::max();
+      for (uint32_t i = 0; i < 16; i++)
+      {
+        const glm::ivec4 delta = palette[i] - glm::ivec4(block[t]);
+        const int error = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z + delta.w * delta.w;
+        if (error < bestError)
+        {
+          bestError = error;
+          indices[t] = i;
+        }
+      }
+    }
+
+    // the index of the first texel is stored without its high bit, swapping the endpoints clears it
+    if (indices[0] >= 8)
+    {
+      std::swap(quantized[0], quantized[1]);
+      std::swap(pBits[0], pBits[1]);
+      for (uint32_t& index : indices)
+      {
+        index = 15 - index;
+      }
+    }
+
+    std::fill(output, output + 16, 0);
+    BitWriter writer{output};
+    writer.write(1 << 6, 7);  // mode 6
+    for (uint32_t c = 0; c < 4; c++)
+    {
+      writer.write(quantized[0][c], 7);
+      writer.write(quantized[1][c], 7);
+    }
+    writer.write(pBits[0], 1);
+    writer.write(pBits[1], 1);
+    writer.write(indices[0], 3);
+    for (uint32_t t = 1; t < 16; t++)
+    {
+      writer.write(indices[t], 4);
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Bytes of a 4x4 block of the formats the cooker writes, 0 for the others
+  uint32_t blockSizeOf(VkFormat format)
+  {
+    switch (format)
+    {
+      case VK_FORMAT_BC7_UNORM_BLOCK:
+      case VK_FORMAT_BC5_UNORM_BLOCK: return 16;
+      case VK_FORMAT_BC4_UNORM_BLOCK: return 8;
+      default: return 0;
+    }
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Bytes of the blocks of a level of the mip chain of a texture
+  uint64_t mipByteSize(uint32_t width, uint32_t height, uint32_t mip, uint32_t blockSize)
+  {
+    const uint64_t mipWidth = std::max(width >> mip, 1u);
+    const uint64_t mipHeight = std::max(height >> mip, 1u);
+    return ((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * blockSize;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Bytes of a level of a KTX2 texture, 0 for the formats it is not expected to hold: the cooked BC formats, and rgba8
+  // for the devices without block compression
+  uint64_t ktx2LevelByteSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mip)
+  {
+    if (format == VK_FORMAT_R8G8B8A8_UNORM)
+    {
+      return uint64_t(std::max(width >> mip, 1u)) * std::max(height >> mip, 1u) * 4;
+    }
+    const uint32_t blockSize = blockSizeOf(format);
+    return blockSize == 0 ? 0 : mipByteSize(width, height, mip, blockSize);
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  uint64_t hashBytes(std::span<const std::byte> bytes)
+  {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (std::byte b : bytes)
+    {
+      hash ^= static_cast<uint64_t>(b);
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  //--------------------------------------------------------------------------------------------------
+  // Texels of a png or jpg file, 4 channels whatever the file holds.
+  std::optional<vkutil::DecodedImage> decodeRgba8(std::span<const std::byte> encodedImage)
+  {
+    int width, height, nrChannels;
+    unsigned char* data = stbi_load_from_memory(
+      reinterpret_cast<const stbi_uc*>(encodedImage.data()),
+      static_cast<int>(encodedImage.size()),
+      &width,
+      &height,
+      &nrChannels,
+      4);
+    if (!data)
+    {
+      return {};
+    }
+
+    vkutil::DecodedImage image;
+    image.extent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1};
+    const std::byte* texels = reinterpret_cast<const std::byte*>(data);
+    image.texels.assign(texels, texels + size_t(width) * height * 4);
+    stbi_image_free(data);
+    return image;
+  }
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::CookedTexture> vkutil::loadTexture(std::span<const std::byte> encodedImage, TextureUsage usage)
+{
+  if (isKtx2(encodedImage))
+  {
+    return loadKtx2(encodedImage);
+  }
+
+  const std::filesystem::path cachePath = cookedTexturePath(encodedImage, usage);
+  if (std::optional<CookedTexture> cached = loadCookedTexture(cachePath))
+  {
+    return cached;
+  }
+
+  std::optional<DecodedImage> image = decodeRgba8(encodedImage);
+  if (!image.has_value())
+  {
+    return {};
+  }
+
+  CookedTexture texture = cookTexture(
+    reinterpret_cast<const uint8_t*>(image->texels.data()), image->extent.width, image->extent.height, usage);
+
+  saveCookedTexture(cachePath, texture);
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::DecodedImage> vkutil::decodeImage(std::span<const std::byte> encodedImage)
+{
+  if (isKtx2(encodedImage))
+  {
+    std::optional<CookedTexture> texture = loadKtx2(encodedImage);
+    if (!texture.has_value() || texture->format != VK_FORMAT_R8G8B8A8_UNORM)
+    {
+      return {};
+    }
+    return DecodedImage{texture->extent, std::move(texture->mips[0])};
+  }
+
+  return decodeRgba8(encodedImage);
+}
+
+//--------------------------------------------------------------------------------------------------
+vkutil::CookedTexture vkutil::cookTexture(const uint8_t* rgba, uint32_t width, uint32_t height, TextureUsage usage)
+{
+  CookedTexture texture;
+  texture.extent = {width, height, 1};
+
+  switch (usage)
+  {
+    case TextureUsage::Color: texture.format = VK_FORMAT_BC7_UNORM_BLOCK; break;
+    case TextureUsage::Normal: texture.format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+    case TextureUsage::SingleChannel: texture.format = VK_FORMAT_BC4_UNORM_BLOCK; break;
+  }
+  const uint32_t blockSize = blockSizeOf(texture.format);
+
+  const uint32_t mipCount = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+  std::vector<uint8_t> level(rgba, rgba + size_t(width) * height * 4);
+
+  for (uint32_t mip = 0; mip < mipCount; mip++)
+  {
+    const uint32_t blockCountX = (width + 3) / 4;
+    const uint32_t blockCountY = (height + 3) / 4;
+    std::vector<std::byte>& blocks = texture.mips.emplace_back(size_t(blockCountX) * blockCountY * blockSize);
+
+    // rows of blocks are independent, spread them over the worker threads
+    parallelFor(
+      blockCountY,
+      [&](uint32_t beginRow, uint32_t endRow)
+      {
+        for (uint32_t blockY = beginRow; blockY < endRow; blockY++)
+        {
+          for (uint32_t blockX = 0; blockX < blockCountX; blockX++)
+          {
+            const Block block = fetchBlock(level, width, height, blockX, blockY);
+            uint8_t* output = reinterpret_cast<uint8_t*>(blocks.data()) + (size_t(blockY) * blockCountX + blockX) * blockSize;
+            switch (usage)
+            {
+              case TextureUsage::Color: encodeBC7(block, output); break;
+              case TextureUsage::Normal:
+                encodeBC4(block, 0, output);
+                encodeBC4(block, 1, output + 8);
+                break;
+              case TextureUsage::SingleChannel: encodeBC4(block, 0, output); break;
+            }
+          }
+        }
+      });
+
+    if (mip + 1 < mipCount)
+    {
+      level = downsample(level, width, height);
+      width = std::max(width / 2, 1u);
+      height = std::max(height / 2, 1u);
+    }
+  }
+
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool vkutil::isKtx2(std::span<const std::byte> data)
+{
+  return data.size() >= KTX2_IDENTIFIER.size() &&
+         std::memcmp(data.data(), KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size()) == 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::CookedTexture> vkutil::loadKtx2(std::span<const std::byte> data)
+{
+  // identifier, header and index, the level index follows
+  constexpr size_t headerSize = 80;
+  constexpr size_t levelIndexEntrySize = 24;
+  if (!isKtx2(data) || data.size() < headerSize)
+  {
+    return {};
+  }
+
+  auto read32 = [&](size_t offset)
+  {
+    uint32_t value;
+    std::memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+  };
+  auto read64 = [&](size_t offset)
+  {
+    uint64_t value;
+    std::memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+  };
+
+  const uint32_t vkFormat = read32(12);
+  const uint32_t pixelWidth = read32(20);
+  const uint32_t pixelHeight = std::max(read32(24), 1u);
+  const uint32_t pixelDepth = read32(28);
+  const uint32_t layerCount = read32(32);
+  const uint32_t faceCount = read32(36);
+  const uint32_t levelCount = std::max(read32(40), 1u);
+  const uint32_t supercompressionScheme = read32(44);
+
+  // Basis Universal files (ETC1S is supercompressed, UASTC has no vkFormat) need a transcoder
+  if (vkFormat == VK_FORMAT_UNDEFINED || supercompressionScheme != 0)
+  {
+    fmt::println("KTX2 Basis textures are not supported, transcode them to a BC format when cooking");
+    return {};
+  }
+  if (pixelDepth > 1 || layerCount > 1 || faceCount != 1)
+  {
+    fmt::println("Only 2D KTX2 textures are supported");
+    return {};
+  }
+
+  // The image is created and uploaded from the header and the level index: they are checked against the file rather
+  // than trusted with the sizes of the allocations and of the copies
+  const VkFormat format = static_cast<VkFormat>(vkFormat);
+  if (ktx2LevelByteSize(format, 1, 1, 0) == 0)
+  {
+    fmt::println("KTX2 format {} is not supported, only BC4, BC5, BC7 and rgba8 textures are", string_VkFormat(format));
+    return {};
+  }
+  const uint32_t fullMipCount = static_cast<uint32_t>(std::floor(std::log2(std::max(pixelWidth, pixelHeight)))) + 1;
+  if (pixelWidth == 0 || pixelWidth > KTX2_MAX_EXTENT || pixelHeight > KTX2_MAX_EXTENT || levelCount > fullMipCount)
+  {
+    return {};
+  }
+  if (data.size() < headerSize + levelCount * levelIndexEntrySize)
+  {
+    return {};
+  }
+
+  CookedTexture texture;
+  texture.format = format;
+  texture.extent = {pixelWidth, pixelHeight, 1};
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    const size_t entry = headerSize + level * levelIndexEntrySize;
+    const uint64_t byteOffset = read64(entry);
+    const uint64_t byteLength = read64(entry + 8);
+    // written so that a huge offset or length cannot wrap around
+    if (byteLength != ktx2LevelByteSize(format, pixelWidth, pixelHeight, level) || byteOffset > data.size() ||
+        byteLength > data.size() - byteOffset)
+    {
+      return {};
+    }
+    texture.mips.emplace_back(data.begin() + byteOffset, data.begin() + byteOffset + byteLength);
+  }
+
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+std::filesystem::path vkutil::cookedTexturePath(std::span<const std::byte> encodedImage, TextureUsage usage)
+{
+  return COOKED_TEXTURE_CACHE /
+         fmt::format("{:016x}_{}.vct", hashBytes(encodedImage), static_cast<uint32_t>(usage));
+}
+
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::CookedTexture> vkutil::loadCookedTexture(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+  {
+    return {};
+  }
+
+  CookedTextureHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || header.magic != COOKED_MAGIC || header.version != COOKER_VERSION)
+  {
+    return {};
+  }
+
+  // A corrupt or stale file is cooked again rather than trusted with the sizes of the allocations and of the upload
+  const VkFormat format = static_cast<VkFormat>(header.format);
+  const uint32_t blockSize = blockSizeOf(format);
+  if (blockSize == 0 || header.width == 0 || header.height == 0 || header.mipCount == 0 ||
+      header.mipCount > static_cast<uint32_t>(std::floor(std::log2(std::max(header.width, header.height)))) + 1)
+  {
+    return {};
+  }
+
+  std::vector<uint64_t> mipSizes(header.mipCount);
+  file.read(reinterpret_cast<char*>(mipSizes.data()), mipSizes.size() * sizeof(uint64_t));
+  if (!file)
+  {
+    return {};
+  }
+  for (uint32_t mip = 0; mip < header.mipCount; mip++)
+  {
+    if (mipSizes[mip] != mipByteSize(header.width, header.height, mip, blockSize))
+    {
+      return {};
+    }
+  }
+
+  CookedTexture texture;
+  texture.format = format;
+  texture.extent = {header.width, header.height, 1};
+  for (uint64_t mipSize : mipSizes)
+  {
+    std::vector<std::byte>& mip = texture.mips.emplace_back(mipSize);
+    file.read(reinterpret_cast<char*>(mip.data()), mipSize);
+  }
+
+  if (!file)
+  {
+    return {};
+  }
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+void vkutil::saveCookedTexture(const std::filesystem::path& path, const CookedTexture& texture)
+{
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open())
+  {
+    fmt::println("Could not write the cooked texture {}", path.string());
+    return;
+  }
+
+  CookedTextureHeader header;
+  header.magic = COOKED_MAGIC;
+  header.version = COOKER_VERSION;
+  header.format = texture.format;
+  header.width = texture.extent.width;
+  header.height = texture.extent.height;
+  header.mipCount = static_cast<uint32_t>(texture.mips.size());
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (const std::vector<std::byte>& mip : texture.mips)
+  {
+    const uint64_t mipSize = mip.size();
+    file.write(reinterpret_cast<const char*>(&mipSize), sizeof(mipSize));
+  }
+  for (const std::vector<std::byte>& mip : texture.mips)
+  {
+    file.write(reinterpret_cast<const char*>(mip.data()), mip.size());
+  }
+}
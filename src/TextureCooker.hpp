@@ -0,0 +1,51 @@
+#pragma once
+#include <filesystem>
+#include "VkTypes.hpp"
+
+namespace vkutil
+{
+  // What a texture is sampled for, decides the block compression format it is cooked to.
+  enum class TextureUsage : uint8_t
+  {
+    Color,          // BC7, also used for packed maps such as metal-roughness
+    Normal,         // BC5, only the X and Y components are kept
+    SingleChannel,  // BC4, red channel only (occlusion)
+  };
+
+  // Block compressed (or raw) texture with its full mip chain, mips[0] is the largest level.
+  struct CookedTexture
+  {
+    VkFormat format;
+    VkExtent3D extent;
+    std::vector<std::vector<std::byte>> mips;
+  };
+
+  // Uncompressed rgba8 texels of the largest level of an image.
+  struct DecodedImage
+  {
+    VkExtent3D extent;
+    std::vector<std::byte> texels;
+  };
+
+  // Folder where the cooked textures are cached, relative to the executable like the assets.
+  const std::filesystem::path COOKED_TEXTURE_CACHE = "../cache/textures";
+
+  // Turns an encoded image file (png, jpg or ktx2) into an uploadable texture.
+  // KTX2 files are used as is, other images are cooked once and then read back from the disk cache.
+  std::optional<CookedTexture> loadTexture(std::span<const std::byte> encodedImage, TextureUsage usage);
+
+  // Turns an encoded image file into rgba8 texels, for the devices without block compression. KTX2 files are only read
+  // when they hold rgba8 texels.
+  std::optional<DecodedImage> decodeImage(std::span<const std::byte> encodedImage);
+
+  // Generates the mip chain of a rgba8 image and block compresses every mip on worker threads.
+  CookedTexture cookTexture(const uint8_t* rgba, uint32_t width, uint32_t height, TextureUsage usage);
+
+  // Reads the levels of a KTX2 container, supercompressed (Basis) files are rejected.
+  std::optional<CookedTexture> loadKtx2(std::span<const std::byte> data);
+  bool isKtx2(std::span<const std::byte> data);
+
+  std::filesystem::path cookedTexturePath(std::span<const std::byte> encodedImage, TextureUsage usage);
+  std::optional<CookedTexture> loadCookedTexture(const std::filesystem::path& path);
+  void saveCookedTexture(const std::filesystem::path& path, const CookedTexture& texture);
+}  // namespace vkutil
@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "TextureStreamer.hpp"
+#include "VkEngine.hpp"
+#include "VkImages.hpp"
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::TextureStreamer::TextureStreamer(VkEngine* engine) : _engine(engine)
+{
+  _worker = std::thread(&TextureStreamer::runWorker, this);
+}
+
+//--------------------------------------------------------------------------------------------------
+VulkanBackend::TextureStreamer::~TextureStreamer()
+{
+  {
+    std::lock_guard lock(_mutex);
+    _isStopping = true;
+  }
+  _condition.notify_all();
+  _worker.join();
+
+  // the queued uploads never got a staging buffer
+  for (Upload& upload : _preparedUploads)
+  {
+    _engine->destroyBuffer(upload.staging);
+  }
+
+  for (std::optional<StreamedTexture>& texture : _textures)
+  {
+    if (texture.has_value())
+    {
+      _engine->destroyImage(texture->image->_handle);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+uint32_t VulkanBackend::TextureStreamer::addTexture(vkutil::CookedTexture&& texture)
+{
+  StreamedTexture streamed;
+  streamed.source = std::make_shared<const vkutil::CookedTexture>(std::move(texture));
+  const vkutil::CookedTexture& source = *streamed.source;
+
+  // first mip small enough to stay resident, or the smallest one the source has
+  const uint32_t lastMip = static_cast<uint32_t>(source.mips.size()) - 1;
+  uint32_t baseMip = 0;
+  while (baseMip < lastMip && std::max(source.extent.width, source.extent.height) >> baseMip > STREAMING_RESIDENT_SIZE)
+  {
+    baseMip++;
+  }
+  streamed.baseMip = baseMip;
+  streamed.residentMip = baseMip;
+  streamed.wantedMip = baseMip;
+
+  std::vector<std::span<const std::byte>> mipLevels(source.mips.begin() + baseMip, source.mips.end());
+  VkExtent3D extent = {std::max(source.extent.width >> baseMip, 1u), std::max(source.extent.height >> baseMip, 1u), 1};
+  _engine->createImage(streamed.image, mipLevels, extent, source.format, VK_IMAGE_USAGE_SAMPLED_BIT);
+
+  _stats.textureCount++;
+  _stats.residentBytes += residentSize(source, baseMip);
+
+  _textures.push_back(std::move(streamed));
+  return static_cast<uint32_t>(_textures.size() - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::removeTexture(uint32_t texture)
+{
+  std::optional<StreamedTexture>& streamed = _textures.at(texture);
+  if (!streamed.has_value())
+  {
+    return;
+  }
+
+  // an upload still in flight is dropped when it comes back
+  _engine->destroyImage(streamed->image->_handle);
+  _stats.textureCount--;
+  _stats.residentBytes -= residentSize(*streamed->source, streamed->residentMip);
+  streamed.reset();
+}
+
+//--------------------------------------------------------------------------------------------------
+AllocatedImage VulkanBackend::TextureStreamer::getImage(uint32_t texture) const
+{
+  return _textures.at(texture)->image->_handle;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::addBinding(
+  uint32_t texture,
+  const std::array<VkDescriptorSet, FRAME_OVERLAP>& sets,
+  uint32_t binding,
+  VkSampler sampler)
+{
+  _textures.at(texture)->bindings.push_back({sets, binding, sampler});
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::requestTextures(std::span<const TextureRequest> requests, uint32_t frameNumber)
+{
+  // finest mip wanted by every texture seen this frame
+  std::unordered_map<uint32_t, uint32_t> wantedMips;
+  for (const TextureRequest& request : requests)
+  {
+    std::optional<StreamedTexture>& streamed = _textures.at(request.texture);
+    if (!streamed.has_value())
+    {
+      continue;
+    }
+
+    // about one texel per pixel, every halving of the size on screen drops a mip
+    const vkutil::CookedTexture& source = *streamed->source;
+    const float ratio =
+      static_cast<float>(std::max(source.extent.width, source.extent.height)) / std::max(request.screenSize, 1.f);
+    const uint32_t mip = std::min(ratio > 1.f ? static_cast<uint32_t>(std::log2(ratio)) : 0u, streamed->baseMip);
+
+    auto [wanted, isInserted] = wantedMips.try_emplace(request.texture, mip);
+    if (!isInserted)
+    {
+      wanted->second = std::min(wanted->second, mip);
+    }
+  }
+
+  for (auto& [texture, mip] : wantedMips)
+  {
+    StreamedTexture& streamed = *_textures[texture];
+    streamed.lastRequestFrame = frameNumber;
+    streamed.wantedMip = mip;
+
+    // growing a texture under memory pressure would only get it evicted again
+    if (mip < streamed.residentMip && !streamed.isPending && !_isOverBudget)
+    {
+      queueUpload(texture, mip);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::update(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue, uint32_t frameNumber)
+{
+  this->updateBudget(frameNumber);
+
+  const VkDeviceSize limit = static_cast<VkDeviceSize>(_stats.budget * STREAMING_BUDGET_THRESHOLD);
+  _isOverBudget = _stats.usage > limit;
+  if (_isOverBudget)
+  {
+    this->evictTextures(frameNumber, _stats.usage - limit);
+  }
+
+  std::vector<Upload> uploads;
+  {
+    std::lock_guard lock(_mutex);
+    while (!_preparedUploads.empty() && uploads.size() < MAX_STREAMING_UPLOADS_PER_FRAME)
+    {
+      uploads.push_back(std::move(_preparedUploads.front()));
+      _preparedUploads.pop_front();
+    }
+    _stats.pendingUploads = static_cast<uint32_t>(_queuedUploads.size() + _preparedUploads.size());
+  }
+
+  // the fence of this slot was waited, its sets can follow the images swapped in by the other frames
+  const uint32_t slot = frameNumber % FRAME_OVERLAP;
+  this->updateStaleBindings(slot);
+
+  _stats.uploadsLastFrame = 0;
+  for (Upload& upload : uploads)
+  {
+    this->applyUpload(cmd, frameDeletionQueue, upload, slot);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::queueUpload(uint32_t texture, uint32_t mip)
+{
+  StreamedTexture& streamed = *_textures[texture];
+  streamed.isPending = true;
+
+  {
+    std::lock_guard lock(_mutex);
+    _queuedUploads.push_back({texture, mip, streamed.source});
+  }
+  _condition.notify_one();
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::prepareUpload(Upload& upload)
+{
+  const vkutil::CookedTexture& source = *upload.source;
+
+  // buffer offsets of a copy must be a multiple of the texel block size, 16 covers every format
+  constexpr size_t mipAlignment = 16;
+  std::vector<size_t> offsets;
+  size_t dataSize = 0;
+  for (uint32_t mip = upload.mip; mip < source.mips.size(); mip++)
+  {
+    offsets.push_back(dataSize);
+    dataSize += (source.mips[mip].size() + mipAlignment - 1) & ~(mipAlignment - 1);
+  }
+
+  // VMA is internally synchronized, the worker can allocate while the main thread renders
+  upload.staging = _engine->createBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryIntent::Upload);
+
+  for (uint32_t mip = upload.mip; mip < source.mips.size(); mip++)
+  {
+    const uint32_t level = mip - upload.mip;
+    memcpy((char*)upload.staging.info.pMappedData + offsets[level], source.mips[mip].data(), source.mips[mip].size());
+
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = offsets[level];
+    copyRegion.bufferRowLength = 0;
+    copyRegion.bufferImageHeight = 0;
+
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = level;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = {std::max(source.extent.width >> mip, 1u), std::max(source.extent.height >> mip, 1u), 1};
+    upload.regions.push_back(copyRegion);
+  }
+  _engine->flushBuffer(upload.staging);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::applyUpload(
+  VkCommandBuffer cmd,
+  DeletionQueue& frameDeletionQueue,
+  Upload& upload,
+  uint32_t slot)
+{
+  // the staging buffer is read by the copies of this frame
+  AllocatedBuffer staging = upload.staging;
+  frameDeletionQueue.push([=, this]() { _engine->destroyBuffer(staging); });
+
+  std::optional<StreamedTexture>& streamed = _textures[upload.texture];
+  if (!streamed.has_value())
+  {
+    return;
+  }
+  streamed->isPending = false;
+
+  // the budget may have run out since the request
+  if (upload.mip == streamed->residentMip || (upload.mip < streamed->residentMip && _isOverBudget))
+  {
+    return;
+  }
+
+  const vkutil::CookedTexture& source = *streamed->source;
+  const VkExtent3D extent = {
+    std::max(source.extent.width >> upload.mip, 1u), std::max(source.extent.height >> upload.mip, 1u), 1};
+  const uint32_t mipLevels = static_cast<uint32_t>(source.mips.size()) - upload.mip;
+
+  std::unique_ptr<Image> image = std::make_unique<Image>(
+    _engine->_device,
+    extent,
+    source.format,
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    _engine->_allocator,
+    true,
+    mipLevels);
+
+  vkutil::transitionImage(cmd, image->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  vkCmdCopyBufferToImage(
+    cmd,
+    staging.buffer,
+    image->_handle.image,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    upload.regions.size(),
+    upload.regions.data());
+  vkutil::transitionImage(
+    cmd, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  // The old image goes with the resources of this frame: the other frames in flight may still sample it through
+  // their sets, which only follow the new image once their own fence was waited
+  AllocatedImage oldImage = streamed->image->_handle;
+  frameDeletionQueue.push([=, this]() { _engine->destroyImage(oldImage); });
+
+  _stats.residentBytes -= residentSize(source, streamed->residentMip);
+  _stats.residentBytes += residentSize(source, upload.mip);
+  _stats.uploadsLastFrame++;
+
+  streamed->image = std::move(image);
+  streamed->residentMip = upload.mip;
+
+  // no draw of this frame is recorded yet, its sets can be rewritten right away
+  this->writeBindings(*streamed, slot);
+  if (streamed->staleSlots == 0)
+  {
+    _staleTextures.push_back(upload.texture);
+  }
+  streamed->staleSlots = ((1u << FRAME_OVERLAP) - 1) & ~(1u << slot);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::writeBindings(const StreamedTexture& streamed, uint32_t slot)
+{
+  for (const Binding& binding : streamed.bindings)
+  {
+    DescriptorWriter writer;
+    writer.writeImage(
+      binding.binding,
+      streamed.image->_handle.imageView,
+      binding.sampler,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.updateSet(_engine->_device->getHandle(), binding.sets[slot]);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::updateStaleBindings(uint32_t slot)
+{
+  std::erase_if(
+    _staleTextures,
+    [&](uint32_t texture)
+    {
+      std::optional<StreamedTexture>& streamed = _textures[texture];
+      // a removed texture has no set left to draw with
+      if (!streamed.has_value())
+      {
+        return true;
+      }
+      if (streamed->staleSlots & (1u << slot))
+      {
+        this->writeBindings(*streamed, slot);
+        streamed->staleSlots &= ~(1u << slot);
+      }
+      return streamed->staleSlots == 0;
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::evictTextures(uint32_t frameNumber, VkDeviceSize excess)
+{
+  // textures holding more than they need: unseen for a while they go back to their resident mips, otherwise to the
+  // mip they were last requested at
+  std::vector<std::pair<uint32_t, uint32_t>> candidates;
+  for (uint32_t texture = 0; texture < _textures.size(); texture++)
+  {
+    const std::optional<StreamedTexture>& streamed = _textures[texture];
+    if (!streamed.has_value() || streamed->isPending || streamed->residentMip == streamed->baseMip)
+    {
+      continue;
+    }
+
+    const bool isStale = frameNumber - streamed->lastRequestFrame > STREAMING_EVICTION_DELAY;
+    const uint32_t mip = isStale ? streamed->baseMip : streamed->wantedMip;
+    if (mip > streamed->residentMip)
+    {
+      candidates.push_back({texture, mip});
+    }
+  }
+
+  // least recently used first
+  std::sort(
+    candidates.begin(),
+    candidates.end(),
+    [&](const auto& a, const auto& b)
+    { return _textures[a.first]->lastRequestFrame < _textures[b.first]->lastRequestFrame; });
+
+  VkDeviceSize freed = 0;
+  for (auto& [texture, mip] : candidates)
+  {
+    if (freed >= excess)
+    {
+      break;
+    }
+
+    const StreamedTexture& streamed = *_textures[texture];
+    freed += residentSize(*streamed.source, streamed.residentMip) - residentSize(*streamed.source, mip);
+    this->queueUpload(texture, mip);
+    _stats.evictions++;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::updateBudget(uint32_t frameNumber)
+{
+  // the budget of VK_EXT_memory_budget is only fetched again when the frame index changes
+  vmaSetCurrentFrameIndex(_engine->_allocator, frameNumber);
+
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+  vmaGetHeapBudgets(_engine->_allocator, budgets);
+
+  const VkPhysicalDeviceMemoryProperties* memoryProperties;
+  vmaGetMemoryProperties(_engine->_allocator, &memoryProperties);
+
+  _stats.budget = 0;
+  _stats.usage = 0;
+  for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++)
+  {
+    if (memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+    {
+      _stats.budget += budgets[heap].budget;
+      _stats.usage += budgets[heap].usage;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::TextureStreamer::runWorker()
+{
+  while (true)
+  {
+    Upload upload;
+    {
+      std::unique_lock lock(_mutex);
+      _condition.wait(lock, [this]() { return _isStopping || !_queuedUploads.empty(); });
+      if (_isStopping)
+      {
+        return;
+      }
+      upload = std::move(_queuedUploads.front());
+      _queuedUploads.pop_front();
+    }
+
+    this->prepareUpload(upload);
+
+    std::lock_guard lock(_mutex);
+    _preparedUploads.push_back(std::move(upload));
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+VkDeviceSize VulkanBackend::TextureStreamer::residentSize(const vkutil::CookedTexture& source, uint32_t mip)
+{
+  VkDeviceSize size = 0;
+  for (size_t level = mip; level < source.mips.size(); level++)
+  {
+    size += source.mips[level].size();
+  }
+  return size;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "Image.hpp"
+#include "TextureCooker.hpp"
+#include "VkDescriptors.hpp"
+#include "VkTypes.hpp"
+
+//forward declaration
+class VkEngine;
+
+namespace VulkanBackend
+{
+  // Mips up to this size are uploaded when a texture is added and never evicted
+  constexpr uint32_t STREAMING_RESIDENT_SIZE = 64;
+  // Residency changes applied per frame, spreads the copies of a freshly loaded scene over several frames
+  constexpr uint32_t MAX_STREAMING_UPLOADS_PER_FRAME = 4;
+  // Fraction of the device local budget above which textures stop growing and the least recently used shrink
+  constexpr float STREAMING_BUDGET_THRESHOLD = 0.9f;
+  // Frames without any request after which a texture falls back to its resident mips under memory pressure
+  constexpr uint32_t STREAMING_EVICTION_DELAY = 60;
+
+  // Size in pixels covered on screen this frame by a surface sampling the texture
+  struct TextureRequest
+  {
+    uint32_t texture;
+    float screenSize;
+  };
+
+  struct StreamingStats
+  {
+    uint32_t textureCount = 0;
+    uint32_t pendingUploads = 0;
+    uint32_t uploadsLastFrame = 0;
+    uint32_t evictions = 0;
+    VkDeviceSize residentBytes = 0;
+    // device local heaps, reported by VK_EXT_memory_budget when the device has it
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+  };
+
+  // Keeps the top mips of the textures on the GPU only while they are seen close enough to need them.
+  // The cooked mip chains stay in system memory; changing the residency of a texture builds a new image holding the
+  // mips from the wanted level down, filled by a worker thread and copied at the start of a frame, then swapped into
+  // the descriptor sets sampling it.
+  class TextureStreamer
+  {
+   public:
+    TextureStreamer(VkEngine* engine);
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // uploads the low mips right away and returns the id used by the other calls
+    uint32_t addTexture(vkutil::CookedTexture&& texture);
+    void removeTexture(uint32_t texture);
+    AllocatedImage getImage(uint32_t texture) const;
+    // the combined image sampler at `binding` of the sets of every frame follows the residency changes of the texture
+    void addBinding(
+      uint32_t texture, const std::array<VkDescriptorSet, FRAME_OVERLAP>& sets, uint32_t binding, VkSampler sampler);
+
+    void requestTextures(std::span<const TextureRequest> requests, uint32_t frameNumber);
+    // records the finished uploads, must run before the draws of the frame are recorded
+    void update(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue, uint32_t frameNumber);
+
+    StreamingStats _stats;
+
+   private:
+    struct Binding
+    {
+      std::array<VkDescriptorSet, FRAME_OVERLAP> sets;
+      uint32_t binding;
+      VkSampler sampler;
+    };
+
+    struct StreamedTexture
+    {
+      std::shared_ptr<const vkutil::CookedTexture> source;
+      std::unique_ptr<Image> image;
+      uint32_t residentMip;  // first mip of the source held by the image
+      uint32_t baseMip;      // first mip always kept resident
+      uint32_t wantedMip;    // finest mip requested during the last frame it was seen
+      uint32_t lastRequestFrame = 0;
+      bool isPending = false;
+      uint32_t staleSlots = 0;  // frames in flight whose sets still sample a replaced image, one bit per slot
+      std::vector<Binding> bindings;
+    };
+
+    // mips [mip, mipCount) of a texture packed in a staging buffer
+    struct Upload
+    {
+      uint32_t texture;
+      uint32_t mip;
+      std::shared_ptr<const vkutil::CookedTexture> source;
+      AllocatedBuffer staging;
+      std::vector<VkBufferImageCopy> regions;
+    };
+
+    void queueUpload(uint32_t texture, uint32_t mip);
+    void prepareUpload(Upload& upload);
+    void applyUpload(VkCommandBuffer cmd, DeletionQueue& frameDeletionQueue, Upload& upload, uint32_t slot);
+    void writeBindings(const StreamedTexture& streamed, uint32_t slot);
+    void updateStaleBindings(uint32_t slot);
+    void evictTextures(uint32_t frameNumber, VkDeviceSize excess);
+    void updateBudget(uint32_t frameNumber);
+    void runWorker();
+    static VkDeviceSize residentSize(const vkutil::CookedTexture& source, uint32_t mip);
+
+    VkEngine* _engine;
+    std::vector<std::optional<StreamedTexture>> _textures;  // indexed by id, empty once removed
+    std::vector<uint32_t> _staleTextures;                   // textures with a stale slot
+    bool _isOverBudget = false;
+
+    // shared with the worker thread
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<Upload> _queuedUploads;    // waiting for their staging buffer
+    std::deque<Upload> _preparedUploads;  // waiting for a frame to copy them
+    bool _isStopping = false;
+    std::thread _worker;
+  };
+}  // namespace VulkanBackend
@@ -1,3 +1,4 @@
+#include <glm/matrix.hpp>
 #include "TopLevelAccelerationStructure.hpp"
 #include "VkLoader.hpp"
 
@@ -24,7 +25,8 @@ VulkanBackend::Raytracing::TopLevelAccelerationStructure::TopLevelAccelerationSt
   _topASGeometry.geometry.instances = _instances;
 
   _buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-  _buildGeometryInfo.flags = _flags;
+  // the transforms of the instances change every frame, they are refitted rather than rebuilt
+  _buildGeometryInfo.flags = _flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
   _buildGeometryInfo.geometryCount = 1;
   _buildGeometryInfo.pGeometries = &_topASGeometry;
   _buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -40,27 +42,38 @@ VulkanBackend::Raytracing::TopLevelAccelerationStructure::TopLevelAccelerationSt
 void VulkanBackend::Raytracing::TopLevelAccelerationStructure::Generate(
   std::unique_ptr<Device>& device,
   VkCommandBuffer commandBuffer,
-  AllocatedBuffer& scratchBuffer,
-  const VkDeviceSize scratchOffset,
+  VkDeviceAddress scratchAddress,
   AllocatedBuffer& resultBuffer,
   const VkDeviceSize resultOffset)
 {
   // Create the acceleration structure.
-  createAccelerationStructure(device, resultBuffer, resultOffset);
+  createAccelerationStructure(device, resultBuffer, resultOffset, _buildSizesInfo.accelerationStructureSize);
+  Build(device, commandBuffer, _instances.data.deviceAddress, scratchAddress, false);
+}
 
-  // Build the actual bottom-level acceleration structure
+//--------------------------------------------------------------------------------------------------
+void VulkanBackend::Raytracing::TopLevelAccelerationStructure::Build(
+  std::unique_ptr<Device>& device,
+  VkCommandBuffer commandBuffer,
+  VkDeviceAddress instanceAddress,
+  VkDeviceAddress scratchAddress,
+  bool isUpdate)
+{
   VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo = {};
   buildOffsetInfo.primitiveCount = _instancesCount;
 
   const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
 
+  // the structure may have moved since its construction, along with its geometry
+  _instances.data.deviceAddress = instanceAddress;
+  _topASGeometry.geometry.instances = _instances;
+  _buildGeometryInfo.pGeometries = &_topASGeometry;
+
+  _buildGeometryInfo.mode = isUpdate ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+                                     : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+  _buildGeometryInfo.srcAccelerationStructure = isUpdate ? _handle : VK_NULL_HANDLE;
   _buildGeometryInfo.dstAccelerationStructure = _handle;
-  VkBufferDeviceAddressInfo info = {};
-  info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-  info.pNext = nullptr;
-  info.buffer = scratchBuffer.buffer;
-  VkDeviceAddress scratchBufferAdress = vkGetBufferDeviceAddress(device->getHandle(), &info);
-  _buildGeometryInfo.scratchData.deviceAddress = scratchBufferAdress + scratchOffset;
+  _buildGeometryInfo.scratchData.deviceAddress = scratchAddress;
   auto cmdBuildAccelerationStructuresKHR = vkloader::loadFunction<PFN_vkCmdBuildAccelerationStructuresKHR>(
     device->getHandle(), "vkCmdBuildAccelerationStructuresKHR");
   cmdBuildAccelerationStructuresKHR(commandBuffer, 1, &_buildGeometryInfo, &pBuildOffsetInfo);
@@ -75,13 +88,17 @@ VkAccelerationStructureInstanceKHR VulkanBackend::Raytracing::TopLevelAccelerati
   const uint32_t hitGroupId,
   const uint32_t mask)
 {
-  VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
-  addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-  addressInfo.accelerationStructure = bottomLevelAs._handle;
-  auto getAccelerationStructureDeviceAddressKHR = vkloader::loadFunction<PFN_vkGetAccelerationStructureDeviceAddressKHR>(
-    device->getHandle(), "vkGetAccelerationStructureDeviceAddressKHR");
-  const VkDeviceAddress address = getAccelerationStructureDeviceAddressKHR(device->getHandle(), &addressInfo);
+  return CreateInstance(GetDeviceAddress(device, bottomLevelAs), transform, instanceId, hitGroupId, mask);
+}
 
+//--------------------------------------------------------------------------------------------------
+VkAccelerationStructureInstanceKHR VulkanBackend::Raytracing::TopLevelAccelerationStructure::CreateInstance(
+  VkDeviceAddress bottomLevelAddress,
+  const glm::mat4& transform,
+  const uint32_t instanceId,
+  const uint32_t hitGroupId,
+  const uint32_t mask)
+{
   VkAccelerationStructureInstanceKHR instance = {};
   instance.instanceCustomIndex = instanceId;
   instance.mask = mask;
@@ -89,12 +106,26 @@ VkAccelerationStructureInstanceKHR VulkanBackend::Raytracing::TopLevelAccelerati
     hitGroupId;  // Set the hit group index, that will be used to find the shader code to execute when hitting the geometry.
   instance.flags =
     VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;  // Disable culling - more fine control could be provided by the application
-  instance.accelerationStructureReference = address;
+  instance.accelerationStructureReference = bottomLevelAddress;
 
-  // The instance.transform value only contains 12 values, corresponding to a 4x3 matrix,
+  // The instance.transform value only contains 12 values, corresponding to a row-major 3x4 matrix,
   // hence saving the last row that is anyway always (0,0,0,1).
-  // Since the matrix is row-major, we simply copy the first 12 values of the original 4x4 matrix
-  std::memcpy(&instance.transform, &transform, sizeof(instance.transform));
+  // glm matrices are column-major, the first 12 values of the transposed matrix are the 3 first rows.
+  const glm::mat4 rowMajorTransform = glm::transpose(transform);
+  std::memcpy(&instance.transform, &rowMajorTransform, sizeof(instance.transform));
 
   return instance;
 }
+
+//--------------------------------------------------------------------------------------------------
+VkDeviceAddress VulkanBackend::Raytracing::TopLevelAccelerationStructure::GetDeviceAddress(
+  std::unique_ptr<Device>& device,
+  const AccelerationStructure& structure)
+{
+  VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
+  addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+  addressInfo.accelerationStructure = structure._handle;
+  auto getAccelerationStructureDeviceAddressKHR = vkloader::loadFunction<PFN_vkGetAccelerationStructureDeviceAddressKHR>(
+    device->getHandle(), "vkGetAccelerationStructureDeviceAddressKHR");
+  return getAccelerationStructureDeviceAddressKHR(device->getHandle(), &addressInfo);
+}
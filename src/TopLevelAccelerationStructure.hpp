@@ -17,10 +17,17 @@ namespace VulkanBackend::Raytracing
     void Generate(
       std::unique_ptr<Device>& device,
       VkCommandBuffer commandBuffer,
-      AllocatedBuffer& scratchBuffer,
-      const VkDeviceSize scratchOffset,
+      VkDeviceAddress scratchAddress,
       AllocatedBuffer& resultBuffer,
       const VkDeviceSize resultOffset);
+    // Records the build of the created structure from the instances at `instanceAddress`. An update refits the previous
+    // build in place and only needs the update scratch size, the instance count must not have changed.
+    void Build(
+      std::unique_ptr<Device>& device,
+      VkCommandBuffer commandBuffer,
+      VkDeviceAddress instanceAddress,
+      VkDeviceAddress scratchAddress,
+      bool isUpdate);
     static VkAccelerationStructureInstanceKHR CreateInstance(
       std::unique_ptr<Device>& device,
       BottomLevelAccelerationStructure& bottomLevelAs,
@@ -28,6 +35,18 @@ namespace VulkanBackend::Raytracing
       const uint32_t instanceId,
       const uint32_t hitGroupId,
       const uint32_t mask);
+    static VkAccelerationStructureInstanceKHR CreateInstance(
+      VkDeviceAddress bottomLevelAddress,
+      const glm::mat4& transform,
+      const uint32_t instanceId,
+      const uint32_t hitGroupId,
+      const uint32_t mask);
+    static VkDeviceAddress GetDeviceAddress(std::unique_ptr<Device>& device, const AccelerationStructure& structure);
+    uint32_t instancesCount() const
+    {
+      return _instancesCount;
+    }
+
    private:
     uint32_t _instancesCount;
     VkAccelerationStructureGeometryInstancesDataKHR _instances{};
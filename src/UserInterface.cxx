@@ -4,6 +4,7 @@
 #include <imgui_impl_sdl2.h>
 #include <imgui_impl_vulkan.h>
 #endif
+#include <algorithm>
 #include "UserInterface.hpp"
 #include "VkEngine.hpp"
 
@@ -97,6 +98,11 @@ void UserInterface::display(VkEngine* engine)
   displaySceneSelector(engine);
   displayLighting(engine);
   displayRenderingModeSelector(engine);
+  displayLevelOfDetail(engine);
+  displayCulling(engine);
+  displayTextureStreaming(engine);
+  displayGeometryArenas(engine);
+  displayMemoryIntents(engine);
 
   ImGui::Render();
 }
@@ -143,6 +149,49 @@ void UserInterface::displaySceneSelector(VkEngine* engine)
     }
     ImGui::EndCombo();
   }
+
+  // the selected scene is drawn and traced, the others stay loaded with their instances masked out
+  if (ImGui::BeginCombo("Loaded scenes", engine->_selectedSceneName.c_str()))
+  {
+    for (const auto& [name, scene] : engine->_loadedScenes)
+    {
+      const bool isSelected = name == engine->_selectedSceneName;
+      if (ImGui::Selectable(name.c_str(), isSelected))
+      {
+        engine->_selectedSceneName = name;
+      }
+    }
+    ImGui::EndCombo();
+  }
+  if (!engine->_selectedSceneName.empty() && ImGui::Button("Unload scene"))
+  {
+    engine->removeScene(engine->_selectedSceneName);
+  }
+
+  // the glTF files of the assets, a file loaded again replaces its scene
+  if (ImGui::TreeNode("Load scene"))
+  {
+    std::error_code error;
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(ASSETS_PATH, error))
+    {
+      const std::filesystem::path extension = entry.path().extension();
+      if (extension == ".glb" || extension == ".gltf")
+      {
+        files.push_back(entry.path());
+      }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const std::filesystem::path& file : files)
+    {
+      if (ImGui::Button(file.filename().string().c_str()))
+      {
+        engine->loadScene(file);
+      }
+    }
+    ImGui::TreePop();
+  }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -171,6 +220,230 @@ void UserInterface::displayRenderingModeSelector(VkEngine* engine)
   if (ImGui::Begin("Rendering Mode Selector"))
   {
     ImGui::Checkbox("Raytracing", (bool*)&engine->_isRaytracingEnabled);
+    // a few samples per frame filtered over space and time, instead of an accumulation until convergence
+    if (ImGui::Checkbox("Denoiser", &engine->_isDenoiserEnabled))
+    {
+      engine->_denoiser->reset();
+      engine->resetFrame();
+    }
+    // rasterized primary visibility, only the shadow and secondary rays are traced
+    if (ImGui::Checkbox("Hybrid", &engine->_isHybridEnabled))
+    {
+      engine->_denoiser->reset();
+      engine->resetFrame();
+    }
+    if (engine->isSoftwareRaytracing())
+    {
+      ImGui::Text("No ray tracing device, software BVH traversal");
+    }
+    // both backends run the same path tracer, the accumulation goes on with the other one
+    const bool isRayQuerySupported = engine->_rayQueryPipeline != nullptr;
+    ImGui::BeginDisabled(!isRayQuerySupported || engine->_backendBenchmark.isRunning);
+    const char* backends[RAYTRACING_BACKEND_COUNT] = {"Ray tracing pipeline", "Ray query"};
+    ImGui::Combo("Backend", &engine->_raytracingBackend, backends, RAYTRACING_BACKEND_COUNT);
+    if (ImGui::Button("Benchmark backends"))
+    {
+      engine->startBackendBenchmark();
+    }
+    ImGui::EndDisabled();
+    const BackendBenchmark& benchmark = engine->_backendBenchmark;
+    if (benchmark.isRunning)
+    {
+      ImGui::Text(
+        "Benchmarking, %u/%u frames",
+        std::min(
+          benchmark.frameCount[RAYTRACING_BACKEND_PIPELINE], benchmark.frameCount[RAYTRACING_BACKEND_RAY_QUERY]),
+        BACKEND_BENCHMARK_FRAMES);
+    }
+    else if (benchmark.averageMs[RAYTRACING_BACKEND_PIPELINE] > 0.f)
+    {
+      ImGui::Text(
+        "Pipeline %.3f ms, ray query %.3f ms",
+        benchmark.averageMs[RAYTRACING_BACKEND_PIPELINE],
+        benchmark.averageMs[RAYTRACING_BACKEND_RAY_QUERY]);
+    }
+    ImGui::Text("Trace %.3f ms", engine->_stats.traceTime);
+    // ground truth of the backends, blocks the frames until it is done
+    ImGui::SliderInt("Reference samples", &engine->_referenceSamples, 1, 1024);
+    if (ImGui::Button("Render CPU reference"))
+    {
+      engine->renderReference();
+    }
+    const vkutil::ReferenceImage& reference = engine->_referenceImage;
+    if (reference.renderTime > 0.f)
+    {
+      ImGui::Text(
+        "Reference %.1f ms (BVH %.1f ms), %.2f Mrays/s",
+        reference.renderTime,
+        reference.buildTime,
+        reference.rayCount / (reference.renderTime * 1000.f));
+    }
+    // a new threshold or sampling rate starts a new accumulation
+    const char* samplerTypes[SAMPLER_TYPE_COUNT] = {"Random", "Sobol", "Rank-1 lattice", "Blue noise"};
+    bool hasSamplingChanged = ImGui::Combo("Sampler", &engine->_rtSamplerType, samplerTypes, SAMPLER_TYPE_COUNT);
+    hasSamplingChanged |= ImGui::SliderFloat("Error threshold", &engine->_rtErrorThreshold, 0.001f, 0.2f, "%.3f");
+    hasSamplingChanged |= ImGui::SliderInt("Min samples", &engine->_rtMinSamples, 2, 256);
+    hasSamplingChanged |= ImGui::SliderInt("Samples per frame", &engine->_rtSamplesPerFrame, 1, 32);
+    hasSamplingChanged |= ImGui::SliderInt("Max bounces", &engine->_rtMaxBounces, 1, 16);
+    hasSamplingChanged |= ImGui::SliderInt("Russian roulette after", &engine->_rtRouletteDepth, 1, 16);
+    if (hasSamplingChanged)
+    {
+      engine->resetFrame();
+    }
+    if (!engine->_isDenoiserEnabled)
+    {
+      if (engine->_isRaytracingConverged)
+      {
+        ImGui::Text("Converged in %.1f ms", engine->_stats.convergenceTime);
+      }
+      else
+      {
+        ImGui::Text("%u pixels still sampled", engine->_activePixelCount);
+      }
+      ImGui::Text("%.1f Mrays/s (primary)", engine->_stats.raysPerSecond / 1000000.f);
+    }
+    ImGui::Text(
+      "BLAS memory %.2f MiB, %.2f MiB before compaction",
+      static_cast<float>(engine->_bottomCompactedSize) / (1024.f * 1024.f),
+      static_cast<float>(engine->_bottomBuildSize) / (1024.f * 1024.f));
+    ImGui::Text(
+      "%zu BLAS for %zu TLAS instances", engine->_bottomLevelCache.size(), engine->_topInstances.size());
+    // the procedural primitives are only seen by the rays
+    for (const std::shared_ptr<ProceduralAsset>& asset : engine->_proceduralAssets)
+    {
+      ImGui::Checkbox(asset->name.c_str(), &asset->isVisible);
+      ImGui::SameLine();
+      ImGui::Text("%u procedural primitives", asset->primitiveCount);
+    }
+    if (engine->_scratchPool)
+    {
+      ImGui::Text(
+        "AS scratch peak %.2f MiB for %.2f MiB of BLAS builds",
+        static_cast<float>(engine->_scratchPool->_peakSize) / (1024.f * 1024.f),
+        static_cast<float>(engine->_scratchPool->_requestedSize) / (1024.f * 1024.f));
+      ImGui::Checkbox("Refit TLAS", &engine->_isTopRefitEnabled);
+    }
+    ImGui::Text(
+      "TLAS %u rebuilds, %u refits, %f ms",
+      engine->_topRebuildCount,
+      engine->_topRefitCount,
+      engine->_stats.accelerationStructureTime);
+  }
+  ImGui::End();
+}
+
+//--------------------------------------------------------------------------------------------------
+void UserInterface::displayLevelOfDetail(VkEngine* engine)
+{
+  if (ImGui::Begin("Level of detail"))
+  {
+    ImGui::Checkbox("Enable LOD", &engine->_isLodEnabled);
+    ImGui::SliderFloat("Max screen error (px)", &engine->_lodThreshold, 0.1f, 16.f);
+  }
+  ImGui::End();
+}
+
+//--------------------------------------------------------------------------------------------------
+void UserInterface::displayCulling(VkEngine* engine)
+{
+  if (ImGui::Begin("Culling"))
+  {
+    ImGui::Checkbox("GPU meshlet culling", &engine->_isMeshletCullingEnabled);
+    ImGui::Checkbox("Backface cone culling", &engine->_isMeshletConeCullingEnabled);
+  }
+  ImGui::End();
+}
+
+//--------------------------------------------------------------------------------------------------
+void UserInterface::displayTextureStreaming(VkEngine* engine)
+{
+  if (ImGui::Begin("Texture streaming"))
+  {
+    const StreamingStats& stats = engine->_textureStreamer->_stats;
+    constexpr float mebibyte = 1024.f * 1024.f;
+    ImGui::Text("textures %u", stats.textureCount);
+    ImGui::Text("resident %.1f MiB", stats.residentBytes / mebibyte);
+    ImGui::Text("pending uploads %u", stats.pendingUploads);
+    ImGui::Text("uploads last frame %u", stats.uploadsLastFrame);
+    ImGui::Text("evictions %u", stats.evictions);
+    ImGui::Text("device memory %.1f / %.1f MiB", stats.usage / mebibyte, stats.budget / mebibyte);
+    ImGui::ProgressBar(stats.budget > 0 ? static_cast<float>(stats.usage) / stats.budget : 0.f);
+  }
+  ImGui::End();
+}
+
+//--------------------------------------------------------------------------------------------------
+void UserInterface::displayGeometryArenas(VkEngine* engine)
+{
+  if (ImGui::Begin("Geometry"))
+  {
+    ImGui::Checkbox("Indirect draws", &engine->_isIndirectDrawEnabled);
+
+    for (GeometryArena* arena : {engine->_vertexArena.get(), engine->_indexArena.get()})
+    {
+      const vkutil::OffsetAllocatorReport report = arena->report();
+      ImGui::Separator();
+      ImGui::Text(arena == engine->_vertexArena.get() ? "vertices" : "indices");
+      ImGui::Text("ranges %u", report.allocationCount);
+      ImGui::Text("used %u / %u", arena->_capacity - report.totalFree, arena->_capacity);
+      ImGui::Text("largest free range %u", report.largestFree);
+    }
+
+    // compacting keeps the capacity, the arenas only grow when an allocation fails
+    if (ImGui::Button("Defragment"))
+    {
+      engine->_vertexArena->defragment(engine->_vertexArena->_capacity);
+      engine->_indexArena->defragment(engine->_indexArena->_capacity);
+    }
+  }
+  ImGui::End();
+}
+
+//--------------------------------------------------------------------------------------------------
+void UserInterface::displayMemoryIntents(VkEngine* engine)
+{
+  if (ImGui::Begin("Buffer memory"))
+  {
+    ImGui::Text(engine->_isUnifiedMemory ? "unified memory" : "dedicated memory");
+    if (engine->_directWriteHeap)
+    {
+      // only applies to the buffers created afterwards and to the writes of the mapped ones
+      ImGui::Checkbox("Write static data in place", &engine->_isDirectWriteEnabled);
+    }
+    else
+    {
+      ImGui::Text("no host visible device local heap, static data goes through transfers");
+    }
+
+    if (ImGui::Button("Benchmark uploads"))
+    {
+      engine->_uploadBenchmark = engine->benchmarkUploads(64 * 1024 * 1024, 8);
+    }
+    const UploadBenchmark& benchmark = engine->_uploadBenchmark;
+    if (benchmark.size > 0)
+    {
+      ImGui::Text("%llu MiB staged %.2f ms", static_cast<unsigned long long>(benchmark.size >> 20), benchmark.stagedMs);
+      if (benchmark.isDirectAvailable)
+      {
+        ImGui::Text("%llu MiB in place %.2f ms", static_cast<unsigned long long>(benchmark.size >> 20), benchmark.directMs);
+      }
+    }
+
+    constexpr const char* intentNames[] = {"gpu only", "upload", "readback", "dynamic", "static"};
+    const auto report = engine->memoryReport();
+    for (size_t intent = 0; intent < report.size(); intent++)
+    {
+      // in MiB, a single buffer of a few bytes still shows up in the count
+      const auto toMiB = [](VkDeviceSize bytes) { return static_cast<float>(bytes) / (1024.f * 1024.f); };
+      const MemoryIntentReport& intentReport = report[intent];
+      ImGui::Separator();
+      ImGui::Text("%s: %u buffers", intentNames[intent], intentReport.bufferCount);
+      ImGui::Text("device local %.2f MiB", toMiB(intentReport.bytes[static_cast<size_t>(MemoryPlacement::DeviceLocal)]));
+      ImGui::Text(
+        "device local, host visible %.2f MiB",
+        toMiB(intentReport.bytes[static_cast<size_t>(MemoryPlacement::DeviceLocalHostVisible)]));
+      ImGui::Text("host visible %.2f MiB", toMiB(intentReport.bytes[static_cast<size_t>(MemoryPlacement::HostVisible)]));
+    }
   }
   ImGui::End();
 }
@@ -21,4 +21,9 @@ static class UserInterface
   static void displaySceneSelector(VkEngine* engine);
   static void displayLighting(VkEngine* engine);
   static void displayRenderingModeSelector(VkEngine* engine);
+  static void displayLevelOfDetail(VkEngine* engine);
+  static void displayCulling(VkEngine* engine);
+  static void displayTextureStreaming(VkEngine* engine);
+  static void displayGeometryArenas(VkEngine* engine);
+  static void displayMemoryIntents(VkEngine* engine);
 };
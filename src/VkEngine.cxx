@@ -12,14 +12,19 @@
 #include <SDL2/SDL_vulkan.h>
 #endif
 #include <vma/vk_mem_alloc.h>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
 #include <glm/packing.hpp>
+#include <random>
 #include <set>
 #include <thread>
+#include "BlueNoise.hpp"
 #include "DebugUtils.hpp"
 #include "PipelineLayout.hpp"
 #include "SingleTimeCommand.hpp"
@@ -79,6 +84,25 @@ bool is_visible(const RenderObject& obj, const glm::mat4& viewproj)
   }
 }
 
+// the normal cones of the meshlets keep their angle under rotations and uniform scales only
+bool has_uniform_scale(const glm::mat4& transform)
+{
+  // the columns of the upper 3x3 are orthogonal and of the same length
+  const glm::mat3 gram = glm::transpose(glm::mat3(transform)) * glm::mat3(transform);
+  const float squaredScale = (gram[0][0] + gram[1][1] + gram[2][2]) / 3.f;
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      if (std::abs(gram[i][j] - (i == j ? squaredScale : 0.f)) > 1e-3f * squaredScale)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 template<class TAccelerationStructure> VkAccelerationStructureBuildSizesInfoKHR GetTotalRequirements(
   const std::vector<TAccelerationStructure>& accelerationStructures)
 {
@@ -109,6 +133,10 @@ VkEngine::~VkEngine()
 //--------------------------------------------------------------------------------------------------
 void VkEngine::init()
 {
+  // only one engine initialization is allowed with the application.
+  assert(loadedEngine == nullptr);
+  loadedEngine = this;
+
   // We initialize SDL and create a window with it.
   _window = std::make_unique<Window>(_windowExtent);
 
@@ -122,22 +150,18 @@ void VkEngine::init()
   this->initDefaultData();
   this->initRaytracingDescriptors();
   this->initRaytracingPipeline();
+  this->initComputeTracePipelines();
   this->initShaderBindingTable();
   this->initAccelerationStructures();
-  this->updateRaytracingDescriptors();
+  for (uint32_t slot = 0; slot < FRAME_OVERLAP; slot++)
+  {
+    this->updateRaytracingDescriptors(slot);
+  }
   this->initMainCamera();
   this->initLight();
 
   //everything went fine
   _isInitialized = true;
-
-  std::string structurePath = {"../assets/structure.glb"};
-  /*auto structureFile = vkloader::loadGltf(this, structurePath);
-
-  assert(structureFile.has_value());
-
-  _loadedScenes["structure"] = *structureFile;
-  */
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -162,12 +186,33 @@ void VkEngine::cleanup()
 
       _frames[i]->_deletionQueue.flush();
     }
+    // the draw buffers they retired are gone, only the current ones are left
+    if (_objectCapacity > 0)
+    {
+      destroyBuffer(_objectBuffer);
+    }
+    if (_drawCommandCapacity > 0)
+    {
+      destroyBuffer(_drawCommandBuffer);
+    }
+
+    // the scenes gave their textures back, the streamer only holds its own resources now
+    _textureStreamer.reset();
+    _denoiser.reset();
+    _geometryBuffer.reset();
 
     for (auto& mesh : _testMeshes)
     {
-      destroyBuffer(mesh->meshBuffers.indexBuffer);
-      destroyBuffer(mesh->meshBuffers.vertexBuffer);
+      freeMesh(mesh->meshBuffers);
+      if (mesh->meshletBuffers.meshletCount > 0)
+      {
+        destroyBuffer(mesh->meshletBuffers.meshletBuffer);
+        destroyBuffer(mesh->meshletBuffers.meshletIndexBuffer);
+      }
     }
+    _vertexArena.reset();
+    _indexArena.reset();
+    _scratchPool.reset();
 
     _metalRoughMaterial.clearResources(_device->getHandle());
 
@@ -193,15 +238,16 @@ void VkEngine::cleanup()
 //--------------------------------------------------------------------------------------------------
 void VkEngine::draw()
 {
-  //wait until the gpu has finished rendering the last frame. Timeout of 1 second
+  //wait until the gpu has finished rendering the frame recorded last in this slot. Timeout of 1 second. It was
+  //already waited at the end of the previous draw, unless nothing was submitted since
   VK_CHECK(vkWaitForFences(_device->getHandle(), 1, &this->getCurrentFrame()->_renderFence->_handle, true, 1000000000));
   if (_isRaytracingEnabled != _isPreviousFrameRT)
   {
     this->resetFrame();
   }
+  this->updateBackendBenchmark();
   this->updateFrame();
 
-  this->getCurrentFrame()->_deletionQueue.flush();
   this->getCurrentFrame()->_frameDescriptors.clearPools(_device->getHandle());
   //request image from the swapchain
   uint32_t swapchainImageIndex;
@@ -236,6 +282,9 @@ void VkEngine::draw()
 
   VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+  // swap in the streamed mips before any draw samples them
+  _textureStreamer->update(cmd, this->getCurrentFrame()->_deletionQueue, _frameNumber);
+
   // transition our main draw image into general layout so we can write into it
   // we will overwrite it all so we dont care about what was the older layout
   vkutil::transitionImage(cmd, _drawImage->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
@@ -281,6 +330,24 @@ void VkEngine::draw()
     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
+  // the active pixel counter of this frame is read by the host once its fence is waited, see
+  // updateRaytracingConvergence
+  if (_isRaytracingEnabled)
+  {
+    VkMemoryBarrier2 hostBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    hostBarrier.srcStageMask = this->isSoftwareRaytracing()
+                                 ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+                                 : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
+    hostBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+    hostBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+    VkDependencyInfo dependencyInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &hostBarrier;
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  }
+
   //finalize the command buffer (we can no longer add commands, but it can now be executed)
   VK_CHECK(vkEndCommandBuffer(cmd));
 
@@ -332,17 +399,134 @@ void VkEngine::draw()
   presentInfo.pNext = &presentFenceInfo;
 
   VkResult presentResult = vkQueuePresentKHR(_device->getGraphicsQueue(), &presentInfo);
-  if (e == VK_ERROR_OUT_OF_DATE_KHR)
+  if (presentResult == VK_ERROR_OUT_OF_DATE_KHR)
   {
     _resize_requested = true;
-    return;
   }
-  VK_CHECK(vkWaitForFences(_device->getHandle(), 1, &(this->getCurrentFrame()->_presentFence->_handle), true, 9999999999));
+  else
+  {
+    VK_CHECK(
+      vkWaitForFences(_device->getHandle(), 1, &(this->getCurrentFrame()->_presentFence->_handle), true, 9999999999));
+  }
+
+  // The next frame records in the other slot. Its fence is the one of the frame submitted FRAME_OVERLAP ago, once it
+  // is waited the resources that frame retired are released; from the UI on, the next frame retires into this queue.
+  _frameNumber++;
+  VK_CHECK(vkWaitForFences(_device->getHandle(), 1, &this->getCurrentFrame()->_renderFence->_handle, true, 1000000000));
+  this->getCurrentFrame()->_deletionQueue.flush();
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::drawIndirect()
+void VkEngine::drawIndirect(
+  VkCommandBuffer cmd,
+  const std::vector<uint32_t>& opaqueDraws,
+  const GPUDrawPushConstants& pushConstants,
+  MaterialPipeline* pipelineOverride)
 {
+  // Every surface lives in the geometry arenas, so the only state left between two surfaces is the material: the
+  // sorted draws are issued as one multi draw indirect per material. The meshlet culled surfaces keep the command
+  // written by the culling pass, which indexes the compacted index buffer.
+  std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+  drawCommands.reserve(opaqueDraws.size());
+  for (uint32_t i : opaqueDraws)
+  {
+    const RenderObject& r = _mainDrawContext.OpaqueSurfaces[i];
+    if (r.indirectDrawIndex < 0)
+    {
+      drawCommands.push_back({r.indexCount, 1, r.firstIndex, r.vertexOffset, i});
+    }
+  }
+
+  // the buffer only grows, the frame in flight may still draw from the old one
+  const uint32_t drawCount = static_cast<uint32_t>(drawCommands.size());
+  VkDeviceSize drawCommandOffset = 0;
+  if (drawCount > 0)
+  {
+    if (drawCount > _drawCommandCapacity)
+    {
+      if (_drawCommandCapacity > 0)
+      {
+        AllocatedBuffer oldBuffer = _drawCommandBuffer;
+        this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+      }
+
+      _drawCommandCapacity = std::max(drawCount, _drawCommandCapacity * 2);
+      _drawCommandBuffer = this->createBuffer(
+        FRAME_OVERLAP * _drawCommandCapacity * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        MemoryIntent::Dynamic);
+      DebugUtils::SetObjectName(_drawCommandBuffer.buffer, "Draw commands", _device->getHandle());
+    }
+
+    drawCommandOffset = (_frameNumber % FRAME_OVERLAP) * _drawCommandCapacity * sizeof(VkDrawIndexedIndirectCommand);
+    memcpy(
+      (char*)_drawCommandBuffer.info.pMappedData + drawCommandOffset,
+      drawCommands.data(),
+      drawCount * sizeof(VkDrawIndexedIndirectCommand));
+    VK_CHECK(vmaFlushAllocation(
+      _allocator, _drawCommandBuffer.allocation, drawCommandOffset, drawCount * sizeof(VkDrawIndexedIndirectCommand)));
+  }
+
+  MaterialPipeline* lastPipeline = nullptr;
+  VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+  auto bindIndexBuffer = [&](VkBuffer indexBuffer)
+  {
+    if (indexBuffer != lastIndexBuffer)
+    {
+      lastIndexBuffer = indexBuffer;
+      vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+  };
+
+  uint32_t firstCommand = 0;
+  for (size_t begin = 0; begin < opaqueDraws.size();)
+  {
+    MaterialInstance* material = _mainDrawContext.OpaqueSurfaces[opaqueDraws[begin]].material;
+    this->bindMaterial(cmd, material, lastPipeline, pushConstants, pipelineOverride);
+
+    uint32_t commandCount = 0;
+    size_t end = begin;
+    for (; end < opaqueDraws.size() && _mainDrawContext.OpaqueSurfaces[opaqueDraws[end]].material == material; end++)
+    {
+      const RenderObject& r = _mainDrawContext.OpaqueSurfaces[opaqueDraws[end]];
+      _stats.triangleCount += r.indexCount / 3;
+      if (r.indirectDrawIndex < 0)
+      {
+        commandCount++;
+      }
+    }
+
+    if (commandCount > 0)
+    {
+      bindIndexBuffer(_indexArena->_buffer.buffer);
+      vkCmdDrawIndexedIndirect(
+        cmd,
+        _drawCommandBuffer.buffer,
+        drawCommandOffset + firstCommand * sizeof(VkDrawIndexedIndirectCommand),
+        commandCount,
+        sizeof(VkDrawIndexedIndirectCommand));
+      firstCommand += commandCount;
+      _stats.drawcallCount++;
+    }
+
+    for (size_t i = begin; i < end; i++)
+    {
+      const RenderObject& r = _mainDrawContext.OpaqueSurfaces[opaqueDraws[i]];
+      if (r.indirectDrawIndex >= 0)
+      {
+        bindIndexBuffer(_meshletOutputIndexBuffer.buffer);
+        vkCmdDrawIndexedIndirect(
+          cmd,
+          _meshletDrawCommandBuffer.buffer,
+          _meshletDrawOffset + r.indirectDrawIndex * sizeof(VkDrawIndexedIndirectCommand),
+          1,
+          sizeof(VkDrawIndexedIndirectCommand));
+        _stats.drawcallCount++;
+      }
+    }
+
+    begin = end;
+  }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -380,7 +564,56 @@ void VkEngine::drawBackground(VkCommandBuffer cmd)
 //--------------------------------------------------------------------------------------------------
 void VkEngine::drawRaytracing(VkCommandBuffer cmd)
 {
-  std::vector<VkDescriptorSet> descriptorSets{_raytracingDescriptorSet->_handle, _gpuSceneDataDescriptorSet->_handle};
+  // the timing of the slot may end the benchmark of a backend, which restarts the accumulation
+  this->updateTraceTime();
+
+  // Once converged the frames only copy the accumulated image to the draw image, which does not keep its content
+  uint32_t flags = 0;
+  if (_isDenoiserEnabled)
+  {
+    flags = RAYTRACING_DENOISED;
+  }
+  else if (_isRaytracingConverged || _frameNumber - _convergenceStartFrame >= static_cast<int>(maxNbOfFramesRT))
+  {
+    flags = RAYTRACING_RESOLVE_ONLY;
+  }
+  // the camera moves are reprojected, only a reset of the accumulation drops the history
+  if (_raytracingFrame > 0)
+  {
+    flags |= RAYTRACING_HISTORY;
+  }
+  if (_sceneData.viewproj != _sceneData.previousViewProj)
+  {
+    flags |= RAYTRACING_MOTION;
+  }
+  if (_isHybridEnabled)
+  {
+    flags |= RAYTRACING_HYBRID;
+  }
+
+  // nothing moved since the accumulation started
+  if ((flags & RAYTRACING_RESOLVE_ONLY) == 0)
+  {
+    this->updateTopLevelStructure(cmd);
+  }
+  this->updateRaytracingSceneTable();
+
+  // the set of this slot was last bound by the frame submitted FRAME_OVERLAP ago, it follows the replaced TLAS here
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  if (!_topAS.empty() && _raytracingDescriptorStructures[slot] != _topAS[0]._handle)
+  {
+    this->updateRaytracingDescriptors(slot);
+  }
+
+  const bool isRayQuery = _raytracingBackend == RAYTRACING_BACKEND_RAY_QUERY && _rayQueryPipeline;
+  // without the ray tracing pipeline the rays can only be traced through the software BVH
+  ComputePipeline* computePipeline = this->isSoftwareRaytracing() ? _softwareTracePipeline.get()
+                                     : isRayQuery                 ? _rayQueryPipeline.get()
+                                                                  : nullptr;
+  vkCmdResetQueryPool(cmd, _traceTimestampPool, slot * 2, 2);
+
+  std::vector<VkDescriptorSet> descriptorSets{
+    _raytracingDescriptorSets[slot]->_handle, _gpuSceneDataDescriptorSet->_handle};
 
   VkImageSubresourceRange subresourceRange = {};
   subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -389,30 +622,22 @@ void VkEngine::drawRaytracing(VkCommandBuffer cmd)
   subresourceRange.baseArrayLayer = 0;
   subresourceRange.layerCount = 1;
 
-  // Acquire destination images for rendering.
-  VkImageMemoryBarrier accumulationBarrier;
-  accumulationBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  accumulationBarrier.pNext = nullptr;
-  accumulationBarrier.srcAccessMask = 0;
-  accumulationBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-  accumulationBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  accumulationBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-  accumulationBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  accumulationBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  accumulationBarrier.image = _accumulationImage->_handle.image;
-  accumulationBarrier.subresourceRange = subresourceRange;
-
+  // The accumulation and the G-buffer of the previous frame are reprojected by this one, the hybrid renderer reads the
+  // G-buffer it just rasterized
+  VkMemoryBarrier historyBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  historyBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  historyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
   vkCmdPipelineBarrier(
     cmd,
     VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+    this->raytracingStages(),
     0,
+    1,
+    &historyBarrier,
     0,
     nullptr,
     0,
-    nullptr,
-    1,
-    &accumulationBarrier);
+    nullptr);
 
   // Acquire destination images for rendering.
   VkImageMemoryBarrier drawBarrier;
@@ -430,7 +655,69 @@ void VkEngine::drawRaytracing(VkCommandBuffer cmd)
   vkCmdPipelineBarrier(
     cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &drawBarrier);
 
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _traceTimestampPool, slot * 2);
+
+  // every instance finds its geometry and material in the scene table, a single dispatch traces all of them
+  RaytracingPushConstant rtPushConstant = _raytracingSceneAddresses;
+  VkBufferDeviceAddressInfo counterAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _activePixelBuffer.buffer};
+  rtPushConstant.activePixelCounter = vkGetBufferDeviceAddress(_device->getHandle(), &counterAddressInfo) +
+                                      (_frameNumber % FRAME_OVERLAP) * ACTIVE_PIXEL_COUNTER_STRIDE;
+  VkBufferDeviceAddressInfo blueNoiseAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _blueNoiseBuffer.buffer};
+  rtPushConstant.blueNoiseBuffer = vkGetBufferDeviceAddress(_device->getHandle(), &blueNoiseAddressInfo);
+  rtPushConstant.errorThreshold = _rtErrorThreshold;
+  rtPushConstant.minSamples = static_cast<uint32_t>(_rtMinSamples);
+  rtPushConstant.samplesPerFrame = static_cast<uint32_t>(_rtSamplesPerFrame);
+  rtPushConstant.samplerType = static_cast<uint32_t>(_rtSamplerType);
+  rtPushConstant.flags = flags;
+  rtPushConstant.frameCount = _raytracingFrame;
+  rtPushConstant.maxBounces = static_cast<uint32_t>(_rtMaxBounces);
+  rtPushConstant.rouletteDepth = static_cast<uint32_t>(_rtRouletteDepth);
+
+  if (computePipeline != nullptr)
+  {
+    // a workgroup traces a tile of 8x8 pixels, see shaders/pathtracer.comp and shaders/pathtracer_software.comp
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline->_handle);
+    vkCmdBindDescriptorSets(
+      cmd,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      _computeTracePipelineLayout->_handle,
+      0,
+      descriptorSets.size(),
+      descriptorSets.data(),
+      0,
+      nullptr);
+    vkCmdPushConstants(
+      cmd,
+      _computeTracePipelineLayout->_handle,
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(RaytracingPushConstant),
+      &rtPushConstant);
+    vkCmdDispatch(cmd, std::ceil(_windowExtent.width / 8.0), std::ceil(_windowExtent.height / 8.0), 1);
+  }
+  else
+  {
+    this->traceRays(cmd, descriptorSets, rtPushConstant);
+  }
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _traceTimestampPool, slot * 2 + 1);
+  // the software backend has no other one to be benchmarked against, it is timed in the slot of the pipeline
+  _traceTimestampBackends[slot] = isRayQuery ? RAYTRACING_BACKEND_RAY_QUERY : RAYTRACING_BACKEND_PIPELINE;
+
+  // a resolved frame wrote none of the images of its parity, the next frame reprojects the last traced one
+  if ((flags & RAYTRACING_RESOLVE_ONLY) == 0)
+  {
+    _raytracingFrame++;
+  }
+}
 
+//--------------------------------------------------------------------------------------------------
+void VkEngine::traceRays(
+  VkCommandBuffer cmd,
+  const std::vector<VkDescriptorSet>& descriptorSets,
+  const RaytracingPushConstant& rtPushConstant)
+{
   // Bind ray tracing pipeline.
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, _raytracingPipeline->_handle);
   vkCmdBindDescriptorSets(
@@ -443,31 +730,28 @@ void VkEngine::drawRaytracing(VkCommandBuffer cmd)
     0,
     nullptr);
 
-  RaytracingPushConstant rtPushConstant{};
-  rtPushConstant.vertexBufferAddress = _testMeshes[_selectedMeshIndex]->meshBuffers.vertexBufferAddress;
-  rtPushConstant.indexBufferAddress = _testMeshes[_selectedMeshIndex]->meshBuffers.indexBufferAddress;
-
   vkCmdPushConstants(
     cmd,
     _raytracingPipelineLayout->_handle,
-    VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+    VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR,
     0,
     sizeof(RaytracingPushConstant),
     &rtPushConstant);
 
-  // Describe the shader binding table.
+  // Describe the shader binding table, from the slice of this frame.
+  const VkDeviceSize sliceOffset = (_frameNumber % FRAME_OVERLAP) * _shaderBindingTable->_sliceSize;
   VkStridedDeviceAddressRegionKHR raygenShaderBindingTable = {};
-  raygenShaderBindingTable.deviceAddress = _shaderBindingTable->_raygenShaderAddress;
+  raygenShaderBindingTable.deviceAddress = _shaderBindingTable->_raygenShaderAddress + sliceOffset;
   raygenShaderBindingTable.stride = _shaderBindingTable->_raygenEntrySize;
   raygenShaderBindingTable.size = _shaderBindingTable->_raygenSize;
 
   VkStridedDeviceAddressRegionKHR missShaderBindingTable = {};
-  missShaderBindingTable.deviceAddress = _shaderBindingTable->_missShaderAddress;
+  missShaderBindingTable.deviceAddress = _shaderBindingTable->_missShaderAddress + sliceOffset;
   missShaderBindingTable.stride = _shaderBindingTable->_missEntrySize;
   missShaderBindingTable.size = _shaderBindingTable->_missSize;
 
   VkStridedDeviceAddressRegionKHR hitShaderBindingTable = {};
-  hitShaderBindingTable.deviceAddress = _shaderBindingTable->_closesHitShaderAddress;
+  hitShaderBindingTable.deviceAddress = _shaderBindingTable->_closesHitShaderAddress + sliceOffset;
   hitShaderBindingTable.stride = _shaderBindingTable->_hitGroupEntrySize;
   hitShaderBindingTable.size = _shaderBindingTable->_hitGroupSize;
 
@@ -485,6 +769,7 @@ void VkEngine::drawRaytracing(VkCommandBuffer cmd)
     _windowExtent.height,
     1);
 }
+
 //--------------------------------------------------------------------------------------------------
 void VkEngine::drawImgui(VkCommandBuffer cmd, VkImageView targetImageView)
 {
@@ -500,7 +785,173 @@ void VkEngine::drawImgui(VkCommandBuffer cmd, VkImageView targetImageView)
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::drawGeometry(VkCommandBuffer cmd)
+void VkEngine::cullMeshlets(VkCommandBuffer cmd)
+{
+  if (!_isMeshletCullingEnabled)
+  {
+    return;
+  }
+
+  // Give every render object with meshlets an indirect draw and a range of the output index buffer large enough to
+  // hold all of its meshlets. The culling pass only increments the index count of the draws.
+  std::vector<RenderObject*> culledObjects;
+  std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+  uint32_t outputIndexCount = 0;
+  // same order as the object buffer of drawGeometry, the opaque surfaces first
+  uint32_t objectIndex = 0;
+  for (std::vector<RenderObject>* surfaces : {&_mainDrawContext.OpaqueSurfaces, &_mainDrawContext.TransparentSurfaces})
+  {
+    for (RenderObject& r : *surfaces)
+    {
+      objectIndex++;
+      if (r.meshletCount == 0)
+      {
+        continue;
+      }
+      r.indirectDrawIndex = static_cast<int32_t>(drawCommands.size());
+
+      VkDrawIndexedIndirectCommand drawCommand{};
+      drawCommand.indexCount = 0;
+      drawCommand.instanceCount = 1;
+      drawCommand.firstIndex = outputIndexCount;
+      drawCommand.vertexOffset = r.vertexOffset;
+      drawCommand.firstInstance = objectIndex - 1;
+      drawCommands.push_back(drawCommand);
+
+      culledObjects.push_back(&r);
+      outputIndexCount += r.indexCount;
+    }
+  }
+
+  if (drawCommands.empty())
+  {
+    return;
+  }
+
+  // The buffers only grow, the frame in flight may still draw from the old ones
+  const uint32_t drawCount = static_cast<uint32_t>(drawCommands.size());
+  if (outputIndexCount > _meshletOutputIndexCapacity)
+  {
+    if (_meshletOutputIndexCapacity > 0)
+    {
+      AllocatedBuffer oldBuffer = _meshletOutputIndexBuffer;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    }
+
+    _meshletOutputIndexCapacity = std::max(outputIndexCount, _meshletOutputIndexCapacity * 2);
+    _meshletOutputIndexBuffer = this->createBuffer(
+      _meshletOutputIndexCapacity * sizeof(uint32_t),
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::GpuOnly);
+    DebugUtils::SetObjectName(_meshletOutputIndexBuffer.buffer, "Meshlet output indices", _device->getHandle());
+  }
+  if (drawCount > _meshletDrawCapacity)
+  {
+    if (_meshletDrawCapacity > 0)
+    {
+      AllocatedBuffer oldBuffer = _meshletDrawCommandBuffer;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    }
+
+    _meshletDrawCapacity = std::max(drawCount, _meshletDrawCapacity * 2);
+    _meshletDrawCommandBuffer = this->createBuffer(
+      FRAME_OVERLAP * _meshletDrawCapacity * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::Dynamic);
+    DebugUtils::SetObjectName(_meshletDrawCommandBuffer.buffer, "Meshlet draw commands", _device->getHandle());
+  }
+
+  // the draws are reset through the persistent mapping, in the slice of this frame
+  _meshletDrawOffset = (_frameNumber % FRAME_OVERLAP) * _meshletDrawCapacity * sizeof(VkDrawIndexedIndirectCommand);
+  memcpy(
+    (char*)_meshletDrawCommandBuffer.info.pMappedData + _meshletDrawOffset,
+    drawCommands.data(),
+    drawCount * sizeof(VkDrawIndexedIndirectCommand));
+  VK_CHECK(vmaFlushAllocation(
+    _allocator,
+    _meshletDrawCommandBuffer.allocation,
+    _meshletDrawOffset,
+    drawCount * sizeof(VkDrawIndexedIndirectCommand)));
+
+  VkBufferDeviceAddressInfo outputAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _meshletOutputIndexBuffer.buffer};
+  VkBufferDeviceAddressInfo drawCommandAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _meshletDrawCommandBuffer.buffer};
+
+  MeshletCullPushConstants pushConstants{};
+  pushConstants.outputIndexBuffer = vkGetBufferDeviceAddress(_device->getHandle(), &outputAddressInfo);
+  pushConstants.drawCommandBuffer =
+    vkGetBufferDeviceAddress(_device->getHandle(), &drawCommandAddressInfo) + _meshletDrawOffset;
+
+  // the index buffer is shared by the frames, the draws of the previous one must be done reading it
+  vkCmdPipelineBarrier(
+    cmd,
+    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    0,
+    0,
+    nullptr,
+    0,
+    nullptr,
+    0,
+    nullptr);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipeline->_handle);
+  vkCmdBindDescriptorSets(
+    cmd,
+    VK_PIPELINE_BIND_POINT_COMPUTE,
+    _meshletCullPipelineLayout->_handle,
+    0,
+    1,
+    &_gpuSceneDataDescriptorSet->_handle,
+    0,
+    nullptr);
+
+  for (RenderObject* r : culledObjects)
+  {
+    pushConstants.worldMatrix = r->transform;
+    pushConstants.meshletBuffer = r->meshletBufferAddress;
+    pushConstants.meshletIndexBuffer = r->meshletIndexBufferAddress;
+    pushConstants.meshletOffset = r->meshletOffset;
+    pushConstants.meshletCount = r->meshletCount;
+    pushConstants.outputOffset = drawCommands[r->indirectDrawIndex].firstIndex;
+    pushConstants.drawIndex = r->indirectDrawIndex;
+    // the cutoff of a cone cannot be rescaled for a stretched instance, its meshlets are only frustum culled
+    const bool isConeCulled = _isMeshletConeCullingEnabled && has_uniform_scale(r->transform);
+    pushConstants.cullingFlags = MESHLET_CULL_FRUSTUM | (isConeCulled ? MESHLET_CULL_CONE : 0);
+
+    vkCmdPushConstants(
+      cmd,
+      _meshletCullPipelineLayout->_handle,
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(MeshletCullPushConstants),
+      &pushConstants);
+    // one workgroup per meshlet
+    vkCmdDispatch(cmd, r->meshletCount, 1, 1);
+  }
+
+  // the draws read the compacted indices and the index counts written by the culling
+  VkMemoryBarrier memoryBarrier{};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+  vkCmdPipelineBarrier(
+    cmd,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+    0,
+    1,
+    &memoryBarrier,
+    0,
+    nullptr,
+    0,
+    nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::drawGeometry(VkCommandBuffer cmd, MaterialPipeline* pipelineOverride)
 {
   std::vector<uint32_t> opaqueDraws;
   opaqueDraws.reserve(_mainDrawContext.OpaqueSurfaces.size());
@@ -513,7 +964,7 @@ void VkEngine::drawGeometry(VkCommandBuffer cmd)
     }
   }
 
-  // sort the opaque surfaces by material and mesh
+  // sort the opaque surfaces by material and position in the index arena
   std::sort(
     opaqueDraws.begin(),
     opaqueDraws.end(),
@@ -523,7 +974,7 @@ void VkEngine::drawGeometry(VkCommandBuffer cmd)
       const RenderObject& B = _mainDrawContext.OpaqueSurfaces[iB];
       if (A.material == B.material)
       {
-        return A.indexBuffer < B.indexBuffer;
+        return A.firstIndex < B.firstIndex;
       }
       else
       {
@@ -531,84 +982,110 @@ void VkEngine::drawGeometry(VkCommandBuffer cmd)
       }
     });
 
+  _stats.drawcallCount = 0;
+  _stats.triangleCount = 0;
+
+  const size_t opaqueCount = _mainDrawContext.OpaqueSurfaces.size();
+  const size_t objectCount = opaqueCount + _mainDrawContext.TransparentSurfaces.size();
+  if (objectCount == 0)
+  {
+    return;
+  }
+
+  // world matrices of every render object, the opaque ones first, read by the draws through their instance index;
+  // the buffer only grows, the frame in flight may still read the old one
+  if (objectCount > _objectCapacity)
+  {
+    if (_objectCapacity > 0)
+    {
+      AllocatedBuffer oldBuffer = _objectBuffer;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    }
+
+    _objectCapacity = std::max(static_cast<uint32_t>(objectCount), _objectCapacity * 2);
+    _objectBuffer = this->createBuffer(
+      FRAME_OVERLAP * _objectCapacity * sizeof(glm::mat4),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::Dynamic);
+    DebugUtils::SetObjectName(_objectBuffer.buffer, "Object world matrices", _device->getHandle());
+  }
+
+  const VkDeviceSize objectOffset = (_frameNumber % FRAME_OVERLAP) * _objectCapacity * sizeof(glm::mat4);
+  glm::mat4* worldMatrices = (glm::mat4*)((char*)_objectBuffer.info.pMappedData + objectOffset);
+  for (size_t i = 0; i < opaqueCount; i++)
+  {
+    worldMatrices[i] = _mainDrawContext.OpaqueSurfaces[i].transform;
+  }
+  for (size_t i = 0; i < _mainDrawContext.TransparentSurfaces.size(); i++)
+  {
+    worldMatrices[opaqueCount + i] = _mainDrawContext.TransparentSurfaces[i].transform;
+  }
+  VK_CHECK(vmaFlushAllocation(_allocator, _objectBuffer.allocation, objectOffset, objectCount * sizeof(glm::mat4)));
+
+  VkBufferDeviceAddressInfo objectAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _objectBuffer.buffer};
+
+  GPUDrawPushConstants pushConstants;
+  pushConstants.vertexBuffer = _vertexArena->_address;
+  pushConstants.objectBuffer = vkGetBufferDeviceAddress(_device->getHandle(), &objectAddressInfo) + objectOffset;
+
   //defined outside of the draw function, this is the state we will try to skip
   MaterialPipeline* lastPipeline = nullptr;
   MaterialInstance* lastMaterial = nullptr;
   VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
 
-  auto draw = [&](const RenderObject& r)
+  auto draw = [&](const RenderObject& r, uint32_t objectIndex)
   {
     if (r.material != lastMaterial)
     {
       lastMaterial = r.material;
-      //rebind pipeline and descriptors if the material changed
-      if (r.material->pipeline != lastPipeline)
-      {
-        lastPipeline = r.material->pipeline;
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
-        vkCmdBindDescriptorSets(
-          cmd,
-          VK_PIPELINE_BIND_POINT_GRAPHICS,
-          r.material->pipeline->layout,
-          0,
-          1,
-          &_gpuSceneDataDescriptorSet->_handle,
-          0,
-          nullptr);
-
-        VkViewport viewport = {};
-        viewport.x = 0;
-        viewport.y = 0;
-        viewport.width = (float)_windowExtent.width;
-        viewport.height = (float)_windowExtent.height;
-        viewport.minDepth = 0.f;
-        viewport.maxDepth = 1.f;
-
-        vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-        VkRect2D scissor = {};
-        scissor.offset.x = 0;
-        scissor.offset.y = 0;
-        scissor.extent.width = _windowExtent.width;
-        scissor.extent.height = _windowExtent.height;
-
-        vkCmdSetScissor(cmd, 0, 1, &scissor);
-      }
-
-      vkCmdBindDescriptorSets(
-        cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1, &r.material->materialSet, 0, nullptr);
+      this->bindMaterial(cmd, r.material, lastPipeline, pushConstants, pipelineOverride);
     }
+    //culled meshlets are drawn from the compacted index buffer, everything else from the index arena
+    const bool isIndirect = r.indirectDrawIndex >= 0;
+    VkBuffer indexBuffer = isIndirect ? _meshletOutputIndexBuffer.buffer : _indexArena->_buffer.buffer;
+
     //rebind index buffer if needed
-    if (r.indexBuffer != lastIndexBuffer)
+    if (indexBuffer != lastIndexBuffer)
     {
-      lastIndexBuffer = r.indexBuffer;
-      vkCmdBindIndexBuffer(cmd, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+      lastIndexBuffer = indexBuffer;
+      vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
     }
-    // calculate final mesh matrix
-    GPUDrawPushConstants pushConstants;
-    pushConstants.worldMatrix = r.transform;
-    pushConstants.vertexBuffer = r.vertexBufferAddress;
-
-    vkCmdPushConstants(
-      cmd, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
 
-    //stats
+    //stats, the triangle count is an upper bound for the culled draws
     _stats.drawcallCount++;
     _stats.triangleCount += r.indexCount / 3;
-    vkCmdDrawIndexed(cmd, r.indexCount, 1, r.firstIndex, 0, 0);
+    if (isIndirect)
+    {
+      vkCmdDrawIndexedIndirect(
+        cmd,
+        _meshletDrawCommandBuffer.buffer,
+        _meshletDrawOffset + r.indirectDrawIndex * sizeof(VkDrawIndexedIndirectCommand),
+        1,
+        sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+      vkCmdDrawIndexed(cmd, r.indexCount, 1, r.firstIndex, r.vertexOffset, objectIndex);
+    }
   };
 
-  _stats.drawcallCount = 0;
-  _stats.triangleCount = 0;
-
-  for (auto& r : _mainDrawContext.OpaqueSurfaces)
+  if (_isIndirectDrawEnabled)
+  {
+    this->drawIndirect(cmd, opaqueDraws, pushConstants, pipelineOverride);
+  }
+  else
   {
-    draw(r);
+    for (uint32_t i : opaqueDraws)
+    {
+      draw(_mainDrawContext.OpaqueSurfaces[i], i);
+    }
   }
 
-  for (auto& r : _mainDrawContext.TransparentSurfaces)
+  // the transparent surfaces keep their order, one draw each
+  for (size_t i = 0; i < _mainDrawContext.TransparentSurfaces.size() && !pipelineOverride; i++)
   {
-    draw(r);
+    draw(_mainDrawContext.TransparentSurfaces[i], static_cast<uint32_t>(opaqueCount + i));
   }
 
   // we delete the draw commands now that we processed them
@@ -617,29 +1094,131 @@ void VkEngine::drawGeometry(VkCommandBuffer cmd)
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::drawMain(VkCommandBuffer cmd)
+void VkEngine::drawGeometryBuffer(VkCommandBuffer cmd)
 {
-  VkRenderingAttachmentInfo colorAttachment =
-    vkinit::attachmentInfo(_drawImage->_handle.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+  // the previous frames traced from the images or read them in the denoiser
+  VkMemoryBarrier readBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  readBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  readBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  vkCmdPipelineBarrier(
+    cmd,
+    this->raytracingStages(),
+    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+    0,
+    1,
+    &readBarrier,
+    0,
+    nullptr,
+    0,
+    nullptr);
+
+  // the images of the frame about to be traced, the pixels of the sky keep a negative distance
+  const std::vector<VkImageView> views = _geometryBuffer->attachmentViews(_raytracingFrame & 1);
+  std::array<VkClearValue, 3> clearValues{};
+  clearValues[0].color = {{0.f, 0.f, 0.f, -1.f}};
+  clearValues[1].color = {{0.f, 0.f, 0.f, 1.f}};
+  clearValues[2].color = {{1.f, 1.f, 1.f, 0.f}};
+  std::vector<VkRenderingAttachmentInfo> colorAttachments;
+  for (size_t i = 0; i < views.size(); i++)
+  {
+    colorAttachments.push_back(vkinit::attachmentInfo(views[i], &clearValues[i], VK_IMAGE_LAYOUT_GENERAL));
+  }
   VkRenderingAttachmentInfo depthAttachment =
     vkinit::depthAttachmentInfo(_depthImage->_handle.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  VkRenderingInfo renderInfo = vkinit::renderingInfo(_windowExtent, colorAttachments.data(), &depthAttachment);
+  renderInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
 
-  _gpuSceneDataDescriptorSet =
-    std::make_unique<DescriptorSet>(_device, _gpuSceneDataDescriptorLayout, _globalDescriptorAllocator);
-
-  //allocate a new uniform buffer for the scene data
-  AllocatedBuffer gpuSceneDataBuffer =
-    this->createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  this->cullMeshlets(cmd);
 
-  //add it to the deletion queue of this frame so it gets deleted once its been used
-  this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(gpuSceneDataBuffer); });
+  vkCmdBeginRendering(cmd, &renderInfo);
+  this->drawGeometry(cmd, &_metalRoughMaterial._gbufferPipeline);
+  vkCmdEndRendering(cmd);
+}
 
-  //get the memory mapped data using vma
-  GPUSceneData* sceneUniformData = (GPUSceneData*)gpuSceneDataBuffer.allocation->GetMappedData();
+//--------------------------------------------------------------------------------------------------
+void VkEngine::bindMaterial(
+  VkCommandBuffer cmd,
+  MaterialInstance* material,
+  MaterialPipeline*& lastPipeline,
+  const GPUDrawPushConstants& pushConstants,
+  MaterialPipeline* pipelineOverride)
+{
+  MaterialPipeline* pipeline = pipelineOverride ? pipelineOverride : material->pipeline;
+
+  //rebind pipeline and descriptors if the material changed
+  if (pipeline != lastPipeline)
+  {
+    lastPipeline = pipeline;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+    vkCmdBindDescriptorSets(
+      cmd,
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      pipeline->layout,
+      0,
+      1,
+      &_gpuSceneDataDescriptorSet->_handle,
+      0,
+      nullptr);
+
+    VkViewport viewport = {};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = (float)_windowExtent.width;
+    viewport.height = (float)_windowExtent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent.width = _windowExtent.width;
+    scissor.extent.height = _windowExtent.height;
+
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    // the same for every draw of the frame, the transforms come from the object buffer
+    vkCmdPushConstants(
+      cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+  }
+
+  vkCmdBindDescriptorSets(
+    cmd,
+    VK_PIPELINE_BIND_POINT_GRAPHICS,
+    pipeline->layout,
+    1,
+    1,
+    &material->materialSets[_frameNumber % FRAME_OVERLAP],
+    0,
+    nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::drawMain(VkCommandBuffer cmd)
+{
+  VkRenderingAttachmentInfo colorAttachment =
+    vkinit::attachmentInfo(_drawImage->_handle.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+  VkRenderingAttachmentInfo depthAttachment =
+    vkinit::depthAttachmentInfo(_depthImage->_handle.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+  _gpuSceneDataDescriptorSet =
+    std::make_unique<DescriptorSet>(_device, _gpuSceneDataDescriptorLayout, _globalDescriptorAllocator);
+
+  //allocate a new uniform buffer for the scene data
+  AllocatedBuffer gpuSceneDataBuffer =
+    this->createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, MemoryIntent::Dynamic);
+
+  //add it to the deletion queue of this frame so it gets deleted once its been used
+  this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(gpuSceneDataBuffer); });
+
+  //get the memory mapped data using vma
+  GPUSceneData* sceneUniformData = (GPUSceneData*)gpuSceneDataBuffer.allocation->GetMappedData();
 
   //write the data into the buffer
   _gpuSceneDataDescriptorSet->writeUniformBuffer(
     _device, gpuSceneDataBuffer, sceneUniformData, _sceneData, 0, sizeof(GPUSceneData), 0);
+  this->flushBuffer(gpuSceneDataBuffer);
 
   VkRenderingInfo renderInfo = vkinit::renderingInfo(_windowExtent, &colorAttachment, &depthAttachment);
   // Draw either blinn phong or ray tracing.
@@ -666,6 +1245,8 @@ void VkEngine::drawMain(VkCommandBuffer cmd)
     // execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
     vkCmdDispatch(cmd, std::ceil(_windowExtent.width / 16.0), std::ceil(_windowExtent.height / 16.0), 1);
 
+    this->cullMeshlets(cmd);
+
     vkCmdBeginRendering(cmd, &renderInfo);
     auto start = std::chrono::system_clock::now();
 
@@ -680,8 +1261,31 @@ void VkEngine::drawMain(VkCommandBuffer cmd)
   }
   else
   {
-    if (_frameNumber < maxNbOfFramesRT)
+    // the hybrid renderer rasterizes the surfaces seen by the camera, the paths start from them
+    if (_isHybridEnabled)
+    {
+      this->drawGeometryBuffer(cmd);
+    }
+    else
+    {
+      _mainDrawContext.OpaqueSurfaces.clear();
+      _mainDrawContext.TransparentSurfaces.clear();
+    }
+
+    // the denoiser filters a few samples every frame, the accumulation stops tracing once every pixel has converged
+    if (_isDenoiserEnabled)
+    {
+      // the history is as old as the last ray traced frame
+      if (!_isPreviousFrameRT)
+      {
+        _denoiser->reset();
+      }
+      this->drawRaytracing(cmd);
+      _denoiser->denoise(cmd, _raytracingFrame - 1);
+    }
+    else
     {
+      this->updateRaytracingConvergence();
       this->drawRaytracing(cmd);
     }
     _isPreviousFrameRT = true;
@@ -696,62 +1300,73 @@ GPUMeshBuffers VkEngine::uploadMesh(std::span<uint32_t> indices, std::span<Verte
 
   GPUMeshBuffers newSurface;
 
-  //create vertex buffer
-  newSurface.vertexBuffer = this->createBuffer(
-    vertexBufferSize,
-    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-    VMA_MEMORY_USAGE_AUTO);
+  // reserve the ranges of the mesh in the arenas, the indices stay relative to the first vertex of the mesh
+  newSurface.vertexRange = _vertexArena->allocate(vertices.size());
   newSurface.vertexCount = vertices.size();
+  newSurface.indexRange = _indexArena->allocate(indices.size());
+  newSurface.indexCount = indices.size();
 
-  //find the address of the vertex buffer
-  VkBufferDeviceAddressInfo vertexAdressInfo{
-    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer};
-  newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device->getHandle(), &vertexAdressInfo);
+  // in place when the arenas are host visible
+  const std::array<BufferWrite, 2> writes{
+    BufferWrite{
+      &_vertexArena->_buffer,
+      _vertexArena->offset(newSurface.vertexRange) * sizeof(Vertex),
+      vertices.data(),
+      vertexBufferSize},
+    BufferWrite{
+      &_indexArena->_buffer,
+      _indexArena->offset(newSurface.indexRange) * sizeof(uint32_t),
+      indices.data(),
+      indexBufferSize}};
+  this->writeBuffers(writes);
 
-  //create index buffer
-  newSurface.indexBuffer = this->createBuffer(
-    indexBufferSize,
-    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-    VMA_MEMORY_USAGE_AUTO);
-  newSurface.indexCount = indices.size();
+  return newSurface;
+}
 
-  //find the address of the index buffer
-  VkBufferDeviceAddressInfo indexAdressInfo{
-    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.indexBuffer.buffer};
-  newSurface.indexBufferAddress = vkGetBufferDeviceAddress(_device->getHandle(), &indexAdressInfo);
-  AllocatedBuffer staging =
-    this->createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+//--------------------------------------------------------------------------------------------------
+void VkEngine::freeMesh(const GPUMeshBuffers& mesh)
+{
+  _vertexArena->free(mesh.vertexRange);
+  _indexArena->free(mesh.indexRange);
+}
 
-  void* data = staging.allocation->GetMappedData();
+//--------------------------------------------------------------------------------------------------
+GPUMeshletBuffers VkEngine::uploadMeshlets(std::span<GPUMeshlet> meshlets, std::span<uint32_t> meshletIndices)
+{
+  GPUMeshletBuffers newMeshlets{};
+  if (meshlets.empty())
+  {
+    return newMeshlets;
+  }
 
-  // copy vertex buffer
-  memcpy(data, vertices.data(), vertexBufferSize);
-  // copy index buffer
-  memcpy((char*)data + vertexBufferSize, indices.data(), indexBufferSize);
+  const size_t meshletBufferSize = meshlets.size() * sizeof(GPUMeshlet);
+  const size_t indexBufferSize = meshletIndices.size() * sizeof(uint32_t);
 
-  this->immediateSubmit(
-    [&](VkCommandBuffer cmd)
-    {
-      VkBufferCopy vertexCopy{0};
-      vertexCopy.dstOffset = 0;
-      vertexCopy.srcOffset = 0;
-      vertexCopy.size = vertexBufferSize;
+  newMeshlets.meshletBuffer = this->createBuffer(
+    meshletBufferSize,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    MemoryIntent::Static);
+  newMeshlets.meshletCount = meshlets.size();
 
-      vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
+  VkBufferDeviceAddressInfo meshletAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newMeshlets.meshletBuffer.buffer};
+  newMeshlets.meshletBufferAddress = vkGetBufferDeviceAddress(_device->getHandle(), &meshletAddressInfo);
 
-      VkBufferCopy indexCopy{0};
-      indexCopy.dstOffset = 0;
-      indexCopy.srcOffset = vertexBufferSize;
-      indexCopy.size = indexBufferSize;
+  newMeshlets.meshletIndexBuffer = this->createBuffer(
+    indexBufferSize,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    MemoryIntent::Static);
 
-      vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
-    });
+  VkBufferDeviceAddressInfo indexAddressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newMeshlets.meshletIndexBuffer.buffer};
+  newMeshlets.meshletIndexBufferAddress = vkGetBufferDeviceAddress(_device->getHandle(), &indexAddressInfo);
 
-  this->destroyBuffer(staging);
+  const std::array<BufferWrite, 2> writes{
+    BufferWrite{&newMeshlets.meshletBuffer, 0, meshlets.data(), meshletBufferSize},
+    BufferWrite{&newMeshlets.meshletIndexBuffer, 0, meshletIndices.data(), indexBufferSize}};
+  this->writeBuffers(writes);
 
-  return newSurface;
+  return newMeshlets;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -773,22 +1388,22 @@ void VkEngine::updateScene()
   _sceneData.screenGamma = _mainSurfaceProperties.screenGamma;
   _sceneData.shininess = _mainSurfaceProperties.shininess;
   // camera projection
-  float fov = 70.f;
-  float aspect = (float)_windowExtent.width / (float)_windowExtent.height;
-  float near = 0.1f;
-  float far = 1000.0f;
-  _sceneData.proj = glm::perspective(fov, aspect, near, far);
-  _sceneData.proj[1][1] *= -1;
+  _sceneData.proj = _mainCamera.getProjectionMatrix((float)_windowExtent.width / (float)_windowExtent.height);
   _sceneData.invProj = glm::inverse(_sceneData.proj);
+  _sceneData.previousViewProj = _sceneData.viewproj;
 
-  // invert the Y direction on projection matrix so that we are more similar
-  // to opengl and gltf axis
   _sceneData.viewproj = _sceneData.proj * _sceneData.view;
 
   //some default lighting parameters
   _sceneData.ambientColor = glm::vec4(.1f);
   _sceneData.frameIndex = _frameNumber;
 
+  // proj[1][1] is 1 / tan(fov / 2), an error of 1 at a distance of 1 covers half the viewport times this factor
+  _mainDrawContext.isLodEnabled = _isLodEnabled;
+  _mainDrawContext.cameraPosition = _mainCamera.position;
+  _mainDrawContext.lodScale = 0.5f * _windowExtent.height * std::abs(_sceneData.proj[1][1]);
+  _mainDrawContext.lodThreshold = _lodThreshold;
+
 
   if (!_selectedNodeName.empty())
   {
@@ -800,6 +1415,9 @@ void VkEngine::updateScene()
     _loadedScenes[_selectedSceneName]->Draw(glm::mat4{1.f}, _mainDrawContext);
   }
 
+  _textureStreamer->requestTextures(_mainDrawContext.textureRequests, _frameNumber);
+  _mainDrawContext.textureRequests.clear();
+
   auto end = std::chrono::system_clock::now();
 
   //convert to microseconds (integer), and then come back to miliseconds
@@ -889,6 +1507,23 @@ void VkEngine::initVulkan()
   _chosenGPU = std::make_unique<PhysicalDevice>(_instance, _surface);
   _device = std::make_unique<Device>(_chosenGPU);
   this->createMemoryAllocator();
+  _textureStreamer = std::make_unique<TextureStreamer>(this);
+
+  // every mesh is sub-allocated from these, the ray tracing builds read them as well
+  const VkBufferUsageFlags buildInputUsage =
+    this->isSoftwareRaytracing() ? 0 : VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+  _vertexArena = std::make_unique<GeometryArena>(
+    this,
+    sizeof(Vertex),
+    VERTEX_ARENA_CAPACITY,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | buildInputUsage,
+    "Vertex arena");
+  _indexArena = std::make_unique<GeometryArena>(
+    this,
+    sizeof(uint32_t),
+    INDEX_ARENA_CAPACITY,
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | buildInputUsage,
+    "Index arena");
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -940,13 +1575,14 @@ void VkEngine::initDescriptors()
     {0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}};
   _singleImageDescriptorLayout = std::make_unique<DescriptorSetLayout>(_device, singleImageBindings);
 
+  const VkShaderStageFlags raytracingStages =
+    this->isSoftwareRaytracing() ? 0 : VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
   std::vector<DescriptorBinding> sceneDataBindings = {
     // Camera matrices
     {0,
      1,
      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-     VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
-       VK_SHADER_STAGE_FRAGMENT_BIT}};
+     VK_SHADER_STAGE_VERTEX_BIT | raytracingStages | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT}};
   _gpuSceneDataDescriptorLayout = std::make_unique<DescriptorSetLayout>(_device, sceneDataBindings);
 
   //allocate a descriptor set for our draw image
@@ -968,54 +1604,89 @@ void VkEngine::initDescriptors()
 void VkEngine::initRaytracingDescriptors()
 {
   std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
-    // Top level acceleration structure.
-    {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1},
-    // Image accumulation & output
-    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+    // Image accumulation & output, G-buffer
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 11},
   };
+  // the compute backends bind the same set to their pipeline
+  const bool isSoftware = this->isSoftwareRaytracing();
+  const VkShaderStageFlags stages =
+    isSoftware ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
   std::vector<DescriptorBinding> bindings{
-    // Top level acceleration structure.
-    {0,
-     1,
-     VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-     VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
     // Output image
-    {1, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+    {1, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    // Running mean and variance of the pixels, of both parities
+    {2, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    {3, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    // G-buffer: positions and normals of both parities, albedo, motion vectors
+    {4, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    {5, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    {6, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
+    {7, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stages},
   };
-  _raytracingDescriptorAllocator.init(_device->getHandle(), 1, sizes);
+  // Top level acceleration structure, the software tier finds its BVH through the push constants
+  if (!isSoftware)
+  {
+    sizes.push_back({VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1});
+    bindings.push_back(
+      {0, 1, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, stages | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR});
+  }
+  _raytracingDescriptorAllocator.init(_device->getHandle(), FRAME_OVERLAP, sizes);
   _raytracingDescriptorSetLayout = std::make_unique<DescriptorSetLayout>(_device, bindings);
-  _raytracingDescriptorSet =
-    std::make_unique<DescriptorSet>(_device, _raytracingDescriptorSetLayout, _raytracingDescriptorAllocator);
+  for (std::unique_ptr<DescriptorSet>& descriptorSet : _raytracingDescriptorSets)
+  {
+    descriptorSet =
+      std::make_unique<DescriptorSet>(_device, _raytracingDescriptorSetLayout, _raytracingDescriptorAllocator);
+  }
 
-  //make sure both the descriptor allocator and the new layout get cleaned up properly
+  //make sure both the descriptor allocator and the new layout get cleaned up properly, the sets share the allocator
   _deletionQueue.push(
     [&]()
     {
-      _raytracingDescriptorSet->destroyPools(_device);
+      _raytracingDescriptorSets[0]->destroyPools(_device);
       vkDestroyDescriptorSetLayout(_device->getHandle(), _raytracingDescriptorSetLayout->_handle, nullptr);
     });
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::updateRaytracingDescriptors()
+void VkEngine::updateRaytracingDescriptors(uint32_t slot)
 {
-  // Write acceleration structure
-  VkWriteDescriptorSetAccelerationStructureKHR descASInfo{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
-  descASInfo.accelerationStructureCount = 1;
-  descASInfo.pAccelerationStructures = &_topAS[0]._handle;
-  _raytracingDescriptorSet->writeAccelerationStructure(_device, _topAS[0], 0, descASInfo);
+  std::unique_ptr<DescriptorSet>& descriptorSet = _raytracingDescriptorSets[slot];
+  descriptorSet->clear();
+
+  // Write acceleration structure, there is none in the software tier
+  if (!_topAS.empty())
+  {
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
+      VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures = &_topAS[0]._handle;
+    descriptorSet->writeAccelerationStructure(_device, _topAS[0], 0, descASInfo);
+    _raytracingDescriptorStructures[slot] = _topAS[0]._handle;
+  }
 
   // Write output image
-  _raytracingDescriptorSet->writeImage(_device, _drawImage, 1);
-  _raytracingDescriptorSet->updateSet(_device);
+  descriptorSet->writeImage(_device, _drawImage, 1);
+  std::vector<VkImageView> accumulationViews{
+    _accumulationImages[0]->_handle.imageView, _accumulationImages[1]->_handle.imageView};
+  std::vector<VkImageView> varianceViews{_varianceImages[0]->_handle.imageView, _varianceImages[1]->_handle.imageView};
+  descriptorSet->writeImageViews(_device, accumulationViews, 2);
+  descriptorSet->writeImageViews(_device, varianceViews, 3);
+  _geometryBuffer->write(*descriptorSet, 4, 5, 6, 7);
+  descriptorSet->updateSet(_device);
 }
 
 //--------------------------------------------------------------------------------------------------
 void VkEngine::initPipelines()
 {
   this->initBackgroundPipelines();
+  this->initMeshletCullingPipeline();
+  this->initMipmapPipeline();
   _metalRoughMaterial.buildPipelines(
-    _device->getHandle(), _gpuSceneDataDescriptorLayout->_handle, _drawImage->_handle, _depthImage->_handle);
+    _device->getHandle(),
+    _gpuSceneDataDescriptorLayout->_handle,
+    _drawImage->_handle,
+    _depthImage->_handle,
+    GeometryBuffer::attachmentFormats());
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1056,6 +1727,80 @@ void VkEngine::initBackgroundPipelines()
     });
 }
 
+//--------------------------------------------------------------------------------------------------
+void VkEngine::initMeshletCullingPipeline()
+{
+  VkPushConstantRange pushConstant{};
+  pushConstant.offset = 0;
+  pushConstant.size = sizeof(MeshletCullPushConstants);
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  std::vector<VkPushConstantRange> pushConstants;
+  pushConstants.push_back(pushConstant);
+
+  // The culling reads the camera from the scene data
+  std::vector<VkDescriptorSetLayout> descriptors = {_gpuSceneDataDescriptorLayout->_handle};
+
+  _meshletCullPipelineLayout = std::make_unique<PipelineLayout>(_device, descriptors, pushConstants);
+  _meshletCullPipeline = std::make_unique<ComputePipeline>(
+    _device, _meshletCullPipelineLayout, "../shaders/meshlet_cull.comp.spv", "meshlet culling");
+
+  vkDestroyShaderModule(_device->getHandle(), _meshletCullPipeline->_shader, nullptr);
+  _deletionQueue.push(
+    [=]()
+    {
+      if (_meshletOutputIndexCapacity > 0)
+      {
+        this->destroyBuffer(_meshletOutputIndexBuffer);
+      }
+      if (_meshletDrawCapacity > 0)
+      {
+        this->destroyBuffer(_meshletDrawCommandBuffer);
+      }
+      vkDestroyPipelineLayout(_device->getHandle(), _meshletCullPipelineLayout->_handle, nullptr);
+      vkDestroyPipeline(_device->getHandle(), _meshletCullPipeline->_handle, nullptr);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::initMipmapPipeline()
+{
+  std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_DOWNSAMPLE_MIPS}, {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+  _mipmapDescriptorAllocator.init(_device->getHandle(), 4, sizes);
+
+  std::vector<DescriptorBinding> mipmapBindings = {
+    {0, MAX_DOWNSAMPLE_MIPS, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT},
+    {1, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT}};
+  _mipmapDescriptorLayout = std::make_unique<DescriptorSetLayout>(_device, mipmapBindings);
+
+  VkPushConstantRange pushConstant{};
+  pushConstant.offset = 0;
+  pushConstant.size = sizeof(MipmapPushConstants);
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  std::vector<VkPushConstantRange> pushConstants;
+  pushConstants.push_back(pushConstant);
+
+  std::vector<VkDescriptorSetLayout> descriptors = {_mipmapDescriptorLayout->_handle};
+
+  _mipmapPipelineLayout = std::make_unique<PipelineLayout>(_device, descriptors, pushConstants);
+  _mipmapPipeline = std::make_unique<ComputePipeline>(
+    _device, _mipmapPipelineLayout, "../shaders/mipmap_downsample.comp.spv", "mipmap downsample");
+
+  _mipmapCounterBuffer = this->createBuffer(
+    sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryIntent::GpuOnly);
+
+  vkDestroyShaderModule(_device->getHandle(), _mipmapPipeline->_shader, nullptr);
+  _deletionQueue.push(
+    [=, this]()
+    {
+      this->destroyBuffer(_mipmapCounterBuffer);
+      _mipmapDescriptorAllocator.destroyPools(_device->getHandle());
+      vkDestroyDescriptorSetLayout(_device->getHandle(), _mipmapDescriptorLayout->_handle, nullptr);
+      vkDestroyPipelineLayout(_device->getHandle(), _mipmapPipelineLayout->_handle, nullptr);
+      vkDestroyPipeline(_device->getHandle(), _mipmapPipeline->_handle, nullptr);
+    });
+}
+
 //--------------------------------------------------------------------------------------------------
 void VkEngine::initRaytracingPipeline()
 {
@@ -1064,14 +1809,82 @@ void VkEngine::initRaytracingPipeline()
   drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
   VkExtent3D imageExtent{_windowExtent.width, _windowExtent.height, 1};
 
-  _accumulationImage = std::make_unique<Image>(_device, imageExtent, imageFormat, drawImageUsages, _allocator, false);
+  for (size_t i = 0; i < 2; i++)
+  {
+    _accumulationImages[i] =
+      std::make_unique<Image>(_device, imageExtent, imageFormat, drawImageUsages, _allocator, false);
+    _varianceImages[i] =
+      std::make_unique<Image>(_device, imageExtent, VK_FORMAT_R32_SFLOAT, drawImageUsages, _allocator, false);
+  }
+  // they stay in the general layout, the frames know from their flags whether the content is valid
+  this->immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      for (size_t i = 0; i < 2; i++)
+      {
+        vkutil::transitionImage(
+          cmd, _accumulationImages[i]->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        vkutil::transitionImage(
+          cmd, _varianceImages[i]->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+      }
+    });
+
+  // the counters are apart enough for the flush of one not to touch the others on non coherent memory
+  _activePixelBuffer = this->createBuffer(
+    FRAME_OVERLAP * ACTIVE_PIXEL_COUNTER_STRIDE,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    MemoryIntent::Readback);
+  DebugUtils::SetObjectName(_activePixelBuffer.buffer, "Active pixel counters", _device->getHandle());
+  _activePixelFrames.fill(-1);
+  _accumulationStart = std::chrono::system_clock::now();
+
+  // GPU time of the trace, whichever backend records it
+  VkQueryPoolCreateInfo timestampPoolInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  timestampPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  timestampPoolInfo.queryCount = 2 * FRAME_OVERLAP;
+  VK_CHECK(vkCreateQueryPool(_device->getHandle(), &timestampPoolInfo, nullptr, &_traceTimestampPool));
+  _traceTimestampBackends.fill(-1);
+
+  const VkExtent2D extent{_windowExtent.width, _windowExtent.height};
+  _geometryBuffer = std::make_unique<GeometryBuffer>(this, extent);
+  _denoiser = std::make_unique<Denoiser>(this, extent, _drawImage, *_geometryBuffer);
+
+  const std::vector<float> blueNoise = vkutil::generateBlueNoise(BLUE_NOISE_SIZE);
+  _blueNoiseBuffer = this->createBuffer(
+    blueNoise.size() * sizeof(float),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    MemoryIntent::Static);
+  DebugUtils::SetObjectName(_blueNoiseBuffer.buffer, "Blue noise mask", _device->getHandle());
+  const BufferWrite blueNoiseWrite{&_blueNoiseBuffer, 0, blueNoise.data(), blueNoise.size() * sizeof(float)};
+  this->writeBuffers({&blueNoiseWrite, 1});
+
+  _deletionQueue.push(
+    [=]()
+    {
+      for (size_t i = 0; i < 2; i++)
+      {
+        this->destroyImage(_accumulationImages[i]->_handle);
+        this->destroyImage(_varianceImages[i]->_handle);
+      }
+      this->destroyBuffer(_activePixelBuffer);
+      this->destroyBuffer(_blueNoiseBuffer);
+      vkDestroyQueryPool(_device->getHandle(), _traceTimestampPool, nullptr);
+    });
+
+  // the software tier only traces from its compute pipeline
+  if (this->isSoftwareRaytracing())
+  {
+    return;
+  }
+
   std::vector<VkDescriptorSetLayout> descriptors = {
     _raytracingDescriptorSetLayout->_handle, _gpuSceneDataDescriptorLayout->_handle};
 
   std::vector<VkPushConstantRange> pushConstants;
   VkPushConstantRange pc;
   pc.offset = 0;
-  pc.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+  pc.stageFlags =
+    VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR;
   pc.size = sizeof(RaytracingPushConstant);
   pushConstants.emplace_back(pc);
   _raytracingPipelineLayout = std::make_unique<PipelineLayout>(_device, descriptors, pushConstants);
@@ -1097,71 +1910,168 @@ void VkEngine::initRaytracingPipeline()
   _deletionQueue.push(
     [=]()
     {
-      vmaDestroyImage(_allocator, _accumulationImage->_handle.image, _accumulationImage->_handle.allocation);
-      vkDestroyImageView(_device->getHandle(), _accumulationImage->_handle.imageView, nullptr);
       vkDestroyPipelineLayout(_device->getHandle(), _raytracingPipelineLayout->_handle, nullptr);
       vkDestroyPipeline(_device->getHandle(), _raytracingPipeline->_handle, nullptr);
     });
 }
 
+//--------------------------------------------------------------------------------------------------
+void VkEngine::initComputeTracePipelines()
+{
+  const bool isSoftware = this->isSoftwareRaytracing();
+  if (!isSoftware && !_chosenGPU->_isRayQueryEnabled)
+  {
+    fmt::println("VK_KHR_ray_query is not supported, the rays are only traced by the ray tracing pipeline");
+    return;
+  }
+
+  // same descriptor sets and push constants as the ray tracing pipeline, the compute shaders run the same path tracer
+  VkPushConstantRange pushConstant{};
+  pushConstant.offset = 0;
+  pushConstant.size = sizeof(RaytracingPushConstant);
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  std::vector<VkPushConstantRange> pushConstants;
+  pushConstants.push_back(pushConstant);
+
+  std::vector<VkDescriptorSetLayout> descriptors = {
+    _raytracingDescriptorSetLayout->_handle, _gpuSceneDataDescriptorLayout->_handle};
+
+  _computeTracePipelineLayout = std::make_unique<PipelineLayout>(_device, descriptors, pushConstants);
+  if (isSoftware)
+  {
+    _softwareTracePipeline = std::make_unique<ComputePipeline>(
+      _device, _computeTracePipelineLayout, "../shaders/pathtracer_software.comp.spv", "software path tracer");
+  }
+  else
+  {
+    _rayQueryPipeline = std::make_unique<ComputePipeline>(
+      _device, _computeTracePipelineLayout, "../shaders/pathtracer.comp.spv", "ray query path tracer");
+  }
+  std::unique_ptr<ComputePipeline>& pipeline = isSoftware ? _softwareTracePipeline : _rayQueryPipeline;
+
+  vkDestroyShaderModule(_device->getHandle(), pipeline->_shader, nullptr);
+  _deletionQueue.push(
+    [=, &pipeline]()
+    {
+      vkDestroyPipelineLayout(_device->getHandle(), _computeTracePipelineLayout->_handle, nullptr);
+      vkDestroyPipeline(_device->getHandle(), pipeline->_handle, nullptr);
+    });
+}
+
 //--------------------------------------------------------------------------------------------------
 void VkEngine::initShaderBindingTable()
 {
+  if (this->isSoftwareRaytracing())
+  {
+    return;
+  }
+
   _raytracingProperties = std::make_unique<RaytracingProperties>(_chosenGPU);
+  // the hit records follow the scene table, they are written with it
+  _shaderBindingTable = this->createShaderBindingTable({});
+  _deletionQueue.push([=]() { this->destroyBuffer(_shaderBindingTable->_handle); });
+}
+
+//--------------------------------------------------------------------------------------------------
+std::unique_ptr<ShaderBindingTable> VkEngine::createShaderBindingTable(
+  const std::vector<ShaderBindingTable::Entry>& hitGroups)
+{
   const std::vector<ShaderBindingTable::Entry> rayGenPrograms = {{_raytracingPipeline->_raygenGroupIndex, {}}};
   const std::vector<ShaderBindingTable::Entry> missPrograms = {
     {_raytracingPipeline->_missGroupIndex, {}}, {{_raytracingPipeline->_shadowMissGroupIndex}, {}}};
-  const std::vector<ShaderBindingTable::Entry> hitGroups = {
-    {_raytracingPipeline->_triangleHitGroupIndex, {}}, {_raytracingPipeline->_proceduralHitGroupIndex, {}}};
-  _shaderBindingTable = std::make_unique<ShaderBindingTable>(
-    _device, _allocator, _raytracingProperties, _raytracingPipeline, rayGenPrograms, missPrograms, hitGroups);
-  _deletionQueue.push([=]() { this->destroyBuffer(_shaderBindingTable->_handle); });
+  // one slice per frame in flight, a frame rewrites the records of its own slice only
+  return std::make_unique<ShaderBindingTable>(
+    _device,
+    _allocator,
+    _raytracingProperties,
+    _raytracingPipeline,
+    rayGenPrograms,
+    missPrograms,
+    hitGroups,
+    FRAME_OVERLAP);
 }
 
 //--------------------------------------------------------------------------------------------------
 void VkEngine::initAccelerationStructures()
 {
-  std::unique_ptr<CommandPool> pool = std::make_unique<CommandPool>(_device);
-  std::unique_ptr<SingleTimeCommand> cmdBottom =
-    std::make_unique<SingleTimeCommand>(_device->getHandle(), pool->getHandle(), _device->getGraphicsQueue());
+  // the software BVH are built on the CPU, without scratch memory
+  if (!this->isSoftwareRaytracing())
+  {
+    _scratchPool = std::make_unique<ScratchPool>(
+      this,
+      ACCELERATION_STRUCTURE_SCRATCH_BUDGET,
+      _raytracingProperties->_accelProperties.minAccelerationStructureScratchOffsetAlignment);
+  }
 
-  cmdBottom->begin();
-  DebugUtils::SetObjectName(
-    cmdBottom->buffer, "Single Time Bottom Acceleration structure command buffer", _device->getHandle().device);
-  createBottomLevelStructures(cmdBottom->buffer);
-  cmdBottom->end();
+  this->buildBottomLevelStructures(_testMeshes);
+  this->initProceduralParticles();
+  this->immediateSubmit([&](VkCommandBuffer cmd) { this->createTopLevelStructures(cmd); });
 
+  // every build has executed
+  if (_scratchPool)
+  {
+    _scratchPool->release();
+  }
 
-  std::unique_ptr<SingleTimeCommand> cmdTop =
-    std::make_unique<SingleTimeCommand>(_device->getHandle(), pool->getHandle(), _device->getGraphicsQueue());
-  cmdTop->begin();
-  DebugUtils::SetObjectName(
-    cmdTop->buffer, "Single Time Top Acceleration structure command buffer", _device->getHandle().device);
-  createTopLevelStructures(cmdTop->buffer);
-  cmdTop->end();
-  vkDestroyCommandPool(_device->getHandle(), pool->getHandle(), nullptr);
+  _deletionQueue.push(
+    [=]()
+    {
+      for (auto& [mesh, entry] : _bottomLevelCache)
+      {
+        if (entry.handle != VK_NULL_HANDLE)
+        {
+          auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+            _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+          destroyAccelerationStructureKHR(_device->getHandle(), entry.handle, nullptr);
+        }
+        this->destroyBuffer(entry.buffer);
+      }
+      _bottomLevelCache.clear();
+      for (const std::shared_ptr<ProceduralAsset>& asset : _proceduralAssets)
+      {
+        auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+          _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+        destroyAccelerationStructureKHR(_device->getHandle(), asset->bottomLevel.handle, nullptr);
+        this->destroyBuffer(asset->bottomLevel.buffer);
+        this->destroyBuffer(asset->primitiveBuffer);
+      }
+      _proceduralAssets.clear();
+    });
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::createBottomLevelStructures(VkCommandBuffer cmd)
+void VkEngine::buildBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes)
 {
+  if (this->isSoftwareRaytracing())
+  {
+    this->buildSoftwareBottomLevelStructures(meshes);
+    return;
+  }
+
   // Bottom level acceleration structure
-  // Triangles via vertex buffers.
-  uint32_t vertexOffset = 0;
-  uint32_t indexOffset = 0;
-  for (auto mesh : _testMeshes)
+  // Triangles via the ranges of the meshes in the geometry arenas. A mesh already in the cache keeps its BLAS.
+  std::vector<BottomLevelAccelerationStructure> structures;
+  std::vector<const MeshAsset*> builtMeshes;
+  std::vector<std::string> names;
+  for (const std::shared_ptr<MeshAsset>& mesh : meshes)
   {
+    if (_bottomLevelCache.contains(mesh.get()) ||
+        std::find(builtMeshes.begin(), builtMeshes.end(), mesh.get()) != builtMeshes.end())
+    {
+      continue;
+    }
+
     std::vector<VkAccelerationStructureBuildRangeInfoKHR> offsetInfos;
     std::vector<VkAccelerationStructureGeometryKHR> geometries;
     // Only triangle meshes for now
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR};
     triangles.pNext = nullptr;
-    triangles.vertexData.deviceAddress = mesh->meshBuffers.vertexBufferAddress;
+    triangles.vertexData.deviceAddress = _vertexArena->address(mesh->meshBuffers.vertexRange);
     triangles.vertexStride = sizeof(Vertex);
     triangles.maxVertex = mesh->meshBuffers.vertexCount;
     triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-    triangles.indexData.deviceAddress = mesh->meshBuffers.indexBufferAddress;
+    triangles.indexData.deviceAddress = _indexArena->address(mesh->meshBuffers.indexRange);
     triangles.indexType = VK_INDEX_TYPE_UINT32;
     // Indicate identity transform by setting transformData to null device pointer.
     triangles.transformData = {};
@@ -1172,146 +2082,864 @@ void VkEngine::createBottomLevelStructures(VkCommandBuffer cmd)
     geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
     geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
 
-    geometries.push_back(geometry);
+    // One geometry per surface, so that gl_GeometryIndexEXT finds the surface and its material.
+    // Only the full detail surfaces are traced, they are stored before the LOD ranges in the index buffer
+    for (const GeoSurface& surface : mesh->surfaces)
+    {
+      geometries.push_back(geometry);
+
+      VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo = {};
+      buildOffsetInfo.firstVertex = 0;
+      buildOffsetInfo.primitiveOffset = surface.startIndex * sizeof(uint32_t);
+      buildOffsetInfo.primitiveCount = surface.count / 3;  // Triangles => 3 vertices
+      buildOffsetInfo.transformOffset = 0;
+      offsetInfos.push_back(buildOffsetInfo);
+    }
 
-    VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo = {};
-    buildOffsetInfo.firstVertex = vertexOffset / sizeof(Vertex);
-    buildOffsetInfo.primitiveOffset = indexOffset;
-    buildOffsetInfo.primitiveCount = mesh->meshBuffers.indexCount / 3;  // Triangles => 3 vertices
-    buildOffsetInfo.transformOffset = 0;
+    structures.emplace_back(BottomLevelAccelerationStructure{_device, _raytracingProperties, geometries, offsetInfos});
+    builtMeshes.push_back(mesh.get());
+    names.push_back(mesh->name);
+  }
 
-    offsetInfos.push_back(buildOffsetInfo);
-    _bottomAS.emplace_back(BottomLevelAccelerationStructure{_device, _raytracingProperties, geometries, offsetInfos});
+  if (structures.empty())
+  {
+    return;
+  }
 
-    vertexOffset += mesh->meshBuffers.vertexCount * sizeof(Vertex);
-    indexOffset += mesh->meshBuffers.indexCount * sizeof(uint32_t);
+  const std::vector<BottomLevelEntry> entries = this->buildBottomLevelBatch(structures, names);
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    _bottomLevelCache.emplace(builtMeshes[i], entries[i]);
   }
+}
 
-  // Allocate memory for bottom acceleration structure
-  const auto total = GetTotalRequirements(_bottomAS);
-  _bottomBuffer = this->createBuffer(
+//--------------------------------------------------------------------------------------------------
+std::vector<BottomLevelEntry> VkEngine::buildBottomLevelBatch(
+  std::span<BottomLevelAccelerationStructure> structures,
+  std::span<const std::string> names)
+{
+  // Allocate memory for bottom acceleration structure, only until the structures are compacted
+  const auto total = GetTotalRequirements(structures);
+  AllocatedBuffer buildBuffer = this->createBuffer(
     total.accelerationStructureSize,
     VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-    VMA_MEMORY_USAGE_AUTO);
-  DebugUtils::SetObjectName(_bottomBuffer.buffer, "BLAS structure buffer", _device->getHandle());
-
-  _scratchBuffer = this->createBuffer(
-    total.buildScratchSize,
-    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-    VMA_MEMORY_USAGE_AUTO);
-  DebugUtils::SetObjectName(_bottomBuffer.buffer, "BLAS scratch buffer", _device->getHandle());
-
-  // Generate the structures.
-  VkDeviceSize resultOffset = 0;
-  VkDeviceSize scratchOffset = 0;
-
-  int index = 0;
-  for (BottomLevelAccelerationStructure& accelerationStructure : _bottomAS)
-  {
-    accelerationStructure.Generate(_device, cmd, _scratchBuffer, scratchOffset, _bottomBuffer, resultOffset);
-    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
-    vkCmdPipelineBarrier(
-      cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
-
-    DebugUtils::SetObjectName(
-      accelerationStructure._handle, ("BLAS #" + std::to_string(index)).c_str(), _device->getHandle());
+    MemoryIntent::GpuOnly);
+  DebugUtils::SetObjectName(buildBuffer.buffer, "BLAS structure buffer", _device->getHandle());
+
+  // the compacted sizes are read back once the builds have executed
+  VkQueryPool compactionQueryPool;
+  VkQueryPoolCreateInfo queryPoolInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+  queryPoolInfo.queryCount = static_cast<uint32_t>(structures.size());
+  VK_CHECK(vkCreateQueryPool(_device->getHandle(), &queryPoolInfo, nullptr, &compactionQueryPool));
+
+  // Generate the structures in batches sharing the scratch buffer, the builds of a batch each get their own region of
+  // it and run in a single command. The barrier ending a batch orders its scratch accesses before the next one.
+  std::vector<VkDeviceSize> scratchSizes;
+  for (const BottomLevelAccelerationStructure& accelerationStructure : structures)
+  {
+    scratchSizes.push_back(accelerationStructure._buildSizesInfo.buildScratchSize);
+  }
+  const std::vector<size_t> batchEnds = _scratchPool->partition(scratchSizes);
 
-    resultOffset += accelerationStructure._buildSizesInfo.accelerationStructureSize;
-    scratchOffset += accelerationStructure._buildSizesInfo.buildScratchSize;
+  VkDeviceSize largestBatch = 0;
+  size_t batchStart = 0;
+  for (size_t batchEnd : batchEnds)
+  {
+    VkDeviceSize batchSize = 0;
+    for (size_t i = batchStart; i < batchEnd; i++)
+    {
+      batchSize += scratchSizes[i];
+    }
+    largestBatch = std::max(largestBatch, batchSize);
+    batchStart = batchEnd;
   }
+  const VkDeviceAddress scratchAddress = _scratchPool->acquire(largestBatch);
 
-  // Fill deletion queue with Acceleration structure
-  _deletionQueue.push(
-    [=]()
+  this->immediateSubmit(
+    [&](VkCommandBuffer cmd)
     {
-      for (auto accelerationStructure : _bottomAS)
+      VkDeviceSize resultOffset = 0;
+      size_t batchStart = 0;
+      for (size_t batchEnd : batchEnds)
       {
-        auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
-          _device->getHandle(), "vkDestroyAccelerationStructureKHR");
-        destroyAccelerationStructureKHR(_device->getHandle(), accelerationStructure._handle, nullptr);
+        VkDeviceSize scratchOffset = 0;
+        for (size_t i = batchStart; i < batchEnd; i++)
+        {
+          BottomLevelAccelerationStructure& accelerationStructure = structures[i];
+          accelerationStructure.prepareBuild(_device, scratchAddress + scratchOffset, buildBuffer, resultOffset);
+
+          resultOffset += accelerationStructure._buildSizesInfo.accelerationStructureSize;
+          scratchOffset += accelerationStructure._buildSizesInfo.buildScratchSize;
+        }
+
+        BottomLevelAccelerationStructure::BuildBatch(
+          _device,
+          cmd,
+          std::span(structures).subspan(batchStart, batchEnd - batchStart),
+          compactionQueryPool,
+          static_cast<uint32_t>(batchStart));
+        batchStart = batchEnd;
       }
-      vmaDestroyBuffer(_allocator, _bottomBuffer.buffer, _bottomBuffer.allocation);
-      vmaDestroyBuffer(_allocator, _scratchBuffer.buffer, _scratchBuffer.allocation);
     });
+
+  _bottomBuildSize += total.accelerationStructureSize;
+  std::vector<BottomLevelEntry> entries = this->compactBottomLevelStructures(structures, names, compactionQueryPool);
+
+  // the compacting copies have executed, the built structures are no longer used
+  vkDestroyQueryPool(_device->getHandle(), compactionQueryPool, nullptr);
+  this->destroyBuffer(buildBuffer);
+  return entries;
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::createTopLevelStructures(VkCommandBuffer cmd)
+std::vector<BottomLevelEntry> VkEngine::compactBottomLevelStructures(
+  std::span<BottomLevelAccelerationStructure> structures,
+  std::span<const std::string> names,
+  VkQueryPool queryPool)
 {
-  //Top level acceleration structure
-  std::vector<VkAccelerationStructureInstanceKHR> instances;
+  std::vector<VkDeviceSize> compactedSizes(structures.size());
+  VK_CHECK(vkGetQueryPoolResults(
+    _device->getHandle(),
+    queryPool,
+    0,
+    static_cast<uint32_t>(compactedSizes.size()),
+    compactedSizes.size() * sizeof(VkDeviceSize),
+    compactedSizes.data(),
+    sizeof(VkDeviceSize),
+    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+  // each structure gets its own buffer, so that it can be released with the last scene using its mesh
+  std::vector<BottomLevelEntry> entries;
+  VkDeviceSize buildTotal = 0;
+  VkDeviceSize compactedTotal = 0;
+  for (size_t i = 0; i < structures.size(); i++)
+  {
+    BottomLevelEntry entry{};
+    entry.buffer = this->createBuffer(
+      compactedSizes[i],
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::GpuOnly);
+    entry.size = compactedSizes[i];
+    entry.buildSize = structures[i]._buildSizesInfo.accelerationStructureSize;
+    DebugUtils::SetObjectName(
+      entry.buffer.buffer, ("BLAS compacted structure buffer " + names[i]).c_str(), _device->getHandle());
+    entries.push_back(entry);
+    buildTotal += entry.buildSize;
+    compactedTotal += entry.size;
+  }
 
-  // Hit group 0: triangles
-  // Hit group 1: procedurals for now not implemented
-  uint32_t instanceId = 0;
+  std::vector<VkAccelerationStructureKHR> builtHandles;
+  this->immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      for (size_t i = 0; i < structures.size(); i++)
+      {
+        builtHandles.push_back(structures[i].compact(_device, cmd, entries[i].buffer, 0, compactedSizes[i]));
+      }
+    });
 
-  for (auto mesh : _testMeshes)
+  // immediateSubmit waits for the copies, the built structures are no longer used
+  auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+    _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+  for (VkAccelerationStructureKHR handle : builtHandles)
   {
-    uint32_t mask = mesh->name == _selectedNodeName ? 0xFF : 0x0;
-    ;  // The visibility mask is always set of 0xFF, but if some instances would need to be ignored in some cases, this flag should be passed by the application.
-    instances.push_back(
-      TopLevelAccelerationStructure::CreateInstance(_device, _bottomAS[instanceId], glm::mat4(1), instanceId, 0, mask));
-    instanceId++;
-  }
-  const VkMemoryAllocateFlags allocateFlags = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                                              VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
-  const auto contentSize = sizeof(instances[0]) * instances.size();
-
-  _instancesBuffer = this->createBuffer(contentSize, allocateFlags, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
-  // Create and copy instances buffer (do it in a separate one-time synchronous command buffer).
-  this->copyBuffer(cmd, _instancesBuffer, instances);
-
-  // Make sure the copy of the instance buffer are copied before triggering the acceleration structure build
-  VkMemoryBarrier copyBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-  copyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  copyBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-  vkCmdPipelineBarrier(
-    cmd,
-    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+    destroyAccelerationStructureKHR(_device->getHandle(), handle, nullptr);
+  }
+
+  for (size_t i = 0; i < structures.size(); i++)
+  {
+    entries[i].handle = structures[i]._handle;
+    entries[i].address = TopLevelAccelerationStructure::GetDeviceAddress(_device, structures[i]);
+    DebugUtils::SetObjectName(entries[i].handle, ("BLAS " + names[i]).c_str(), _device->getHandle());
+  }
+  _bottomCompactedSize += compactedTotal;
+
+  fmt::println(
+    "BLAS compaction: {} KiB -> {} KiB ({} structures)",
+    buildTotal / 1024,
+    compactedTotal / 1024,
+    structures.size());
+  return entries;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::buildSoftwareBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes)
+{
+  VkDeviceSize total = 0;
+  size_t builtCount = 0;
+  for (const std::shared_ptr<MeshAsset>& mesh : meshes)
+  {
+    if (_bottomLevelCache.contains(mesh.get()))
+    {
+      continue;
+    }
+
+    // the arenas only live on the device, the BVH is built from a copy of the triangles
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    this->readMeshGeometry(*mesh, vertices, indices);
+
+    // as the geometries of a BLAS, one per full detail surface
+    std::vector<GPUBvhTriangle> triangles;
+    std::vector<vkutil::BvhBounds> primitives;
+    vkutil::BvhBounds meshBounds;
+    for (uint32_t surfaceIndex = 0; surfaceIndex < mesh->surfaces.size(); surfaceIndex++)
+    {
+      const GeoSurface& surface = mesh->surfaces[surfaceIndex];
+      for (uint32_t triangle = 0; triangle < surface.count / 3; triangle++)
+      {
+        const uint32_t* corners = indices.data() + surface.startIndex + triangle * 3;
+        GPUBvhTriangle bvhTriangle{
+          vertices[corners[0]].position,
+          surfaceIndex,
+          vertices[corners[1]].position,
+          triangle,
+          vertices[corners[2]].position,
+          0};
+        vkutil::BvhBounds bounds;
+        bounds.grow(bvhTriangle.v0);
+        bounds.grow(bvhTriangle.v1);
+        bounds.grow(bvhTriangle.v2);
+        meshBounds.grow(bounds);
+        triangles.push_back(bvhTriangle);
+        primitives.push_back(bounds);
+      }
+    }
+
+    std::vector<uint32_t> order;
+    const std::vector<GPUBvhNode> nodes = vkutil::buildBvh(primitives, order, std::thread::hardware_concurrency());
+    std::vector<GPUBvhTriangle> orderedTriangles(triangles.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      orderedTriangles[i] = triangles[order[i]];
+    }
+
+    const VkDeviceSize nodesSize = nodes.size() * sizeof(GPUBvhNode);
+    const VkDeviceSize trianglesSize = orderedTriangles.size() * sizeof(GPUBvhTriangle);
+    BottomLevelEntry entry{};
+    entry.size = nodesSize + trianglesSize;
+    entry.buildSize = entry.size;
+    entry.bounds = meshBounds;
+    entry.buffer = this->createBuffer(
+      entry.size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      MemoryIntent::Static);
+    DebugUtils::SetObjectName(entry.buffer.buffer, ("Software BVH " + mesh->name).c_str(), _device->getHandle());
+    const std::array<BufferWrite, 2> writes{
+      BufferWrite{&entry.buffer, 0, nodes.data(), nodesSize},
+      BufferWrite{&entry.buffer, nodesSize, orderedTriangles.data(), trianglesSize}};
+    this->writeBuffers(writes);
+
+    VkBufferDeviceAddressInfo addressInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = entry.buffer.buffer};
+    entry.address = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo);
+    entry.triangleAddress = entry.address + nodesSize;
+    _bottomLevelCache.emplace(mesh.get(), entry);
+    total += entry.size;
+    builtCount++;
+  }
+
+  if (builtCount == 0)
+  {
+    return;
+  }
+  _bottomBuildSize += total;
+  _bottomCompactedSize += total;
+  fmt::println("Software BVH: {} KiB ({} meshes)", total / 1024, builtCount);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::readMeshGeometry(const MeshAsset& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+  const GPUMeshBuffers& buffers = mesh.meshBuffers;
+  const std::vector<std::byte> vertexData = this->readBuffer(
+    _vertexArena->_buffer,
+    static_cast<VkDeviceSize>(_vertexArena->offset(buffers.vertexRange)) * sizeof(Vertex),
+    static_cast<VkDeviceSize>(buffers.vertexCount) * sizeof(Vertex));
+  const std::vector<std::byte> indexData = this->readBuffer(
+    _indexArena->_buffer,
+    static_cast<VkDeviceSize>(_indexArena->offset(buffers.indexRange)) * sizeof(uint32_t),
+    static_cast<VkDeviceSize>(buffers.indexCount) * sizeof(uint32_t));
+  vertices.resize(buffers.vertexCount);
+  indices.resize(buffers.indexCount);
+  memcpy(vertices.data(), vertexData.data(), vertexData.size());
+  memcpy(indices.data(), indexData.data(), indexData.size());
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::releaseBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes)
+{
+  for (const std::shared_ptr<MeshAsset>& mesh : meshes)
+  {
+    const auto it = _bottomLevelCache.find(mesh.get());
+    if (it == _bottomLevelCache.end())
+    {
+      continue;
+    }
+
+    // the frame in flight may still trace the structure
+    const BottomLevelEntry entry = it->second;
+    this->getCurrentFrame()->_deletionQueue.push(
+      [=, this]()
+      {
+        if (entry.handle != VK_NULL_HANDLE)
+        {
+          auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+            _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+          destroyAccelerationStructureKHR(_device->getHandle(), entry.handle, nullptr);
+        }
+        this->destroyBuffer(entry.buffer);
+      });
+    _bottomBuildSize -= entry.buildSize;
+    _bottomCompactedSize -= entry.size;
+    _bottomLevelCache.erase(it);
+  }
+  _isTopLevelDirty = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool VkEngine::loadScene(const std::filesystem::path& path)
+{
+  std::optional<std::shared_ptr<LoadedGLTF>> scene = vkloader::loadGltf(this, path.string());
+  if (!scene.has_value())
+  {
+    fmt::println("Failed to load the scene {}", path.string());
+    return false;
+  }
+
+  // a file loaded again replaces its scene
+  const std::string name = path.stem().string();
+  this->removeScene(name);
+  this->addScene(name, std::move(scene.value()));
+  _selectedSceneName = name;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::addScene(const std::string& name, std::shared_ptr<LoadedGLTF> scene)
+{
+  // only the meshes of the new scene are built, the instances of every scene are gathered again
+  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  for (const auto& [meshName, mesh] : scene->meshes)
+  {
+    meshes.push_back(mesh);
+  }
+  this->buildBottomLevelStructures(meshes);
+
+  _loadedScenes[name] = std::move(scene);
+  _isTopLevelDirty = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::removeScene(const std::string& name)
+{
+  const auto it = _loadedScenes.find(name);
+  if (it == _loadedScenes.end())
+  {
+    return;
+  }
+
+  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  for (const auto& [meshName, mesh] : it->second->meshes)
+  {
+    meshes.push_back(mesh);
+  }
+  this->releaseBottomLevelStructures(meshes);
+
+  // the frame in flight may still draw the meshes of the scene, it is destroyed with the resources of that frame
+  std::shared_ptr<LoadedGLTF> scene = it->second;
+  this->getCurrentFrame()->_deletionQueue.push([scene]() {});
+  _loadedScenes.erase(it);
+
+  if (_selectedSceneName == name)
+  {
+    _selectedSceneName.clear();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+std::shared_ptr<ProceduralAsset> VkEngine::addProcedurals(
+  const std::string& name,
+  std::span<const GPUProceduralPrimitive> primitives,
+  std::vector<GPURaytracingMaterial> materials,
+  const glm::mat4& transform)
+{
+  if (this->isSoftwareRaytracing() || primitives.empty())
+  {
+    fmt::println("Procedural primitives {} are not traced without the ray tracing pipeline", name);
+    return nullptr;
+  }
+
+  auto asset = std::make_shared<ProceduralAsset>();
+  asset->name = name;
+  asset->primitiveCount = static_cast<uint32_t>(primitives.size());
+  asset->materials = std::move(materials);
+  asset->transform = transform;
+  asset->isVisible = true;
+
+  // read by the BLAS build as its AABB, then by the hit shaders
+  const VkDeviceSize size = primitives.size_bytes();
+  asset->primitiveBuffer = this->createBuffer(
+    size,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    MemoryIntent::Static);
+  DebugUtils::SetObjectName(asset->primitiveBuffer.buffer, ("Procedurals " + name).c_str(), _device->getHandle());
+  const BufferWrite write{&asset->primitiveBuffer, 0, primitives.data(), size};
+  this->writeBuffers({&write, 1});
+  VkBufferDeviceAddressInfo addressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = asset->primitiveBuffer.buffer};
+  asset->primitiveAddress = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo);
+
+  // A single geometry of boxes, the intersection shader finds the primitive in them
+  VkAccelerationStructureGeometryAabbsDataKHR aabbs{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR};
+  aabbs.data.deviceAddress = asset->primitiveAddress;
+  aabbs.stride = sizeof(GPUProceduralPrimitive);
+  VkAccelerationStructureGeometryKHR geometry = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+  geometry.geometry.aabbs = aabbs;
+  geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
+  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+  VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo = {};
+  buildOffsetInfo.primitiveCount = asset->primitiveCount;
+
+  std::vector<VkAccelerationStructureGeometryKHR> geometries{geometry};
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> offsetInfos{buildOffsetInfo};
+  std::vector<BottomLevelAccelerationStructure> structures;
+  structures.emplace_back(BottomLevelAccelerationStructure{_device, _raytracingProperties, geometries, offsetInfos});
+  const std::array<std::string, 1> names{name};
+  asset->bottomLevel = this->buildBottomLevelBatch(structures, names).front();
+
+  _proceduralAssets.push_back(asset);
+  _isTopLevelDirty = true;
+  return asset;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::removeProcedurals(const std::string& name)
+{
+  const auto it = std::find_if(
+    _proceduralAssets.begin(),
+    _proceduralAssets.end(),
+    [&](const std::shared_ptr<ProceduralAsset>& asset) { return asset->name == name; });
+  if (it == _proceduralAssets.end())
+  {
+    return;
+  }
+
+  // the frame in flight may still trace the primitives
+  const std::shared_ptr<ProceduralAsset> asset = *it;
+  this->getCurrentFrame()->_deletionQueue.push(
+    [=, this]()
+    {
+      auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+        _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+      destroyAccelerationStructureKHR(_device->getHandle(), asset->bottomLevel.handle, nullptr);
+      this->destroyBuffer(asset->bottomLevel.buffer);
+      this->destroyBuffer(asset->primitiveBuffer);
+    });
+  _bottomBuildSize -= asset->bottomLevel.buildSize;
+  _bottomCompactedSize -= asset->bottomLevel.size;
+  _proceduralAssets.erase(it);
+  _isTopLevelDirty = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::initProceduralParticles()
+{
+  constexpr uint32_t particleCount = 1 << 16;
+  const std::vector<GPURaytracingMaterial> materials = {
+    {glm::vec4(0.9f, 0.3f, 0.2f, 1.f), glm::vec4(0.f, 0.4f, 0.f, 0.f)},
+    {glm::vec4(0.2f, 0.6f, 0.9f, 1.f), glm::vec4(0.f, 0.2f, 0.f, 0.f)},
+    {glm::vec4(0.95f, 0.8f, 0.4f, 1.f), glm::vec4(1.f, 0.3f, 0.f, 0.f)}};
+
+  // a flat ring of small spheres, one in four a box, the same every run
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  std::vector<GPUProceduralPrimitive> primitives(particleCount);
+  for (uint32_t i = 0; i < particleCount; i++)
+  {
+    const float angle = unit(generator) * glm::two_pi<float>();
+    const float distance = 2.f + unit(generator) * 1.5f;
+    const glm::vec3 center(std::cos(angle) * distance, (unit(generator) - 0.5f) * 0.3f, std::sin(angle) * distance);
+    const float radius = 0.005f + unit(generator) * 0.02f;
+    primitives[i] = GPUProceduralPrimitive{
+      center - radius,
+      center + radius,
+      i % 4 == 0 ? PROCEDURAL_BOX : PROCEDURAL_SPHERE,
+      static_cast<uint32_t>(i % materials.size())};
+  }
+
+  const std::shared_ptr<ProceduralAsset> particles =
+    this->addProcedurals("Particles", primitives, materials, glm::mat4(1.f));
+  if (particles)
+  {
+    particles->isVisible = false;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::createTopLevelStructures(VkCommandBuffer cmd)
+{
+  //Top level acceleration structure
+  this->gatherTopLevelInstances();
+  this->updateTopLevelStructure(cmd);
+
+  _deletionQueue.push(
+    [=]()
+    {
+      for (auto accelerationStructure : _topAS)
+      {
+        auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+          _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+        destroyAccelerationStructureKHR(_device->getHandle(), accelerationStructure._handle, nullptr);
+      }
+      this->destroyBuffer(_instanceRing);
+      this->destroyBuffer(_topBuffer);
+      if (_raytracingSceneCapacity > 0)
+      {
+        this->destroyBuffer(_raytracingSceneBuffer);
+      }
+      if (_softwareTopCapacity > 0)
+      {
+        this->destroyBuffer(_softwareTopBuffer);
+      }
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+bool VkEngine::gatherTopLevelInstances()
+{
+  // One instance per node holding a mesh, the nodes of a same mesh share its BLAS and its geometries in the table. The
+  // geometries have a hit record each in the shader binding table, an instance points at the one of its first geometry.
+  // The hit group of a record is the one of its geometry in _raytracingHitGroups: 0 for the triangles, 1 for the
+  // procedurals, spheres and boxes of the procedural assets.
+  std::vector<VkAccelerationStructureInstanceKHR> instances;
+  _raytracingInstances.clear();
+  _raytracingGeometries.clear();
+  _raytracingMaterials.clear();
+  _raytracingHitGroups.clear();
+  std::unordered_map<const MeshAsset*, uint32_t> firstGeometries;
+  std::unordered_map<const GLTFMaterial*, uint32_t> materialIds;
+
+  auto addInstance = [&](const MeshAsset* mesh, const glm::mat4& transform, uint32_t mask)
+  {
+    const auto entry = _bottomLevelCache.find(mesh);
+    if (entry == _bottomLevelCache.end())
+    {
+      return;
+    }
+
+    auto [firstGeometry, isNewMesh] =
+      firstGeometries.try_emplace(mesh, static_cast<uint32_t>(_raytracingGeometries.size()));
+    if (isNewMesh)
+    {
+      // same order as the geometries of the BLAS
+      for (const GeoSurface& surface : mesh->surfaces)
+      {
+        auto [materialId, isNewMaterial] =
+          materialIds.try_emplace(surface.material.get(), static_cast<uint32_t>(_raytracingMaterials.size()));
+        if (isNewMaterial)
+        {
+          // the surfaces without a material are a rough dielectric, a metal would only reflect the dark sky
+          _raytracingMaterials.push_back(
+            surface.material ? GPURaytracingMaterial{surface.material->colorFactors, surface.material->metalRoughFactors}
+                             : GPURaytracingMaterial{glm::vec4(1.f), glm::vec4(0.f, 0.5f, 0.f, 0.f)});
+        }
+
+        _raytracingGeometries.push_back(
+          {_vertexArena->address(mesh->meshBuffers.vertexRange),
+           _indexArena->address(mesh->meshBuffers.indexRange),
+           surface.startIndex,
+           materialId->second});
+        _raytracingHitGroups.push_back(0);
+      }
+    }
+
+    // the custom index finds the record of the instance
+    const uint32_t instanceId = static_cast<uint32_t>(instances.size());
+    _raytracingInstances.push_back({firstGeometry->second});
+    instances.push_back(TopLevelAccelerationStructure::CreateInstance(
+      entry->second.address, transform, instanceId, firstGeometry->second, mask));
+  };
+
+  // Only the selected node and the selected scene are visible to the rays, as in the raster path
+  for (const std::shared_ptr<MeshAsset>& mesh : _testMeshes)
+  {
+    const auto node = _loadedNodes.find(mesh->name);
+    const glm::mat4 transform = node != _loadedNodes.end() ? node->second->worldTransform : glm::mat4(1.f);
+    addInstance(mesh.get(), transform, mesh->name == _selectedNodeName ? 0xFF : 0x0);
+  }
+
+  for (const auto& [sceneName, scene] : _loadedScenes)
+  {
+    const uint32_t mask = sceneName == _selectedSceneName ? 0xFF : 0x0;
+    for (const auto& [nodeName, node] : scene->nodes)
+    {
+      if (const MeshNode* meshNode = dynamic_cast<const MeshNode*>(node.get()))
+      {
+        addInstance(meshNode->mesh.get(), meshNode->worldTransform, mask);
+      }
+    }
+  }
+
+  // The primitives of a procedural asset take the place of the vertices of its geometry, its materials are its own
+  for (const std::shared_ptr<ProceduralAsset>& asset : _proceduralAssets)
+  {
+    const uint32_t instanceId = static_cast<uint32_t>(instances.size());
+    const uint32_t geometry = static_cast<uint32_t>(_raytracingGeometries.size());
+    _raytracingInstances.push_back({geometry});
+    _raytracingGeometries.push_back(
+      {asset->primitiveAddress, 0, 0, static_cast<uint32_t>(_raytracingMaterials.size())});
+    _raytracingMaterials.insert(_raytracingMaterials.end(), asset->materials.begin(), asset->materials.end());
+    _raytracingHitGroups.push_back(1);
+    instances.push_back(TopLevelAccelerationStructure::CreateInstance(
+      asset->bottomLevel.address, asset->transform, instanceId, geometry, asset->isVisible ? 0xFF : 0x0));
+  }
+
+  const bool hasChanged =
+    instances.size() != _topInstances.size() ||
+    std::memcmp(instances.data(), _topInstances.data(), instances.size() * sizeof(VkAccelerationStructureInstanceKHR)) != 0;
+  _topInstances = std::move(instances);
+  return hasChanged;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateRaytracingSceneTable()
+{
+  // instances, geometries then materials, each on a 16 bytes boundary
+  auto alignUp = [](size_t size) { return (size + 15) & ~size_t(15); };
+  const size_t instancesSize = alignUp(_raytracingInstances.size() * sizeof(GPURaytracingInstance));
+  const size_t geometriesSize = alignUp(_raytracingGeometries.size() * sizeof(GPURaytracingGeometry));
+  const size_t materialsSize = alignUp(_raytracingMaterials.size() * sizeof(GPURaytracingMaterial));
+
+  std::vector<std::byte> data(instancesSize + geometriesSize + materialsSize);
+  memcpy(data.data(), _raytracingInstances.data(), _raytracingInstances.size() * sizeof(GPURaytracingInstance));
+  memcpy(
+    data.data() + instancesSize,
+    _raytracingGeometries.data(),
+    _raytracingGeometries.size() * sizeof(GPURaytracingGeometry));
+  memcpy(
+    data.data() + instancesSize + geometriesSize,
+    _raytracingMaterials.data(),
+    _raytracingMaterials.size() * sizeof(GPURaytracingMaterial));
+
+  if (data.empty())
+  {
+    return;
+  }
+
+  if (data.size() > _raytracingSceneCapacity)
+  {
+    // the frame in flight may still read the old table
+    if (_raytracingSceneCapacity > 0)
+    {
+      AllocatedBuffer oldBuffer = _raytracingSceneBuffer;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    }
+
+    _raytracingSceneCapacity = std::max(data.size(), _raytracingSceneCapacity * 2);
+    _raytracingSceneBuffer = this->createBuffer(
+      FRAME_OVERLAP * _raytracingSceneCapacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::Dynamic);
+    DebugUtils::SetObjectName(_raytracingSceneBuffer.buffer, "Raytracing scene table", _device->getHandle());
+    for (std::vector<std::byte>& sliceData : _raytracingSceneData)
+    {
+      sliceData.clear();
+    }
+  }
+
+  // every frame reads the slice of its slot
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  const VkDeviceSize sliceOffset = slot * _raytracingSceneCapacity;
+  VkBufferDeviceAddressInfo addressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _raytracingSceneBuffer.buffer};
+  const VkDeviceAddress address = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo) + sliceOffset;
+  _raytracingSceneAddresses.instanceBuffer = address;
+  _raytracingSceneAddresses.geometryBuffer = address + instancesSize;
+  _raytracingSceneAddresses.materialBuffer = address + instancesSize + geometriesSize;
+
+  // the table only changes with the set of instances, or when the geometry arenas move the meshes; a slice catches up
+  // with the changes written by the other frames
+  if (data == _raytracingSceneData[slot])
+  {
+    return;
+  }
+
+  const BufferWrite write{&_raytracingSceneBuffer, sliceOffset, data.data(), data.size()};
+  this->writeBuffers({&write, 1});
+  _raytracingSceneData[slot] = std::move(data);
+
+  this->updateShaderBindingTable();
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateShaderBindingTable()
+{
+  // without the ray tracing pipeline
+  if (!_shaderBindingTable)
+  {
+    return;
+  }
+
+  // The hit shaders read their geometry and its material from the inline data of the record, the procedural ones still
+  // find the materials of their primitives in the scene table
+  std::vector<ShaderBindingTable::Entry> hitGroups(_raytracingGeometries.size());
+  for (size_t i = 0; i < hitGroups.size(); i++)
+  {
+    const GPURaytracingGeometry& geometry = _raytracingGeometries[i];
+    const GPURaytracingHitRecord record{_raytracingMaterials[geometry.materialId], geometry};
+    hitGroups[i].GroupIndex = _raytracingHitGroups[i] == 0 ? _raytracingPipeline->_triangleHitGroupIndex
+                                                           : _raytracingPipeline->_proceduralHitGroupIndex;
+    hitGroups[i].InlineData.resize(sizeof(record));
+    memcpy(hitGroups[i].InlineData.data(), &record, sizeof(record));
+  }
+
+  auto isSameRecord = [](const ShaderBindingTable::Entry& a, const ShaderBindingTable::Entry& b)
+  { return a.GroupIndex == b.GroupIndex && a.InlineData == b.InlineData; };
+
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  std::vector<ShaderBindingTable::Entry>& records = _hitGroupRecords[slot];
+  if (hitGroups.size() != records.size())
+  {
+    // the frame in flight may still trace with the old table, the new one is written in every slice
+    AllocatedBuffer oldBuffer = _shaderBindingTable->_handle;
+    this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    _shaderBindingTable = this->createShaderBindingTable(hitGroups);
+    _hitGroupRecords.fill(hitGroups);
+    return;
+  }
+
+  // Only the records between the first and the last that changed are written again, as when a material is edited. The
+  // slice of this frame is compared to the records it was last written with, it catches up with the other frames.
+  const auto first = std::mismatch(hitGroups.begin(), hitGroups.end(), records.begin(), isSameRecord);
+  if (first.first == hitGroups.end())
+  {
+    return;
+  }
+  const auto last = std::mismatch(hitGroups.rbegin(), hitGroups.rend(), records.rbegin(), isSameRecord);
+  const std::vector<ShaderBindingTable::Entry> changedRecords(first.first, last.first.base());
+  _shaderBindingTable->updateHitGroups(
+    _allocator, _raytracingProperties, slot, first.first - hitGroups.begin(), changedRecords);
+  records = std::move(hitGroups);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateTopLevelStructure(VkCommandBuffer cmd)
+{
+  if (this->isSoftwareRaytracing())
+  {
+    this->updateSoftwareTopLevelStructure();
+    return;
+  }
+
+  auto start = std::chrono::system_clock::now();
+  const uint32_t instanceCount = static_cast<uint32_t>(_topInstances.size());
+  constexpr VkDeviceSize instanceSize = sizeof(VkAccelerationStructureInstanceKHR);
+
+  if (instanceCount > _instanceRingCapacity || _instanceRing.buffer == VK_NULL_HANDLE)
+  {
+    // the frame in flight may still build from the old ring
+    if (_instanceRing.buffer != VK_NULL_HANDLE)
+    {
+      AllocatedBuffer oldRing = _instanceRing;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldRing); });
+    }
+
+    _instanceRingCapacity = std::max({instanceCount, _instanceRingCapacity * 2, 1u});
+    _instanceRing = this->createBuffer(
+      FRAME_OVERLAP * _instanceRingCapacity * instanceSize,
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::Dynamic);
+    DebugUtils::SetObjectName(_instanceRing.buffer, "TLAS instance ring", _device->getHandle());
+    VkBufferDeviceAddressInfo addressInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _instanceRing.buffer};
+    _instanceRingAddress = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo);
+  }
+
+  // written in place through the persistent mapping, the build reads the slice of this frame
+  const VkDeviceSize sliceOffset = (_frameNumber % FRAME_OVERLAP) * _instanceRingCapacity * instanceSize;
+  memcpy((char*)_instanceRing.info.pMappedData + sliceOffset, _topInstances.data(), instanceCount * instanceSize);
+  VK_CHECK(vmaFlushAllocation(_allocator, _instanceRing.allocation, sliceOffset, instanceCount * instanceSize));
+  const VkDeviceAddress instanceAddress = _instanceRingAddress + sliceOffset;
+
+  // The structure and the scratch regions are shared by the frames: the previous one must be done tracing through
+  // them and building them before they are written again
+  VkMemoryBarrier reuseBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  reuseBarrier.srcAccessMask =
+    VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  reuseBarrier.dstAccessMask =
+    VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  vkCmdPipelineBarrier(
+    cmd,
+    this->raytracingStages() | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
     0,
     1,
-    &copyBarrier,
+    &reuseBarrier,
     0,
     nullptr,
     0,
     nullptr);
-  VkBufferDeviceAddressInfo addressInfo = {};
-  addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-  addressInfo.pNext = nullptr;
-  addressInfo.buffer = _instancesBuffer.buffer;
-  VkDeviceAddress instancesBufferAdress = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo);
-  _topAS.emplace_back(
-    TopLevelAccelerationStructure{
-      _device, _raytracingProperties, _instancesBuffer, 0, instancesBufferAdress, static_cast<uint32_t>(instances.size())});
-
-  // Allocate the structure memory.
-  const auto total = GetTotalRequirements(_topAS);
-  _topBuffer = this->createBuffer(
-    total.accelerationStructureSize,
-    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
-  _topScratchBuffer = this->createBuffer(
-    total.buildScratchSize,
-    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
 
-  // Generate the structures.
-  _topAS[0].Generate(_device, cmd, _topScratchBuffer, 0, _topBuffer, 0);
+  if (_topAS.empty() || _topAS[0].instancesCount() != instanceCount)
+  {
+    // instances were added or removed, the size of the structure changes: it is recreated and fully built
+    const bool isReplaced = !_topAS.empty();
+    if (isReplaced)
+    {
+      const VkAccelerationStructureKHR oldHandle = _topAS[0]._handle;
+      const AllocatedBuffer oldBuffer = _topBuffer;
+      this->getCurrentFrame()->_deletionQueue.push(
+        [=, this]()
+        {
+          auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
+            _device->getHandle(), "vkDestroyAccelerationStructureKHR");
+          destroyAccelerationStructureKHR(_device->getHandle(), oldHandle, nullptr);
+          this->destroyBuffer(oldBuffer);
+        });
+      _topAS.clear();
+    }
+
+    _topAS.emplace_back(
+      TopLevelAccelerationStructure{_device, _raytracingProperties, _topBuffer, 0, instanceAddress, instanceCount});
+    _topBuffer = this->createBuffer(
+      _topAS[0]._buildSizesInfo.accelerationStructureSize,
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      MemoryIntent::GpuOnly);
+    DebugUtils::SetObjectName(_topBuffer.buffer, "TLAS structure buffer", _device->getHandle());
+
+    _topAS[0].Generate(
+      _device, cmd, _scratchPool->acquire(_topAS[0]._buildSizesInfo.buildScratchSize), _topBuffer, 0);
+    _topRebuildCount++;
+  }
+  else if (_isTopRefitEnabled && !_isTopLevelDirty)
+  {
+    // only the transforms changed, the structure is refitted in place
+    _topAS[0].Build(
+      _device, cmd, instanceAddress, _scratchPool->acquire(_topAS[0]._buildSizesInfo.updateScratchSize), true);
+    _topRefitCount++;
+  }
+  else
+  {
+    // a scene was added or removed and the instances may point to other BLAS, or the refit is disabled: the structure
+    // is fully built again
+    _topAS[0].Build(
+      _device, cmd, instanceAddress, _scratchPool->acquire(_topAS[0]._buildSizesInfo.buildScratchSize), false);
+    _topRebuildCount++;
+  }
+  _isTopLevelDirty = false;
 
   // Make sure to have the TLAS ready before using it
   VkMemoryBarrier readyBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-  readyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  readyBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
   readyBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
   vkCmdPipelineBarrier(
     cmd,
     VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+    VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
     0,
     1,
     &readyBarrier,
@@ -1320,19 +2948,134 @@ void VkEngine::createTopLevelStructures(VkCommandBuffer cmd)
     0,
     nullptr);
 
-  _deletionQueue.push(
-    [=]()
+  auto end = std::chrono::system_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  _stats.accelerationStructureTime = elapsed.count() / 1000.f;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateSoftwareTopLevelStructure()
+{
+  // the BVH only changes with the instances, a moved instance gets a new transform and so new bounds
+  const bool hasChanged =
+    _isTopLevelDirty || _softwareTopCapacity == 0 || _topInstances.size() != _softwareTopInstances.size() ||
+    std::memcmp(
+      _topInstances.data(),
+      _softwareTopInstances.data(),
+      _topInstances.size() * sizeof(VkAccelerationStructureInstanceKHR)) != 0;
+  if (hasChanged)
+  {
+    this->buildSoftwareTopLevelStructure();
+  }
+
+  // every frame traces the slice of its slot, written once the frame that last traced it is over
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  const VkDeviceSize sliceOffset = slot * _softwareTopCapacity;
+  if (_softwareTopStaleSlots & (1u << slot))
+  {
+    const BufferWrite write{&_softwareTopBuffer, sliceOffset, _softwareTopData.data(), _softwareTopData.size()};
+    this->writeBuffers({&write, 1});
+    _softwareTopStaleSlots &= ~(1u << slot);
+  }
+
+  VkBufferDeviceAddressInfo addressInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = _softwareTopBuffer.buffer};
+  const VkDeviceAddress address = vkGetBufferDeviceAddress(_device->getHandle(), &addressInfo) + sliceOffset;
+  _raytracingSceneAddresses.bvhNodes = address;
+  _raytracingSceneAddresses.bvhInstances = address + _softwareTopNodesSize;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::buildSoftwareTopLevelStructure()
+{
+  auto start = std::chrono::system_clock::now();
+  std::unordered_map<VkDeviceAddress, const BottomLevelEntry*> entries;
+  for (const auto& [mesh, entry] : _bottomLevelCache)
+  {
+    entries.emplace(entry.address, &entry);
+  }
+
+  // the instances hidden by their mask or without any triangle are left out, as the hardware traversal skips them
+  std::vector<GPUBvhInstance> instances;
+  std::vector<vkutil::BvhBounds> primitives;
+  for (const VkAccelerationStructureInstanceKHR& topInstance : _topInstances)
+  {
+    const auto entry = entries.find(topInstance.accelerationStructureReference);
+    if (topInstance.mask == 0 || entry == entries.end() || entry->second->bounds.isEmpty())
     {
-      for (auto accelerationStructure : _topAS)
+      continue;
+    }
+
+    // back from the row-major 3x4 transform of the instance
+    glm::mat4 objectToWorld(1.f);
+    for (int row = 0; row < 3; row++)
+    {
+      for (int column = 0; column < 4; column++)
       {
-        auto destroyAccelerationStructureKHR = vkloader::loadFunction<PFN_vkDestroyAccelerationStructureKHR>(
-          _device->getHandle(), "vkDestroyAccelerationStructureKHR");
-        destroyAccelerationStructureKHR(_device->getHandle(), accelerationStructure._handle, nullptr);
+        objectToWorld[column][row] = topInstance.transform.matrix[row][column];
       }
-      vmaDestroyBuffer(_allocator, _instancesBuffer.buffer, _instancesBuffer.allocation);
-      vmaDestroyBuffer(_allocator, _topBuffer.buffer, _topBuffer.allocation);
-      vmaDestroyBuffer(_allocator, _topScratchBuffer.buffer, _topScratchBuffer.allocation);
-    });
+    }
+
+    const vkutil::BvhBounds& meshBounds = entry->second->bounds;
+    vkutil::BvhBounds worldBounds;
+    for (int corner = 0; corner < 8; corner++)
+    {
+      const glm::vec3 point(
+        (corner & 1) ? meshBounds.max.x : meshBounds.min.x,
+        (corner & 2) ? meshBounds.max.y : meshBounds.min.y,
+        (corner & 4) ? meshBounds.max.z : meshBounds.min.z);
+      worldBounds.grow(glm::vec3(objectToWorld * glm::vec4(point, 1.f)));
+    }
+
+    instances.push_back(
+      {glm::mat4x3(glm::inverse(objectToWorld)),
+       entry->second->address,
+       entry->second->triangleAddress,
+       topInstance.instanceCustomIndex,
+       0});
+    primitives.push_back(worldBounds);
+  }
+
+  std::vector<uint32_t> order;
+  const std::vector<GPUBvhNode> nodes = vkutil::buildBvh(primitives, order);
+  std::vector<GPUBvhInstance> orderedInstances(instances.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    orderedInstances[i] = instances[order[i]];
+  }
+
+  const size_t nodesSize = nodes.size() * sizeof(GPUBvhNode);
+  const size_t instancesSize = orderedInstances.size() * sizeof(GPUBvhInstance);
+  if (nodesSize + instancesSize > _softwareTopCapacity)
+  {
+    // the frame in flight may still trace the old BVH
+    if (_softwareTopCapacity > 0)
+    {
+      AllocatedBuffer oldBuffer = _softwareTopBuffer;
+      this->getCurrentFrame()->_deletionQueue.push([=, this]() { this->destroyBuffer(oldBuffer); });
+    }
+
+    _softwareTopCapacity = std::max(nodesSize + instancesSize, _softwareTopCapacity * 2);
+    _softwareTopBuffer = this->createBuffer(
+      FRAME_OVERLAP * _softwareTopCapacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      MemoryIntent::Dynamic);
+    DebugUtils::SetObjectName(_softwareTopBuffer.buffer, "Software top level BVH", _device->getHandle());
+  }
+
+  // the nodes then the instances, copied to the slice of every frame in flight
+  _softwareTopData.resize(nodesSize + instancesSize);
+  memcpy(_softwareTopData.data(), nodes.data(), nodesSize);
+  memcpy(_softwareTopData.data() + nodesSize, orderedInstances.data(), instancesSize);
+  _softwareTopNodesSize = nodesSize;
+  _softwareTopStaleSlots = (1u << FRAME_OVERLAP) - 1;
+  _softwareTopInstances = _topInstances;
+  _isTopLevelDirty = false;
+  _topRebuildCount++;
+
+  auto end = std::chrono::system_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  _stats.accelerationStructureTime = elapsed.count() / 1000.f;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1366,11 +3109,15 @@ void VkEngine::initDefaultData()
 
   sampl.magFilter = VK_FILTER_NEAREST;
   sampl.minFilter = VK_FILTER_NEAREST;
+  sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampl.minLod = 0;
+  sampl.maxLod = VK_LOD_CLAMP_NONE;
 
   vkCreateSampler(_device->getHandle(), &sampl, nullptr, &_defaultSamplerNearest);
 
   sampl.magFilter = VK_FILTER_LINEAR;
   sampl.minFilter = VK_FILTER_LINEAR;
+  sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
   vkCreateSampler(_device->getHandle(), &sampl, nullptr, &_defaultSamplerLinear);
 
   _deletionQueue.push(
@@ -1394,13 +3141,15 @@ void VkEngine::initDefaultData()
 
   //set the uniform buffer for the material data
   AllocatedBuffer materialConstants = createBuffer(
-    sizeof(GLTFMetallicRoughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    sizeof(GLTFMetallicRoughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, MemoryIntent::Dynamic);
 
   //write the buffer
   GLTFMetallicRoughness::MaterialConstants* sceneUniformData =
     (GLTFMetallicRoughness::MaterialConstants*)materialConstants.allocation->GetMappedData();
   sceneUniformData->colorFactors = glm::vec4{1, 1, 1, 1};
-  sceneUniformData->metalRoughFactors = glm::vec4{1, 0.5, 0, 0};
+  // a rough dielectric, as in the material table of the ray tracing
+  sceneUniformData->metalRoughFactors = glm::vec4{0, 0.5, 0, 0};
+  this->flushBuffer(materialConstants);
 
   _mainSurfaceProperties.ambientCoefficient = 0.1;
   _mainSurfaceProperties.screenGamma = 2.2;
@@ -1443,16 +3192,14 @@ void VkEngine::initDefaultData()
 void VkEngine::initMainCamera()
 {
   _mainCamera.velocity = glm::vec3(0.f);
-  _mainCamera.position = glm::vec3(0.f, -0.f, 5.f);
+  _mainCamera.position = DEFAULT_CAMERA_POSITION;
   _mainCamera.yaw = 0;
 }
 
 //--------------------------------------------------------------------------------------------------
 void VkEngine::initLight()
 {
-  _mainLight.position = glm::vec4(5.0f, 5.0f, 5.0f, 0.0f);
-  _mainLight.color = glm::vec4(1.0f);
-  _mainLight.power = 1;
+  _mainLight = DEFAULT_LIGHT;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1504,47 +3251,192 @@ void VkEngine::createMemoryAllocator()
   allocatorInfo.device = _device->getHandle();
   allocatorInfo.instance = _instance->getHandle();
   allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+  if (_chosenGPU->_isMemoryBudgetEnabled)
+  {
+    allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+  }
   vmaCreateAllocator(&allocatorInfo, &_allocator);
 
-  _deletionQueue.push([&]() { vmaDestroyAllocator(_allocator); });
+  // integrated GPUs only have memory both device local and host visible
+  const VkPhysicalDeviceMemoryProperties* memoryProperties;
+  vmaGetMemoryProperties(_allocator, &memoryProperties);
+  _isUnifiedMemory = true;
+  for (uint32_t i = 0; i < memoryProperties->memoryTypeCount; i++)
+  {
+    const VkMemoryPropertyFlags flags = memoryProperties->memoryTypes[i].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+    {
+      _isUnifiedMemory = false;
+    }
+  }
+
+  // static data is written in place only in the whole memory of an integrated GPU, or VRAM behind a resizable BAR,
+  // the 256 MiB window of a GPU without it is left to the dynamic buffers
+  VkDeviceSize largestDeviceHeap = 0;
+  for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+  {
+    if (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+    {
+      largestDeviceHeap = std::max(largestDeviceHeap, memoryProperties->memoryHeaps[i].size);
+    }
+  }
+  for (uint32_t i = 0; i < memoryProperties->memoryTypeCount && !_directWriteHeap; i++)
+  {
+    const VkMemoryType& memoryType = memoryProperties->memoryTypes[i];
+    const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    if ((memoryType.propertyFlags & directFlags) == directFlags &&
+        memoryProperties->memoryHeaps[memoryType.heapIndex].size * 2 >= largestDeviceHeap)
+    {
+      _directWriteHeap = memoryType.heapIndex;
+    }
+  }
+
+  _deletionQueue.push([&]() { vmaDestroyAllocator(_allocator); });
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::createImage(
+  std::unique_ptr<Image>& image,
+  void* data,
+  VkExtent3D size,
+  VkFormat format,
+  VkImageUsageFlags usage,
+  bool mipmapped)
+{
+  size_t data_size = size.depth * size.width * size.height * 4;
+  AllocatedBuffer uploadbuffer = createBuffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryIntent::Upload);
+
+  memcpy(uploadbuffer.info.pMappedData, data, data_size);
+  this->flushBuffer(uploadbuffer);
+
+  // the mips are generated in a single compute dispatch when possible, with blits otherwise
+  const uint32_t mipLevels = mipmapped ? Image::mipLevelCount(size) : 1;
+  const bool isDownsampledInCompute = mipLevels > 1 && this->canDownsampleInCompute(format, mipLevels);
+
+  VkImageUsageFlags imageUsage = usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (isDownsampledInCompute)
+  {
+    imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  }
+  image = std::make_unique<Image>(_device, size, format, imageUsage, _allocator, mipmapped);
+
+  // the downsampler writes every mip through its own storage view
+  std::vector<VkImageView> mipViews;
+  if (isDownsampledInCompute)
+  {
+    for (uint32_t mip = 0; mip < mipLevels; mip++)
+    {
+      VkImageViewCreateInfo viewInfo =
+        vkinit::imageViewCreateInfo(format, image->_handle.image, VK_IMAGE_ASPECT_COLOR_BIT);
+      viewInfo.subresourceRange.baseMipLevel = mip;
+      viewInfo.subresourceRange.levelCount = 1;
+
+      VkImageView mipView;
+      VK_CHECK(vkCreateImageView(_device->getHandle(), &viewInfo, nullptr, &mipView));
+      mipViews.push_back(mipView);
+    }
+  }
+
+  immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      vkutil::transitionImage(cmd, image->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+      VkBufferImageCopy copyRegion = {};
+      copyRegion.bufferOffset = 0;
+      copyRegion.bufferRowLength = 0;
+      copyRegion.bufferImageHeight = 0;
+
+      copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      copyRegion.imageSubresource.mipLevel = 0;
+      copyRegion.imageSubresource.baseArrayLayer = 0;
+      copyRegion.imageSubresource.layerCount = 1;
+      copyRegion.imageExtent = size;
+
+      // copy the buffer into the image
+      vkCmdCopyBufferToImage(
+        cmd, uploadbuffer.buffer, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+      if (isDownsampledInCompute)
+      {
+        this->downsampleMipmaps(cmd, image, mipViews);
+      }
+      else if (mipLevels > 1)
+      {
+        vkutil::generateMipmaps(cmd, image->_handle.image, VkExtent2D{size.width, size.height});
+      }
+      else
+      {
+        vkutil::transitionImage(
+          cmd, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      }
+    });
+
+  for (VkImageView mipView : mipViews)
+  {
+    vkDestroyImageView(_device->getHandle(), mipView, nullptr);
+  }
+  _mipmapDescriptorAllocator.clearPools(_device->getHandle());
+
+  destroyBuffer(uploadbuffer);
 }
 
 //--------------------------------------------------------------------------------------------------
 void VkEngine::createImage(
   std::unique_ptr<Image>& image,
-  void* data,
+  const std::vector<std::span<const std::byte>>& mipLevels,
   VkExtent3D size,
   VkFormat format,
-  VkImageUsageFlags usage,
-  bool mipmapped)
+  VkImageUsageFlags usage)
 {
-  size_t data_size = size.depth * size.width * size.height * 4;
-  AllocatedBuffer uploadbuffer = createBuffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  // buffer offsets of a copy must be a multiple of the texel block size, 16 covers every format
+  constexpr size_t mipAlignment = 16;
+  std::vector<size_t> offsets;
+  size_t data_size = 0;
+  for (const std::span<const std::byte>& mip : mipLevels)
+  {
+    offsets.push_back(data_size);
+    data_size += (mip.size() + mipAlignment - 1) & ~(mipAlignment - 1);
+  }
 
-  memcpy(uploadbuffer.info.pMappedData, data, data_size);
+  AllocatedBuffer uploadbuffer = createBuffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryIntent::Upload);
+  for (size_t mip = 0; mip < mipLevels.size(); mip++)
+  {
+    memcpy((char*)uploadbuffer.info.pMappedData + offsets[mip], mipLevels[mip].data(), mipLevels[mip].size());
+  }
+  this->flushBuffer(uploadbuffer);
 
   image = std::make_unique<Image>(
-    _device, size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, _allocator, mipmapped);
+    _device, size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, _allocator, true, mipLevels.size());
+
+  std::vector<VkBufferImageCopy> copyRegions;
+  for (uint32_t mip = 0; mip < mipLevels.size(); mip++)
+  {
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = offsets[mip];
+    copyRegion.bufferRowLength = 0;
+    copyRegion.bufferImageHeight = 0;
+
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = mip;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = {std::max(size.width >> mip, 1u), std::max(size.height >> mip, 1u), 1};
+    copyRegions.push_back(copyRegion);
+  }
 
   immediateSubmit(
     [&](VkCommandBuffer cmd)
     {
       vkutil::transitionImage(cmd, image->_handle.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-      VkBufferImageCopy copyRegion = {};
-      copyRegion.bufferOffset = 0;
-      copyRegion.bufferRowLength = 0;
-      copyRegion.bufferImageHeight = 0;
-
-      copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      copyRegion.imageSubresource.mipLevel = 0;
-      copyRegion.imageSubresource.baseArrayLayer = 0;
-      copyRegion.imageSubresource.layerCount = 1;
-      copyRegion.imageExtent = size;
-
-      // copy the buffer into the image
       vkCmdCopyBufferToImage(
-        cmd, uploadbuffer.buffer, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        cmd,
+        uploadbuffer.buffer,
+        image->_handle.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        copyRegions.size(),
+        copyRegions.data());
 
       vkutil::transitionImage(
         cmd, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
@@ -1553,6 +3445,78 @@ void VkEngine::createImage(
   destroyBuffer(uploadbuffer);
 }
 
+//--------------------------------------------------------------------------------------------------
+bool VkEngine::canDownsampleInCompute(VkFormat format, uint32_t mipLevels)
+{
+  // the shader declares its images as rgba8
+  if (format != VK_FORMAT_R8G8B8A8_UNORM || mipLevels > MAX_DOWNSAMPLE_MIPS)
+  {
+    return false;
+  }
+
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(_chosenGPU->getHandle().physical_device, format, &properties);
+  return properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::downsampleMipmaps(VkCommandBuffer cmd, std::unique_ptr<Image>& image, std::vector<VkImageView>& mipViews)
+{
+  const VkExtent3D size = image->_handle.imageExtent;
+
+  // every slot of the array needs a valid view, the ones past the last mip are never accessed
+  std::vector<VkImageView> views = mipViews;
+  views.resize(MAX_DOWNSAMPLE_MIPS, mipViews.back());
+
+  DescriptorSet descriptorSet(_device, _mipmapDescriptorLayout, _mipmapDescriptorAllocator);
+  descriptorSet.writeImageViews(_device, views, 0);
+  descriptorSet.updateSet(_device);
+
+  DescriptorWriter writer;
+  writer.writeBuffer(1, _mipmapCounterBuffer.buffer, sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.updateSet(_device->getHandle(), descriptorSet._handle);
+
+  vkutil::transitionImage(cmd, image->_handle.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+
+  // the last workgroup is detected by counting the finished ones
+  vkCmdFillBuffer(cmd, _mipmapCounterBuffer.buffer, 0, sizeof(uint32_t), 0);
+
+  VkMemoryBarrier memoryBarrier{};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(
+    cmd,
+    VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    0,
+    1,
+    &memoryBarrier,
+    0,
+    nullptr,
+    0,
+    nullptr);
+
+  // each workgroup reduces a 64x64 tile of the mip 0
+  const uint32_t groupCountX = (size.width + 63) / 64;
+  const uint32_t groupCountY = (size.height + 63) / 64;
+
+  MipmapPushConstants pushConstants{};
+  pushConstants.size = glm::ivec2(size.width, size.height);
+  pushConstants.mipCount = image->_handle.mipLevels - 1;
+  pushConstants.workGroupCount = groupCountX * groupCountY;
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _mipmapPipeline->_handle);
+  vkCmdBindDescriptorSets(
+    cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _mipmapPipelineLayout->_handle, 0, 1, &descriptorSet._handle, 0, nullptr);
+  vkCmdPushConstants(
+    cmd, _mipmapPipelineLayout->_handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MipmapPushConstants), &pushConstants);
+  vkCmdDispatch(cmd, groupCountX, groupCountY, 1);
+
+  vkutil::transitionImage(cmd, image->_handle.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
 //--------------------------------------------------------------------------------------------------
 void VkEngine::destroyImage(const AllocatedImage& img)
 {
@@ -1600,7 +3564,241 @@ void VkEngine::createDepthImage()
 //--------------------------------------------------------------------------------------------------
 void VkEngine::resetFrame()
 {
-  _frameNumber = -1;
+  // only the accumulation restarts, the frame number keeps selecting the resources of the frame in flight
+  _raytracingFrame = 0;
+  this->restartConvergence();
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::restartConvergence()
+{
+  // the counters read back from now on were written by frames of the previous accumulation
+  _activePixelFrames.fill(-1);
+  _convergenceStartFrame = _frameNumber;
+  _isRaytracingConverged = false;
+  _tracedSampleCount = 0;
+  _accumulationStart = std::chrono::system_clock::now();
+  _stats.convergenceTime = 0.f;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateRaytracingConvergence()
+{
+  // the fence of the frame waited for the last frame counting in this counter
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  const VkDeviceSize offset = slot * ACTIVE_PIXEL_COUNTER_STRIDE;
+  uint32_t* counter = reinterpret_cast<uint32_t*>(static_cast<char*>(_activePixelBuffer.info.pMappedData) + offset);
+  VK_CHECK(vmaInvalidateAllocation(_allocator, _activePixelBuffer.allocation, offset, sizeof(uint32_t)));
+
+  if (_activePixelFrames[slot] >= 0 && !_isRaytracingConverged)
+  {
+    _activePixelCount = *counter;
+    _tracedSampleCount += static_cast<uint64_t>(_activePixelCount) * _rtSamplesPerFrame;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now() - _accumulationStart);
+    const float seconds = elapsed.count() / 1000000.f;
+    _stats.raysPerSecond = seconds > 0.f ? _tracedSampleCount / seconds : 0.f;
+
+    if (_activePixelCount == 0)
+    {
+      _isRaytracingConverged = true;
+      _stats.convergenceTime = elapsed.count() / 1000.f;
+      fmt::println(
+        "Ray tracing converged in {} ms, {} frames, {} primary rays",
+        _stats.convergenceTime,
+        _activePixelFrames[slot] - _convergenceStartFrame + 1,
+        _tracedSampleCount);
+    }
+  }
+
+  // counts the pixels of the frame recorded now
+  *counter = 0;
+  VK_CHECK(vmaFlushAllocation(_allocator, _activePixelBuffer.allocation, offset, sizeof(uint32_t)));
+  _activePixelFrames[slot] = _frameNumber;
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateTraceTime()
+{
+  // the fence of the frame waited for the last trace timed by this pair
+  const uint32_t slot = _frameNumber % FRAME_OVERLAP;
+  const int backend = _traceTimestampBackends[slot];
+  if (backend < 0)
+  {
+    return;
+  }
+  _traceTimestampBackends[slot] = -1;
+
+  std::array<uint64_t, 2> timestamps;
+  const VkResult result = vkGetQueryPoolResults(
+    _device->getHandle(),
+    _traceTimestampPool,
+    slot * 2,
+    2,
+    sizeof(timestamps),
+    timestamps.data(),
+    sizeof(uint64_t),
+    VK_QUERY_RESULT_64_BIT);
+  if (result == VK_NOT_READY)
+  {
+    return;
+  }
+  VK_CHECK(result);
+
+  const float timestampPeriod = _chosenGPU->getHandle().properties.limits.timestampPeriod;
+  _stats.traceTime = static_cast<float>(timestamps[1] - timestamps[0]) * timestampPeriod / 1000000.f;
+  if (_backendBenchmark.isRunning)
+  {
+    _backendBenchmark.totalMs[backend] += _stats.traceTime;
+    _backendBenchmark.frameCount[backend]++;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::startBackendBenchmark()
+{
+  if (!_rayQueryPipeline || !_isRaytracingEnabled)
+  {
+    return;
+  }
+  _backendBenchmark.isRunning = true;
+  _backendBenchmark.frame = 0;
+  _backendBenchmark.totalMs.fill(0.0);
+  _backendBenchmark.frameCount.fill(0);
+  // the traces timed before the start are not part of it
+  _traceTimestampBackends.fill(-1);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::updateBackendBenchmark()
+{
+  BackendBenchmark& benchmark = _backendBenchmark;
+  if (!benchmark.isRunning)
+  {
+    return;
+  }
+  if (!_isRaytracingEnabled)
+  {
+    benchmark.isRunning = false;
+    return;
+  }
+
+  const bool isFinished = std::all_of(
+    benchmark.frameCount.begin(),
+    benchmark.frameCount.end(),
+    [](uint32_t count) { return count >= BACKEND_BENCHMARK_FRAMES; });
+  if (isFinished)
+  {
+    for (size_t backend = 0; backend < RAYTRACING_BACKEND_COUNT; backend++)
+    {
+      benchmark.averageMs[backend] = static_cast<float>(benchmark.totalMs[backend] / benchmark.frameCount[backend]);
+    }
+    _raytracingBackend = benchmark.averageMs[RAYTRACING_BACKEND_RAY_QUERY] <
+                             benchmark.averageMs[RAYTRACING_BACKEND_PIPELINE]
+                           ? RAYTRACING_BACKEND_RAY_QUERY
+                           : RAYTRACING_BACKEND_PIPELINE;
+    benchmark.isRunning = false;
+    fmt::println(
+      "Trace in {} ms with the ray tracing pipeline, {} ms with ray queries",
+      benchmark.averageMs[RAYTRACING_BACKEND_PIPELINE],
+      benchmark.averageMs[RAYTRACING_BACKEND_RAY_QUERY]);
+    this->resetFrame();
+    return;
+  }
+
+  // Every frame traces all the pixels from scratch with the other backend, so that both time the same work. Alternating
+  // at every frame spreads the changes of the GPU clocks over both of them.
+  _raytracingBackend = static_cast<int>(benchmark.frame % RAYTRACING_BACKEND_COUNT);
+  benchmark.frame++;
+  this->resetFrame();
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::renderReference()
+{
+  // The visible instances as in gatherTopLevelInstances, their meshes are read back from the arenas
+  vkutil::ReferenceScene scene;
+  scene.sceneData = _sceneData;
+  std::unordered_map<const MeshAsset*, uint32_t> meshIds;
+  std::unordered_map<const GLTFMaterial*, uint32_t> materialIds;
+  auto addInstance = [&](const MeshAsset* mesh, const glm::mat4& transform)
+  {
+    auto [meshId, isNewMesh] = meshIds.try_emplace(mesh, static_cast<uint32_t>(scene.meshes.size()));
+    if (isNewMesh)
+    {
+      std::vector<Vertex> vertices;
+      std::vector<uint32_t> indices;
+      this->readMeshGeometry(*mesh, vertices, indices);
+
+      vkutil::ReferenceMesh& referenceMesh = scene.meshes.emplace_back();
+      for (const Vertex& vertex : vertices)
+      {
+        referenceMesh.positions.push_back(vertex.position);
+        referenceMesh.normals.push_back(vertex.normal);
+      }
+      // the full detail surfaces, as the geometries of the BLAS
+      for (const GeoSurface& surface : mesh->surfaces)
+      {
+        auto [materialId, isNewMaterial] =
+          materialIds.try_emplace(surface.material.get(), static_cast<uint32_t>(scene.materials.size()));
+        if (isNewMaterial)
+        {
+          scene.materials.push_back(
+            surface.material ? GPURaytracingMaterial{surface.material->colorFactors, surface.material->metalRoughFactors}
+                             : GPURaytracingMaterial{glm::vec4(1.f), glm::vec4(0.f, 0.5f, 0.f, 0.f)});
+        }
+        referenceMesh.indices.insert(
+          referenceMesh.indices.end(),
+          indices.begin() + surface.startIndex,
+          indices.begin() + surface.startIndex + surface.count / 3 * 3);
+        referenceMesh.materials.insert(referenceMesh.materials.end(), surface.count / 3, materialId->second);
+      }
+    }
+    scene.instances.push_back({transform, meshId->second});
+  };
+
+  for (const std::shared_ptr<MeshAsset>& mesh : _testMeshes)
+  {
+    if (mesh->name != _selectedNodeName)
+    {
+      continue;
+    }
+    const auto node = _loadedNodes.find(mesh->name);
+    addInstance(mesh.get(), node != _loadedNodes.end() ? node->second->worldTransform : glm::mat4(1.f));
+  }
+  const auto selectedScene = _loadedScenes.find(_selectedSceneName);
+  if (selectedScene != _loadedScenes.end())
+  {
+    for (const auto& [nodeName, node] : selectedScene->second->nodes)
+    {
+      if (const MeshNode* meshNode = dynamic_cast<const MeshNode*>(node.get()))
+      {
+        addInstance(meshNode->mesh.get(), meshNode->worldTransform);
+      }
+    }
+  }
+
+  const vkutil::ReferenceSettings settings{
+    .width = _windowExtent.width,
+    .height = _windowExtent.height,
+    .samplesPerPixel = static_cast<uint32_t>(_referenceSamples),
+    .maxBounces = static_cast<uint32_t>(_rtMaxBounces),
+    .rouletteDepth = static_cast<uint32_t>(_rtRouletteDepth),
+    .threadCount = 0};
+  _referenceImage = vkutil::renderReference(scene, settings);
+  vkutil::saveReferenceImage(REFERENCE_IMAGE_PATH, _referenceImage);
+  fmt::println(
+    "Reference {}x{}, {} spp: BVH {:.1f} ms, render {:.1f} ms, {:.2f} Mrays/s",
+    settings.width,
+    settings.height,
+    settings.samplesPerPixel,
+    _referenceImage.buildTime,
+    _referenceImage.renderTime,
+    _referenceImage.rayCount / (_referenceImage.renderTime * 1000.f));
+
+  // only the statistics are shown, the image is in the file
+  _referenceImage.pixels = {};
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1610,12 +3808,18 @@ void VkEngine::updateFrame()
 
   const auto& m = _mainCamera.getViewMatrix();
 
-  if (refCamMatrix != m)
+  // The accumulation of the ray traced frames restarts whenever an instance moves. A camera move is reprojected, only
+  // the pixels it uncovers or whose history is not enough anymore are sampled again.
+  const bool haveInstancesChanged = this->gatherTopLevelInstances();
+  if (haveInstancesChanged)
   {
     resetFrame();
-    refCamMatrix = m;
   }
-  _frameNumber++;
+  else if (refCamMatrix != m)
+  {
+    this->restartConvergence();
+  }
+  refCamMatrix = m;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1712,7 +3916,7 @@ MeshAsset VkEngine::createTestQuadMesh()
 }
 
 //--------------------------------------------------------------------------------------------------
-AllocatedBuffer VkEngine::createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+AllocatedBuffer VkEngine::createBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryIntent intent)
 {
   // allocate buffer
   VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
@@ -1721,49 +3925,229 @@ AllocatedBuffer VkEngine::createBuffer(size_t allocSize, VkBufferUsageFlags usag
   bufferInfo.usage = usage;
 
   VmaAllocationCreateInfo vmaallocInfo = {};
-  vmaallocInfo.usage = memoryUsage;
-  vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  switch (intent)
+  {
+    case MemoryIntent::GpuOnly:
+      // never mapped, so that it is never pushed out of the VRAM the CPU cannot reach
+      vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+      break;
+    case MemoryIntent::Upload:
+      vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+      vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+      break;
+    case MemoryIntent::Readback:
+      // random access picks cached memory, uncached reads from the CPU are very slow
+      vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+      vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+      break;
+    case MemoryIntent::Static:
+      vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+      if (_isDirectWriteEnabled && _directWriteHeap)
+      {
+        // mapped device local memory while the heap has room for it, the budget fallback below drops to GpuOnly
+        vmaallocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                             VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+      }
+      break;
+    case MemoryIntent::Dynamic:
+    default:
+      // the BAR, or the memory of an integrated GPU, while it stays within its budget, system memory otherwise
+      vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+      vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                           VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+      break;
+  }
   AllocatedBuffer newBuffer;
 
   // allocate the buffer
-  VK_CHECK(
-    vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+  VkResult result =
+    vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info);
+  if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && (vmaallocInfo.flags & VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT))
+  {
+    // every heap is over its budget, let the driver decide, static data then goes through transfers
+    vmaallocInfo.flags &= ~VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+    if (intent == MemoryIntent::Static)
+    {
+      vmaallocInfo.requiredFlags = 0;
+      vmaallocInfo.flags = 0;
+    }
+    result =
+      vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info);
+  }
+  VK_CHECK(result);
+
+  VkMemoryPropertyFlags memoryFlags;
+  vmaGetAllocationMemoryProperties(_allocator, newBuffer.allocation, &memoryFlags);
+  MemoryPlacement placement = MemoryPlacement::HostVisible;
+  if (memoryFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+  {
+    placement = memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ? MemoryPlacement::DeviceLocalHostVisible
+                                                                   : MemoryPlacement::DeviceLocal;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    _trackedBuffers[newBuffer.allocation] = {intent, placement, newBuffer.info.size};
+    MemoryIntentReport& report = _memoryReport[static_cast<size_t>(intent)];
+    report.bufferCount++;
+    report.bytes[static_cast<size_t>(placement)] += newBuffer.info.size;
+  }
 
   return newBuffer;
 }
 
+//--------------------------------------------------------------------------------------------------
+std::array<MemoryIntentReport, static_cast<size_t>(MemoryIntent::Count)> VkEngine::memoryReport()
+{
+  std::lock_guard<std::mutex> lock(_bufferMutex);
+  return _memoryReport;
+}
+
 //--------------------------------------------------------------------------------------------------
 template<class T> void VkEngine::copyBuffer(VkCommandBuffer cmd, AllocatedBuffer& dstBuffer, const std::vector<T>& content)
 {
-  const auto contentSize = sizeof(content[0]) * content.size();
-  // Create a temporary host-visible staging buffer.
-  auto stagingBuffer = this->createBuffer(contentSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_HOST);
+  const BufferWrite write{&dstBuffer, 0, content.data(), sizeof(content[0]) * content.size()};
+  this->writeBuffers({&write, 1});
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::destroyBuffer(const AllocatedBuffer& buffer)
+{
+  {
+    std::lock_guard<std::mutex> lock(_bufferMutex);
+    auto tracked = _trackedBuffers.find(buffer.allocation);
+    if (tracked != _trackedBuffers.end())
+    {
+      MemoryIntentReport& report = _memoryReport[static_cast<size_t>(tracked->second.intent)];
+      report.bufferCount--;
+      report.bytes[static_cast<size_t>(tracked->second.placement)] -= tracked->second.size;
+      _trackedBuffers.erase(tracked);
+    }
+  }
+  vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::writeBuffers(std::span<const BufferWrite> writes, const AllocatedBuffer* stagingBuffer)
+{
+  VkDeviceSize stagingSize = 0;
+  for (const BufferWrite& write : writes)
+  {
+    if (_isDirectWriteEnabled && write.buffer->info.pMappedData != nullptr)
+    {
+      memcpy((char*)write.buffer->info.pMappedData + write.offset, write.data, write.size);
+      VK_CHECK(vmaFlushAllocation(_allocator, write.buffer->allocation, write.offset, write.size));
+    }
+    else
+    {
+      stagingSize += write.size;
+    }
+  }
 
-  // Copy the host data into the staging buffer.
-  void* data;
-  VK_CHECK(vmaMapMemory(_allocator, stagingBuffer.allocation, &data));
-  std::memcpy(data, content.data(), contentSize);
-  vmaUnmapMemory(_allocator, stagingBuffer.allocation);
+  if (stagingSize == 0)
+  {
+    return;
+  }
 
+  const AllocatedBuffer staging =
+    stagingBuffer != nullptr ? *stagingBuffer
+                             : this->createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryIntent::Upload);
+  std::vector<std::pair<VkBuffer, VkBufferCopy>> copies;
+  VkDeviceSize stagingOffset = 0;
+  for (const BufferWrite& write : writes)
+  {
+    if ((_isDirectWriteEnabled && write.buffer->info.pMappedData != nullptr) || write.size == 0)
+    {
+      continue;
+    }
+    memcpy((char*)staging.info.pMappedData + stagingOffset, write.data, write.size);
+    copies.push_back({write.buffer->buffer, VkBufferCopy{stagingOffset, write.offset, write.size}});
+    stagingOffset += write.size;
+  }
+  this->flushBuffer(staging);
 
-  // Copy the staging buffer to the device buffer.
   this->immediateSubmit(
     [&](VkCommandBuffer cmd)
     {
-      VkBufferCopy bufferCopy{};
-      bufferCopy.dstOffset = 0;
-      bufferCopy.srcOffset = 0;
-      bufferCopy.size = contentSize;
+      for (const auto& [buffer, copy] : copies)
+      {
+        vkCmdCopyBuffer(cmd, staging.buffer, buffer, 1, &copy);
+      }
+    });
+
+  if (stagingBuffer == nullptr)
+  {
+    this->destroyBuffer(staging);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void VkEngine::flushBuffer(const AllocatedBuffer& buffer)
+{
+  VK_CHECK(vmaFlushAllocation(_allocator, buffer.allocation, 0, VK_WHOLE_SIZE));
+}
+
+//--------------------------------------------------------------------------------------------------
+std::vector<std::byte> VkEngine::readBuffer(const AllocatedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+  std::vector<std::byte> content(size);
+  if (size == 0)
+  {
+    return content;
+  }
 
-      vkCmdCopyBuffer(cmd, stagingBuffer.buffer, dstBuffer.buffer, 1, &bufferCopy);
+  AllocatedBuffer readback = this->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryIntent::Readback);
+  this->immediateSubmit(
+    [&](VkCommandBuffer cmd)
+    {
+      const VkBufferCopy copy{offset, 0, size};
+      vkCmdCopyBuffer(cmd, buffer.buffer, readback.buffer, 1, &copy);
     });
-  this->destroyBuffer(stagingBuffer);
+  VK_CHECK(vmaInvalidateAllocation(_allocator, readback.allocation, 0, VK_WHOLE_SIZE));
+  memcpy(content.data(), readback.info.pMappedData, size);
+  this->destroyBuffer(readback);
+  return content;
 }
 
 //--------------------------------------------------------------------------------------------------
-void VkEngine::destroyBuffer(const AllocatedBuffer& buffer)
+UploadBenchmark VkEngine::benchmarkUploads(VkDeviceSize size, uint32_t iterations)
 {
-  vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+  UploadBenchmark benchmark{size, false, 0.f, 0.f};
+  std::vector<std::byte> content(size, std::byte{0x5a});
+
+  const bool wasDirectWriteEnabled = _isDirectWriteEnabled;
+  _isDirectWriteEnabled = true;
+  AllocatedBuffer buffer = this->createBuffer(
+    size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryIntent::Static);
+  benchmark.isDirectAvailable = buffer.info.pMappedData != nullptr;
+
+  // the same buffer for both paths, the staged one ignores the mapping; its staging buffer is created once, only the
+  // copies are timed
+  AllocatedBuffer staging = this->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryIntent::Upload);
+  const BufferWrite write{&buffer, 0, content.data(), size};
+  for (bool isDirect : {false, true})
+  {
+    if (isDirect && !benchmark.isDirectAvailable)
+    {
+      continue;
+    }
+
+    _isDirectWriteEnabled = isDirect;
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      this->writeBuffers({&write, 1}, &staging);
+    }
+    const auto end = std::chrono::high_resolution_clock::now();
+    const float elapsedMs = std::chrono::duration<float, std::milli>(end - start).count() / iterations;
+    (isDirect ? benchmark.directMs : benchmark.stagedMs) = elapsedMs;
+  }
+
+  _isDirectWriteEnabled = wasDirectWriteEnabled;
+  this->destroyBuffer(staging);
+  this->destroyBuffer(buffer);
+  return benchmark;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1771,16 +4155,44 @@ void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
 {
   glm::mat4 nodeMatrix = topMatrix * worldTransform;
 
-  for (auto& s : mesh->surfaces)
+  // the surfaces index ranges are relative to the mesh ranges in the geometry arenas
+  const VkEngine& engine = VkEngine::Get();
+  const uint32_t meshFirstIndex = engine._indexArena->offset(mesh->meshBuffers.indexRange);
+  const int32_t meshVertexOffset = static_cast<int32_t>(engine._vertexArena->offset(mesh->meshBuffers.vertexRange));
+
+  currentLods.resize(mesh->surfaces.size(), 0);
+
+  for (size_t i = 0; i < mesh->surfaces.size(); i++)
   {
+    auto& s = mesh->surfaces[i];
     RenderObject def;
     def.indexCount = s.count;
-    def.firstIndex = s.startIndex;
-    def.indexBuffer = mesh->meshBuffers.indexBuffer.buffer;
+    def.firstIndex = meshFirstIndex + s.startIndex;
+    def.vertexOffset = meshVertexOffset;
+    if (!s.lods.empty())
+    {
+      currentLods[i] = ctx.isLodEnabled ? selectLod(s, currentLods[i], nodeMatrix, ctx) : 0;
+      const SurfaceLod& lod = s.lods[currentLods[i]];
+      def.indexCount = lod.count;
+      def.firstIndex = meshFirstIndex + lod.startIndex;
+      def.meshletOffset = lod.meshletOffset;
+      def.meshletCount = lod.meshletCount;
+      def.meshletBufferAddress = mesh->meshletBuffers.meshletBufferAddress;
+      def.meshletIndexBufferAddress = mesh->meshletBuffers.meshletIndexBufferAddress;
+    }
     def.material = &s.material->data;
     def.bounds = s.bounds;
     def.transform = nodeMatrix;
-    def.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress;
+
+    // the streamed textures are sized after the surface on screen
+    if (!s.material->streamedTextures.empty())
+    {
+      const float screenSize = projectedDiameter(s.bounds, nodeMatrix, ctx);
+      for (uint32_t texture : s.material->streamedTextures)
+      {
+        ctx.textureRequests.push_back({texture, screenSize});
+      }
+    }
 
     if (s.material->data.passType == MaterialPass::Transparent)
     {
@@ -1795,3 +4207,51 @@ void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
   // recurse down
   Node::Draw(topMatrix, ctx);
 }
+
+//--------------------------------------------------------------------------------------------------
+uint32_t MeshNode::selectLod(
+  const GeoSurface& surface,
+  uint32_t currentLod,
+  const glm::mat4& nodeMatrix,
+  const DrawContext& ctx)
+{
+  // bring the bounding sphere to world space, the largest axis scale bounds the error scaling
+  const glm::vec3 center = glm::vec3(nodeMatrix * glm::vec4(surface.bounds.origin, 1.f));
+  const float scale = std::max(
+    {glm::length(glm::vec3(nodeMatrix[0])), glm::length(glm::vec3(nodeMatrix[1])), glm::length(glm::vec3(nodeMatrix[2]))});
+  const float radius = surface.bounds.sphereRadius * scale;
+
+  // distance to the closest point of the sphere, clamped so that we never divide by zero when inside it
+  const float distance = std::max(glm::length(center - ctx.cameraPosition) - radius, 0.1f);
+
+  auto projectedError = [&](uint32_t lod) { return surface.lods[lod].error * scale * ctx.lodScale / distance; };
+
+  uint32_t lod = std::min(currentLod, static_cast<uint32_t>(surface.lods.size() - 1));
+
+  // refine immediately when the current level is too coarse
+  while (lod > 0 && projectedError(lod) > ctx.lodThreshold)
+  {
+    lod--;
+  }
+
+  // only coarsen when the next level is comfortably under the threshold
+  while (lod + 1 < surface.lods.size() && projectedError(lod + 1) <= ctx.lodThreshold * (1.f - LOD_HYSTERESIS))
+  {
+    lod++;
+  }
+
+  return lod;
+}
+
+//--------------------------------------------------------------------------------------------------
+float MeshNode::projectedDiameter(const Bounds& bounds, const glm::mat4& nodeMatrix, const DrawContext& ctx)
+{
+  const glm::vec3 center = glm::vec3(nodeMatrix * glm::vec4(bounds.origin, 1.f));
+  const float scale = std::max(
+    {glm::length(glm::vec3(nodeMatrix[0])), glm::length(glm::vec3(nodeMatrix[1])), glm::length(glm::vec3(nodeMatrix[2]))});
+  const float radius = bounds.sphereRadius * scale;
+  const float distance = std::max(glm::length(center - ctx.cameraPosition) - radius, 0.1f);
+
+  // lodScale turns a world space size at a distance of 1 into pixels
+  return 2.f * radius * ctx.lodScale / distance;
+}
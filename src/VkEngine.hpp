@@ -1,25 +1,36 @@
 #pragma once
 
 #include <VkBootstrap.h>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include "BoundingVolumeHierarchy.hpp"
 #include "Camera.hpp"
 #include "ComputePipeline.hpp"
 #include "DescriptorSet.hpp"
 #include "DescriptorSetLayout.hpp"
+#include "Denoiser.hpp"
 #include "Device.hpp"
 #include "FrameData.hpp"
+#include "GeometryArena.hpp"
+#include "GeometryBuffer.hpp"
 #include "Image.hpp"
 #include "Instance.hpp"
 #include "Materials.hpp"
 #include "PhysicalDevice.hpp"
 #include "PointLight.hpp"
 #include "RaytracingPipeline.hpp"
+#include "ReferencePathTracer.hpp"
+#include "ScratchPool.hpp"
 #include "ShaderBindingTable.hpp"
 #include "Swapchain.hpp"
+#include "TextureStreamer.hpp"
 #include "TopLevelAccelerationStructure.hpp"
 #include "VkDescriptors.hpp"
 #include "VkLoader.hpp"
 #include "VkTypes.hpp"
 #include "Window.hpp"
+#include "shaders/sampler_shared.h"
 
 using namespace VulkanBackend;
 using namespace VulkanBackend::Raytracing;
@@ -27,27 +38,78 @@ using namespace VulkanBackend::Raytracing;
 struct RenderObject
 {
   uint32_t indexCount;
-  uint32_t firstIndex;
-  VkBuffer indexBuffer;
+  uint32_t firstIndex;  // in the index arena
+  int32_t vertexOffset;  // first vertex of the mesh in the vertex arena
 
   MaterialInstance* material;
 
   glm::mat4 transform;
-  VkDeviceAddress vertexBufferAddress;
   Bounds bounds;
+
+  // meshlets of the selected LOD, culled on the GPU when there are any
+  uint32_t meshletOffset = 0;
+  uint32_t meshletCount = 0;
+  VkDeviceAddress meshletBufferAddress;
+  VkDeviceAddress meshletIndexBufferAddress;
+  int32_t indirectDrawIndex = -1;  // draw command written by the meshlet culling pass, -1 for a direct draw
 };
 
 struct DrawContext
 {
   std::vector<RenderObject> OpaqueSurfaces;
   std::vector<RenderObject> TransparentSurfaces;
+
+  // Level of detail selection parameters, refreshed every frame by the engine
+  bool isLodEnabled = true;
+  glm::vec3 cameraPosition;
+  float lodScale;      // converts a world space error at a distance of 1 into pixels
+  float lodThreshold;  // maximum screen space error in pixels
+
+  // streamed textures sampled by the surfaces drawn this frame
+  std::vector<TextureRequest> textureRequests;
 };
 
+// Fraction of the threshold a coarser LOD must stay under before switching to it, avoids popping back and forth
+constexpr float LOD_HYSTERESIS = 0.25f;
+
 struct MeshNode : public Node
 {
   std::shared_ptr<MeshAsset> mesh;
+  // LOD selected for each surface during the previous draw
+  std::vector<uint32_t> currentLods;
 
   virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx) override;
+
+ private:
+  uint32_t selectLod(const GeoSurface& surface, uint32_t currentLod, const glm::mat4& nodeMatrix, const DrawContext& ctx);
+  float projectedDiameter(const Bounds& bounds, const glm::mat4& nodeMatrix, const DrawContext& ctx);
+};
+
+// BLAS of a mesh asset, shared by every node instancing the mesh. In the software tier there is no handle, `buffer`
+// holds the BVH nodes at `address` followed by the triangles.
+struct BottomLevelEntry
+{
+  VkAccelerationStructureKHR handle;
+  VkDeviceAddress address;
+  AllocatedBuffer buffer;  // compacted storage of the structure
+  VkDeviceSize size;       // once compacted
+  VkDeviceSize buildSize;  // as built
+  VkDeviceAddress triangleAddress;  // software BVH only
+  vkutil::BvhBounds bounds;         // software BVH only, in object space
+};
+
+// Spheres and boxes traced through an AABB BLAS and the procedural hit group, as for particles or point clouds. Only the
+// ray traced frames see them, the rasterizer has no geometry for them.
+struct ProceduralAsset
+{
+  std::string name;
+  AllocatedBuffer primitiveBuffer;  // GPUProceduralPrimitive, also the AABB data of the BLAS
+  VkDeviceAddress primitiveAddress;
+  uint32_t primitiveCount;
+  std::vector<GPURaytracingMaterial> materials;  // indexed by the materialIndex of the primitives
+  glm::mat4 transform;                           // object to world
+  bool isVisible;
+  BottomLevelEntry bottomLevel;
 };
 
 struct EngineStats
@@ -57,6 +119,10 @@ struct EngineStats
   int drawcallCount = 0;
   float sceneUpdateTime;
   float meshDrawTime;
+  float accelerationStructureTime;  // recording of the TLAS refit or rebuild
+  float convergenceTime;            // from the reset of the accumulation to every pixel converged, 0 until then
+  float raysPerSecond;              // primary rays since the reset of the accumulation
+  float traceTime;                  // GPU time of the trace of the last finished frame
 };
 
 struct SurfaceProperties
@@ -68,7 +134,28 @@ struct SurfaceProperties
 };
 
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+// Bytes between the active pixel counters of the frames in flight, at least the nonCoherentAtomSize of the devices
+constexpr VkDeviceSize ACTIVE_PIXEL_COUNTER_STRIDE = 256;
+// Mips handled by the single pass downsampler, mip 0 included : up to 4096x4096 images
+constexpr uint32_t MAX_DOWNSAMPLE_MIPS = 13;
+// Initial size of the geometry arenas in elements, they double whenever they run out of space
+constexpr uint32_t VERTEX_ARENA_CAPACITY = 1 << 20;
+constexpr uint32_t INDEX_ARENA_CAPACITY = 1 << 22;
+// Scratch memory of a batch of acceleration structure builds, the builds of a batch run in parallel
+constexpr VkDeviceSize ACCELERATION_STRUCTURE_SCRATCH_BUDGET = 32 * 1024 * 1024;
+// Timed frames of each ray tracing backend in a benchmark
+constexpr uint32_t BACKEND_BENCHMARK_FRAMES = 32;
+// Written by the CPU reference renderer, next to the assets
+constexpr const char* REFERENCE_IMAGE_PATH = "../reference.pfm";
+// Searched for the glTF files the UI can load as scenes
+constexpr const char* ASSETS_PATH = "../assets";
+// Start of a freshly launched engine, and of the --reference renders
+constexpr VkExtent2D DEFAULT_WINDOW_EXTENT{1700, 900};
+constexpr glm::vec3 DEFAULT_CAMERA_POSITION{0.f, 0.f, 5.f};
+constexpr PointLight DEFAULT_LIGHT{glm::vec4(5.0f, 5.0f, 5.0f, 0.0f), glm::vec4(1.0f), 1.f};
+constexpr int DEFAULT_MAX_BOUNCES = 8;
+constexpr int DEFAULT_ROULETTE_DEPTH = 3;
+constexpr int DEFAULT_REFERENCE_SAMPLES = 64;
 
 class VkEngine
 {
@@ -85,8 +172,13 @@ class VkEngine
   bool _stopRendering{false};
   bool _isRaytracingEnabled{true};
   bool _isPreviousFrameRT{false};
-  uint32_t maxNbOfFramesRT = 10;
-  VkExtent2D _windowExtent{1700, 900};
+  uint32_t maxNbOfFramesRT = 4096;  // stops the accumulation when the error threshold is never reached
+  bool _isLodEnabled{true};
+  float _lodThreshold{1.f};  // screen space error in pixels
+  bool _isMeshletCullingEnabled{true};
+  bool _isMeshletConeCullingEnabled{true};
+  bool _isIndirectDrawEnabled{true};
+  VkExtent2D _windowExtent{DEFAULT_WINDOW_EXTENT};
 
   std::unique_ptr<Window> _window;
   std::unique_ptr<Instance> _instance;         // Vulkan library handle
@@ -100,10 +192,26 @@ class VkEngine
   {
     return _frames.at(_frameNumber % FRAME_OVERLAP);
   }
+  bool isSoftwareRaytracing() const
+  {
+    return _chosenGPU->_raytracingTier == RaytracingTier::Software;
+  }
+  // stages tracing rays, the ray tracing shader stage is only valid with the ray tracing pipeline
+  VkPipelineStageFlags raytracingStages() const
+  {
+    return this->isSoftwareRaytracing()
+             ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+             : VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  }
 
   DeletionQueue _deletionQueue;  //Queue that keeps tracks of all the allocated structures.
 
   VmaAllocator _allocator;
+  bool _isUnifiedMemory;
+  // heap both device local and host visible large enough to hold static data, if any
+  std::optional<uint32_t> _directWriteHeap;
+  bool _isDirectWriteEnabled{true};
+  UploadBenchmark _uploadBenchmark{};
 
   //draw resources
   std::unique_ptr<Image> _drawImage;
@@ -132,6 +240,32 @@ class VkEngine
   VkPipelineLayout _meshPipelineLayout;
   VkPipeline _meshPipeline;
 
+  // Mipmap generation
+  std::unique_ptr<DescriptorSetLayout> _mipmapDescriptorLayout;
+  std::unique_ptr<PipelineLayout> _mipmapPipelineLayout;
+  std::unique_ptr<ComputePipeline> _mipmapPipeline;
+  DescriptorAllocatorGrowable _mipmapDescriptorAllocator;
+  AllocatedBuffer _mipmapCounterBuffer;  // finished workgroups, the last one reduces the tail of the mip chain
+
+  // Meshlet culling
+  std::unique_ptr<PipelineLayout> _meshletCullPipelineLayout;
+  std::unique_ptr<ComputePipeline> _meshletCullPipeline;
+  AllocatedBuffer _meshletOutputIndexBuffer;  // compacted indices of the visible meshlets, written by the culling
+  uint32_t _meshletOutputIndexCapacity{0};
+  AllocatedBuffer _meshletDrawCommandBuffer;  // a slice per frame in flight, one indexed indirect draw per culled object
+  uint32_t _meshletDrawCapacity{0};           // draws per slice
+  VkDeviceSize _meshletDrawOffset{0};         // slice of the current frame
+
+  // Draws of drawGeometry, a slice per frame in flight
+  AllocatedBuffer _objectBuffer;       // world matrix of every render object
+  uint32_t _objectCapacity{0};         // objects per slice
+  AllocatedBuffer _drawCommandBuffer;  // one indexed indirect draw per surface outside the meshlet culling
+  uint32_t _drawCommandCapacity{0};    // draws per slice
+
+  // Geometry of every mesh, sub-allocated from a few large buffers
+  std::unique_ptr<GeometryArena> _vertexArena;
+  std::unique_ptr<GeometryArena> _indexArena;
+
   std::vector<std::shared_ptr<MeshAsset>> _testMeshes;
 
   bool _resize_requested = false;
@@ -147,6 +281,8 @@ class VkEngine
   std::unique_ptr<Image> _greyImage;
   std::unique_ptr<Image> _errorCheckerboardImage;
 
+  std::unique_ptr<TextureStreamer> _textureStreamer;
+
   VkSampler _defaultSamplerLinear;
   VkSampler _defaultSamplerNearest;
 
@@ -159,7 +295,6 @@ class VkEngine
   std::unordered_map<std::string, std::shared_ptr<Node>> _loadedNodes;
   std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> _loadedScenes;
   std::string _selectedNodeName = "Teapot";
-  uint32_t _selectedMeshIndex = 0;
   std::string _selectedSceneName = "";
 
   Camera _mainCamera;
@@ -174,19 +309,81 @@ class VkEngine
   // Raytracing
   std::unique_ptr<PipelineLayout> _raytracingPipelineLayout;
   std::unique_ptr<RaytracingPipeline> _raytracingPipeline;
-  std::unique_ptr<Image> _accumulationImage;
+  // layout of the path tracer in a compute shader, whether it traces with ray queries or through the software BVH
+  std::unique_ptr<PipelineLayout> _computeTracePipelineLayout;
+  // tracing with ray queries, null when the device has no VK_KHR_ray_query
+  std::unique_ptr<ComputePipeline> _rayQueryPipeline;
+  // the path tracer traversing the BVH built by the engine, only on devices without the ray tracing pipeline
+  std::unique_ptr<ComputePipeline> _softwareTracePipeline;
+  int _raytracingBackend{RAYTRACING_BACKEND_PIPELINE};
+  VkQueryPool _traceTimestampPool{VK_NULL_HANDLE};           // start and end of the trace, a pair per frame in flight
+  std::array<int, FRAME_OVERLAP> _traceTimestampBackends;  // backend timed by each pair, -1 before it is written
+  BackendBenchmark _backendBenchmark{};
+  int _referenceSamples{DEFAULT_REFERENCE_SAMPLES};  // per pixel, of the CPU reference
+  vkutil::ReferenceImage _referenceImage{};  // statistics of the last reference, without its pixels
+  // of the current and previous traced frames, by parity
+  std::array<std::unique_ptr<Image>, 2> _accumulationImages;  // running mean of each pixel, its sample count in alpha
+  std::array<std::unique_ptr<Image>, 2> _varianceImages;      // squared deviations of the luminance of the samples
+  std::unique_ptr<GeometryBuffer> _geometryBuffer;            // primary hits, for the reprojection
+  uint32_t _raytracingFrame{0};                               // frames traced since the start
+  AllocatedBuffer _activePixelBuffer;         // a counter per frame in flight, read back
+  std::array<int, FRAME_OVERLAP> _activePixelFrames;  // frame counted by each counter, -1 before the reset
+  AllocatedBuffer _blueNoiseBuffer;
+  int _rtSamplerType{SAMPLER_SOBOL};
+  float _rtErrorThreshold{0.02f};
+  int _rtMinSamples{16};
+  int _rtSamplesPerFrame{4};
+  int _rtMaxBounces{DEFAULT_MAX_BOUNCES};
+  int _rtRouletteDepth{DEFAULT_ROULETTE_DEPTH};
+  bool _isRaytracingConverged{false};
+  int _convergenceStartFrame{0};  // first frame sampling the pixels again, after a reset or a camera move
+  uint32_t _activePixelCount{0};  // of the last finished frame
+  uint64_t _tracedSampleCount{0};
+  std::chrono::system_clock::time_point _accumulationStart;
+  std::unique_ptr<Denoiser> _denoiser;
+  bool _isDenoiserEnabled{false};
+  bool _isHybridEnabled{false};  // the primary visibility is rasterized, only the secondary rays are traced
   std::unique_ptr<RaytracingProperties> _raytracingProperties;
   std::unique_ptr<ShaderBindingTable> _shaderBindingTable;
   DescriptorAllocatorGrowable _raytracingDescriptorAllocator;
   std::unique_ptr<DescriptorSetLayout> _raytracingDescriptorSetLayout;
-  std::unique_ptr<DescriptorSet> _raytracingDescriptorSet;
+  // one set per frame in flight, each one written with the TLAS it points to
+  std::array<std::unique_ptr<DescriptorSet>, FRAME_OVERLAP> _raytracingDescriptorSets;
+  std::array<VkAccelerationStructureKHR, FRAME_OVERLAP> _raytracingDescriptorStructures{};
   std::vector<TopLevelAccelerationStructure> _topAS;
-  std::vector<BottomLevelAccelerationStructure> _bottomAS;
-  AllocatedBuffer _bottomBuffer;
-  AllocatedBuffer _scratchBuffer;
+  std::unordered_map<const MeshAsset*, BottomLevelEntry> _bottomLevelCache;
+  std::vector<std::shared_ptr<ProceduralAsset>> _proceduralAssets;
+  std::unique_ptr<ScratchPool> _scratchPool;
+  VkDeviceSize _bottomBuildSize{0};      // size of the cached BLAS as built
+  VkDeviceSize _bottomCompactedSize{0};  // size of the cached BLAS once compacted
   AllocatedBuffer _topBuffer;
-  AllocatedBuffer _topScratchBuffer;
-  AllocatedBuffer _instancesBuffer;
+  std::vector<VkAccelerationStructureInstanceKHR> _topInstances;  // from the transforms of the nodes, every frame
+  AllocatedBuffer _instanceRing;                                  // a slice of instances per frame in flight
+  VkDeviceAddress _instanceRingAddress{0};
+  uint32_t _instanceRingCapacity{0};  // instances per slice
+  bool _isTopRefitEnabled{true};
+  bool _isTopLevelDirty{false};  // the set of instances changed, the next TLAS update is a full build
+  uint32_t _topRebuildCount{0};
+  uint32_t _topRefitCount{0};
+  // scene table of the closest hit shaders, gathered with the instances
+  std::vector<GPURaytracingInstance> _raytracingInstances;
+  std::vector<GPURaytracingGeometry> _raytracingGeometries;
+  std::vector<GPURaytracingMaterial> _raytracingMaterials;
+  std::vector<uint32_t> _raytracingHitGroups;  // of each geometry, 0 for the triangles and 1 for the procedurals
+  // as last written in each slice of the buffer, one per frame in flight
+  std::array<std::vector<std::byte>, FRAME_OVERLAP> _raytracingSceneData;
+  AllocatedBuffer _raytracingSceneBuffer;
+  size_t _raytracingSceneCapacity{0};  // of a slice
+  RaytracingPushConstant _raytracingSceneAddresses{};
+  // as last written in each slice of the shader binding table
+  std::array<std::vector<ShaderBindingTable::Entry>, FRAME_OVERLAP> _hitGroupRecords;
+  // software tier: top level BVH nodes followed by the instances
+  AllocatedBuffer _softwareTopBuffer;       // one slice per frame in flight
+  size_t _softwareTopCapacity{0};           // of a slice
+  std::vector<std::byte> _softwareTopData;  // nodes then instances, as last built
+  size_t _softwareTopNodesSize{0};          // offset of the instances
+  uint32_t _softwareTopStaleSlots{0};       // slices not written since the last build, one bit per frame in flight
+  std::vector<VkAccelerationStructureInstanceKHR> _softwareTopInstances;  // as last built
 
   static VkEngine& Get();
 
@@ -198,11 +395,27 @@ class VkEngine
 
   // draw loop
   void draw();
-  void drawIndirect();
+  void drawIndirect(
+    VkCommandBuffer cmd,
+    const std::vector<uint32_t>& opaqueDraws,
+    const GPUDrawPushConstants& pushConstants,
+    MaterialPipeline* pipelineOverride);
   void drawBackground(VkCommandBuffer cmd);
   void drawRaytracing(VkCommandBuffer cmd);
+  // records the trace of the ray tracing pipeline backend
+  void traceRays(
+    VkCommandBuffer cmd,
+    const std::vector<VkDescriptorSet>& descriptorSets,
+    const RaytracingPushConstant& rtPushConstant);
+  // times both ray tracing backends over the next frames, then keeps the faster one
+  void startBackendBenchmark();
+  // path traces the visible scene on the CPU at the size of the window and saves it to REFERENCE_IMAGE_PATH
+  void renderReference();
   void drawImgui(VkCommandBuffer cmd, VkImageView targetImageView);
-  void drawGeometry(VkCommandBuffer cmd);
+  void cullMeshlets(VkCommandBuffer cmd);
+  // `pipelineOverride` draws the opaque surfaces only, all with its pipeline and their own material set
+  void drawGeometry(VkCommandBuffer cmd, MaterialPipeline* pipelineOverride = nullptr);
+  void drawGeometryBuffer(VkCommandBuffer cmd);
   void drawMain(VkCommandBuffer cmd);
 
   // run main loop
@@ -211,13 +424,27 @@ class VkEngine
   void immediateSubmit(std::function<void(VkCommandBuffer)>&& function);
 
   GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+  void freeMesh(const GPUMeshBuffers& mesh);
+  GPUMeshletBuffers uploadMeshlets(std::span<GPUMeshlet> meshlets, std::span<uint32_t> meshletIndices);
 
   void updateScene();
 
-  AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+  AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryIntent intent);
   template<class T> void copyBuffer(VkCommandBuffer cmd, AllocatedBuffer& dstBuffer, const std::vector<T>& content);
   void destroyBuffer(const AllocatedBuffer& buffer);
-
+  // memcpy into the mapped buffers, a single staging buffer and transfer for the others; the staging buffer is created
+  // for the call unless one large enough is given
+  void writeBuffers(std::span<const BufferWrite> writes, const AllocatedBuffer* stagingBuffer = nullptr);
+  // makes the host writes to a mapped buffer visible to the device, a no-op on coherent memory
+  void flushBuffer(const AllocatedBuffer& buffer);
+  // copies a range of a device buffer back to the host, waits for the copy
+  std::vector<std::byte> readBuffer(const AllocatedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size);
+  UploadBenchmark benchmarkUploads(VkDeviceSize size, uint32_t iterations);
+  // live buffers of each intent, by the memory they landed in
+  std::array<MemoryIntentReport, static_cast<size_t>(MemoryIntent::Count)> memoryReport();
+
+  // uploads the mip 0 of an uncooked image, the others are generated on the GPU when mipmapped: in a single compute
+  // dispatch for rgba8 images, with blits otherwise
   void createImage(
     std::unique_ptr<Image>& image,
     void* data,
@@ -225,8 +452,31 @@ class VkEngine
     VkFormat format,
     VkImageUsageFlags usage,
     bool mipmapped = false);
+  // uploads a prebuilt mip chain, mipLevels[i] holds the tightly packed texels or blocks of the mip i
+  void createImage(
+    std::unique_ptr<Image>& image,
+    const std::vector<std::span<const std::byte>>& mipLevels,
+    VkExtent3D size,
+    VkFormat format,
+    VkImageUsageFlags usage);
   void destroyImage(const AllocatedImage& img);
   void resetFrame();
+  // the pixels are sampled again until they converge, the accumulation is kept
+  void restartConvergence();
+
+  // loads a glTF file as the scene named after the file and selects it
+  bool loadScene(const std::filesystem::path& path);
+  // registers a loaded scene, only the BLAS of its meshes are built and the TLAS is rebuilt from every scene
+  void addScene(const std::string& name, std::shared_ptr<LoadedGLTF> scene);
+  // releases the BLAS of the meshes of the scene, its resources are destroyed once the frame in flight is over
+  void removeScene(const std::string& name);
+  // uploads the primitives and builds their BLAS, none in the software tier whose BVH only holds triangles
+  std::shared_ptr<ProceduralAsset> addProcedurals(
+    const std::string& name,
+    std::span<const GPUProceduralPrimitive> primitives,
+    std::vector<GPURaytracingMaterial> materials,
+    const glm::mat4& transform);
+  void removeProcedurals(const std::string& name);
 
  private:
   void initVulkan();
@@ -235,14 +485,46 @@ class VkEngine
   void initImmediateCommands();
   void initDescriptors();
   void initRaytracingDescriptors();
-  void updateRaytracingDescriptors();
+  void updateRaytracingDescriptors(uint32_t slot);
   void initPipelines();
   void initBackgroundPipelines();
+  void initMeshletCullingPipeline();
+  void initMipmapPipeline();
   void initRaytracingPipeline();
+  // the ray query path tracer when the device has ray queries, the software one when it has no ray tracing at all
+  void initComputeTracePipelines();
   void initShaderBindingTable();
+  std::unique_ptr<ShaderBindingTable> createShaderBindingTable(const std::vector<ShaderBindingTable::Entry>& hitGroups);
   void initAccelerationStructures();
-  void createBottomLevelStructures(VkCommandBuffer cmd);
+  // builds and compacts the BLAS of the meshes not in the cache yet
+  void buildBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes);
+  // builds the structures in batches sharing the scratch pool, then compacts each into a buffer of its own
+  std::vector<BottomLevelEntry> buildBottomLevelBatch(
+    std::span<BottomLevelAccelerationStructure> structures,
+    std::span<const std::string> names);
+  std::vector<BottomLevelEntry> compactBottomLevelStructures(
+    std::span<BottomLevelAccelerationStructure> structures,
+    std::span<const std::string> names,
+    VkQueryPool queryPool);
+  // BVH of the meshes traversed by the software tier, from their triangles read back from the geometry arenas
+  void buildSoftwareBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes);
+  // copies the vertices and indices of a mesh back from the geometry arenas
+  void readMeshGeometry(const MeshAsset& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+  void releaseBottomLevelStructures(std::span<const std::shared_ptr<MeshAsset>> meshes);
+  // a ring of spheres and boxes around the test meshes, hidden until shown from the UI
+  void initProceduralParticles();
   void createTopLevelStructures(VkCommandBuffer cmd);
+  bool gatherTopLevelInstances();
+  void updateTopLevelStructure(VkCommandBuffer cmd);
+  // top level BVH over the instances, built on the CPU whenever the instances change
+  void updateSoftwareTopLevelStructure();
+  void buildSoftwareTopLevelStructure();
+  void updateRaytracingSceneTable();
+  // hit records of the geometries of the scene table, rewritten in place while their number stays the same
+  void updateShaderBindingTable();
+  void updateRaytracingConvergence();
+  void updateTraceTime();
+  void updateBackendBenchmark();
   void initDefaultData();
   void initMainCamera();
   void initLight();
@@ -252,7 +534,26 @@ class VkEngine
   void createMemoryAllocator();
   void createDrawImage();
   void createDepthImage();
+  bool canDownsampleInCompute(VkFormat format, uint32_t mipLevels);
+  void downsampleMipmaps(VkCommandBuffer cmd, std::unique_ptr<Image>& image, std::vector<VkImageView>& mipViews);
   void updateFrame();
+  void bindMaterial(
+    VkCommandBuffer cmd,
+    MaterialInstance* material,
+    MaterialPipeline*& lastPipeline,
+    const GPUDrawPushConstants& pushConstants,
+    MaterialPipeline* pipelineOverride);
+
+  struct TrackedBuffer
+  {
+    MemoryIntent intent;
+    MemoryPlacement placement;
+    VkDeviceSize size;
+  };
+  // the texture streamer creates its staging buffers from its worker thread
+  std::mutex _bufferMutex;
+  std::unordered_map<VmaAllocation, TrackedBuffer> _trackedBuffers;
+  std::array<MemoryIntentReport, static_cast<size_t>(MemoryIntent::Count)> _memoryReport{};
 
   //Debug tools
   MeshAsset createTestTriangleMesh();
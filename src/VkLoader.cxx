@@ -6,75 +6,166 @@
 #endif  // !GLM_ENABLE_EXPERIMENTAL
 
 
+#include <fstream>
 #include <glm/gtx/quaternion.hpp>
 #include <iostream>
+#include "MeshProcessing.hpp"
+#include "TextureCooker.hpp"
 #include "VkEngine.hpp"
 #include "VkInitializers.hpp"
 #include "VkLoader.hpp"
 #include "VkTypes.hpp"
-#include "stb_image.h"
 
 
-//--------------------------------------------------------------------------------------------------
-std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine, std::string_view filePath)
+namespace
 {
-  fmt::print("Loading GLTF: {}", filePath);
-
-  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
-  scene->creator = engine;
-  LoadedGLTF& file = *scene.get();
+  //------------------------------------------------------------------------------------------------
+  std::optional<fastgltf::Asset> parseGltf(std::string_view filePath)
+  {
+    fastgltf::Parser parser{};
 
-  fastgltf::Parser parser{};
+    constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble |
+                                 fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
+    // fastgltf::Options::LoadExternalImages;
 
-  constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble |
-                               fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
-  // fastgltf::Options::LoadExternalImages;
+    auto data = fastgltf::GltfDataBuffer::FromPath(filePath);
 
-  auto data = fastgltf::GltfDataBuffer::FromPath(filePath);
+    std::filesystem::path path = filePath;
 
-  fastgltf::Asset gltf;
-
-  std::filesystem::path path = filePath;
-
-  auto type = fastgltf::determineGltfFileType(data.get());
-  if (type == fastgltf::GltfType::glTF)
-  {
-    auto load = parser.loadGltf(data.get(), path.parent_path(), gltfOptions);
-    if (load)
-    {
-      gltf = std::move(load.get());
-    }
-    else
+    auto type = fastgltf::determineGltfFileType(data.get());
+    if (type == fastgltf::GltfType::glTF)
     {
+      auto load = parser.loadGltf(data.get(), path.parent_path(), gltfOptions);
+      if (load)
+      {
+        return std::move(load.get());
+      }
       std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
       return {};
     }
-  }
-  else if (type == fastgltf::GltfType::GLB)
-  {
-    auto load = parser.loadGltfBinary(data.get(), path.parent_path(), gltfOptions);
-    if (load)
-    {
-      gltf = std::move(load.get());
-    }
-    else
+    else if (type == fastgltf::GltfType::GLB)
     {
+      auto load = parser.loadGltfBinary(data.get(), path.parent_path(), gltfOptions);
+      if (load)
+      {
+        return std::move(load.get());
+      }
       std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
       return {};
     }
+    std::cerr << "Failed to determine glTF container" << std::endl;
+    return {};
   }
-  else
+
+  //------------------------------------------------------------------------------------------------
+  glm::mat4 nodeLocalTransform(const fastgltf::Node& node)
+  {
+    glm::mat4 localTransform;
+    std::visit(
+      fastgltf::visitor{
+        [&](fastgltf::math::fmat4x4 matrix) { memcpy(&localTransform, matrix.data(), sizeof(matrix)); },
+        [&](fastgltf::TRS transform)
+        {
+          glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
+          glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+          glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+          glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
+          glm::mat4 rm = glm::toMat4(rot);
+          glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+
+          localTransform = tm * rm * sm;
+        }},
+      node.transform);
+    return localTransform;
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Bytes of the encoded image file (png, jpg or ktx2), read into fileBytes when the image is an external file
+  std::span<const std::byte> readEncodedImage(
+    fastgltf::Asset& asset,
+    fastgltf::Image& gltfImage,
+    std::vector<std::byte>& fileBytes)
+  {
+    std::span<const std::byte> encodedImage;
+
+    std::visit(
+      fastgltf::visitor{
+        [](auto& arg) {},
+        [&](fastgltf::sources::URI& filePath)
+        {
+          assert(filePath.fileByteOffset == 0);  // We don't support offsets with stbi.
+          assert(filePath.uri.isLocalPath());    // We're only capable of loading
+                                                 // local files.
+
+          const std::string path(filePath.uri.path().begin(),
+                                 filePath.uri.path().end());  // Thanks C++.
+          std::ifstream file(path, std::ios::binary | std::ios::ate);
+          if (file.is_open())
+          {
+            fileBytes.resize(file.tellg());
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(fileBytes.data()), fileBytes.size());
+            encodedImage = fileBytes;
+          }
+        },
+        [&](fastgltf::sources::Vector& vector)
+        {
+          encodedImage = std::span(reinterpret_cast<const std::byte*>(vector.bytes.data()), vector.bytes.size());
+        },
+        [&](fastgltf::sources::Array& array)
+        {
+          encodedImage = std::span(reinterpret_cast<const std::byte*>(array.bytes.data()), array.bytes.size());
+        },
+        [&](fastgltf::sources::BufferView& view)
+        {
+          auto& bufferView = asset.bufferViews[view.bufferViewIndex];
+          auto& buffer = asset.buffers[bufferView.bufferIndex];
+
+          std::visit(
+            fastgltf::visitor{// We only care about VectorWithMime here, because we
+                              // specify LoadExternalBuffers, meaning all buffers
+                              // are already loaded into a vector.
+                              [](auto& arg) {},
+                              [&](fastgltf::sources::Array& array)
+                              {
+                                encodedImage =
+                                  std::span(reinterpret_cast<const std::byte*>(array.bytes.data()), array.bytes.size())
+                                    .subspan(bufferView.byteOffset, bufferView.byteLength);
+                              }},
+            buffer.data);
+        },
+      },
+      gltfImage.data);
+
+    return encodedImage;
+  }
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine, std::string_view filePath)
+{
+  fmt::print("Loading GLTF: {}", filePath);
+
+  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
+  scene->creator = engine;
+  LoadedGLTF& file = *scene.get();
+
+  std::optional<fastgltf::Asset> parsed = parseGltf(filePath);
+  if (!parsed.has_value())
   {
-    std::cerr << "Failed to determine glTF container" << std::endl;
     return {};
   }
+  fastgltf::Asset& gltf = parsed.value();
+
   // we can stimate the descriptors we will need accurately
   std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
     {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
     {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
 
-  file.descriptorPool.init(engine->_device->getHandle().device, gltf.materials.size(), sizes);
+  // every material has a set per frame in flight
+  file.descriptorPool.init(engine->_device->getHandle().device, gltf.materials.size() * FRAME_OVERLAP, sizes);
 
   // load samplers
   for (fastgltf::Sampler& sampler : gltf.samplers)
@@ -97,26 +188,75 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
   // temporal arrays for all the objects to use while creating the GLTF data
   std::vector<std::shared_ptr<MeshAsset>> meshes;
   std::vector<std::shared_ptr<Node>> nodes;
-  std::vector<std::unique_ptr<VulkanBackend::Image>> images;
-  images.resize(gltf.images.size());
+  std::vector<AllocatedImage> images(gltf.images.size());
+  std::vector<std::optional<uint32_t>> streamedTextures(gltf.images.size());
   std::vector<std::shared_ptr<GLTFMaterial>> materials;
 
+  // find what every image is sampled for to pick its compression format, images shared between several kinds of
+  // maps (such as packed occlusion-roughness-metal) are kept as color
+  std::vector<std::optional<vkutil::TextureUsage>> imageUsages(gltf.images.size());
+  auto markUsage = [&](size_t textureIndex, vkutil::TextureUsage usage)
+  {
+    if (!gltf.textures[textureIndex].imageIndex.has_value())
+    {
+      return;
+    }
+    std::optional<vkutil::TextureUsage>& imageUsage = imageUsages[gltf.textures[textureIndex].imageIndex.value()];
+    imageUsage = (imageUsage.has_value() && imageUsage != usage) ? vkutil::TextureUsage::Color : usage;
+  };
+  for (fastgltf::Material& mat : gltf.materials)
+  {
+    if (mat.pbrData.baseColorTexture.has_value())
+    {
+      markUsage(mat.pbrData.baseColorTexture->textureIndex, vkutil::TextureUsage::Color);
+    }
+    if (mat.pbrData.metallicRoughnessTexture.has_value())
+    {
+      markUsage(mat.pbrData.metallicRoughnessTexture->textureIndex, vkutil::TextureUsage::Color);
+    }
+    if (mat.normalTexture.has_value())
+    {
+      markUsage(mat.normalTexture->textureIndex, vkutil::TextureUsage::Normal);
+    }
+    if (mat.occlusionTexture.has_value())
+    {
+      markUsage(mat.occlusionTexture->textureIndex, vkutil::TextureUsage::SingleChannel);
+    }
+  }
+
   // load all textures
   int i = 0;
   for (fastgltf::Image& image : gltf.images)
   {
-    // Need to transfer ownership
-    loadImage(images.at(i), engine, gltf, image);
-
-    if (images.at(i)->_handle.image != VK_NULL_HANDLE)
+    bool isLoaded = false;
+    if (engine->_chosenGPU->_isTextureCompressionBCEnabled)
     {
-      file.images[image.name.c_str()] = images.at(i)->_handle;
+      std::optional<vkutil::CookedTexture> texture =
+        loadImage(gltf, image, imageUsages[i].value_or(vkutil::TextureUsage::Color));
+      if (texture.has_value())
+      {
+        // only the low mips are uploaded here, the streamer brings the others when they get close enough
+        streamedTextures.at(i) = engine->_textureStreamer->addTexture(std::move(*texture));
+        images.at(i) = engine->_textureStreamer->getImage(*streamedTextures.at(i));
+        file.streamedTextures.push_back(*streamedTextures.at(i));
+        isLoaded = true;
+      }
     }
-    else
+    else if (std::optional<vkutil::DecodedImage> decoded = decodeImage(gltf, image))
+    {
+      // without block compression the whole image is uploaded as rgba8, its mips are generated on the GPU
+      std::unique_ptr<Image>& uploaded = file.images.emplace_back();
+      engine->createImage(
+        uploaded, decoded->texels.data(), decoded->extent, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+      images.at(i) = uploaded->_handle;
+      isLoaded = true;
+    }
+
+    if (!isLoaded)
     {
-      // we failed to load, so lets give the slot a default white texture to not
+      // we failed to load, so lets give the slot a default texture to not
       // completely break loading
-      images.at(i) = std::move(engine->_errorCheckerboardImage);
+      images.at(i) = engine->_errorCheckerboardImage->_handle;
       std::cout << "gltf failed to load texture " << image.name << std::endl;
     }
     i++;
@@ -125,7 +265,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
   file.materialDataBuffer = engine->createBuffer(
     sizeof(GLTFMetallicRoughness::MaterialConstants) * gltf.materials.size(),
     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-    VMA_MEMORY_USAGE_CPU_TO_GPU);
+    MemoryIntent::Dynamic);
   int data_index = 0;
   GLTFMetallicRoughness::MaterialConstants* sceneMaterialConstants =
     (GLTFMetallicRoughness::MaterialConstants*)file.materialDataBuffer.info.pMappedData;
@@ -146,6 +286,8 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
     constants.metalRoughFactors.y = mat.pbrData.roughnessFactor;
     // write material parameters to buffer
     sceneMaterialConstants[data_index] = constants;
+    newMat->colorFactors = constants.colorFactors;
+    newMat->metalRoughFactors = constants.metalRoughFactors;
 
     MaterialPass passType = MaterialPass::MainColor;
     if (mat.alphaMode == fastgltf::AlphaMode::Blend)
@@ -169,15 +311,26 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
       size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
       size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
 
-      materialResources.colorImage = images[img]->_handle;
+      materialResources.colorImage = images[img];
       materialResources.colorSampler = file.samplers[sampler];
+      if (streamedTextures[img].has_value())
+      {
+        newMat->streamedTextures.push_back(*streamedTextures[img]);
+      }
     }
     // build material
     newMat->data = engine->_metalRoughMaterial.writeMaterial(
       engine->_device->getHandle().device, passType, materialResources, file.descriptorPool);
 
+    // the color texture is bound at binding 1 of the material sets, rewritten when its residency changes
+    for (uint32_t texture : newMat->streamedTextures)
+    {
+      engine->_textureStreamer->addBinding(texture, newMat->data.materialSets, 1, materialResources.colorSampler);
+    }
+
     data_index++;
   }
+  engine->flushBuffer(file.materialDataBuffer);
 
   // use the same vectors for all meshes so that the memory doesnt reallocate as
   // often
@@ -275,21 +428,31 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
         newSurface.material = materials[0];
       }
 
-      glm::vec3 minpos = vertices[initial_vtx].position;
-      glm::vec3 maxpos = vertices[initial_vtx].position;
-      for (int i = initial_vtx; i < vertices.size(); i++)
+      newSurface.bounds = vkutil::computeSurfaceBounds(
+        std::span(indices).subspan(newSurface.startIndex, newSurface.count), vertices);
+      newmesh->surfaces.push_back(newSurface);
+    }
+
+    // LOD ranges are appended after every full detail surface so that the full detail geometry stays a
+    // contiguous prefix of the index buffer (used to build the acceleration structures).
+    for (GeoSurface& surface : newmesh->surfaces)
+    {
+      vkutil::generateSurfaceLods(indices, vertices, surface);
+    }
+
+    // Every LOD gets its own meshlets so that the GPU culling works whichever level is selected.
+    std::vector<GPUMeshlet> meshlets;
+    std::vector<uint32_t> meshletIndices;
+    for (GeoSurface& surface : newmesh->surfaces)
+    {
+      for (SurfaceLod& lod : surface.lods)
       {
-        minpos = glm::min(minpos, vertices[i].position);
-        maxpos = glm::max(maxpos, vertices[i].position);
+        vkutil::generateMeshlets(indices, vertices, lod, meshlets, meshletIndices);
       }
-
-      newSurface.bounds.origin = (maxpos + minpos) / 2.f;
-      newSurface.bounds.extents = (maxpos - minpos) / 2.f;
-      newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
-      newmesh->surfaces.push_back(newSurface);
     }
 
     newmesh->meshBuffers = engine->uploadMesh(indices, vertices);
+    newmesh->meshletBuffers = engine->uploadMeshlets(meshlets, meshletIndices);
   }
   // load all nodes and their meshes
   for (fastgltf::Node& node : gltf.nodes)
@@ -310,22 +473,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
     nodes.push_back(newNode);
     file.nodes[node.name.c_str()];
 
-    std::visit(
-      fastgltf::visitor{
-        [&](fastgltf::math::fmat4x4 matrix) { memcpy(&newNode->localTransform, matrix.data(), sizeof(matrix)); },
-        [&](fastgltf::TRS transform)
-        {
-          glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
-          glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
-          glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
-
-          glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
-          glm::mat4 rm = glm::toMat4(rot);
-          glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
-
-          newNode->localTransform = tm * rm * sm;
-        }},
-      node.transform);
+    newNode->localTransform = nodeLocalTransform(node);
   }
 
   // run loop again to setup transform hierarchy
@@ -353,6 +501,110 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkloader::loadGltf(VkEngine* engine,
   return scene;
 }
 
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::ReferenceScene> vkloader::loadReferenceScene(std::string_view filePath)
+{
+  std::optional<fastgltf::Asset> parsed = parseGltf(filePath);
+  if (!parsed.has_value())
+  {
+    return {};
+  }
+  fastgltf::Asset& gltf = parsed.value();
+
+  vkutil::ReferenceScene scene;
+
+  // the factors of the materials, the primitives without one use the first as in loadGltf
+  for (fastgltf::Material& mat : gltf.materials)
+  {
+    scene.materials.push_back(
+      {glm::vec4(
+         mat.pbrData.baseColorFactor[0],
+         mat.pbrData.baseColorFactor[1],
+         mat.pbrData.baseColorFactor[2],
+         mat.pbrData.baseColorFactor[3]),
+       glm::vec4(mat.pbrData.metallicFactor, mat.pbrData.roughnessFactor, 0.f, 0.f)});
+  }
+  if (scene.materials.empty())
+  {
+    scene.materials.push_back({glm::vec4(1.f), glm::vec4(0.f, 0.5f, 0.f, 0.f)});
+  }
+
+  // the full detail triangles of the primitives, without the LODs and meshlets of the rasterizer
+  for (fastgltf::Mesh& mesh : gltf.meshes)
+  {
+    vkutil::ReferenceMesh& referenceMesh = scene.meshes.emplace_back();
+    for (auto&& p : mesh.primitives)
+    {
+      auto positions = p.findAttribute("POSITION");
+      if (!p.indicesAccessor.has_value() || positions == p.attributes.end())
+      {
+        continue;
+      }
+      const size_t initial_vtx = referenceMesh.positions.size();
+      const size_t initial_idx = referenceMesh.indices.size();
+
+      fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
+      referenceMesh.indices.reserve(initial_idx + indexaccessor.count);
+      fastgltf::iterateAccessor<std::uint32_t>(
+        gltf, indexaccessor, [&](std::uint32_t idx) { referenceMesh.indices.push_back(idx + initial_vtx); });
+      referenceMesh.indices.resize(initial_idx + indexaccessor.count / 3 * 3);
+
+      fastgltf::Accessor& posAccessor = gltf.accessors[positions->accessorIndex];
+      referenceMesh.positions.resize(initial_vtx + posAccessor.count);
+      referenceMesh.normals.resize(initial_vtx + posAccessor.count, glm::vec3(1.f, 0.f, 0.f));
+      fastgltf::iterateAccessorWithIndex<glm::vec3>(
+        gltf, posAccessor, [&](glm::vec3 v, size_t index) { referenceMesh.positions[initial_vtx + index] = v; });
+
+      auto normals = p.findAttribute("NORMAL");
+      if (normals != p.attributes.end())
+      {
+        fastgltf::iterateAccessorWithIndex<glm::vec3>(
+          gltf,
+          gltf.accessors[(*normals).accessorIndex],
+          [&](glm::vec3 v, size_t index) { referenceMesh.normals[initial_vtx + index] = v; });
+      }
+
+      const uint32_t material = gltf.materials.empty() ? 0 : static_cast<uint32_t>(p.materialIndex.value_or(0));
+      referenceMesh.materials.insert(referenceMesh.materials.end(), indexaccessor.count / 3, material);
+    }
+  }
+
+  // an instance per mesh node, with its world transform from the top nodes down
+  std::vector<bool> isChild(gltf.nodes.size(), false);
+  for (fastgltf::Node& node : gltf.nodes)
+  {
+    for (auto& c : node.children)
+    {
+      isChild[c] = true;
+    }
+  }
+  std::vector<std::pair<size_t, glm::mat4>> pending;
+  for (size_t i = 0; i < gltf.nodes.size(); i++)
+  {
+    if (!isChild[i])
+    {
+      pending.push_back({i, glm::mat4{1.f}});
+    }
+  }
+  while (!pending.empty())
+  {
+    const auto [nodeIndex, parentTransform] = pending.back();
+    pending.pop_back();
+
+    const fastgltf::Node& node = gltf.nodes[nodeIndex];
+    const glm::mat4 worldTransform = parentTransform * nodeLocalTransform(node);
+    if (node.meshIndex.has_value())
+    {
+      scene.instances.push_back({worldTransform, static_cast<uint32_t>(*node.meshIndex)});
+    }
+    for (auto& c : node.children)
+    {
+      pending.push_back({c, worldTransform});
+    }
+  }
+  return scene;
+}
+
 //--------------------------------------------------------------------------------------------------
 VkFilter vkloader::extractFilter(fastgltf::Filter filter)
 {
@@ -385,126 +637,33 @@ VkSamplerMipmapMode vkloader::extractMipmapMode(fastgltf::Filter filter)
   }
 }
 
-std::optional<AllocatedImage> vkloader::loadImage(
-  std::unique_ptr<VulkanBackend::Image>& image,
-  VkEngine* engine,
+std::optional<vkutil::CookedTexture> vkloader::loadImage(
   fastgltf::Asset& asset,
-  fastgltf::Image& gltfImage)
+  fastgltf::Image& gltfImage,
+  vkutil::TextureUsage usage)
 {
-  AllocatedImage newImage{};
-
-  int width, height, nrChannels;
-
-  std::visit(
-    fastgltf::visitor{
-      [](auto& arg) {},
-      [&](fastgltf::sources::URI& filePath)
-      {
-        assert(filePath.fileByteOffset == 0);  // We don't support offsets with stbi.
-        assert(filePath.uri.isLocalPath());    // We're only capable of loading
-                                               // local files.
-
-        const std::string path(filePath.uri.path().begin(),
-                               filePath.uri.path().end());  // Thanks C++.
-        unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-        if (data)
-        {
-          VkExtent3D imagesize;
-          imagesize.width = width;
-          imagesize.height = height;
-          imagesize.depth = 1;
-
-          engine->createImage(image, data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-          stbi_image_free(data);
-        }
-      },
-      [&](fastgltf::sources::Vector& vector)
-      {
-        unsigned char* data = stbi_load_from_memory(
-          reinterpret_cast<const stbi_uc*>(vector.bytes.data()),
-          static_cast<int>(vector.bytes.size()),
-          &width,
-          &height,
-          &nrChannels,
-          4);
-        if (data)
-        {
-          VkExtent3D imagesize;
-          imagesize.width = width;
-          imagesize.height = height;
-          imagesize.depth = 1;
-
-          engine->createImage(image, data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-          stbi_image_free(data);
-        }
-      },
-      [&](fastgltf::sources::Array& array)
-      {
-        unsigned char* data = stbi_load_from_memory(
-          reinterpret_cast<const stbi_uc*>(array.bytes.data()),
-          static_cast<int>(array.bytes.size()),
-          &width,
-          &height,
-          &nrChannels,
-          4);
-        if (data)
-        {
-          VkExtent3D imagesize;
-          imagesize.width = width;
-          imagesize.height = height;
-          imagesize.depth = 1;
-
-          engine->createImage(image, data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
+  std::vector<std::byte> fileBytes;
+  std::span<const std::byte> encodedImage = readEncodedImage(asset, gltfImage, fileBytes);
+  if (encodedImage.empty())
+  {
+    return {};
+  }
 
-          stbi_image_free(data);
-        }
-      },
-      [&](fastgltf::sources::BufferView& view)
-      {
-        auto& bufferView = asset.bufferViews[view.bufferViewIndex];
-        auto& buffer = asset.buffers[bufferView.bufferIndex];
-
-        std::visit(
-          fastgltf::visitor{// We only care about VectorWithMime here, because we
-                            // specify LoadExternalBuffers, meaning all buffers
-                            // are already loaded into a vector.
-                            [](auto& arg) {},
-                            [&](fastgltf::sources::Array& array)
-                            {
-                              unsigned char* data = stbi_load_from_memory(
-                                reinterpret_cast<const stbi_uc*>(array.bytes.data()) + bufferView.byteOffset,
-                                static_cast<int>(bufferView.byteLength),
-                                &width,
-                                &height,
-                                &nrChannels,
-                                4);
-                              if (data)
-                              {
-                                VkExtent3D imagesize;
-                                imagesize.width = width;
-                                imagesize.height = height;
-                                imagesize.depth = 1;
-
-                                engine->createImage(
-                                  image, data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-
-                                stbi_image_free(data);
-                              }
-                            }},
-          buffer.data);
-      },
-    },
-    gltfImage.data);
+  // the blocks are uploaded as they are, the mip chain comes from the cooker or the KTX2 file
+  return vkutil::loadTexture(encodedImage, usage);
+}
 
-  // if any of the attempts to load the data failed, we havent written the image
-  // so handle is null
-  if (image->_handle.image == VK_NULL_HANDLE)
+//--------------------------------------------------------------------------------------------------
+std::optional<vkutil::DecodedImage> vkloader::decodeImage(fastgltf::Asset& asset, fastgltf::Image& gltfImage)
+{
+  std::vector<std::byte> fileBytes;
+  std::span<const std::byte> encodedImage = readEncodedImage(asset, gltfImage, fileBytes);
+  if (encodedImage.empty())
   {
-    const char* test = stbi_failure_reason();
     return {};
   }
+
+  return vkutil::decodeImage(encodedImage);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -527,18 +686,21 @@ void LoadedGLTF::clearAll()
 
   for (auto& [k, v] : meshes)
   {
-    creator->destroyBuffer(v->meshBuffers.indexBuffer);
-    creator->destroyBuffer(v->meshBuffers.vertexBuffer);
+    creator->freeMesh(v->meshBuffers);
+    if (v->meshletBuffers.meshletCount > 0)
+    {
+      creator->destroyBuffer(v->meshletBuffers.meshletBuffer);
+      creator->destroyBuffer(v->meshletBuffers.meshletIndexBuffer);
+    }
   }
 
-  for (auto& [k, v] : images)
+  for (uint32_t texture : streamedTextures)
   {
-    if (v.image == creator->_errorCheckerboardImage->_handle.image)
-    {
-      //dont destroy the default images
-      continue;
-    }
-    creator->destroyImage(v);
+    creator->_textureStreamer->removeTexture(texture);
+  }
+  for (std::unique_ptr<Image>& image : images)
+  {
+    creator->destroyImage(image->_handle);
   }
 
   for (auto& sampler : samplers)
@@ -657,9 +819,22 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> vkloader::loadGltfMeshes(
           gltf.accessors[(*colors).accessorIndex],
           [&](glm::vec4 v, size_t index) { vertices[initial_vtx + index].color = v; });
       }
+      newSurface.bounds =
+        vkutil::computeSurfaceBounds(std::span(indices).subspan(newSurface.startIndex, newSurface.count), vertices);
       newmesh.surfaces.push_back(newSurface);
     }
 
+    std::vector<GPUMeshlet> meshlets;
+    std::vector<uint32_t> meshletIndices;
+    for (GeoSurface& surface : newmesh.surfaces)
+    {
+      vkutil::generateSurfaceLods(indices, vertices, surface);
+      for (SurfaceLod& lod : surface.lods)
+      {
+        vkutil::generateMeshlets(indices, vertices, lod, meshlets, meshletIndices);
+      }
+    }
+
     // display the vertex normals
     constexpr bool OverrideColors = true;
     if (OverrideColors)
@@ -670,6 +845,7 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> vkloader::loadGltfMeshes(
       }
     }
     newmesh.meshBuffers = engine->uploadMesh(indices, vertices);
+    newmesh.meshletBuffers = engine->uploadMeshlets(meshlets, meshletIndices);
 
     meshes.emplace_back(std::make_shared<MeshAsset>(std::move(newmesh)));
   }
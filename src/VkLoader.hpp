@@ -2,6 +2,8 @@
 #include <filesystem>
 #include <unordered_map>
 #include "Image.hpp"
+#include "ReferencePathTracer.hpp"
+#include "TextureCooker.hpp"
 #include "VkDescriptors.hpp"
 #include "VkTypes.hpp"
 #include "fastgltf/types.hpp"
@@ -9,6 +11,10 @@
 struct GLTFMaterial
 {
   MaterialInstance data;
+  std::vector<uint32_t> streamedTextures;  // textures sampled by the material, ids in the engine texture streamer
+  // factors of the material constants, kept for the ray tracing material table
+  glm::vec4 colorFactors{1.f};
+  glm::vec4 metalRoughFactors{1.f, 0.5f, 0.f, 0.f};
 };
 
 struct Bounds
@@ -18,12 +24,24 @@ struct Bounds
   glm::vec3 extents;
 };
 
+// Index range of a surface simplified at import time, stored in the same index buffer as the full detail one
+struct SurfaceLod
+{
+  uint32_t startIndex;
+  uint32_t count;
+  float error;  // object space geometric error compared to the full detail surface
+  // meshlets covering the same triangles, stored in the mesh meshlet buffers
+  uint32_t meshletOffset = 0;
+  uint32_t meshletCount = 0;
+};
+
 struct GeoSurface
 {
   uint32_t startIndex;
   uint32_t count;
   Bounds bounds;
   std::shared_ptr<GLTFMaterial> material;
+  std::vector<SurfaceLod> lods;  // lods[0] is the full detail range, may be empty for hand made meshes
 };
 
 struct MeshAsset
@@ -32,6 +50,7 @@ struct MeshAsset
 
   std::vector<GeoSurface> surfaces;
   GPUMeshBuffers meshBuffers;
+  GPUMeshletBuffers meshletBuffers{};
 };
 
 //forward declaration
@@ -41,7 +60,8 @@ struct LoadedGLTF : public IRenderable
 {
   std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
   std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
-  std::unordered_map<std::string, AllocatedImage> images;
+  std::vector<uint32_t> streamedTextures;
+  std::vector<std::unique_ptr<Image>> images;  // rgba8 images of the devices without block compression, not streamed
   std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
 
   // nodes that dont have a parent, for iterating through the file in tree order
@@ -69,15 +89,20 @@ struct LoadedGLTF : public IRenderable
 namespace vkloader
 {
   std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(VkEngine* engine, std::string_view filePath);
+  // Triangles, mesh nodes and material factors of the file for the CPU reference, read without any device: nothing is
+  // uploaded and the textures are not decoded. The scene data is left to the caller.
+  std::optional<vkutil::ReferenceScene> loadReferenceScene(std::string_view filePath);
   // Legacy for debug
   std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGltfMeshes(VkEngine* engine, std::filesystem::path filePath);
   VkFilter extractFilter(fastgltf::Filter filter);
   VkSamplerMipmapMode extractMipmapMode(fastgltf::Filter filter);
-  std::optional<AllocatedImage> loadImage(
-    std::unique_ptr<VulkanBackend::Image>& image,
-    VkEngine* engine,
+  // Reads the image and cooks it, the texture streamer then decides which of its mips are uploaded
+  std::optional<vkutil::CookedTexture> loadImage(
     fastgltf::Asset& asset,
-    fastgltf::Image& gltfImage);
+    fastgltf::Image& gltfImage,
+    vkutil::TextureUsage usage);
+  // Reads the image as rgba8 texels for the devices without block compression, its mips are generated on upload
+  std::optional<vkutil::DecodedImage> decodeImage(fastgltf::Asset& asset, fastgltf::Image& gltfImage);
 
   template<typename T> T loadFunction(VkDevice device, const char* funcName)
   {
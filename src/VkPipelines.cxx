@@ -44,8 +44,10 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device)
 
   colorBlending.logicOpEnable = VK_FALSE;
   colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &_colorBlendAttachment;
+  std::vector<VkPipelineColorBlendAttachmentState> blendAttachments(
+    _renderInfo.colorAttachmentCount, _colorBlendAttachment);
+  colorBlending.attachmentCount = _renderInfo.colorAttachmentCount;
+  colorBlending.pAttachments = blendAttachments.data();
 
   // completely clear VertexInputStateCreateInfo, as we have no need for it
   VkPipelineVertexInputStateCreateInfo _vertexInputInfo = {
@@ -183,6 +185,14 @@ void PipelineBuilder::setColorAttachmentFormat(VkFormat format)
   _renderInfo.pColorAttachmentFormats = &_colorAttachmentformat;
 }
 
+//--------------------------------------------------------------------------------------------------
+void PipelineBuilder::setColorAttachmentFormats(const std::vector<VkFormat>& formats)
+{
+  _colorAttachmentFormats = formats;
+  _renderInfo.colorAttachmentCount = static_cast<uint32_t>(_colorAttachmentFormats.size());
+  _renderInfo.pColorAttachmentFormats = _colorAttachmentFormats.data();
+}
+
 //--------------------------------------------------------------------------------------------------
 void PipelineBuilder::setDepthFormat(VkFormat format)
 {
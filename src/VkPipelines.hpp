@@ -15,6 +15,7 @@ class PipelineBuilder
   VkPipelineDepthStencilStateCreateInfo _depthStencil;
   VkPipelineRenderingCreateInfo _renderInfo;
   VkFormat _colorAttachmentformat;
+  std::vector<VkFormat> _colorAttachmentFormats;  // of a pipeline writing several attachments
 
   PipelineBuilder()
   {
@@ -34,6 +35,8 @@ class PipelineBuilder
   void enableBlendingAlphablend();
 
   void setColorAttachmentFormat(VkFormat format);
+  // every attachment gets the same blending
+  void setColorAttachmentFormats(const std::vector<VkFormat>& formats);
   void setDepthFormat(VkFormat format);
   void disableDepthtest();
   void enableDepthtest(bool depthWriteEnable, VkCompareOp op);
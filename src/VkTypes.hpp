@@ -5,7 +5,9 @@
 #include <array>
 #include <deque>
 #include <functional>
+#include <glm/mat4x3.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 #include <memory>
 #include <optional>
@@ -30,6 +32,7 @@ struct AllocatedImage
   VmaAllocation allocation;
   VkExtent3D imageExtent;
   VkFormat imageFormat;
+  uint32_t mipLevels = 1;
 };
 
 struct AllocatedBuffer
@@ -39,6 +42,51 @@ struct AllocatedBuffer
   VmaAllocationInfo info;
 };
 
+// How the CPU and the GPU access a buffer, decides the memory it is allocated from
+enum class MemoryIntent : uint8_t
+{
+  GpuOnly,   // only the GPU touches it, or it is filled once through a transfer
+  Upload,    // staging written once by the CPU and read by a transfer
+  Readback,  // written by the GPU and read back by the CPU
+  Dynamic,   // written by the CPU, usually every frame, and read in place by the GPU
+  Static,    // read by the GPU, written in place when the device local memory is host visible, with a transfer otherwise
+  Count
+};
+
+// Memory a buffer actually landed in
+enum class MemoryPlacement : uint8_t
+{
+  DeviceLocal,             // VRAM the CPU cannot map
+  DeviceLocalHostVisible,  // VRAM behind the resizable BAR, or the single memory of an integrated GPU
+  HostVisible,             // system memory, the GPU reads it over the bus
+  Count
+};
+
+// Buffers of one intent, with the bytes allocated in each placement
+struct MemoryIntentReport
+{
+  uint32_t bufferCount;
+  std::array<VkDeviceSize, static_cast<size_t>(MemoryPlacement::Count)> bytes;
+};
+
+// Bytes to copy at `offset` in `buffer`
+struct BufferWrite
+{
+  const AllocatedBuffer* buffer;
+  VkDeviceSize offset;
+  const void* data;
+  VkDeviceSize size;
+};
+
+// Average time to fill a buffer through a staging copy, and through its mapping when it is host visible
+struct UploadBenchmark
+{
+  VkDeviceSize size;
+  bool isDirectAvailable;
+  float stagedMs;
+  float directMs;
+};
+
 struct ComputePushConstants
 {
   glm::vec4 data1;
@@ -47,6 +95,14 @@ struct ComputePushConstants
   glm::vec4 data4;
 };
 
+// push constants of the single pass mipmap downsampler
+struct MipmapPushConstants
+{
+  glm::ivec2 size;  // extent of the mip 0
+  uint32_t mipCount;  // number of mips to generate after the mip 0
+  uint32_t workGroupCount;
+};
+
 struct ComputeEffect
 {
   const char* name;
@@ -94,6 +150,7 @@ struct GPUSceneData
   glm::mat4 proj;
   glm::mat4 invProj;
   glm::mat4 viewproj;
+  glm::mat4 previousViewProj;  // of the previous frame, for the reprojection
   glm::vec4 ambientColor;
   glm::vec4 cameraPosition;
   glm::vec4 lightPosition;
@@ -121,35 +178,226 @@ struct MaterialPipeline
   VkPipelineLayout layout;
 };
 
+// Frames recorded while the previous ones may still run on the GPU
+constexpr unsigned int FRAME_OVERLAP = 2;
+
 struct MaterialInstance
 {
   MaterialPipeline* pipeline;
-  VkDescriptorSet materialSet;
+  // one set per frame in flight, the streamed textures rewrite the set of a frame only once the GPU is done with it
+  std::array<VkDescriptorSet, FRAME_OVERLAP> materialSets;
   MaterialPass passType;
 };
 
 // holds the resources needed for a mesh
+// Ranges of a mesh in the vertex and index arenas of the engine, shared by every mesh
 struct GPUMeshBuffers
 {
-  AllocatedBuffer indexBuffer;
-  AllocatedBuffer vertexBuffer;
-  VkDeviceAddress vertexBufferAddress;
-  VkDeviceAddress indexBufferAddress;
+  uint32_t vertexRange;  // range handles, the offsets behind them move when an arena is defragmented
+  uint32_t indexRange;
   uint32_t vertexCount;
   uint32_t indexCount;
 };
 
+// cluster of at most 64 vertices and 124 triangles, culled as a whole by the meshlet culling pass
+struct GPUMeshlet
+{
+  glm::vec3 center;
+  float radius;
+  glm::vec3 coneApex;
+  float coneCutoff;
+  glm::vec3 coneAxis;
+  uint32_t indexOffset;  // first index of the meshlet in the meshlet index buffer
+  uint32_t indexCount;
+  uint32_t padding[3];
+};
+
+static_assert(sizeof(GPUMeshlet) == 64);
+
+// holds the meshlets of every surface and LOD of a mesh
+struct GPUMeshletBuffers
+{
+  AllocatedBuffer meshletBuffer;
+  AllocatedBuffer meshletIndexBuffer;
+  VkDeviceAddress meshletBufferAddress;
+  VkDeviceAddress meshletIndexBufferAddress;
+  uint32_t meshletCount;
+};
+
+enum MeshletCullingFlags : uint32_t
+{
+  MESHLET_CULL_FRUSTUM = 1 << 0,
+  MESHLET_CULL_CONE = 1 << 1
+};
+
+// push constants of the meshlet culling compute pass, one dispatch per render object
+struct MeshletCullPushConstants
+{
+  glm::mat4 worldMatrix;
+  VkDeviceAddress meshletBuffer;
+  VkDeviceAddress meshletIndexBuffer;
+  VkDeviceAddress outputIndexBuffer;
+  VkDeviceAddress drawCommandBuffer;
+  uint32_t meshletOffset;
+  uint32_t meshletCount;
+  uint32_t outputOffset;
+  uint32_t drawIndex;
+  uint32_t cullingFlags;
+};
+
 // push constants for our mesh object draws
 struct GPUDrawPushConstants
 {
-  glm::mat4 worldMatrix;
-  VkDeviceAddress vertexBuffer;
+  VkDeviceAddress vertexBuffer;  // vertex arena, the draws offset into it with their vertex offset
+  VkDeviceAddress objectBuffer;  // world matrices of the render objects, indexed by the instance index
+};
+
+// Ray tracing scene table, an instance is found by gl_InstanceCustomIndexEXT, its geometries follow each other
+struct GPURaytracingInstance
+{
+  uint32_t firstGeometry;  // geometry of the gl_GeometryIndexEXT 0 of the instance
 };
 
+// a surface of a mesh, a geometry of its BLAS
+struct GPURaytracingGeometry
+{
+  VkDeviceAddress vertexBuffer;  // range of the mesh in the vertex arena
+  VkDeviceAddress indexBuffer;   // range of the mesh in the index arena
+  uint32_t firstIndex;           // of the surface, gl_PrimitiveID counts from it
+  uint32_t materialId;
+};
+
+static_assert(sizeof(GPURaytracingGeometry) == 24);
+
+struct GPURaytracingMaterial
+{
+  glm::vec4 colorFactors;
+  glm::vec4 metalRoughFactors;
+};
+
+// Inline data of a hit record of the shader binding table, one record per geometry of the scene table: an instance
+// points at the record of its first geometry. A procedural record holds the first material of its asset.
+struct GPURaytracingHitRecord
+{
+  GPURaytracingMaterial material;
+  GPURaytracingGeometry geometry;
+};
+
+static_assert(sizeof(GPURaytracingHitRecord) == 56);
+
+enum ProceduralType : uint32_t
+{
+  PROCEDURAL_SPHERE = 0,  // the sphere inscribed in the bounds, of the radius of their x extent
+  PROCEDURAL_BOX = 1      // the bounds themselves
+};
+
+// Analytic primitive of a procedural geometry, see shaders/procedural.glsl. It starts with its bounds, as a
+// VkAabbPositionsKHR, so that the primitives are also the AABB data of their BLAS.
+struct GPUProceduralPrimitive
+{
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  uint32_t type;           // ProceduralType
+  uint32_t materialIndex;  // in the materials of its procedural asset
+};
+
+static_assert(sizeof(GPUProceduralPrimitive) == 32);
+
+// Node of a BVH of the software ray tracing, the children of an inner node follow each other
+struct GPUBvhNode
+{
+  glm::vec3 boundsMin;
+  uint32_t first;  // left child of an inner node, first primitive of a leaf
+  glm::vec3 boundsMax;
+  uint32_t count;  // primitives of a leaf, 0 for an inner node
+};
+
+static_assert(sizeof(GPUBvhNode) == 32);
+
+// triangle of the BVH of a mesh, in the order of its leaves
+struct GPUBvhTriangle
+{
+  glm::vec3 v0;
+  uint32_t geometryIndex;  // surface of the mesh, as gl_GeometryIndexEXT
+  glm::vec3 v1;
+  uint32_t primitiveIndex;  // in the surface, as gl_PrimitiveID
+  glm::vec3 v2;
+  uint32_t padding;
+};
+
+// instance of a mesh in the top level BVH, in the order of its leaves
+struct GPUBvhInstance
+{
+  glm::mat4x3 worldToObject;
+  VkDeviceAddress nodes;      // BVH of the mesh
+  VkDeviceAddress triangles;  // of the mesh
+  uint32_t customIndex;       // as gl_InstanceCustomIndexEXT, the record of the instance in the scene table
+  uint32_t padding;
+};
+
+static_assert(sizeof(GPUBvhInstance) == 72);
+
 struct RaytracingPushConstant
 {
-  VkDeviceAddress vertexBufferAddress;
-  VkDeviceAddress indexBufferAddress;
+  VkDeviceAddress instanceBuffer;
+  VkDeviceAddress geometryBuffer;
+  VkDeviceAddress materialBuffer;
+  VkDeviceAddress activePixelCounter;  // pixels the frame still samples, read back to detect the convergence
+  VkDeviceAddress blueNoiseBuffer;     // mask of the SAMPLER_BLUE_NOISE sampler
+  float errorThreshold;                // standard error of the mean under which a pixel is converged, relative to it
+  uint32_t minSamples;                 // before a pixel may be considered converged
+  uint32_t samplesPerFrame;
+  uint32_t samplerType;                // SAMPLER_* of shaders/sampler_shared.h
+  uint32_t flags;                      // RaytracingFlags
+  uint32_t frameCount;                 // traced frames, their parity selects the images of the current frame
+  uint32_t maxBounces;                 // surfaces a path may hit, the first one included
+  uint32_t rouletteDepth;              // bounces before the paths may be terminated by Russian roulette
+  VkDeviceAddress bvhNodes;            // top level BVH of the software ray tracing
+  VkDeviceAddress bvhInstances;        // instances in the order of its leaves
+};
+
+enum RaytracingFlags : uint32_t
+{
+  RAYTRACING_RESOLVE_ONLY = 1 << 0,  // no rays, the accumulated estimate is copied to the output
+  RAYTRACING_DENOISED = 1 << 1,      // the samples of the frame only, filtered by the denoiser
+  RAYTRACING_HISTORY = 1 << 2,       // the previous frame was traced, its accumulation is reprojected
+  RAYTRACING_MOTION = 1 << 3,        // the camera moved since the previous frame, the G-buffer is traced again
+  RAYTRACING_HYBRID = 1 << 4         // the G-buffer was rasterized, the paths start from its surfaces
+};
+
+// How the rays of the path tracer are traced, the fastest one depends on the device
+enum RaytracingBackend : int
+{
+  RAYTRACING_BACKEND_PIPELINE = 0,   // vkCmdTraceRaysKHR, the hit shaders of the shader binding table
+  RAYTRACING_BACKEND_RAY_QUERY = 1,  // ray queries of a compute shader, needs VK_KHR_ray_query
+  RAYTRACING_BACKEND_COUNT = 2
+};
+
+// GPU time of the trace with each backend, on frames alternating between them and all tracing every pixel from scratch
+struct BackendBenchmark
+{
+  bool isRunning;
+  uint32_t frame;  // recorded since the start
+  std::array<double, RAYTRACING_BACKEND_COUNT> totalMs;
+  std::array<uint32_t, RAYTRACING_BACKEND_COUNT> frameCount;  // timed so far
+  std::array<float, RAYTRACING_BACKEND_COUNT> averageMs;      // of the last finished benchmark, 0 before
+};
+
+enum DenoiserFlags : uint32_t
+{
+  DENOISER_WRITE_HISTORY = 1 << 0,
+  DENOISER_FINAL = 1 << 1
+};
+
+// push constants of the passes of the denoiser
+struct DenoiserPushConstants
+{
+  glm::ivec2 size;
+  uint32_t frameParity;  // images of the current frame
+  uint32_t isHistoryValid;
+  uint32_t stepSize;  // between the taps of the a-trous iteration
+  uint32_t source;    // ping pong image read by the a-trous iteration
+  uint32_t flags;     // DenoiserFlags
 };
 
 struct DrawContext;
@@ -1,9 +1,83 @@
 // #include "VesuveApp.hpp"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
 #include "VkEngine.hpp"
+#include "VkLoader.hpp"
 
+namespace
+{
+  //------------------------------------------------------------------------------------------------
+  // Vesuve --reference <scene.gltf> [image.pfm] [samples per pixel]
+  // Path traces the file on the CPU without creating a window nor a Vulkan device, for the render farm nodes. The
+  // camera, the light and the settings are the defaults of the engine, as the reference of a freshly started one.
+  int renderReference(int argc, char* argv[])
+  {
+    std::optional<vkutil::ReferenceScene> scene = vkloader::loadReferenceScene(argv[2]);
+    if (!scene.has_value())
+    {
+      return EXIT_FAILURE;
+    }
+    const char* imagePath = argc > 3 ? argv[3] : REFERENCE_IMAGE_PATH;
+
+    uint32_t samplesPerPixel = DEFAULT_REFERENCE_SAMPLES;
+    if (argc > 4)
+    {
+      const std::string_view samples = argv[4];
+      const auto [end, error] = std::from_chars(samples.data(), samples.data() + samples.size(), samplesPerPixel);
+      if (error != std::errc() || end != samples.data() + samples.size() || samplesPerPixel == 0)
+      {
+        fmt::println("Invalid sample count {}, a positive number of samples per pixel is expected", samples);
+        return EXIT_FAILURE;
+      }
+    }
+    const vkutil::ReferenceSettings settings{
+      .width = DEFAULT_WINDOW_EXTENT.width,
+      .height = DEFAULT_WINDOW_EXTENT.height,
+      .samplesPerPixel = samplesPerPixel,
+      .maxBounces = DEFAULT_MAX_BOUNCES,
+      .rouletteDepth = DEFAULT_ROULETTE_DEPTH,
+      .threadCount = 0};
+
+    Camera camera;
+    camera.velocity = glm::vec3(0.f);
+    camera.position = DEFAULT_CAMERA_POSITION;
+    const PointLight light = DEFAULT_LIGHT;
+
+    // as VkEngine::updateScene
+    GPUSceneData& sceneData = scene->sceneData;
+    sceneData.view = camera.getViewMatrix();
+    sceneData.invView = glm::inverse(sceneData.view);
+    sceneData.proj = camera.getProjectionMatrix((float)settings.width / (float)settings.height);
+    sceneData.invProj = glm::inverse(sceneData.proj);
+    sceneData.viewproj = sceneData.proj * sceneData.view;
+    sceneData.cameraPosition = glm::vec4(camera.position, 1.0f);
+    sceneData.lightPosition = light.position;
+    sceneData.lightColor = light.color;
+    sceneData.lightPower = light.power;
 
-int main()
+    const vkutil::ReferenceImage image = vkutil::renderReference(scene.value(), settings);
+    vkutil::saveReferenceImage(imagePath, image);
+    fmt::println(
+      "Reference {}x{}, {} spp: BVH {:.1f} ms, render {:.1f} ms, {:.2f} Mrays/s",
+      settings.width,
+      settings.height,
+      settings.samplesPerPixel,
+      image.buildTime,
+      image.renderTime,
+      image.rayCount / (image.renderTime * 1000.f));
+    return EXIT_SUCCESS;
+  }
+}  // namespace
+
+int main(int argc, char* argv[])
 {
+  if (argc > 2 && std::strcmp(argv[1], "--reference") == 0)
+  {
+    return renderReference(argc, argv);
+  }
+
   VkEngine renderEngine;
 
   renderEngine.init();
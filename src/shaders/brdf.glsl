@@ -0,0 +1,142 @@
+// Metallic-roughness BRDF of the glTF materials: a Lambertian diffuse lobe for the dielectric part and a GGX specular
+// lobe (Trowbridge-Reitz distribution, height correlated Smith masking, Schlick Fresnel). The directions all point
+// away from the surface.
+
+const float PI = 3.14159265359;
+
+struct BrdfSurface
+{
+  vec3 normal;
+  vec3 albedo;
+  float metallic;
+  float alpha;  // GGX roughness, the square of the perceptual one
+};
+
+BrdfSurface brdfSurface(vec3 normal, vec3 albedo, float metallic, float roughness)
+{
+  // a perfect mirror would be a delta the sampling cannot reach from the light
+  const float perceptualRoughness = clamp(roughness, 0.05, 1.0);
+  return BrdfSurface(normal, albedo, clamp(metallic, 0.0, 1.0), perceptualRoughness * perceptualRoughness);
+}
+
+float brdfLuminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 fresnelSchlick(vec3 f0, float cosTheta)
+{
+  return f0 + (1.0 - f0) * pow(1.0 - cosTheta, 5.0);
+}
+
+float distributionGGX(float NdotH, float alpha)
+{
+  const float a2 = alpha * alpha;
+  const float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+  return a2 / (PI * d * d);
+}
+
+// masking-shadowing divided by 4 NdotL NdotV
+float visibilitySmithGGX(float NdotL, float NdotV, float alpha)
+{
+  const float a2 = alpha * alpha;
+  const float lambdaV = NdotL * sqrt(NdotV * NdotV * (1.0 - a2) + a2);
+  const float lambdaL = NdotV * sqrt(NdotL * NdotL * (1.0 - a2) + a2);
+  return 0.5 / max(lambdaV + lambdaL, 1e-7);
+}
+
+// Probability of sampling the specular lobe, following the weight of the lobes seen from the view direction
+float specularProbability(BrdfSurface surface, float NdotV)
+{
+  const vec3 f0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+  const float specular = brdfLuminance(fresnelSchlick(f0, NdotV));
+  const float diffuse = brdfLuminance(surface.albedo) * (1.0 - surface.metallic);
+  return clamp(specular / max(specular + diffuse, 1e-4), 0.1, 0.9);
+}
+
+vec3 brdfEvaluate(BrdfSurface surface, vec3 view, vec3 light)
+{
+  const float NdotL = dot(surface.normal, light);
+  const float NdotV = dot(surface.normal, view);
+  if(NdotL <= 0.0 || NdotV <= 0.0)
+  {
+    return vec3(0.0);
+  }
+  const vec3 halfVector = normalize(view + light);
+  const float NdotH = max(dot(surface.normal, halfVector), 0.0);
+  const float VdotH = max(dot(view, halfVector), 0.0);
+
+  const vec3 f0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+  const vec3 fresnel = fresnelSchlick(f0, VdotH);
+  const vec3 specular =
+    fresnel * distributionGGX(NdotH, surface.alpha) * visibilitySmithGGX(NdotL, NdotV, surface.alpha);
+  const vec3 diffuse = (1.0 - fresnel) * (1.0 - surface.metallic) * surface.albedo / PI;
+  return diffuse + specular;
+}
+
+// Density of brdfSample for the direction, both lobes together
+float brdfPdf(BrdfSurface surface, vec3 view, vec3 light)
+{
+  const float NdotL = dot(surface.normal, light);
+  const float NdotV = dot(surface.normal, view);
+  if(NdotL <= 0.0 || NdotV <= 0.0)
+  {
+    return 0.0;
+  }
+  const vec3 halfVector = normalize(view + light);
+  const float NdotH = max(dot(surface.normal, halfVector), 0.0);
+  const float VdotH = max(dot(view, halfVector), 1e-4);
+
+  const float specularPdf = distributionGGX(NdotH, surface.alpha) * NdotH / (4.0 * VdotH);
+  const float diffusePdf = NdotL / PI;
+  const float probability = specularProbability(surface, NdotV);
+  return mix(diffusePdf, specularPdf, probability);
+}
+
+// Orthonormal basis around n, see Duff et al. "Building an Orthonormal Basis, Revisited"
+void brdfBasis(vec3 n, out vec3 tangent, out vec3 bitangent)
+{
+  const float s = n.z >= 0.0 ? 1.0 : -1.0;
+  const float a = -1.0 / (s + n.z);
+  const float b = n.x * n.y * a;
+  tangent = vec3(1.0 + s * n.x * n.x * a, s * b, -s * n.x);
+  bitangent = vec3(b, s + n.y * n.y * a, -n.y);
+}
+
+// Draws a direction from one of the lobes, picked with `lobe` in [0, 1). `weight` is the BRDF times the cosine over
+// the density of the direction; false when the direction goes below the surface.
+bool brdfSample(BrdfSurface surface, vec3 view, vec2 u, float lobe, out vec3 light, out vec3 weight)
+{
+  vec3 tangent, bitangent;
+  brdfBasis(surface.normal, tangent, bitangent);
+
+  const float NdotV = dot(surface.normal, view);
+  if(lobe < specularProbability(surface, NdotV))
+  {
+    // half vector from the GGX distribution
+    const float a2 = surface.alpha * surface.alpha;
+    const float phi = 2.0 * PI * u.x;
+    const float cosTheta = sqrt((1.0 - u.y) / (1.0 + (a2 - 1.0) * u.y));
+    const float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+    const vec3 halfVector = normalize(
+      tangent * (sinTheta * cos(phi)) + bitangent * (sinTheta * sin(phi)) + surface.normal * cosTheta);
+    light = reflect(-view, halfVector);
+  }
+  else
+  {
+    // cosine weighted hemisphere
+    const float radius = sqrt(u.x);
+    const float phi = 2.0 * PI * u.y;
+    light = normalize(
+      tangent * (radius * cos(phi)) + bitangent * (radius * sin(phi)) + surface.normal * sqrt(max(1.0 - u.x, 0.0)));
+  }
+
+  const float pdf = brdfPdf(surface, view, light);
+  if(pdf <= 0.0)
+  {
+    weight = vec3(0.0);
+    return false;
+  }
+  weight = brdfEvaluate(surface, view, light) * dot(surface.normal, light) / pdf;
+  return true;
+}
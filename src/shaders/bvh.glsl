@@ -0,0 +1,262 @@
+// Bounding volume hierarchies of the software ray tracing, built by the engine when the device has no acceleration
+// structures. A top level BVH over the instances leads to the BVH of their meshes, traversed in object space as with the
+// hardware structures, and a hit gives what the closest hit shader would get from its builtins.
+// Requires GL_EXT_buffer_reference and GL_EXT_scalar_block_layout.
+
+struct BvhNode
+{
+  vec3 boundsMin;
+  uint first;  // left child of an inner node, the right one follows it, or first primitive of a leaf
+  vec3 boundsMax;
+  uint count;  // primitives of a leaf, 0 for an inner node
+};
+
+struct BvhTriangle
+{
+  vec3 v0;
+  uint geometryIndex;   // as gl_GeometryIndexEXT
+  vec3 v1;
+  uint primitiveIndex;  // as gl_PrimitiveID
+  vec3 v2;
+  uint padding;
+};
+
+layout(buffer_reference, scalar) readonly buffer BvhNodeBuffer{
+	BvhNode nodes[];  // the root first
+};
+
+layout(buffer_reference, scalar) readonly buffer BvhTriangleBuffer{
+	BvhTriangle triangles[];  // in the order of the leaves
+};
+
+// an instance of a mesh, in the order of the leaves of the top level BVH
+struct BvhInstance
+{
+  mat4x3 worldToObject;
+  BvhNodeBuffer nodes;
+  BvhTriangleBuffer triangles;
+  uint customIndex;  // as gl_InstanceCustomIndexEXT, finds the instance in the scene table
+  uint padding;
+};
+
+layout(buffer_reference, scalar) readonly buffer BvhInstanceBuffer{
+	BvhInstance instances[];
+};
+
+struct BvhHit
+{
+  bool isHit;
+  float t;  // tMax of the ray until something is hit
+  vec2 barycentrics;
+  uint customIndex;
+  uint geometryIndex;
+  uint primitiveIndex;
+  mat4x3 worldToObject;
+};
+
+// pending far children, more than the depth of the trees built by the engine
+const uint BVH_STACK_SIZE = 64;
+// distance of the boxes and triangles missed, beyond any ray
+const float BVH_MISS = 1e30;
+
+// A zero component would make the slabs parallel to the ray NaN
+vec3 bvhInverseDirection(vec3 direction)
+{
+  return 1.0 / mix(vec3(1e-20), direction, greaterThan(abs(direction), vec3(1e-20)));
+}
+
+// Distance at which the ray enters the box, BVH_MISS when it does not between tMin and tMax
+float bvhEnterBounds(vec3 origin, vec3 inverseDirection, BvhNode node, float tMin, float tMax)
+{
+  const vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+  const vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+  const vec3 tNear = min(t0, t1);
+  const vec3 tFar = max(t0, t1);
+  const float enter = max(max(tNear.x, tNear.y), max(tNear.z, tMin));
+  const float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+  return enter <= exit ? enter : BVH_MISS;
+}
+
+// Distance and barycentrics of the hit of both faces of a triangle (Moller-Trumbore), BVH_MISS as distance when missed
+vec3 bvhIntersectTriangle(vec3 origin, vec3 direction, BvhTriangle triangle)
+{
+  const vec3 edge1 = triangle.v1 - triangle.v0;
+  const vec3 edge2 = triangle.v2 - triangle.v0;
+  const vec3 p = cross(direction, edge2);
+  const float determinant = dot(edge1, p);
+  if(determinant == 0.0)
+  {
+    return vec3(BVH_MISS, 0.0, 0.0);
+  }
+
+  const float inverseDeterminant = 1.0 / determinant;
+  const vec3 s = origin - triangle.v0;
+  const float u = dot(s, p) * inverseDeterminant;
+  const vec3 q = cross(s, edge1);
+  const float v = dot(direction, q) * inverseDeterminant;
+  if(u < 0.0 || v < 0.0 || u + v > 1.0)
+  {
+    return vec3(BVH_MISS, 0.0, 0.0);
+  }
+  return vec3(dot(edge2, q) * inverseDeterminant, u, v);
+}
+
+// Triangles of the mesh of an instance closer than hit.t, the ray is in object space so that the distances stay those
+// of the world ray. Returns as soon as a triangle is hit when `isAnyHit`.
+void bvhTraceMesh(BvhInstance instance, vec3 origin, vec3 direction, float tMin, bool isAnyHit, inout BvhHit hit)
+{
+  const vec3 inverseDirection = bvhInverseDirection(direction);
+  uint stack[BVH_STACK_SIZE];
+  uint stackSize = 0;
+  BvhNode node = instance.nodes.nodes[0];
+  while(true)
+  {
+    if(node.count > 0)
+    {
+      for(uint i = 0; i < node.count; i++)
+      {
+        const BvhTriangle triangle = instance.triangles.triangles[node.first + i];
+        const vec3 intersection = bvhIntersectTriangle(origin, direction, triangle);
+        if(intersection.x >= tMin && intersection.x < hit.t)
+        {
+          hit.isHit = true;
+          hit.t = intersection.x;
+          hit.barycentrics = intersection.yz;
+          hit.customIndex = instance.customIndex;
+          hit.geometryIndex = triangle.geometryIndex;
+          hit.primitiveIndex = triangle.primitiveIndex;
+          hit.worldToObject = instance.worldToObject;
+          if(isAnyHit)
+          {
+            return;
+          }
+        }
+      }
+      if(stackSize == 0)
+      {
+        return;
+      }
+      node = instance.nodes.nodes[stack[--stackSize]];
+      continue;
+    }
+
+    // the nearest child first, the other one waits on the stack
+    uint nearIndex = node.first;
+    uint farIndex = node.first + 1;
+    BvhNode nearNode = instance.nodes.nodes[nearIndex];
+    BvhNode farNode = instance.nodes.nodes[farIndex];
+    float tNear = bvhEnterBounds(origin, inverseDirection, nearNode, tMin, hit.t);
+    float tFar = bvhEnterBounds(origin, inverseDirection, farNode, tMin, hit.t);
+    if(tFar < tNear)
+    {
+      const uint swappedIndex = nearIndex;
+      nearIndex = farIndex;
+      farIndex = swappedIndex;
+      const BvhNode swappedNode = nearNode;
+      nearNode = farNode;
+      farNode = swappedNode;
+      const float swappedT = tNear;
+      tNear = tFar;
+      tFar = swappedT;
+    }
+
+    if(tNear == BVH_MISS)
+    {
+      if(stackSize == 0)
+      {
+        return;
+      }
+      node = instance.nodes.nodes[stack[--stackSize]];
+      continue;
+    }
+    if(tFar != BVH_MISS && stackSize < BVH_STACK_SIZE)
+    {
+      stack[stackSize++] = farIndex;
+    }
+    node = nearNode;
+  }
+}
+
+// Closest triangle of the scene between tMin and tMax, or any of them when `isAnyHit`, as a shadow ray
+BvhHit bvhTrace(
+  BvhNodeBuffer topNodes,
+  BvhInstanceBuffer instances,
+  vec3 origin,
+  float tMin,
+  vec3 direction,
+  float tMax,
+  bool isAnyHit)
+{
+  BvhHit hit;
+  hit.isHit = false;
+  hit.t = tMax;
+
+  // the root of a scene without any visible instance has empty bounds
+  BvhNode node = topNodes.nodes[0];
+  if(node.boundsMin.x > node.boundsMax.x)
+  {
+    return hit;
+  }
+
+  const vec3 inverseDirection = bvhInverseDirection(direction);
+  uint stack[BVH_STACK_SIZE];
+  uint stackSize = 0;
+  while(true)
+  {
+    if(node.count > 0)
+    {
+      for(uint i = 0; i < node.count; i++)
+      {
+        const BvhInstance instance = instances.instances[node.first + i];
+        const vec3 objectOrigin = instance.worldToObject * vec4(origin, 1.0);
+        const vec3 objectDirection = instance.worldToObject * vec4(direction, 0.0);
+        bvhTraceMesh(instance, objectOrigin, objectDirection, tMin, isAnyHit, hit);
+        if(isAnyHit && hit.isHit)
+        {
+          return hit;
+        }
+      }
+      if(stackSize == 0)
+      {
+        return hit;
+      }
+      node = topNodes.nodes[stack[--stackSize]];
+      continue;
+    }
+
+    uint nearIndex = node.first;
+    uint farIndex = node.first + 1;
+    BvhNode nearNode = topNodes.nodes[nearIndex];
+    BvhNode farNode = topNodes.nodes[farIndex];
+    float tNear = bvhEnterBounds(origin, inverseDirection, nearNode, tMin, hit.t);
+    float tFar = bvhEnterBounds(origin, inverseDirection, farNode, tMin, hit.t);
+    if(tFar < tNear)
+    {
+      const uint swappedIndex = nearIndex;
+      nearIndex = farIndex;
+      farIndex = swappedIndex;
+      const BvhNode swappedNode = nearNode;
+      nearNode = farNode;
+      farNode = swappedNode;
+      const float swappedT = tNear;
+      tNear = tFar;
+      tFar = swappedT;
+    }
+
+    if(tNear == BVH_MISS)
+    {
+      if(stackSize == 0)
+      {
+        return hit;
+      }
+      node = topNodes.nodes[stack[--stackSize]];
+      continue;
+    }
+    if(tFar != BVH_MISS && stackSize < BVH_STACK_SIZE)
+    {
+      stack[stackSize++] = farIndex;
+    }
+    node = nearNode;
+  }
+  return hit;
+}
@@ -0,0 +1,35 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : enable
+#include "input_structures.glsl"
+
+// G-buffer of the hybrid renderer, the same layout as the one the raygen shader writes for the primary hits: the ray
+// traced passes start from these surfaces instead of tracing the camera rays. The raygen shader derives the motion
+// vectors from the positions, it knows the size of the frame.
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec3 inColor;
+layout (location = 2) in vec2 inUV;
+layout (location = 4) in vec3 inWorldPos;
+
+layout (location = 0) out vec4 outPosition;  // world position, distance to the camera in w
+layout (location = 1) out vec4 outNormal;    // world normal facing the camera, roughness in w
+layout (location = 2) out vec4 outAlbedo;    // metallic in alpha
+
+void main()
+{
+	const vec3 toCamera = sceneData.cameraPosition.xyz - inWorldPos;
+	vec3 normal = normalize(inNormal);
+	if (dot(normal, toCamera) < 0.0)
+	{
+		normal = -normal;
+	}
+
+	// glTF packs the roughness in green and the metalness in blue
+	const vec4 metalRough = texture(metalRoughTex, inUV);
+	const float metallic = materialData.metal_rough_factors.x * metalRough.b;
+	const float roughness = materialData.metal_rough_factors.y * metalRough.g;
+
+	outPosition = vec4(inWorldPos, length(toCamera));
+	outNormal = vec4(normal, roughness);
+	outAlbedo = vec4(inColor * texture(colorTex, inUV).rgb, metallic);
+}
@@ -7,6 +7,7 @@ layout(set = 0, binding = 0) uniform SceneData
 	mat4 proj;
 	mat4 invProj;
 	mat4 viewproj;
+	mat4 previousViewProj;  // of the previous frame, for the reprojection
 	vec4 ambientColor;
 	vec4 cameraPosition;
 	vec4 lightPosition;
@@ -9,6 +9,7 @@ layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
 layout (location = 3) out vec3 outPos;
+layout (location = 4) out vec3 outWorldPos;
 
 struct Vertex {
 
@@ -23,22 +24,30 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{ 
+	mat4 worldMatrices[];
+};
+
 //push constants block
 layout( push_constant ) uniform constants
 {
-	mat4 render_matrix;
 	VertexBuffer vertexBuffer;
+	ObjectBuffer objectBuffer;
 } PushConstants;
 
 void main() 
 {
+	// the vertex offset of the draw is already in gl_VertexIndex, the first instance picks the object
 	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	mat4 renderMatrix = PushConstants.objectBuffer.worldMatrices[gl_InstanceIndex];
 	
 	vec4 position = vec4(v.position, 1.0f);
-	gl_Position = sceneData.viewproj * PushConstants.render_matrix * position;
+	vec4 worldPosition = renderMatrix * position;
+	gl_Position = sceneData.viewproj * worldPosition;
 	outColor = v.color.xyz * materialData.colorFactors.xyz;
-	outNormal = (PushConstants.render_matrix * vec4(v.normal, 0.f)).xyz;
+	outNormal = (renderMatrix * vec4(v.normal, 0.f)).xyz;
 	outUV.x = v.uv_x;
 	outUV.y = v.uv_y;
 	outPos = v.position;
+	outWorldPos = worldPosition.xyz;
 }
@@ -0,0 +1,403 @@
+// Path tracer of the ray traced frames, shared by the backends. The raygen shader and the ray query and software
+// compute shaders include it after declaring the hit payload `prd` and LAUNCH_SIZE, the size of the frame, then define
+// traceSurface and isLightVisible and call tracePixel for each pixel. The backends using the acceleration structures
+// declare topLevelAS themselves, the devices of the software backend have none.
+// Requires GL_EXT_buffer_reference, GL_EXT_scalar_block_layout and GL_GOOGLE_include_directive.
+#include "random.glsl"
+#include "sampler.glsl"
+#include "reprojection.glsl"
+#include "brdf.glsl"
+#include "scene.glsl"
+#include "bvh.glsl"
+
+layout(binding = 1, set = 0, rgba32f) uniform image2D image;
+// The images of the current frame and of the previous one alternate with the parity of the traced frames
+// running mean of the pixel, its number of samples in alpha
+layout(binding = 2, set = 0, rgba32f) uniform image2D accumulationImages[2];
+// sum of the squared deviations of the luminance of the samples (Welford), the variance is m2 / (n - 1)
+layout(binding = 3, set = 0, r32f) uniform image2D varianceImages[2];
+// G-buffer of the primary hits: world position with the hit distance in w (-1 for a miss), normal, albedo and offset in
+// pixels to where the surface was in the previous frame
+layout(binding = 4, set = 0, rgba32f) uniform image2D positionImages[2];
+layout(binding = 5, set = 0, rgba16f) uniform image2D normalImages[2];
+layout(binding = 6, set = 0, rgba16f) uniform image2D albedoImage;
+layout(binding = 7, set = 0, rg32f) uniform image2D motionImage;
+layout(binding = 0, set = 1) uniform UniformBufferObject {
+	mat4 view;
+	mat4 invView;
+	mat4 proj;
+	mat4 invProj;
+	mat4 viewproj;
+	mat4 previousViewProj;  // of the previous frame, for the reprojection
+	vec4 ambientColor;
+	vec4 cameraPosition;
+	vec4 lightPosition;
+	vec4 lightColor;
+	float lightPower;
+	float specularCoefficient;
+	float ambientCoefficient;
+	float shininess;
+	float screenGamma;
+	float aspectRatio;
+	uint frameIndex;
+} ubo;
+
+layout(buffer_reference, scalar) buffer PixelCounter{ 
+	uint activePixels;
+};
+
+//push constants block, the scene table is also read by the closest hit shaders
+layout( push_constant ) uniform constants
+{
+	InstanceBuffer instanceBuffer;
+	GeometryBuffer geometryBuffer;
+	MaterialBuffer materialBuffer;
+	PixelCounter activePixelCounter;
+	BlueNoiseBuffer blueNoise;
+	float errorThreshold;
+	uint minSamples;
+	uint samplesPerFrame;
+	uint samplerType;
+	uint flags;
+	uint frameCount;  // of the denoiser
+	uint maxBounces;
+	uint rouletteDepth;
+	BvhNodeBuffer bvhNodes;  // top level BVH of the software backend
+	BvhInstanceBuffer bvhInstances;
+} PushConstants;
+
+const uint RAYTRACING_RESOLVE_ONLY = 1;
+const uint RAYTRACING_DENOISED = 2;
+const uint RAYTRACING_HISTORY = 4;
+const uint RAYTRACING_MOTION = 8;
+const uint RAYTRACING_HYBRID = 16;
+
+// Samples kept by the history of a moving camera: the shading depends on the view and the reprojected texel is not
+// exactly the pixel, the older samples are progressively replaced
+const float MAX_REPROJECTED_SAMPLES = 64.0;
+
+// Light of the sky, reached by the paths leaving the scene
+const vec3 SKY_RADIANCE = vec3(0.0, 0.1, 0.3);
+// Radiant intensity of the point light at a power of 1, the former direct shading gave 20 / d^2 to a white diffuse
+// surface facing the light
+const float LIGHT_INTENSITY = 20.0 * PI;
+
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool isInside(ivec2 pixel)
+{
+  return all(greaterThanEqual(pixel, ivec2(0))) && all(lessThan(pixel, ivec2(LAUNCH_SIZE)));
+}
+
+// Defined by the backend, the ray tracing pipeline or the ray queries
+// Traces the surface hit by a ray into prd
+void traceSurface(vec3 origin, float tMin, vec3 direction);
+// Whether nothing lies between a point and the light
+bool isLightVisible(vec3 origin, vec3 direction, float distance);
+
+vec3 cameraOrigin()
+{
+    return (ubo.invView * vec4(0, 0, 0, 1)).xyz;
+}
+
+// Direction of the camera ray through a position in pixels
+vec3 cameraRayDirection(vec2 pixelPosition)
+{
+    const vec2 inUV = pixelPosition/vec2(LAUNCH_SIZE);
+    vec2 d = inUV * 2.0 - 1.0;
+    vec4 target    = ubo.invProj * vec4(d.x, d.y, 1.0, 1.0);
+    return (ubo.invView * vec4(normalize(target.xyz), 0)).xyz;
+}
+
+// Traces the camera ray through a position in pixels into prd, returns its direction
+vec3 traceCameraRay(vec2 pixelPosition)
+{
+    const vec3 direction = cameraRayDirection(pixelPosition);
+    traceSurface(cameraOrigin(), 0.1, direction);
+    return direction;
+}
+
+// Origin of a ray leaving a surface, pushed off it so that the ray does not hit it again
+vec3 offsetRayOrigin(vec3 position, vec3 normal)
+{
+    return position + normal * 1e-3 * max(1.0, length(position));
+}
+
+// Radiance of a path from the surface in prd, hit by the ray from origin along direction. The bounces are a loop here
+// rather than a recursion of the hit shaders: at each surface the point light is sampled with a shadow ray, then the
+// BRDF gives the next direction and, past the first bounces, Russian roulette stops the paths carrying little light.
+vec3 shadePath(inout Sampler sampler, vec3 origin, vec3 direction)
+{
+    vec3 radiance = vec3(0.0);
+    vec3 throughput = vec3(1.0);
+    for(uint bounce = 0;; bounce++)
+    {
+        if(prd.hitT < 0.0)
+        {
+            radiance += throughput * SKY_RADIANCE;
+            break;
+        }
+
+        const vec3 position = origin + direction * prd.hitT;
+        const vec3 view = -direction;
+        const BrdfSurface surface = brdfSurface(prd.normal, prd.albedo, prd.metallic, prd.roughness);
+        const vec3 rayOrigin = offsetRayOrigin(position, prd.normal);
+
+        // next event estimation, the paths cannot hit the point light
+        const vec3 toLight = ubo.lightPosition.xyz - position;
+        const float lightDistance = length(toLight);
+        const vec3 lightDirection = toLight / max(lightDistance, 1e-4);
+        const float NdotL = dot(prd.normal, lightDirection);
+        if(NdotL > 0.0 && lightDistance > 1e-4 && isLightVisible(rayOrigin, lightDirection, lightDistance))
+        {
+            const vec3 intensity = LIGHT_INTENSITY * ubo.lightPower * ubo.lightColor.rgb;
+            radiance += throughput * brdfEvaluate(surface, view, lightDirection) * NdotL * intensity /
+                        (lightDistance * lightDistance);
+        }
+
+        if(bounce + 1 >= PushConstants.maxBounces)
+        {
+            break;
+        }
+
+        samplerStartBounce(sampler, bounce, SAMPLER_DIMENSION_BSDF);
+        const vec2 u = samplerNext2D(sampler);
+        const vec2 choices = samplerNext2D(sampler);
+        vec3 weight;
+        if(!brdfSample(surface, view, u, choices.x, direction, weight))
+        {
+            break;
+        }
+        throughput *= weight;
+
+        // the surviving paths carry the light of the stopped ones
+        if(bounce >= PushConstants.rouletteDepth)
+        {
+            const float survival = clamp(max(throughput.r, max(throughput.g, throughput.b)), 0.05, 0.95);
+            if(choices.y >= survival)
+            {
+                break;
+            }
+            throughput /= survival;
+        }
+
+        origin = rayOrigin;
+        traceSurface(origin, 0.0, direction);
+    }
+    return radiance;
+}
+
+// Radiance of a path from the camera through pixelPosition, the first hit is left in `primary` for the G-buffer
+vec3 tracePath(inout Sampler sampler, vec2 pixelPosition, out hitPayload primary, out vec3 primaryDirection)
+{
+    primaryDirection = traceCameraRay(pixelPosition);
+    primary = prd;
+    return shadePath(sampler, cameraOrigin(), primaryDirection);
+}
+
+// Offset in pixels from pixelPosition to where the hit was in the previous frame. The sky only moves with the rotation
+// of the camera, a point behind the previous camera has no history.
+vec2 motionVector(vec2 pixelPosition, vec4 hit, vec3 direction)
+{
+    const vec4 previousClip = ubo.previousViewProj * (hit.w >= 0.0 ? vec4(hit.xyz, 1.0) : vec4(direction, 0.0));
+    if(previousClip.w <= 0.0)
+    {
+        return vec2(-65536.0);
+    }
+    return (previousClip.xy / previousClip.w * 0.5 + 0.5) * vec2(LAUNCH_SIZE) - pixelPosition;
+}
+
+// Writes the surface hit by the camera ray through pixelPosition to the G-buffer of the frame
+void writeGeometryBuffer(
+    ivec2 pixel, uint parity, vec2 pixelPosition, vec3 direction, hitPayload surface, out vec4 hit, out vec2 motion)
+{
+    hit = vec4(cameraOrigin() + direction * max(surface.hitT, 0.0), surface.hitT);
+    motion = motionVector(pixelPosition, hit, direction);
+
+    imageStore(positionImages[parity], pixel, hit);
+    imageStore(normalImages[parity], pixel, vec4(surface.normal, surface.roughness));
+    imageStore(albedoImage, pixel, vec4(surface.albedo, surface.metallic));
+    imageStore(motionImage, pixel, vec4(motion, 0.0, 0.0));
+}
+
+// Surface rasterized through the center of the pixel by the hybrid renderer, returns the direction of the camera ray
+// to it. The motion vector is written here, the rasterizer does not know the size of the frame.
+vec3 loadGeometryBuffer(ivec2 pixel, uint parity, out hitPayload surface, out vec4 hit, out vec2 motion)
+{
+    hit = imageLoad(positionImages[parity], pixel);
+    const vec4 normal = imageLoad(normalImages[parity], pixel);
+    const vec4 albedo = imageLoad(albedoImage, pixel);
+    surface = hitPayload(normal.xyz, hit.w, albedo.rgb, albedo.a, normal.w);
+
+    const vec2 pixelCenter = vec2(pixel) + 0.5;
+    const vec3 direction = hit.w >= 0.0 ? normalize(hit.xyz - cameraOrigin()) : cameraRayDirection(pixelCenter);
+    motion = motionVector(pixelCenter, hit, direction);
+    imageStore(motionImage, pixel, vec4(motion, 0.0, 0.0));
+    return direction;
+}
+
+// A few samples of the frame only, the denoiser accumulates them over the frames. The first sample gives the G-buffer,
+// unless the rasterizer wrote it.
+void traceDenoised(ivec2 pixel)
+{
+    const uint parity = PushConstants.frameCount & 1;
+    const bool isHybrid = (PushConstants.flags & RAYTRACING_HYBRID) != 0;
+    hitPayload rasterized;
+    vec3 rasterizedDirection;
+    if(isHybrid)
+    {
+        vec4 hit;
+        vec2 motion;
+        rasterizedDirection = loadGeometryBuffer(pixel, parity, rasterized, hit, motion);
+    }
+
+    vec3 color = vec3(0);
+    for(uint smpl = 0; smpl < PushConstants.samplesPerFrame; smpl++)
+    {
+        // the frames walk the sequence of the pixel one after the other
+        const uint sampleIndex = PushConstants.frameCount * PushConstants.samplesPerFrame + smpl;
+        Sampler sampler = samplerInit(PushConstants.samplerType, uvec2(pixel), sampleIndex, PushConstants.blueNoise);
+        if(isHybrid)
+        {
+            prd = rasterized;
+            color += shadePath(sampler, cameraOrigin(), rasterizedDirection);
+            continue;
+        }
+
+        // Subpixel jitter: send the ray through a different position inside the pixel
+        // each time, to provide antialiasing.
+        const vec2 pixelPosition = vec2(pixel) + samplerNext2D(sampler);
+        hitPayload primary;
+        vec3 direction;
+        color += tracePath(sampler, pixelPosition, primary, direction);
+
+        if(smpl == 0)
+        {
+            vec4 hit;
+            vec2 motion;
+            writeGeometryBuffer(pixel, parity, pixelPosition, direction, primary, hit, motion);
+        }
+    }
+    imageStore(image, pixel, vec4(color / float(PushConstants.samplesPerFrame), 1.f));
+}
+
+// Estimate of a pixel for the frame, in the mode of the flags
+void tracePixel(ivec2 pixel)
+{
+    const uint current = PushConstants.frameCount & 1;
+    const uint previous = 1 - current;
+
+    if((PushConstants.flags & RAYTRACING_DENOISED) != 0)
+    {
+      traceDenoised(pixel);
+      return;
+    }
+
+    // The output image does not keep its content from a frame to the next, once every pixel has converged the frames
+    // only copy the estimate of the last traced frame to it
+    if((PushConstants.flags & RAYTRACING_RESOLVE_ONLY) != 0)
+    {
+      imageStore(image, pixel, vec4(imageLoad(accumulationImages[previous], pixel).rgb, 1.f));
+      return;
+    }
+
+    // Surface seen through the center of the pixel. It is only traced again when the camera moved, the samples keep
+    // their jitter. The hybrid renderer rasterized it, its samples all start from it.
+    const bool hasHistory = (PushConstants.flags & RAYTRACING_HISTORY) != 0;
+    const bool hasMoved = (PushConstants.flags & RAYTRACING_MOTION) != 0;
+    const bool isHybrid = (PushConstants.flags & RAYTRACING_HYBRID) != 0;
+    vec4 position;
+    vec3 normal;
+    vec2 motion = vec2(0.0);
+    hitPayload rasterized;
+    vec3 rasterizedDirection;
+    if(isHybrid)
+    {
+      rasterizedDirection = loadGeometryBuffer(pixel, current, rasterized, position, motion);
+      normal = rasterized.normal;
+    }
+    else if(!hasHistory || hasMoved)
+    {
+      const vec2 pixelCenter = vec2(pixel) + 0.5;
+      const vec3 direction = traceCameraRay(pixelCenter);
+      writeGeometryBuffer(pixel, current, pixelCenter, direction, prd, position, motion);
+      normal = prd.normal;
+    }
+    else
+    {
+      position = imageLoad(positionImages[previous], pixel);
+      normal = imageLoad(normalImages[previous], pixel).xyz;
+      imageStore(positionImages[current], pixel, position);
+      imageStore(normalImages[current], pixel, vec4(normal, 0.0));
+      imageStore(motionImage, pixel, vec4(0.0));
+    }
+
+    // the estimate of the texel the pixel was in the previous frame, when it saw the same surface
+    vec4 accumulated = vec4(0);
+    float m2 = 0;
+    if(hasHistory)
+    {
+      const ivec2 tap = ivec2(floor(vec2(pixel) + 0.5 + motion));
+      if(isInside(tap) &&
+         isSameSurface(position, normal, imageLoad(positionImages[previous], tap), imageLoad(normalImages[previous], tap).xyz))
+      {
+        accumulated = imageLoad(accumulationImages[previous], tap);
+        m2 = imageLoad(varianceImages[previous], tap).r;
+        if(hasMoved && accumulated.a > MAX_REPROJECTED_SAMPLES)
+        {
+          m2 *= MAX_REPROJECTED_SAMPLES / accumulated.a;
+          accumulated.a = MAX_REPROJECTED_SAMPLES;
+        }
+      }
+    }
+    vec3 mean = accumulated.rgb;
+    float n = accumulated.a;
+
+    // Converged once the standard error of the mean is a small enough fraction of the mean, the pixel is then only
+    // carried over to the images of the frame
+    bool isConverged = false;
+    if(n >= float(PushConstants.minSamples))
+    {
+      float standardError = sqrt(m2 / ((n - 1) * n));
+      isConverged = standardError <= PushConstants.errorThreshold * max(luminance(mean), 1e-3);
+    }
+
+    if(!isConverged)
+    {
+      atomicAdd(PushConstants.activePixelCounter.activePixels, 1);
+
+      for(uint smpl = 0; smpl < PushConstants.samplesPerFrame; smpl++)
+      {
+          // the samples of the pixel walk its sequence, wherever the adaptive sampling stopped it
+          Sampler sampler = samplerInit(PushConstants.samplerType, uvec2(pixel), uint(n), PushConstants.blueNoise);
+          // Subpixel jitter: send the ray through a different position inside the pixel
+          // each time, to provide antialiasing.
+          vec3 radiance;
+          if(isHybrid)
+          {
+            prd = rasterized;
+            radiance = shadePath(sampler, cameraOrigin(), rasterizedDirection);
+          }
+          else
+          {
+            hitPayload primary;
+            vec3 direction;
+            radiance = tracePath(sampler, vec2(pixel) + samplerNext2D(sampler), primary, direction);
+          }
+
+          // running mean and variance, one sample at a time
+          n += 1;
+          const float previousLuminance = luminance(mean);
+          mean += (radiance - mean) / n;
+          const float sampleLuminance = luminance(radiance);
+          m2 += (sampleLuminance - previousLuminance) * (sampleLuminance - luminance(mean));
+      }
+    }
+
+    imageStore(accumulationImages[current], pixel, vec4(mean, n));
+    imageStore(varianceImages[current], pixel, vec4(m2));
+    imageStore(image, pixel, vec4(mean, 1.f));
+}
@@ -0,0 +1,155 @@
+// Analytic primitives of the procedural assets, traced through AABB BLAS: a sphere inscribed in the bounds of the
+// primitive or a box filling them. The geometry of a procedural instance in the scene table points at its primitives in
+// place of the vertices, and its materialId at the first of its materials.
+// Requires GL_EXT_buffer_reference, GL_EXT_scalar_block_layout, raycommon.glsl and scene.glsl.
+
+const uint PROCEDURAL_SPHERE = 0;
+const uint PROCEDURAL_BOX = 1;
+
+struct ProceduralPrimitive
+{
+  vec3 boundsMin;  // also the AABB of the BLAS
+  vec3 boundsMax;
+  uint type;
+  uint materialIndex;  // from the materialId of the geometry
+};
+
+layout(buffer_reference, scalar) readonly buffer ProceduralBuffer{
+	ProceduralPrimitive primitives[];
+};
+
+ProceduralPrimitive proceduralPrimitive(Geometry geometry, uint primitiveIndex, out uint materialId)
+{
+  const ProceduralPrimitive primitive = ProceduralBuffer(geometry.vertexBuffer).primitives[primitiveIndex];
+  materialId = geometry.materialId + primitive.materialIndex;
+  return primitive;
+}
+
+ProceduralPrimitive proceduralPrimitive(
+  InstanceBuffer instanceBuffer,
+  GeometryBuffer geometryBuffer,
+  uint instanceIndex,
+  uint primitiveIndex,
+  out uint materialId)
+{
+  const Geometry geometry = geometryBuffer.geometries[instanceBuffer.firstGeometries[instanceIndex]];
+  return proceduralPrimitive(geometry, primitiveIndex, materialId);
+}
+
+// Distance of the first hit of the surface between tMin and tMax, the far side when the ray starts inside, -1 when
+// missed. The ray is in object space: the transform keeps the distances of the world ray, its direction is not
+// normalized.
+float proceduralIntersect(ProceduralPrimitive primitive, vec3 origin, vec3 direction, float tMin, float tMax)
+{
+  const vec3 center = (primitive.boundsMin + primitive.boundsMax) * 0.5;
+  float t;
+  if(primitive.type == PROCEDURAL_SPHERE)
+  {
+    const float radius = (primitive.boundsMax.x - primitive.boundsMin.x) * 0.5;
+    const vec3 offset = origin - center;
+    const float a = dot(direction, direction);
+    const float b = dot(offset, direction);
+    const float c = dot(offset, offset) - radius * radius;
+    const float discriminant = b * b - a * c;
+    if(discriminant < 0.0)
+    {
+      return -1.0;
+    }
+    const float root = sqrt(discriminant);
+    t = (-b - root) / a;
+    if(t < tMin)
+    {
+      t = (-b + root) / a;
+    }
+  }
+  else
+  {
+    // a zero component would make the slabs parallel to the ray NaN
+    const vec3 inverseDirection = 1.0 / mix(vec3(1e-20), direction, greaterThan(abs(direction), vec3(1e-20)));
+    const vec3 t0 = (primitive.boundsMin - origin) * inverseDirection;
+    const vec3 t1 = (primitive.boundsMax - origin) * inverseDirection;
+    const vec3 tNear = min(t0, t1);
+    const vec3 tFar = max(t0, t1);
+    const float enter = max(max(tNear.x, tNear.y), tNear.z);
+    const float exit = min(min(tFar.x, tFar.y), tFar.z);
+    if(enter > exit)
+    {
+      return -1.0;
+    }
+    t = enter >= tMin ? enter : exit;
+  }
+  return t >= tMin && t <= tMax ? t : -1.0;
+}
+
+// Object space normal of the surface at a point on it
+vec3 proceduralNormal(ProceduralPrimitive primitive, vec3 position)
+{
+  const vec3 center = (primitive.boundsMin + primitive.boundsMax) * 0.5;
+  if(primitive.type == PROCEDURAL_SPHERE)
+  {
+    return normalize(position - center);
+  }
+
+  // the face the point is the closest to, relative to the half extents
+  const vec3 local = (position - center) / max((primitive.boundsMax - primitive.boundsMin) * 0.5, vec3(1e-6));
+  const vec3 distances = abs(local);
+  if(distances.x >= distances.y && distances.x >= distances.z)
+  {
+    return vec3(sign(local.x), 0.0, 0.0);
+  }
+  if(distances.y >= distances.z)
+  {
+    return vec3(0.0, sign(local.y), 0.0);
+  }
+  return vec3(0.0, 0.0, sign(local.z));
+}
+
+// Surface of a procedural primitive of the geometry hit, its material is the one of the primitive
+hitPayload proceduralSurface(
+  Geometry geometry,
+  MaterialBuffer materialBuffer,
+  uint primitiveIndex,
+  vec3 objectOrigin,
+  vec3 objectDirection,
+  mat4x3 worldToObject,
+  vec3 rayDirection,
+  float hitT)
+{
+  uint materialId;
+  const ProceduralPrimitive primitive = proceduralPrimitive(geometry, primitiveIndex, materialId);
+  const Material material = materialBuffer.materials[materialId];
+  const vec3 normal = proceduralNormal(primitive, objectOrigin + objectDirection * hitT);
+
+  // two-sided as the triangles, a ray leaving a sphere from inside sees its inner face
+  vec3 worldNormal = normalize(vec3(normal * worldToObject));
+  if(dot(worldNormal, rayDirection) > 0)
+  {
+    worldNormal = -worldNormal;
+  }
+
+  hitPayload surface;
+  surface.normal = worldNormal;
+  surface.hitT = hitT;
+  surface.albedo = material.colorFactors.xyz;
+  surface.metallic = material.metalRoughFactors.x;
+  surface.roughness = material.metalRoughFactors.y;
+  return surface;
+}
+
+// Surface of a procedural primitive hit found by a ray query, through the scene table
+hitPayload proceduralSurface(
+  InstanceBuffer instanceBuffer,
+  GeometryBuffer geometryBuffer,
+  MaterialBuffer materialBuffer,
+  uint instanceIndex,
+  uint primitiveIndex,
+  vec3 objectOrigin,
+  vec3 objectDirection,
+  mat4x3 worldToObject,
+  vec3 rayDirection,
+  float hitT)
+{
+  const Geometry geometry = geometryBuffer.geometries[instanceBuffer.firstGeometries[instanceIndex]];
+  return proceduralSurface(
+    geometry, materialBuffer, primitiveIndex, objectOrigin, objectDirection, worldToObject, rayDirection, hitT);
+}
@@ -1,4 +1,15 @@
+// Surface of the closest hit, the raygen shader shades it and continues the path from there
 struct hitPayload
 {
-  vec3 hitValue;
-};
\ No newline at end of file
+  vec3 normal;  // world shading normal, facing the ray
+  float hitT;   // -1 when the ray missed
+  vec3 albedo;
+  float metallic;
+  float roughness;
+};
+
+// Nothing hit, the path tracer adds the light of the sky
+hitPayload missPayload()
+{
+  return hitPayload(vec3(0.0), -1.0, vec3(1.0), 0.0, 1.0);
+}
@@ -0,0 +1,16 @@
+// Reuse of the previous frame through the G-buffer written by the raygen shader: positions with their hit distance in w
+// (-1 for a miss) and normals, the motion vectors give the pixel of the previous frame.
+
+// The texel of the previous frame saw the surface of the pixel: disocclusions and surfaces seen from the other side are
+// rejected. The tolerances are relative to the hit distance so that they do not depend on the scale of the scene.
+bool isSameSurface(vec4 position, vec3 normal, vec4 previousPosition, vec3 previousNormal)
+{
+  if(position.w < 0.0 || previousPosition.w < 0.0)
+  {
+    // the sky is always the sky
+    return position.w < 0.0 && previousPosition.w < 0.0;
+  }
+  const vec3 offset = previousPosition.xyz - position.xyz;
+  return abs(dot(normal, offset)) < 0.01 * position.w && length(offset) < 0.05 * position.w &&
+         dot(normal, previousNormal) > 0.9;
+}
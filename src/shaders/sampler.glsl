@@ -0,0 +1,128 @@
+// Samples of a pixel, drawn from the sequence selected by the engine. The sample index is the one of the pixel, so that
+// the pixels sampled more than others by the adaptive sampling keep walking their own sequence.
+// Requires GL_EXT_buffer_reference, GL_EXT_scalar_block_layout and random.glsl.
+#include "sampler_shared.h"
+
+layout(buffer_reference, scalar) readonly buffer BlueNoiseBuffer{
+	float ranks[];  // BLUE_NOISE_SIZE x BLUE_NOISE_SIZE ranks in [0, 1)
+};
+
+struct Sampler
+{
+  uint type;
+  uvec2 pixel;
+  uint pixelSeed;    // decorrelates the sequences of the pixels
+  uint sampleIndex;  // of the pixel
+  uint dimension;    // next dimension drawn
+  BlueNoiseBuffer blueNoise;
+};
+
+// lowbias32 integer hash
+uint samplerHash(uint x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Owen scrambling of the bits of x from the most significant one, see Burley, "Practical Hash-based Owen Scrambling"
+uint nestedUniformScramble(uint x, uint seed)
+{
+  x = bitfieldReverse(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return bitfieldReverse(x);
+}
+
+// Second dimension of the Sobol sequence, the first one is the bit reversal of the index
+uint sobolSecondDimension(uint index)
+{
+  uint result = 0;
+  for(uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+  {
+    if((index & 1u) != 0)
+    {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+// 24 bits, a float of [0, 1) cannot hold more
+vec2 toUnitSquare(uvec2 bits)
+{
+  return vec2(bits >> 8) / 16777216.0;
+}
+
+// Point `index` of a scrambled (0,2) sequence. The points are shuffled for every pair of dimensions so that the pairs are
+// not correlated with each other.
+vec2 sobol2D(uint index, uint seed)
+{
+  const uint shuffled = nestedUniformScramble(index, samplerHash(seed));
+  const uint x = nestedUniformScramble(bitfieldReverse(shuffled), samplerHash(seed ^ 0x5bd1e995u));
+  const uint y = nestedUniformScramble(sobolSecondDimension(shuffled), samplerHash(seed ^ 0x27d4eb2fu));
+  return toUnitSquare(uvec2(x, y));
+}
+
+Sampler samplerInit(uint type, uvec2 pixel, uint sampleIndex, BlueNoiseBuffer blueNoise)
+{
+  Sampler s;
+  s.type = type;
+  s.pixel = pixel;
+  s.pixelSeed = samplerHash(pixel.x ^ samplerHash(pixel.y));
+  s.sampleIndex = sampleIndex;
+  s.dimension = SAMPLER_DIMENSION_CAMERA;
+  s.blueNoise = blueNoise;
+  return s;
+}
+
+// Dimensions of the bounce from `offset`, one of the SAMPLER_DIMENSION_* offsets in a bounce
+void samplerStartBounce(inout Sampler s, uint bounce, uint offset)
+{
+  s.dimension = SAMPLER_DIMENSION_FIRST_BOUNCE + bounce * SAMPLER_DIMENSIONS_PER_BOUNCE + offset;
+}
+
+vec2 samplerNext2D(inout Sampler s)
+{
+  const uint dimension = s.dimension;
+  s.dimension += 2;
+
+  if(s.type == SAMPLER_SOBOL)
+  {
+    return sobol2D(s.sampleIndex, s.pixelSeed ^ samplerHash(dimension));
+  }
+  if(s.type == SAMPLER_LATTICE)
+  {
+    // generator of the R2 sequence in 32 bits fixed point, the wrap around of the integers is the modulo 1
+    const uvec2 generator = uvec2(3242174889u, 2447445414u);
+    const uvec2 shift = uvec2(samplerHash(s.pixelSeed ^ dimension), samplerHash(s.pixelSeed ^ dimension ^ 0x68bc21ebu));
+    return toUnitSquare(s.sampleIndex * generator + shift);
+  }
+  if(s.type == SAMPLER_BLUE_NOISE)
+  {
+    // Every pixel walks the same sequence, rotated by the mask: the error of neighbour pixels differs as blue noise.
+    // The mask is offset for every dimension so that the rotations of the dimensions are not the same.
+    const vec2 point = sobol2D(s.sampleIndex, samplerHash(dimension));
+    const uvec2 texel = (s.pixel + uvec2(dimension * 17u, dimension * 41u)) % BLUE_NOISE_SIZE;
+    const uvec2 secondTexel = (texel + uvec2(BLUE_NOISE_SIZE / 2)) % BLUE_NOISE_SIZE;
+    const vec2 rotation = vec2(
+      s.blueNoise.ranks[texel.y * BLUE_NOISE_SIZE + texel.x],
+      s.blueNoise.ranks[secondTexel.y * BLUE_NOISE_SIZE + secondTexel.x]);
+    return fract(point + rotation);
+  }
+
+  uint seed = tea(s.pixelSeed ^ samplerHash(dimension), s.sampleIndex);
+  return vec2(rnd(seed), rnd(seed));
+}
+
+// Draws a whole pair, the second dimension is left unused
+float samplerNext1D(inout Sampler s)
+{
+  return samplerNext2D(s).x;
+}
@@ -0,0 +1,25 @@
+// Definitions shared by the engine and the sampler of the ray tracing shaders, plain defines so that both C++ and
+// GLSL can include them
+#ifndef SAMPLER_SHARED_H
+#define SAMPLER_SHARED_H
+
+// Sequences the samples of a pixel are drawn from
+#define SAMPLER_RANDOM 0      // white noise, hash of the pixel, the sample index and the dimension
+#define SAMPLER_SOBOL 1       // Owen scrambled Sobol (0,2) sequence per pair of dimensions, shuffled per pixel
+#define SAMPLER_LATTICE 2     // rank-1 lattice of the R2 generator, rotated per pixel
+#define SAMPLER_BLUE_NOISE 3  // Sobol sequence shared by the pixels, rotated per pixel by a blue noise mask
+#define SAMPLER_TYPE_COUNT 4
+
+// Side of the tileable blue noise mask, in pixels
+#define BLUE_NOISE_SIZE 64
+
+// Dimensions of a path, drawn two at a time. The camera comes first, then every bounce gets the same number of
+// dimensions whether it uses all of them or not, so that a dimension always means the same thing across the samples.
+#define SAMPLER_DIMENSION_CAMERA 0        // jitter in the pixel
+#define SAMPLER_DIMENSION_FIRST_BOUNCE 2
+#define SAMPLER_DIMENSION_LIGHT 0         // offset in a bounce: point on the light
+#define SAMPLER_DIMENSION_BSDF 2          // offset in a bounce: direction of the next ray
+#define SAMPLER_DIMENSION_CHOICES 4       // offset in a bounce: lobe of the BSDF, then Russian roulette
+#define SAMPLER_DIMENSIONS_PER_BOUNCE 6
+
+#endif  // SAMPLER_SHARED_H
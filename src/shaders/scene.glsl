@@ -0,0 +1,100 @@
+// Scene table of the ray tracing, gl_InstanceCustomIndexEXT finds the instance and gl_GeometryIndexEXT its surface.
+// The hit shaders of the ray tracing pipeline read the geometry and its material from their hit record instead.
+// Requires GL_EXT_buffer_reference, GL_EXT_scalar_block_layout and raycommon.glsl.
+
+struct Vertex {
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+layout(buffer_reference, scalar) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+layout(buffer_reference, scalar) readonly buffer IndexBuffer{ 
+	uint indices[];
+};
+
+struct Geometry {
+	VertexBuffer vertexBuffer;
+	IndexBuffer indexBuffer;
+	uint firstIndex;
+	uint materialId;
+};
+
+struct Material {
+	vec4 colorFactors;
+	vec4 metalRoughFactors;
+};
+
+layout(buffer_reference, scalar) readonly buffer InstanceBuffer{ 
+	uint firstGeometries[];
+};
+
+layout(buffer_reference, scalar) readonly buffer GeometryBuffer{ 
+	Geometry geometries[];
+};
+
+layout(buffer_reference, scalar) readonly buffer MaterialBuffer{ 
+	Material materials[];
+};
+
+// Surface of a triangle of the geometry hit
+hitPayload triangleSurface(
+  Geometry geometry,
+  Material material,
+  uint primitiveIndex,
+  vec2 attribs,
+  mat4x3 worldToObject,
+  vec3 rayDirection,
+  float hitT)
+{
+  uint triIndex0 = geometry.indexBuffer.indices[geometry.firstIndex + primitiveIndex*3 + 0];
+  uint triIndex1 = geometry.indexBuffer.indices[geometry.firstIndex + primitiveIndex*3 + 1];
+  uint triIndex2 = geometry.indexBuffer.indices[geometry.firstIndex + primitiveIndex*3 + 2];
+
+  vec3 n0 = geometry.vertexBuffer.vertices[triIndex0].normal;
+  vec3 n1 = geometry.vertexBuffer.vertices[triIndex1].normal;
+  vec3 n2 = geometry.vertexBuffer.vertices[triIndex2].normal;
+
+  const vec3 barycentrics = vec3(1.0 - attribs.x - attribs.y, attribs.x, attribs.y);
+
+  vec3 normal = n0 * barycentrics.x + n1 * barycentrics.y + n2 * barycentrics.z;
+
+  // Computing the normal at hit position, two-sided: it faces the ray
+  vec3 worldNormal = normalize(vec3(normal * worldToObject));  // Transforming the normal to world space
+  if (dot(worldNormal, rayDirection) > 0)
+  {
+    worldNormal = -worldNormal;
+  }
+
+  hitPayload surface;
+  surface.normal = worldNormal;
+  surface.hitT = hitT;
+  surface.albedo = material.colorFactors.xyz;
+  surface.metallic = material.metalRoughFactors.x;
+  surface.roughness = material.metalRoughFactors.y;
+  return surface;
+}
+
+// Surface of a triangle hit found by a ray query, through the scene table
+hitPayload triangleSurface(
+  InstanceBuffer instanceBuffer,
+  GeometryBuffer geometryBuffer,
+  MaterialBuffer materialBuffer,
+  uint instanceIndex,
+  uint geometryIndex,
+  uint primitiveIndex,
+  vec2 attribs,
+  mat4x3 worldToObject,
+  vec3 rayDirection,
+  float hitT)
+{
+  uint firstGeometry = instanceBuffer.firstGeometries[instanceIndex];
+  Geometry geometry = geometryBuffer.geometries[firstGeometry + geometryIndex];
+  Material material = materialBuffer.materials[geometry.materialId];
+  return triangleSurface(geometry, material, primitiveIndex, attribs, worldToObject, rayDirection, hitT);
+}
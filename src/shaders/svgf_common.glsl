@@ -0,0 +1,48 @@
+// Resources of the passes of the denoiser (spatiotemporal variance guided filter). The images of a frame and of the
+// previous one alternate with the parity of the frame.
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(rgba32f, set = 0, binding = 0) uniform image2D noisyImage;  // ray traced frame in, denoised frame out
+layout(rgba32f, set = 0, binding = 1) uniform image2D positionImages[2];  // world position, hit distance in w (-1: miss)
+layout(rgba16f, set = 0, binding = 2) uniform image2D normalImages[2];
+layout(rgba16f, set = 0, binding = 3) uniform image2D albedoImage;
+layout(rgba32f, set = 0, binding = 4) uniform image2D colorHistory[2];     // filtered illumination, variance in w
+layout(rgba32f, set = 0, binding = 5) uniform image2D momentHistory[2];    // luminance moments, history length in z
+layout(rgba32f, set = 0, binding = 6) uniform image2D pingPongImages[2];   // illumination, variance in w
+layout(rg32f, set = 0, binding = 7) uniform image2D motionImage;
+
+layout(push_constant) uniform constants
+{
+	ivec2 size;
+	uint frameParity;  // images of the current frame
+	uint isHistoryValid;
+	uint stepSize;     // between the taps of the a-trous iteration
+	uint source;       // ping pong image read by the a-trous iteration
+	uint flags;
+} PushConstants;
+
+const uint DENOISER_WRITE_HISTORY = 1;
+const uint DENOISER_FINAL = 2;
+
+#include "reprojection.glsl"
+
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool isInside(ivec2 pixel)
+{
+  return all(greaterThanEqual(pixel, ivec2(0))) && all(lessThan(pixel, PushConstants.size));
+}
+
+// Edge stopping weight of the normals and of the distance of the neighbour to the tangent plane of the pixel, relative to
+// the hit distance so that it does not depend on the scale of the scene
+float geometryWeight(vec4 position, vec3 normal, vec4 neighbourPosition, vec3 neighbourNormal, float sigmaDepth)
+{
+  const float normalWeight = pow(max(dot(normal, neighbourNormal), 0.0), 128.0);
+  const float planeDistance = abs(dot(normal, neighbourPosition.xyz - position.xyz));
+  const float depthWeight = exp(-planeDistance / max(sigmaDepth * position.w, 1e-4));
+  return normalWeight * depthWeight;
+}